@@ -0,0 +1,342 @@
+#include "att.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include "debug.hpp"
+#include "metrics.hpp"
+
+namespace {
+
+constexpr int kBtProtoL2cap = 0;
+constexpr uint16_t kAttCid = 4;
+constexpr int kRequestTimeoutMs = 5000;
+
+struct SockaddrL2 {
+  sa_family_t l2_family;
+  uint16_t l2_psm;
+  uint8_t l2_bdaddr[6];
+  uint16_t l2_cid;
+  uint8_t l2_bdaddr_type;
+};
+
+enum : uint8_t {
+  kErrorRsp = 0x01,
+  kMtuReq = 0x02,
+  kMtuRsp = 0x03,
+  kFindInfoReq = 0x04,
+  kFindInfoRsp = 0x05,
+  kReadByTypeReq = 0x08,
+  kReadByTypeRsp = 0x09,
+  kReadByGroupReq = 0x10,
+  kReadByGroupRsp = 0x11,
+  kWriteReq = 0x12,
+  kWriteRsp = 0x13,
+  kNotify = 0x1b,
+  kIndicate = 0x1d,
+  kConfirm = 0x1e,
+  kCommandFlag = 0x40,
+};
+constexpr uint8_t kErrNotSupported = 0x06;
+constexpr uint16_t kPrimaryService = 0x2800;
+constexpr uint16_t kCharacteristic = 0x2803;
+
+inline uint16_t le16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+inline void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+
+}  // namespace
+
+AttClient::~AttClient() {
+  close();
+}
+
+void AttClient::close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  connecting_ = false;
+  mtu_ = 23;
+}
+
+void AttClient::lost(const char* why) {
+  ERR << "[warn] ATT link lost: " << why << "\n";
+  close();
+}
+
+bool AttClient::connect(const BtAddr& local, const BtAddr& peer, int timeout_ms,
+                        std::string* err) {
+  if (!connect_begin(local, peer, err)) return false;
+  if (connecting_) {
+    pollfd pfd{fd_, POLLOUT, 0};
+    if (poll(&pfd, 1, timeout_ms) == 0) {
+      *err = "LE connect: timeout";
+      close();
+      return false;
+    }
+  }
+  return connect_finish(err);
+}
+
+bool AttClient::connect_begin(const BtAddr& local, const BtAddr& peer, std::string* err) {
+  close();
+  int fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, kBtProtoL2cap);
+  if (fd < 0) {
+    *err = std::string("L2CAP socket: ") + strerror(errno);
+    return false;
+  }
+  SockaddrL2 a{};
+  a.l2_family = AF_BLUETOOTH;
+  std::memcpy(a.l2_bdaddr, local.b, 6);
+  a.l2_cid = kAttCid;
+  a.l2_bdaddr_type = local.type;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof a) < 0) {
+    *err = std::string("L2CAP bind: ") + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  std::memcpy(a.l2_bdaddr, peer.b, 6);
+  a.l2_bdaddr_type = peer.type;
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&a), sizeof a) < 0 && errno != EINPROGRESS) {
+    *err = std::string("LE connect: ") + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  connecting_ = true;
+  return true;
+}
+
+bool AttClient::connect_finish(std::string* err) {
+  if (!connecting_) return connected();
+  int so_error = 0;
+  socklen_t sl = sizeof so_error;
+  if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &so_error, &sl) < 0) so_error = errno;
+  if (so_error) {
+    *err = std::string("LE connect: ") + strerror(so_error);
+    close();
+    return false;
+  }
+  connecting_ = false;
+  return true;
+}
+
+bool AttClient::send_pdu(const uint8_t* p, size_t n) {
+  for (;;) {
+    if (send(fd_, p, n, MSG_NOSIGNAL) >= 0) return true;
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN) {
+      pollfd pfd{fd_, POLLOUT, 0};
+      if (poll(&pfd, 1, kRequestTimeoutMs) > 0) continue;
+    }
+    lost(strerror(errno));
+    return false;
+  }
+}
+
+bool AttClient::handle_unsolicited(const uint8_t* p, size_t n, uint64_t recv_ns) {
+  uint8_t op = p[0];
+  if (op == kNotify || op == kIndicate) {
+    if (n >= 3) notify_(ctx_, le16(p + 1), p + 3, n - 3, recv_ns);
+    if (op == kIndicate) {
+      uint8_t c = kConfirm;
+      send_pdu(&c, 1);
+    }
+    return true;
+  }
+  if (op == kMtuReq && n >= 3) {
+    // The peer's own client asking; answer with what we can take.
+    uint8_t rsp[3] = {kMtuRsp};
+    put16(rsp + 1, sizeof rsp_);
+    send_pdu(rsp, sizeof rsp);
+    uint16_t peer = le16(p + 1);
+    mtu_ = std::max<uint16_t>(23, std::min<uint16_t>(peer, sizeof rsp_));
+    return true;
+  }
+  // Other even opcodes are requests; there is no ATT server here to offer.
+  if (!(op & kCommandFlag) && (op & 1) == 0 && op != kConfirm) {
+    uint8_t rsp[5] = {kErrorRsp, op, 0, 0, kErrNotSupported};
+    send_pdu(rsp, sizeof rsp);
+    return true;
+  }
+  return op & kCommandFlag;  // commands need no answer
+}
+
+bool AttClient::transact(const uint8_t* req, size_t len, uint8_t rsp_op, uint8_t* att_error) {
+  *att_error = 0;
+  if (fd_ < 0 || !send_pdu(req, len)) return false;
+  uint64_t t0 = metrics_now_ns();
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(kRequestTimeoutMs);
+  for (;;) {
+    ssize_t n = recv(fd_, rsp_, sizeof rsp_, MSG_DONTWAIT);
+    if (n == 0) {
+      lost("closed");
+      return false;
+    }
+    if (n > 0) {
+      if (rsp_[0] == rsp_op) {
+        rsp_len_ = (size_t)n;
+        metrics_since(Metric::CallOther, t0);
+        return true;
+      }
+      if (rsp_[0] == kErrorRsp && n >= 5 && rsp_[1] == req[0]) {
+        *att_error = rsp_[4];
+        metrics_since(Metric::CallOther, t0);
+        return false;
+      }
+      if (!handle_unsolicited(rsp_, (size_t)n, metrics_now_ns())) {
+        DBG << "[dbg] ATT: unexpected opcode 0x" << std::hex << (int)rsp_[0] << std::dec << "\n";
+      }
+      if (fd_ < 0) return false;
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno != EAGAIN) {
+      lost(strerror(errno));
+      return false;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0) {
+      // ATT allows one outstanding request; a late response would be taken
+      // for the next one's, so the bearer is unusable now.
+      lost("request timed out");
+      return false;
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    poll(&pfd, 1, (int)left);
+  }
+}
+
+bool AttClient::exchange_mtu(uint16_t mtu) {
+  uint8_t req[3] = {kMtuReq};
+  put16(req + 1, mtu);
+  uint8_t e = 0;
+  if (!transact(req, sizeof req, kMtuRsp, &e) || rsp_len_ < 3) return false;
+  mtu_ = std::max<uint16_t>(23, std::min(mtu, le16(rsp_ + 1)));
+  DBG << "[dbg] ATT MTU " << mtu_ << "\n";
+  return true;
+}
+
+bool AttClient::find_service(uint16_t uuid16, uint16_t* start, uint16_t* end) {
+  uint16_t from = 1;
+  for (;;) {
+    uint8_t req[7] = {kReadByGroupReq};
+    put16(req + 1, from);
+    put16(req + 3, 0xffff);
+    put16(req + 5, kPrimaryService);
+    uint8_t e = 0;
+    if (!transact(req, sizeof req, kReadByGroupRsp, &e)) return false;
+    if (rsp_len_ < 2) return false;
+    size_t elen = rsp_[1];
+    if (elen < 6) return false;
+    uint16_t last = 0;
+    for (size_t i = 2; i + elen <= rsp_len_; i += elen) {
+      uint16_t s = le16(rsp_ + i), en = le16(rsp_ + i + 2);
+      if (elen == 6 && le16(rsp_ + i + 4) == uuid16) {
+        *start = s;
+        *end = en;
+        return true;
+      }
+      last = en;
+    }
+    if (last == 0xffff || last < from) return false;
+    from = (uint16_t)(last + 1);
+  }
+}
+
+bool AttClient::find_characteristic(uint16_t start, uint16_t end, uint16_t uuid16,
+                                    uint16_t* value_handle, uint16_t* last_handle) {
+  bool found = false;
+  uint16_t from = start;
+  while (from <= end) {
+    uint8_t req[7] = {kReadByTypeReq};
+    put16(req + 1, from);
+    put16(req + 3, end);
+    put16(req + 5, kCharacteristic);
+    uint8_t e = 0;
+    if (!transact(req, sizeof req, kReadByTypeRsp, &e)) break;
+    if (rsp_len_ < 2) break;
+    size_t elen = rsp_[1];
+    if (elen < 7) break;
+    uint16_t decl = 0;
+    for (size_t i = 2; i + elen <= rsp_len_; i += elen) {
+      decl = le16(rsp_ + i);
+      if (found) {
+        // The next declaration ends the wanted characteristic's descriptors.
+        *last_handle = (uint16_t)(decl - 1);
+        return true;
+      }
+      if (elen == 7 && le16(rsp_ + i + 5) == uuid16) {
+        *value_handle = le16(rsp_ + i + 3);
+        found = true;
+      }
+    }
+    if (decl >= end) break;
+    from = (uint16_t)(decl + 1);
+  }
+  if (found) *last_handle = end;
+  return found;
+}
+
+bool AttClient::find_descriptor(uint16_t start, uint16_t end, uint16_t uuid16, uint16_t* handle) {
+  uint16_t from = start;
+  while (from <= end) {
+    uint8_t req[5] = {kFindInfoReq};
+    put16(req + 1, from);
+    put16(req + 3, end);
+    uint8_t e = 0;
+    if (!transact(req, sizeof req, kFindInfoRsp, &e) || rsp_len_ < 2) return false;
+    size_t elen = (rsp_[1] == 1) ? 4 : 18;
+    uint16_t h = 0;
+    for (size_t i = 2; i + elen <= rsp_len_; i += elen) {
+      h = le16(rsp_ + i);
+      if (elen == 4 && le16(rsp_ + i + 2) == uuid16) {
+        *handle = h;
+        return true;
+      }
+    }
+    if (h == 0 || h >= end) return false;
+    from = (uint16_t)(h + 1);
+  }
+  return false;
+}
+
+bool AttClient::write(uint16_t handle, const uint8_t* value, size_t len) {
+  uint8_t req[3 + 512] = {kWriteReq};
+  if (len > mtu_ - 3u) return false;
+  put16(req + 1, handle);
+  std::memcpy(req + 3, value, len);
+  uint8_t e = 0;
+  if (transact(req, 3 + len, kWriteRsp, &e)) return true;
+  if (e) ERR << "[err] ATT write 0x" << std::hex << handle << ": error 0x" << (int)e << std::dec << "\n";
+  return false;
+}
+
+int AttClient::process() {
+  if (fd_ < 0) return -1;
+  int count = 0;
+  for (;;) {
+    ssize_t n = recv(fd_, rsp_, sizeof rsp_, MSG_DONTWAIT);
+    if (n == 0) {
+      lost("closed");
+      return -1;
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) return count;
+      lost(strerror(errno));
+      return -1;
+    }
+    ++count;
+    if (!handle_unsolicited(rsp_, (size_t)n, metrics_now_ns())) {
+      DBG << "[dbg] ATT: stray opcode 0x" << std::hex << (int)rsp_[0] << std::dec << "\n";
+    }
+    if (fd_ < 0) return -1;
+  }
+}
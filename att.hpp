@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mgmt.hpp"
+
+// Minimal ATT client on the LE fixed channel (CID 4) of an L2CAP socket, for
+// --backend att. Connecting the socket makes the kernel create the LE link
+// (with any parameters loaded through MgmtSocket::load_conn_param); requests
+// are blocking with a timeout, and notifications that arrive meanwhile are
+// delivered rather than dropped. Only 16-bit UUIDs are looked up.
+class AttClient {
+ public:
+  // recv_ns: metrics_now_ns() when the PDU was read.
+  using NotifyFn = void (*)(void* ctx, uint16_t handle, const uint8_t* value, size_t len,
+                            uint64_t recv_ns);
+
+  AttClient(NotifyFn fn, void* ctx) : notify_(fn), ctx_(ctx) {}
+  ~AttClient();
+  AttClient(const AttClient&) = delete;
+  AttClient& operator=(const AttClient&) = delete;
+
+  bool connect(const BtAddr& local, const BtAddr& peer, int timeout_ms, std::string* err);
+  // The same without waiting: connect_begin() leaves fd() connecting, and
+  // connect_finish() completes it once fd() polls POLLOUT.
+  bool connect_begin(const BtAddr& local, const BtAddr& peer, std::string* err);
+  bool connect_finish(std::string* err);
+  void close();
+  int fd() const { return fd_; }
+  bool connecting() const { return connecting_; }
+  bool connected() const { return fd_ >= 0 && !connecting_; }
+  uint16_t mtu() const { return mtu_; }
+
+  bool exchange_mtu(uint16_t mtu);
+  // Primary service handle range.
+  bool find_service(uint16_t uuid16, uint16_t* start, uint16_t* end);
+  // Characteristic value handle, and the last handle before the next
+  // characteristic (where its descriptors end).
+  bool find_characteristic(uint16_t start, uint16_t end, uint16_t uuid16,
+                           uint16_t* value_handle, uint16_t* last_handle);
+  bool find_descriptor(uint16_t start, uint16_t end, uint16_t uuid16, uint16_t* handle);
+  // Write Request; true once the peer acknowledged it.
+  bool write(uint16_t handle, const uint8_t* value, size_t len);
+
+  // Drains the socket without blocking: notifications to the handler,
+  // indications confirmed, peer requests refused. Returns PDUs read, or -1
+  // once the link is gone (the socket is closed then).
+  int process();
+
+ private:
+  // Sends `req` and waits for `rsp_op` (or an Error Response to it);
+  // the response lands in rsp_/rsp_len_. *att_error: error code, 0 if none.
+  bool transact(const uint8_t* req, size_t len, uint8_t rsp_op, uint8_t* att_error);
+  // Notification, indication or peer request; false if not one of those.
+  bool handle_unsolicited(const uint8_t* p, size_t n, uint64_t recv_ns);
+  bool send_pdu(const uint8_t* p, size_t n);
+  void lost(const char* why);
+
+  NotifyFn notify_;
+  void* ctx_;
+  int fd_ = -1;
+  bool connecting_ = false;  // connect_begin() until connect_finish()
+  uint16_t mtu_ = 23;
+  uint8_t rsp_[517];
+  size_t rsp_len_ = 0;
+};
@@ -0,0 +1,198 @@
+#include "backend_att.hpp"
+
+#include <poll.h>
+
+#include <algorithm>
+
+#include "debug.hpp"
+#include "metrics.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr uint16_t kHeartRateService = 0x180d;
+constexpr uint16_t kHeartRateMeasurement = 0x2a37;
+constexpr uint16_t kClientConfig = 0x2902;
+constexpr uint16_t kAttMtu = 247;
+
+uint64_t epoch_ms() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+bool AttBackend::open(std::string* err) {
+  if (!mgmt_.open(g_att.hci_index, err)) return false;
+  if (!mgmt_.read_address(&local_)) {
+    *err = "hci" + std::to_string(g_att.hci_index) + ": adapter not found";
+    return false;
+  }
+  DBG << "[dbg] ATT backend on hci" << g_att.hci_index << " (" << bt_addr_string(local_) << ")\n";
+  return true;
+}
+
+void AttBackend::on_notify(void* ctx, uint16_t handle, const uint8_t* value, size_t len,
+                           uint64_t recv_ns) {
+  auto* self = static_cast<AttBackend*>(ctx);
+  if (handle != self->hr_value_) {
+    DBG << "[dbg] ATT notification on 0x" << std::hex << handle << std::dec
+        << " raw=[" << LogHex{value, len} << "]\n";
+    return;
+  }
+  hrm_on_value(&self->src_, value, len, recv_ns, epoch_ms());
+  metrics_since(Metric::Callback, recv_ns);
+}
+
+bool AttBackend::find_any_device_by_names(const std::vector<std::string_view>& names,
+                                          int timeout_ms) {
+  if (!mgmt_.start_le_discovery()) return false;
+  const auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+  bool found = false;
+  while (!found) {
+    MgmtDeviceFound dev;
+    int r = mgmt_.read_event(&dev);
+    if (r < 0) break;
+    if (r > 0) {
+      if (std::find(names.begin(), names.end(), dev.name) != names.end()) {
+        peer_ = dev.addr;
+        name_ = std::string(dev.name);
+        address_ = bt_addr_string(dev.addr);
+        found = true;
+      }
+      continue;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+    if (left.count() <= 0) break;
+    pollfd pfd{mgmt_.fd(), POLLIN, 0};
+    poll(&pfd, 1, (int)left.count());
+  }
+  // Controllers may refuse to initiate while scanning.
+  mgmt_.stop_le_discovery();
+  return found;
+}
+
+void AttBackend::load_conn_param() {
+  if (g_att.interval_min) {
+    mgmt_.load_conn_param(peer_, g_att.interval_min, g_att.interval_max, 0,
+                          g_att.supervision_timeout);
+  }
+}
+
+bool AttBackend::connect(int timeout_ms) {
+  load_conn_param();
+  std::string err;
+  if (!att_.connect(local_, peer_, timeout_ms, &err)) {
+    ERR << "[err] " << address_ << ": " << err << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool AttBackend::start_notify() {
+  if (!att_.exchange_mtu(kAttMtu) && !att_.connected()) return false;
+  if (!hr_cccd_) {
+    uint16_t start = 0, end = 0, last = 0;
+    if (!att_.find_service(kHeartRateService, &start, &end) ||
+        !att_.find_characteristic(start, end, kHeartRateMeasurement, &hr_value_, &last) ||
+        !att_.find_descriptor((uint16_t)(hr_value_ + 1), last, kClientConfig, &hr_cccd_)) {
+      hr_value_ = hr_cccd_ = 0;
+      ERR << "[err] Heart Rate Measurement characteristic not found over ATT\n";
+      return false;
+    }
+    DBG << "[dbg] 2a37 value handle 0x" << std::hex << hr_value_ << ", CCCD 0x" << hr_cccd_
+        << std::dec << "\n";
+  }
+  DBG << "[dbg] Enabling notifications on " << address_ << "\n";
+  const uint8_t enable[2] = {0x01, 0x00};
+  if (att_.write(hr_cccd_, enable, sizeof enable)) return true;
+  // Handles may have moved (firmware update); look them up again next time.
+  hr_value_ = hr_cccd_ = 0;
+  return false;
+}
+
+bool AttBackend::startup(const std::vector<std::string_view>& names, StartupTimes* t) {
+  t->start_ns = metrics_now_ns();
+  t->scanned = true;
+  ERR << "[info] Starting discovery (mgmt)...\n";
+  if (!find_any_device_by_names(names, 90000)) {
+    ERR << "[err] Device not found after scan.\n";
+    return false;
+  }
+  t->found_ns = metrics_now_ns();
+  ERR << "[info] Found device: " << name_ << " address: " << address_ << "\n";
+  if (g_att.interval_min) {
+    ERR << "[info] Requesting LE connection interval " << g_att.interval_min * 1.25 << "-"
+        << g_att.interval_max * 1.25 << " ms\n";
+  }
+
+  ERR << "[info] Connecting...\n";
+  if (!connect(20000)) {
+    ERR << "[err] Failed to connect.\n";
+    return false;
+  }
+  t->connected_ns = metrics_now_ns();
+  ERR << "[info] Connected.\n";
+
+  if (!start_notify()) {
+    ERR << "[err] Could not enable HR notifications\n";
+    return false;
+  }
+  // Discovery and the CCCD write are one request each; no separate
+  // "services resolved" step exists on a raw bearer.
+  t->resolved_ns = t->subscribed_ns = metrics_now_ns();
+  startup_log_times(*t);
+  return true;
+}
+
+uint64_t AttBackend::maintain() {
+  if (att_.connected()) return UINT64_MAX;
+  auto now = Clock::now();
+  if (att_.connecting() && now >= connect_deadline_) {
+    ERR << "[err] " << address_ << ": LE connect: timeout\n";
+    return retry_later();
+  }
+  auto wait_until = att_.connecting() ? connect_deadline_ : retry_at_;
+  if (now < wait_until) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(wait_until - now)
+      .count();
+  }
+  // Started here and completed in ready() once the socket is writable, so
+  // the loop keeps running while the controller pages the strap.
+  ERR << "[info] Reconnecting (ATT)...\n";
+  load_conn_param();
+  std::string err;
+  if (!att_.connect_begin(local_, peer_, &err)) {
+    ERR << "[err] " << address_ << ": " << err << "\n";
+    return retry_later();
+  }
+  connect_deadline_ = now + 10s;
+  return 10000000;
+}
+
+uint64_t AttBackend::retry_later() {
+  att_.close();
+  retry_at_ = Clock::now() + 2s;
+  return 2000000;
+}
+
+void AttBackend::ready() {
+  if (att_.connecting()) {
+    std::string err;
+    if (!att_.connect_finish(&err)) {
+      ERR << "[err] " << address_ << ": " << err << "\n";
+      retry_later();
+    } else if (start_notify()) {
+      ERR << "[info] Reconnected; notifications enabled.\n";
+    } else {
+      retry_later();
+    }
+    return;
+  }
+  if (att_.process() < 0) {
+    hrm_source_down(&src_);
+    retry_at_ = {};
+  }
+}
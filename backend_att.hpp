@@ -0,0 +1,79 @@
+#pragma once
+#include <poll.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "att.hpp"
+#include "bluetooth.hpp"
+#include "mgmt.hpp"
+#include "startup.hpp"
+
+// --backend att: the default mode without bluetoothd in the data path. The
+// same steps as the BlueZ helpers (find the strap by name, connect, find the
+// HR characteristic, start notifications, keep it connected) run over the
+// kernel's management socket and an L2CAP ATT bearer, and notifications go
+// to hrm_on_value() like either D-Bus transport does, so parsing, health
+// checks, HRV, --pipeline and output are unchanged.
+struct AttBackendOptions {
+  uint16_t hci_index = 0;
+  // Requested LE connection interval in 1.25 ms units (0: the kernel's
+  // default, 30-50 ms), loaded before every connect.
+  uint16_t interval_min = 0;
+  uint16_t interval_max = 0;
+  uint16_t supervision_timeout = 400;  // 10 ms units
+};
+
+extern AttBackendOptions g_att;
+
+class AttBackend {
+ public:
+  AttBackend() : att_(on_notify, this) {}
+
+  bool open(std::string* err);
+  // startup_connect() over mgmt/ATT, with the same phases, timeouts and
+  // timing line.
+  bool startup(const std::vector<std::string_view>& names, StartupTimes* t);
+  // ensure_connected_and_notifying(): after a link loss, reconnect and
+  // resubscribe, 2 s between attempts. The connect is started here and
+  // completed by ready(). Returns the poll timeout in usec.
+  uint64_t maintain();
+  int fd() const { return att_.fd(); }  // -1 while down
+  // What to poll fd() for: POLLOUT while a reconnect is in progress.
+  short events() const { return att_.connecting() ? POLLOUT : POLLIN; }
+  // fd() polled ready: the reconnect completed (then resubscribe), or
+  // notifications are queued; a closed link is left to maintain().
+  void ready();
+
+  const HrmSource& source() const { return src_; }
+  const std::string& name() const { return name_; }
+  const std::string& address() const { return address_; }
+
+ private:
+  // Scans (mgmt LE discovery) until one of `names` advertises.
+  bool find_any_device_by_names(const std::vector<std::string_view>& names, int timeout_ms);
+  void load_conn_param();
+  bool connect(int timeout_ms);
+  // Closes the socket and schedules the next reconnect.
+  uint64_t retry_later();
+  // Finds the 2a37 value and CCCD handles (once per run) and enables
+  // notifications.
+  bool start_notify();
+  static void on_notify(void* ctx, uint16_t handle, const uint8_t* value, size_t len,
+                        uint64_t recv_ns);
+
+  MgmtSocket mgmt_;
+  AttClient att_;
+  BtAddr local_;
+  BtAddr peer_;
+  std::string name_;
+  std::string address_;
+  uint16_t hr_value_ = 0;
+  uint16_t hr_cccd_ = 0;
+  HrmSource src_;
+  std::chrono::steady_clock::time_point retry_at_{};
+  std::chrono::steady_clock::time_point connect_deadline_{};
+};
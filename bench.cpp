@@ -0,0 +1,652 @@
+// polarm-bench: microbenchmarks for the per-sample paths.
+//
+// Usage: polarm-bench [iterations]
+//        polarm-bench --gen-log <path|-> <size>[k|M|G] [devices] [seed]
+//        polarm-bench --replay <log>...
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "feat_health.hpp"
+#include "feat_health_af.hpp"
+#include "hrm.hpp"
+#include "logscan.hpp"
+#include "pmd.hpp"
+#include "rrkern.hpp"
+#include "synth.hpp"
+
+HealthThresholds g_health_thresholds;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps results observable so the optimizer cannot drop the work.
+volatile uint64_t g_sink = 0;
+
+struct Payload {
+  std::vector<uint8_t> bytes;
+};
+
+// Synthetic straps: three with 8-bit HR and one with 16-bit HR, EE every
+// 16th payload on one of them, over the full rhythm mix.
+std::vector<Payload> make_payloads(size_t n) {
+  std::vector<SynthStrap> straps;
+  for (uint32_t i = 0; i < 4; ++i) {
+    SynthOptions o;
+    o.seed = 12345 + i;
+    o.hr_16bit = (i == 3);
+    o.ee_every = (i == 0) ? 16 : 64;
+    straps.emplace_back(o);
+  }
+  std::vector<Payload> out;
+  out.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    uint8_t buf[kSynthPayloadMax];
+    uint64_t ts = 0;
+    size_t len = straps[i & 3].next_payload(buf, &ts);
+    out.push_back(Payload{std::vector<uint8_t>(buf, buf + len)});
+  }
+  return out;
+}
+
+// The pre-hrm.cpp notification path: byte-wise copy, vectors, ostringstream
+// and a string copy for duplicate suppression.
+uint64_t legacy_path(const Payload& p, uint64_t t, std::string* last_line) {
+  std::vector<uint8_t> bytes;
+  for (uint8_t b : p.bytes) bytes.push_back(b);
+
+  int bpm = -1;
+  std::vector<int> rr_ms;
+  if (!bytes.empty()) {
+    uint8_t flags = bytes[0];
+    size_t idx = 1;
+    if (flags & 0x01) {
+      if (bytes.size() >= idx + 2) { bpm = bytes[idx] | (bytes[idx + 1] << 8); idx += 2; }
+    } else if (bytes.size() >= idx + 1) {
+      bpm = bytes[idx];
+      idx += 1;
+    }
+    if ((flags & 0x08) && bytes.size() >= idx + 2) idx += 2;
+    if (flags & 0x10) {
+      while (bytes.size() >= idx + 2) {
+        uint16_t rr1024 = (uint16_t)bytes[idx] | ((uint16_t)bytes[idx + 1] << 8);
+        idx += 2;
+        rr_ms.push_back((int)((rr1024 * 1000ULL + 512ULL) / 1024ULL));
+      }
+    }
+  }
+  std::ostringstream line_oss;
+  line_oss << t;
+  if (bpm >= 0) line_oss << "," << bpm;
+  for (int v : rr_ms) line_oss << "," << v;
+  std::string out = line_oss.str();
+  uint64_t n = out.size();
+  if (out != *last_line) *last_line = std::move(out);
+  return n;
+}
+
+uint64_t hot_path(const Payload& p, uint64_t t, HrmSample* last) {
+  HrmSample s;
+  hrm_parse(p.bytes.data(), p.bytes.size(), t, &s);
+  char line[kHrmLineMax + 1];
+  size_t n = hrm_format_line(s, line, kHrmLineMax);
+  if (!hrm_same_fields(s, *last)) *last = s;
+  return n + (uint8_t)line[0];
+}
+
+// The pre-logscan --analyze-log line parser.
+bool legacy_parse_log_line(const std::string& line, std::vector<long long>* out) {
+  out->clear();
+  if (line.empty()) return false;
+  size_t i = 0;
+  while (i < line.size()) {
+    if (!std::isdigit(static_cast<unsigned char>(line[i]))) return false;
+    long long v = 0;
+    while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) {
+      v = v * 10 + (line[i] - '0');
+      ++i;
+    }
+    out->push_back(v);
+    if (i == line.size()) break;
+    if (line[i] != ',') return false;
+    ++i;
+  }
+  return out->size() >= 2;
+}
+
+std::string make_text_log(const std::vector<Payload>& payloads, size_t lines, uint64_t t0) {
+  std::string out;
+  char buf[kHrmLineMax + 1];
+  for (size_t i = 0; i < lines; ++i) {
+    HrmSample s;
+    const Payload& p = payloads[i & 4095];
+    hrm_parse(p.bytes.data(), p.bytes.size(), t0 + i * 1000, &s);
+    out.append(buf, hrm_format_line(s, buf, kHrmLineMax));
+    out.push_back('\n');
+  }
+  return out;
+}
+
+// The pre-AfScreen AF metrics: copy the window, clean it, and compute the
+// metrics of the last kHealthAfWindow cleaned beats from scratch (the entropy
+// through a full sort). False when fewer beats survive the cleaning.
+bool legacy_af_metrics(const std::deque<int>& window, AfMetrics* m) {
+  std::vector<int> rr(window.begin(), window.end());
+  std::vector<bool> keep(rr.size(), true);
+  if (rr.size() >= 5) {
+    for (size_t i = 1; i + 2 < rr.size(); ++i) {
+      double r_prev = static_cast<double>(rr[i]) / rr[i - 1];
+      double r_next = static_cast<double>(rr[i + 1]) / rr[i];
+      double r_next2 = static_cast<double>(rr[i + 2]) / rr[i + 1];
+      if ((r_prev <= 0.8) && (r_next >= 1.3) && (r_next2 <= 0.9)) {
+        keep[i] = false;
+        keep[i + 1] = false;
+        i += 1;
+      }
+    }
+  }
+  std::vector<double> cleaned;
+  for (size_t i = 0; i < rr.size(); ++i) {
+    if (keep[i]) cleaned.push_back(static_cast<double>(rr[i]));
+  }
+  if (cleaned.size() < kHealthAfWindow) return false;
+  std::vector<double> seg(cleaned.end() - kHealthAfWindow, cleaned.end());
+
+  double sum = 0.0;
+  size_t tp = 0;
+  for (size_t i = 0; i + 1 < seg.size(); ++i) {
+    double d = seg[i + 1] - seg[i];
+    sum += d * d;
+  }
+  for (size_t i = 1; i + 1 < seg.size(); ++i) {
+    bool peak = seg[i] > seg[i - 1] && seg[i] > seg[i + 1];
+    bool dip = seg[i] < seg[i - 1] && seg[i] < seg[i + 1];
+    if (peak || dip) ++tp;
+  }
+  double rmssd = std::sqrt(sum / static_cast<double>(seg.size() - 1));
+  double meanrr = std::accumulate(seg.begin(), seg.end(), 0.0) / seg.size();
+  m->rmssd_ratio = rmssd / meanrr;
+  m->tpr = static_cast<double>(tp) / static_cast<double>(seg.size() - 2);
+
+  std::vector<double> s = seg;
+  std::sort(s.begin(), s.end());
+  std::vector<double> trimmed(s.begin() + 8, s.end() - 8);
+  double lo = trimmed.front();
+  double hi = trimmed.back();
+  m->entropy = 0.0;
+  if (hi <= lo) return true;
+  int counts[16] = {0};
+  for (double x : trimmed) {
+    int k = static_cast<int>((x - lo) / (hi - lo) * 16);
+    counts[std::clamp(k, 0, 15)] += 1;
+  }
+  double se = 0.0;
+  for (int c : counts) {
+    if (c == 0) continue;
+    double p = static_cast<double>(c) / static_cast<double>(trimmed.size());
+    se -= p * std::log(p);
+  }
+  m->entropy = se / std::log(1.0 / 16);
+  return true;
+}
+
+// Plausible RR stream alternating sinus rhythm, irregular (AF-like) runs and
+// bigeminy (short-long pairs the cleaner drops).
+std::vector<int> make_rr_stream(size_t n) {
+  std::vector<int> out;
+  out.reserve(n);
+  uint32_t seed = 777;
+  auto rnd = [&] {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+  };
+  while (out.size() < n) {
+    uint32_t kind = rnd() % 3;
+    size_t len = 100 + rnd() % 700;
+    for (size_t i = 0; i < len && out.size() < n; ++i) {
+      int v;
+      if (kind == 0) v = 800 + (int)(rnd() % 61) - 30;
+      else if (kind == 1) v = 400 + (int)(rnd() % 900);
+      else v = (i % 4 == 1) ? 560 : (i % 4 == 2) ? 1000 : 820 + (int)(rnd() % 21);
+      out.push_back(std::clamp(v, kHealthMinRRms, kHealthMaxRRms));
+    }
+  }
+  return out;
+}
+
+class CountingSink : public HealthWarningSink {
+ public:
+  void on_warning(const HealthWarning&) override { ++warnings; }
+  uint64_t warnings = 0;
+};
+
+// The single-threaded core of --analyze-log: scan lines, split off the
+// device tag and run that device's detectors on each reading.
+struct ReplayResult {
+  uint64_t samples = 0;
+  uint64_t warnings = 0;
+};
+
+ReplayResult replay_text(const char* data, size_t size) {
+  std::map<std::string, HealthMonitor, std::less<>> monitors;
+  CountingSink sink;
+  ReplayResult res;
+  LineScanner lines(data, size);
+  std::vector<long long> tag_fields;
+  std::vector<int> rr;
+  HealthMonitor* last = nullptr;
+  std::string_view last_tag;
+  while (lines.next()) {
+    std::string_view tag;
+    std::span<const long long> fields = lines.fields();
+    if (!lines.ok()) {
+      std::string_view line = lines.line();
+      size_t sp = line.find(' ');
+      if (sp == std::string_view::npos ||
+          !logscan_parse_fields(line.data() + sp + 1, line.data() + line.size(), &tag_fields))
+        continue;
+      tag = line.substr(0, sp);
+      fields = tag_fields;
+    }
+    if (!last || tag != last_tag) {
+      auto it = monitors.find(tag);
+      if (it == monitors.end()) it = monitors.emplace(std::string(tag), HealthMonitor(std::string(tag))).first;
+      last = &it->second;
+      last_tag = it->first;
+    }
+    rr.clear();
+    for (long long v : fields.subspan(2)) rr.push_back((int)v);
+    last->push(fields[0], (int)fields[1], rr, &sink);
+    ++res.samples;
+  }
+  res.warnings = sink.warnings;
+  return res;
+}
+
+// Whole synthetic capture in memory, as --gen-log would write it.
+std::string make_synth_log(uint64_t bytes, unsigned devices) {
+  char* buf = nullptr;
+  size_t len = 0;
+  std::FILE* f = open_memstream(&buf, &len);
+  if (!f) return {};
+  SynthOptions o;
+  synth_write_log(f, bytes, devices, o);
+  std::fclose(f);
+  std::string out(buf, len);
+  std::free(buf);
+  return out;
+}
+
+// H10-shaped PMD frames: raw ECG (3-byte samples) and delta-compressed ACC
+// (16-bit reference, then blocks of packed deltas), with the values each
+// frame should decode to.
+struct PmdBenchFrame {
+  std::vector<uint8_t> bytes;
+  std::vector<int32_t> values;
+};
+
+void pmd_header(std::vector<uint8_t>* out, PmdType type, uint64_t ts_ns, uint8_t frame) {
+  out->push_back((uint8_t)type);
+  for (int i = 0; i < 8; ++i) out->push_back((uint8_t)(ts_ns >> (8 * i)));
+  out->push_back(frame);
+}
+
+PmdBenchFrame make_ecg_frame(uint32_t* seed, uint64_t ts_ns) {
+  PmdBenchFrame f;
+  pmd_header(&f.bytes, PmdType::Ecg, ts_ns, 0);
+  for (int i = 0; i < 73; ++i) {
+    *seed = *seed * 1103515245u + 12345u;
+    int32_t uv = (int32_t)((*seed >> 8) % 4001) - 2000;
+    f.values.push_back(uv);
+    for (int b = 0; b < 3; ++b) f.bytes.push_back((uint8_t)((uint32_t)uv >> (8 * b)));
+  }
+  return f;
+}
+
+PmdBenchFrame make_acc_delta_frame(uint32_t* seed, uint64_t ts_ns) {
+  PmdBenchFrame f;
+  pmd_header(&f.bytes, PmdType::Acc, ts_ns, 0x80);
+  int32_t cur[3] = {-12, 40, 1000};
+  for (int32_t v : cur) {
+    f.values.push_back(v);
+    f.bytes.push_back((uint8_t)v);
+    f.bytes.push_back((uint8_t)((uint32_t)v >> 8));
+  }
+  const unsigned bits = 6;
+  for (int block = 0; block < 3; ++block) {
+    const unsigned count = 12;
+    f.bytes.push_back((uint8_t)bits);
+    f.bytes.push_back((uint8_t)count);
+    uint64_t acc = 0;
+    unsigned have = 0;
+    for (unsigned i = 0; i < count * 3; ++i) {
+      *seed = *seed * 1103515245u + 12345u;
+      int32_t d = (int32_t)((*seed >> 8) % 63) - 31;
+      cur[i % 3] += d;
+      f.values.push_back(cur[i % 3]);
+      acc |= (uint64_t)((uint32_t)d & ((1u << bits) - 1)) << have;
+      have += bits;
+      while (have >= 8) {
+        f.bytes.push_back((uint8_t)acc);
+        acc >>= 8;
+        have -= 8;
+      }
+    }
+    if (have) f.bytes.push_back((uint8_t)acc);
+  }
+  return f;
+}
+
+template <typename Fn>
+void report(const char* name, size_t iters, Fn&& fn) {
+  auto t0 = Clock::now();
+  uint64_t acc = fn();
+  auto t1 = Clock::now();
+  g_sink = g_sink + acc;
+  double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  std::printf("%-28s %10.1f ns/sample %12.0f samples/s\n",
+              name, ns / (double)iters, (double)iters * 1e9 / ns);
+}
+
+}  // namespace
+
+// "512M", "4G", "100k" or plain bytes.
+bool parse_size(const char* s, uint64_t* out) {
+  char* end = nullptr;
+  unsigned long long v = std::strtoull(s, &end, 10);
+  if (end == s) return false;
+  uint64_t mul = 1;
+  switch (*end) {
+    case 'k': case 'K': mul = 1ULL << 10; ++end; break;
+    case 'm': case 'M': mul = 1ULL << 20; ++end; break;
+    case 'g': case 'G': mul = 1ULL << 30; ++end; break;
+    default: break;
+  }
+  if (*end) return false;
+  *out = v * mul;
+  return true;
+}
+
+int gen_log(int argc, char** argv) {
+  uint64_t bytes = 0;
+  if (argc < 4 || !parse_size(argv[3], &bytes)) {
+    std::fprintf(stderr, "usage: %s --gen-log <path|-> <size>[k|M|G] [devices] [seed]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  unsigned devices = (argc > 4) ? (unsigned)std::strtoul(argv[4], nullptr, 10) : 1;
+  SynthOptions o;
+  if (argc > 5) o.seed = (uint32_t)std::strtoul(argv[5], nullptr, 10);
+  bool to_stdout = std::strcmp(argv[2], "-") == 0;
+  std::FILE* f = to_stdout ? stdout : std::fopen(argv[2], "w");
+  if (!f) {
+    std::fprintf(stderr, "%s: %s\n", argv[2], std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  auto t0 = Clock::now();
+  uint64_t lines = synth_write_log(f, bytes, devices, o);
+  bool ok = lines && std::fflush(f) == 0 && (to_stdout || std::fclose(f) == 0);
+  double s = std::chrono::duration<double>(Clock::now() - t0).count();
+  if (!ok) {
+    std::fprintf(stderr, "%s: write failed\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  std::fprintf(stderr, "%llu lines from %u device(s) in %.1f s\n",
+               (unsigned long long)lines, std::max(devices, 1u), s);
+  return 0;
+}
+
+int replay_files(int argc, char** argv) {
+  int rc = 0;
+  for (int i = 2; i < argc; ++i) {
+    MappedFile file;
+    std::string err;
+    if (!file.open(argv[i], &err)) {
+      std::fprintf(stderr, "%s\n", err.c_str());
+      rc = EXIT_FAILURE;
+      continue;
+    }
+    auto t0 = Clock::now();
+    ReplayResult r = replay_text(file.data(), file.size());
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    std::printf("%s: %llu samples, %llu warnings, %.1f ns/sample %.0f samples/s %.0f MB/s\n",
+                argv[i], (unsigned long long)r.samples, (unsigned long long)r.warnings,
+                ns / (double)std::max<uint64_t>(r.samples, 1), (double)r.samples * 1e9 / ns,
+                (double)file.size() * 1e3 / ns);
+  }
+  return rc;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && std::strcmp(argv[1], "--gen-log") == 0) return gen_log(argc, argv);
+  if (argc > 1 && std::strcmp(argv[1], "--replay") == 0) return replay_files(argc, argv);
+  size_t iters = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+  if (iters == 0) iters = 1;
+  auto payloads = make_payloads(4096);
+  const uint64_t t0 = 1700000000000ULL;
+
+  report("hrm legacy (vector+oss)", iters, [&] {
+    std::string last;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < iters; ++i) acc += legacy_path(payloads[i & 4095], t0 + i, &last);
+    return acc;
+  });
+  report("hrm parse+format+dedup", iters, [&] {
+    HrmSample last;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < iters; ++i) acc += hot_path(payloads[i & 4095], t0 + i, &last);
+    return acc;
+  });
+  std::vector<HrmSample> samples(4096);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    hrm_parse(payloads[i].bytes.data(), payloads[i].bytes.size(), t0 + i, &samples[i]);
+  }
+  report("hrm parse", iters, [&] {
+    uint64_t acc = 0;
+    HrmSample s;
+    for (size_t i = 0; i < iters; ++i) {
+      const Payload& p = payloads[i & 4095];
+      hrm_parse(p.bytes.data(), p.bytes.size(), t0 + i, &s);
+      acc += (uint64_t)s.bpm + s.rr_count;
+    }
+    return acc;
+  });
+  report("hrm format", iters, [&] {
+    uint64_t acc = 0;
+    char line[kHrmLineMax + 1];
+    for (size_t i = 0; i < iters; ++i) acc += hrm_format_line(samples[i & 4095], line, kHrmLineMax);
+    return acc;
+  });
+
+  // All detectors on one strap's synthetic stream, one reading per sample.
+  {
+    SynthStrap strap(SynthOptions{});
+    std::vector<HrmSample> stream(std::min<size_t>(iters, 1000000));
+    for (auto& s : stream) {
+      uint8_t buf[kSynthPayloadMax];
+      uint64_t ts = 0;
+      size_t len = strap.next_payload(buf, &ts);
+      hrm_parse(buf, len, ts, &s);
+    }
+    CountingSink sink;
+    report("health detectors", stream.size(), [&] {
+      HealthMonitor m("bench");
+      for (const auto& s : stream) m.push((long long)s.ts_ms, s.bpm, s.rr(), &sink);
+      return sink.warnings;
+    });
+    std::printf("health detectors warnings: %llu over %zu samples\n",
+                (unsigned long long)sink.warnings, stream.size());
+  }
+
+  // In-memory two-strap capture through the scanner and the detectors.
+  {
+    std::string corpus = make_synth_log((uint64_t)iters * 24, 2);
+    ReplayResult r;
+    size_t lines = (size_t)std::count(corpus.begin(), corpus.end(), '\n');
+    report("replay text (scan+detect)", lines, [&] {
+      r = replay_text(corpus.data(), corpus.size());
+      return r.samples;
+    });
+    std::printf("replay text: %zu MiB, %llu samples, %llu warnings\n", corpus.size() >> 20,
+                (unsigned long long)r.samples, (unsigned long long)r.warnings);
+  }
+
+  std::string text = make_text_log(payloads, iters, t0);
+  report("log getline+isdigit", iters, [&] {
+    std::istringstream in(text);
+    std::string line;
+    std::vector<long long> fields;
+    uint64_t acc = 0;
+    while (std::getline(in, line)) {
+      if (legacy_parse_log_line(line, &fields)) acc += (uint64_t)fields[1];
+    }
+    return acc;
+  });
+  std::string label = std::string("log LineScanner (") + logscan_kernel_name() + ")";
+  report(label.c_str(), iters, [&] {
+    LineScanner lines(text.data(), text.size());
+    uint64_t acc = 0;
+    while (lines.next()) {
+      if (lines.ok()) acc += (uint64_t)lines.fields()[1];
+    }
+    return acc;
+  });
+
+  // AF metrics after every beat, as the live path asks for them.
+  std::vector<int> rr = make_rr_stream(std::min<size_t>(iters, 200000));
+  std::vector<AfMetrics> legacy(rr.size());
+  std::vector<char> legacy_ok(rr.size());
+  report("af metrics legacy (sort)", rr.size(), [&] {
+    std::deque<int> window;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < rr.size(); ++i) {
+      window.push_back(rr[i]);
+      if (window.size() > kHealthRRWindow) window.pop_front();
+      legacy_ok[i] = window.size() >= kHealthAfWindow && legacy_af_metrics(window, &legacy[i]);
+      acc += legacy_ok[i];
+    }
+    return acc;
+  });
+  size_t mismatches = 0;
+  report("af metrics AfScreen", rr.size(), [&] {
+    AfScreen af;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < rr.size(); ++i) {
+      af.push(rr[i]);
+      bool ok = af.raw().size() >= kHealthAfWindow && af.cleaned_size() >= kHealthAfWindow;
+      AfMetrics m;
+      if (ok) m = af.metrics();
+      acc += ok;
+      if (ok != (bool)legacy_ok[i] ||
+          (ok && std::memcmp(&m, &legacy[i], sizeof(m)) != 0)) {
+        ++mismatches;
+      }
+    }
+    return acc;
+  });
+  std::printf("af metrics mismatches: %zu of %zu beats\n", mismatches, rr.size());
+
+  // Whole-recording kernels, scalar against the dispatched ISA.
+  std::vector<int32_t> rec = make_rr_stream(std::max<size_t>(iters, 1000000));
+  const RrKernels& scalar = rr_kernels_scalar();
+  const RrKernels& vec = rr_kernels();
+  std::vector<uint8_t> pat_s(rec.size()), pat_v(rec.size());
+  RrHistogram16 hist_s, hist_v;
+  uint64_t ref[3] = {};
+  uint64_t got[3] = {};
+  for (const RrKernels* k : {&scalar, &vec}) {
+    uint64_t* out = (k == &scalar) ? ref : got;
+    std::string name = std::string("rr sum_sq_diff ") + k->name;
+    report(name.c_str(), rec.size(), [&] {
+      return out[0] = (uint64_t)k->sum_sq_diff(rec.data(), rec.size());
+    });
+    name = std::string("rr turning_points ") + k->name;
+    report(name.c_str(), rec.size(), [&] {
+      return out[1] = k->turning_points(rec.data(), rec.size());
+    });
+    name = std::string("rr dash_patterns ") + k->name;
+    report(name.c_str(), rec.size(), [&] {
+      uint8_t* p = (k == &scalar) ? pat_s.data() : pat_v.data();
+      k->dash_patterns(rec.data(), rec.size(), p);
+      return (uint64_t)p[rec.size() / 2];
+    });
+    name = std::string("rr histogram16 ") + k->name;
+    report(name.c_str(), rec.size(), [&] {
+      RrHistogram16* h = (k == &scalar) ? &hist_s : &hist_v;
+      k->histogram16(rec.data(), rec.size(), 600, 1300, h);
+      return out[2] = h->bins[3];
+    });
+  }
+  bool same = std::memcmp(ref, got, sizeof(ref)) == 0 && pat_s == pat_v &&
+              std::memcmp(&hist_s, &hist_v, sizeof(hist_s)) == 0;
+  std::printf("rr kernels %s vs scalar: %s\n", vec.name, same ? "identical" : "MISMATCH");
+
+  // Batch AF metrics over the cleaned recording, against AfScreen.
+  std::vector<int32_t> cleaned;
+  rr_dash_clean(rec, &cleaned);
+  std::vector<AfMetrics> batch;
+  report("af segment batch (per window)", cleaned.size() - kHealthAfWindow + 1, [&] {
+    af_segment_metrics_batch(cleaned, kHealthAfWindow, 1, &batch);
+    return (uint64_t)batch.size();
+  });
+  size_t seg_mismatches = 0;
+  AfScreen af;
+  for (size_t i = 0; i < rr.size(); ++i) {
+    af.push(rr[i]);
+    if (af.cleaned_size() < kHealthAfWindow) continue;
+    AfMetrics a = af.metrics();
+    AfMetrics b = af_segment_metrics(af.segment());
+    seg_mismatches += std::memcmp(&a, &b, sizeof(a)) != 0;
+  }
+  std::printf("af segment batch mismatches vs AfScreen: %zu\n", seg_mismatches);
+
+  // PMD frames into one preallocated frame, as the --pmd data callback does.
+  {
+    std::vector<PmdBenchFrame> frames;
+    uint32_t seed = 4242;
+    for (int i = 0; i < 256; ++i) {
+      uint64_t ts = 1000000000ULL * (uint64_t)i;
+      frames.push_back((i & 1) ? make_acc_delta_frame(&seed, ts) : make_ecg_frame(&seed, ts));
+    }
+    PmdDecoder dec;
+    auto frame = std::make_unique<PmdFrame>();
+    size_t pmd_mismatches = 0;
+    uint64_t values = 0;
+    for (const auto& f : frames) {
+      bool ok = dec.decode(f.bytes.data(), f.bytes.size(), frame.get()) == PmdDecode::Ok &&
+                (size_t)frame->samples * frame->channels == f.values.size() &&
+                std::memcmp(frame->v, f.values.data(), f.values.size() * sizeof(int32_t)) == 0;
+      pmd_mismatches += !ok;
+      values += f.values.size();
+    }
+    size_t rounds = std::max<size_t>(iters / (size_t)values, 1) * 16;
+    report("pmd decode (ecg+acc delta)", rounds * values, [&] {
+      uint64_t acc = 0;
+      for (size_t r = 0; r < rounds; ++r) {
+        for (const auto& f : frames) {
+          dec.decode(f.bytes.data(), f.bytes.size(), frame.get());
+          acc += (uint64_t)frame->v[0];
+        }
+      }
+      return acc;
+    });
+    std::printf("pmd decode mismatches: %zu of %zu frames\n", pmd_mismatches, frames.size());
+  }
+  return 0;
+}
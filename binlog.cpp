@@ -0,0 +1,551 @@
+#include "binlog.hpp"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include "debug.hpp"
+
+namespace {
+
+constexpr uint32_t kMaxBlockRecords = 512;
+constexpr size_t kMaxBlockPayload = 4096;
+// ts delta + device + header + RR count + bpm + RRs, all varints at their widest.
+constexpr size_t kMaxRecordBytes = 10 + 5 + 1 + 2 + 5 + kHrmMaxRR * 5;
+// Header nibble meaning "the RR count follows as a varint".
+constexpr uint8_t kRRCountEscape = 0x0f;
+constexpr uint32_t kMaxReadPayload = 16u << 20;
+constexpr size_t kResyncWindow = 64u << 10;
+
+constexpr std::array<uint32_t, 256> make_crc_table() {
+  std::array<uint32_t, 256> t{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+    t[i] = c;
+  }
+  return t;
+}
+constexpr auto kCrcTable = make_crc_table();
+
+uint32_t crc32(const uint8_t* p, size_t n) {
+  uint32_t c = 0xffffffffu;
+  for (size_t i = 0; i < n; ++i) c = kCrcTable[(c ^ p[i]) & 0xff] ^ (c >> 8);
+  return c ^ 0xffffffffu;
+}
+
+void put_le(uint8_t* p, uint64_t v, size_t n) {
+  for (size_t i = 0; i < n; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+uint64_t get_le(const uint8_t* p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; ++i) v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+size_t put_varint(uint8_t* p, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+void append_varint(std::vector<uint8_t>* out, uint64_t v) {
+  uint8_t tmp[10];
+  out->insert(out->end(), tmp, tmp + put_varint(tmp, v));
+}
+
+void append_str(std::vector<uint8_t>* out, std::string_view s) {
+  append_varint(out, s.size());
+  out->insert(out->end(), s.begin(), s.end());
+}
+
+void append_device(std::vector<uint8_t>* out, const BinlogDevice& d) {
+  append_varint(out, d.id);
+  append_str(out, d.tag);
+  append_str(out, d.name);
+  append_str(out, d.address);
+}
+
+// Bounds-checked cursor over a block payload.
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+
+  uint64_t varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p == end) break;
+      uint8_t b = *p++;
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return 0;
+  }
+  uint8_t byte() {
+    if (p == end) { ok = false; return 0; }
+    return *p++;
+  }
+  uint64_t fixed(size_t n) {
+    if ((size_t)(end - p) < n) { ok = false; p = end; return 0; }
+    uint64_t v = get_le(p, n);
+    p += n;
+    return v;
+  }
+  std::string str() {
+    uint64_t n = varint();
+    if (!ok || (uint64_t)(end - p) < n) { ok = false; return {}; }
+    std::string s((const char*)p, (size_t)n);
+    p += n;
+    return s;
+  }
+};
+
+bool read_device(Cursor* c, BinlogDevice* d) {
+  d->id = (uint32_t)c->varint();
+  d->tag = c->str();
+  d->name = c->str();
+  d->address = c->str();
+  return c->ok;
+}
+
+}  // namespace
+
+bool binlog_detect(const std::string& path) {
+  std::FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) return false;
+  char magic[sizeof(kBinlogMagic)];
+  bool hit = std::fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+             std::memcmp(magic, kBinlogMagic, sizeof(magic)) == 0;
+  std::fclose(f);
+  return hit;
+}
+
+// ---- BinlogSink ----
+BinlogSink::BinlogSink(int fd, const OutputOptions& opts) : w_(fd, opts), flush_ms_(opts.flush_ms) {
+  block_.reserve(kMaxBlockPayload + kMaxRecordBytes);
+  uint8_t hdr[kBinlogHeaderSize] = {};
+  std::memcpy(hdr, kBinlogMagic, sizeof(kBinlogMagic));
+  put_le(hdr + 8, kBinlogVersion, 2);
+  timespec ts{};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  put_le(hdr + 12, (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL, 8);
+  header_off_ = w_.position();
+  w_.append(std::string_view((const char*)hdr, sizeof(hdr)));
+}
+
+BinlogSink::~BinlogSink() { close(); }
+
+static void append_block(BufferedWriter* w, uint8_t type, uint32_t count, uint64_t base_ts,
+                         const uint8_t* payload, size_t len) {
+  uint8_t hdr[kBinlogBlockHeaderSize] = {};
+  put_le(hdr, kBinlogSync, 4);
+  hdr[4] = type;
+  put_le(hdr + 8, len, 4);
+  put_le(hdr + 12, count, 4);
+  put_le(hdr + 16, base_ts, 8);
+  put_le(hdr + 24, crc32(payload, len), 4);
+  w->append(std::string_view((const char*)hdr, sizeof(hdr)));
+  w->append(std::string_view((const char*)payload, len));
+}
+
+uint32_t BinlogSink::device_id(std::string_view tag) {
+  for (const auto& d : devices_) {
+    if (d.tag == tag) return d.id;
+  }
+  BinlogDevice d;
+  d.id = (uint32_t)devices_.size();
+  d.tag = std::string(tag);
+  devices_.push_back(d);
+  write_device_block(devices_.back());
+  return d.id;
+}
+
+void BinlogSink::write_device_block(const BinlogDevice& d) {
+  close_block();  // keep file order == arrival order
+  std::vector<uint8_t> payload;
+  append_device(&payload, d);
+  append_block(&w_, kBinlogDevice, 1, 0, payload.data(), payload.size());
+}
+
+void BinlogSink::describe_device(std::string_view tag, std::string_view name,
+                                 std::string_view address) {
+  if (closed_) return;
+  BinlogDevice& d = devices_[device_id(tag)];
+  if (d.name == name && d.address == address) return;
+  d.name = std::string(name);
+  d.address = std::string(address);
+  write_device_block(d);
+}
+
+void BinlogSink::write_pmd(std::string_view tag, const PmdFrame& f, uint64_t ts_ms) {
+  if (closed_ || f.samples == 0 || f.channels == 0) return;
+  uint32_t dev = device_id(tag);
+  close_block();  // keep file order == arrival order
+  size_t values = (size_t)f.samples * f.channels;
+  // Sized once for the largest frame, so this never reallocates.
+  pmd_block_.resize(5 + 1 + 1 + 3 + 8 + kPmdMaxValues * 5);
+  uint8_t* p = pmd_block_.data();
+  size_t n = put_varint(p, dev);
+  p[n++] = (uint8_t)f.type;
+  p[n++] = f.channels;
+  n += put_varint(p + n, f.rate_hz);
+  put_le(p + n, f.sensor_ts_ns, 8);
+  n += 8;
+  for (size_t i = 0; i < values; ++i) {
+    int64_t prev = (i >= f.channels) ? f.v[i - f.channels] : 0;
+    n += put_varint(p + n, zigzag((int64_t)f.v[i] - prev));
+  }
+  append_block(&w_, kBinlogPmd, f.samples, ts_ms, p, n);
+}
+
+void BinlogSink::write_sample(std::string_view tag, const HrmSample& s) {
+  if (closed_) return;
+  uint32_t dev = device_id(tag);
+  if (block_count_ == 0) {
+    block_base_ts_ = block_prev_ts_ = block_min_ts_ = block_max_ts_ = s.ts_ms;
+    block_prev_rr_ = 0;
+    block_first_ms_ = monotonic_ms();
+  }
+  uint8_t rec[kMaxRecordBytes];
+  size_t n = 0;
+  n += put_varint(rec + n, zigzag((int64_t)(s.ts_ms - block_prev_ts_)));
+  n += put_varint(rec + n, dev);
+  uint8_t rr_nibble = std::min<uint8_t>(s.rr_count, kRRCountEscape);
+  rec[n++] = (uint8_t)(rr_nibble | (s.bpm >= 0 ? 0x10 : 0));
+  if (rr_nibble == kRRCountEscape) n += put_varint(rec + n, s.rr_count);
+  if (s.bpm >= 0) n += put_varint(rec + n, (uint64_t)s.bpm);
+  for (size_t i = 0; i < s.rr_count; ++i) {
+    n += put_varint(rec + n, zigzag((int64_t)s.rr_ms[i] - block_prev_rr_));
+    block_prev_rr_ = s.rr_ms[i];
+  }
+  block_.insert(block_.end(), rec, rec + n);
+  block_prev_ts_ = s.ts_ms;
+  block_min_ts_ = std::min(block_min_ts_, s.ts_ms);
+  block_max_ts_ = std::max(block_max_ts_, s.ts_ms);
+  ++block_count_;
+
+  if (flush_ms_ == 0 || block_count_ >= kMaxBlockRecords || block_.size() >= kMaxBlockPayload)
+    close_block();
+}
+
+void BinlogSink::close_block() {
+  if (block_count_ == 0) return;
+  BinlogIndexEntry e;
+  e.offset = w_.position();
+  e.records = block_count_;
+  e.first_ts = block_min_ts_;
+  e.last_ts = block_max_ts_;
+  append_block(&w_, kBinlogSamples, block_count_, block_base_ts_, block_.data(), block_.size());
+  index_.push_back(e);
+  block_.clear();
+  block_count_ = 0;
+}
+
+uint64_t BinlogSink::deadline_ms() const {
+  uint64_t d = w_.deadline_ms();
+  if (block_count_ > 0) {
+    uint64_t b = block_first_ms_ + flush_ms_;
+    d = d ? std::min(d, b) : b;
+  }
+  return d;
+}
+
+bool BinlogSink::flush() {
+  close_block();
+  return w_.flush();
+}
+
+bool BinlogSink::close() {
+  if (closed_) return true;
+  closed_ = true;
+  close_block();
+
+  std::vector<uint8_t> payload;
+  append_varint(&payload, devices_.size());
+  for (const auto& d : devices_) append_device(&payload, d);
+  size_t at = payload.size();
+  payload.resize(at + index_.size() * 28);
+  for (const auto& e : index_) {
+    put_le(payload.data() + at, e.first_ts, 8);
+    put_le(payload.data() + at + 8, e.last_ts, 8);
+    put_le(payload.data() + at + 16, e.offset, 8);
+    put_le(payload.data() + at + 24, e.records, 4);
+    at += 28;
+  }
+  uint64_t index_off = w_.position();
+  append_block(&w_, kBinlogIndex, (uint32_t)index_.size(), header_off_, payload.data(),
+               payload.size());
+
+  uint8_t footer[kBinlogFooterSize];
+  put_le(footer, index_off, 8);
+  std::memcpy(footer + 8, kBinlogIndexMagic, sizeof(kBinlogIndexMagic));
+  w_.append(std::string_view((const char*)footer, sizeof(footer)));
+  return w_.flush();
+}
+
+// ---- BinlogReader ----
+BinlogReader::~BinlogReader() {
+  if (f_) std::fclose(f_);
+}
+
+void BinlogReader::set_pmd_handler(PmdFn fn, void* ctx) {
+  pmd_fn_ = fn;
+  pmd_ctx_ = ctx;
+  if (fn && !pmd_frame_) pmd_frame_ = std::make_unique<PmdFrame>();
+}
+
+bool BinlogReader::read_pmd_block(const uint8_t* p, size_t len, uint32_t count, uint64_t ts_ms) {
+  Cursor c{p, p + len};
+  PmdFrame& f = *pmd_frame_;
+  uint32_t dev = (uint32_t)c.varint();
+  uint8_t type = c.byte();
+  f.type = (PmdType)type;
+  f.channels = c.byte();
+  f.rate_hz = (uint16_t)c.varint();
+  f.sensor_ts_ns = c.fixed(8);
+  f.samples = count;
+  size_t values = (size_t)count * f.channels;
+  if (!c.ok || f.channels == 0 || values > kPmdMaxValues) return false;
+  for (size_t i = 0; i < values && c.ok; ++i) {
+    int64_t prev = (i >= f.channels) ? f.v[i - f.channels] : 0;
+    f.v[i] = (int32_t)(prev + unzigzag(c.varint()));
+  }
+  if (!c.ok) return false;
+  pmd_fn_(pmd_ctx_, dev, ts_ms, f);
+  return true;
+}
+
+const BinlogDevice* BinlogReader::device(uint32_t id) const {
+  for (const auto& d : devices_) {
+    if (d.id == id) return &d;
+  }
+  return nullptr;
+}
+
+bool BinlogReader::set_device(const uint8_t* p, size_t len) {
+  Cursor c{p, p + len};
+  BinlogDevice d;
+  if (!read_device(&c, &d)) return false;
+  for (auto& have : devices_) {
+    if (have.id == d.id) {
+      have = std::move(d);
+      return true;
+    }
+  }
+  devices_.push_back(std::move(d));
+  return true;
+}
+
+bool BinlogReader::open(const std::string& path, std::string* err) {
+  path_ = path;
+  f_ = std::fopen(path.c_str(), "rb");
+  if (!f_) {
+    *err = "unable to open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  uint8_t hdr[kBinlogHeaderSize];
+  if (std::fread(hdr, 1, sizeof(hdr), f_) != sizeof(hdr) ||
+      std::memcmp(hdr, kBinlogMagic, sizeof(kBinlogMagic)) != 0) {
+    *err = path + ": not a binary recording";
+    return false;
+  }
+  uint16_t version = (uint16_t)get_le(hdr + 8, 2);
+  if (version != kBinlogVersion) {
+    *err = path + ": unsupported binary recording version " + std::to_string(version);
+    return false;
+  }
+  created_ms_ = get_le(hdr + 12, 8);
+  fseeko(f_, 0, SEEK_END);
+  file_size_ = (uint64_t)ftello(f_);
+  data_end_ = file_size_;
+  if (!load_index()) {
+    DBG << "[dbg] " << path << ": no index, reading sequentially\n";
+    index_.clear();
+    data_end_ = file_size_;
+  }
+  return true;
+}
+
+bool BinlogReader::load_index() {
+  if (file_size_ < kBinlogHeaderSize + kBinlogBlockHeaderSize + kBinlogFooterSize) return false;
+  uint8_t footer[kBinlogFooterSize];
+  fseeko(f_, (off_t)(file_size_ - kBinlogFooterSize), SEEK_SET);
+  if (std::fread(footer, 1, sizeof(footer), f_) != sizeof(footer) ||
+      std::memcmp(footer + 8, kBinlogIndexMagic, sizeof(kBinlogIndexMagic)) != 0)
+    return false;
+  uint64_t off = get_le(footer, 8);
+  if (off < kBinlogHeaderSize || off + kBinlogBlockHeaderSize > file_size_ - kBinlogFooterSize)
+    return false;
+
+  uint8_t bh[kBinlogBlockHeaderSize];
+  fseeko(f_, (off_t)off, SEEK_SET);
+  if (std::fread(bh, 1, sizeof(bh), f_) != sizeof(bh)) return false;
+  uint32_t len = (uint32_t)get_le(bh + 8, 4);
+  uint32_t count = (uint32_t)get_le(bh + 12, 4);
+  if (get_le(bh, 4) != kBinlogSync || bh[4] != kBinlogIndex ||
+      off + kBinlogBlockHeaderSize + len + kBinlogFooterSize != file_size_)
+    return false;
+  if (get_le(bh + 16, 8) != 0) {
+    // Appended to other recordings: the index only covers the last one.
+    DBG << "[dbg] " << path_ << ": several recordings in one file\n";
+    return false;
+  }
+  buf_.resize(len);
+  if (std::fread(buf_.data(), 1, len, f_) != len ||
+      crc32(buf_.data(), len) != (uint32_t)get_le(bh + 24, 4))
+    return false;
+
+  Cursor c{buf_.data(), buf_.data() + len};
+  uint64_t ndev = c.varint();
+  for (uint64_t i = 0; i < ndev && c.ok; ++i) {
+    BinlogDevice d;
+    if (read_device(&c, &d)) devices_.push_back(std::move(d));
+  }
+  if (!c.ok || (uint64_t)(c.end - c.p) != (uint64_t)count * 28) return false;
+  index_.resize(count);
+  for (auto& e : index_) {
+    e.first_ts = c.fixed(8);
+    e.last_ts = c.fixed(8);
+    e.offset = c.fixed(8);
+    e.records = (uint32_t)c.fixed(4);
+  }
+  data_end_ = off;
+  return true;
+}
+
+bool BinlogReader::read_samples(SampleFn fn, void* ctx, uint64_t from_ms) {
+  uint64_t off = kBinlogHeaderSize;
+  if (from_ms && !index_.empty()) {
+    // Every block before the first one reaching from_ms is entirely older.
+    off = data_end_;
+    for (const auto& e : index_) {
+      if (e.last_ts >= from_ms) {
+        off = e.offset;
+        break;
+      }
+    }
+  }
+
+  return read_range(off, data_end_, from_ms, fn, ctx);
+}
+
+bool BinlogReader::read_blocks(size_t first, size_t last, SampleFn fn, void* ctx) {
+  if (first >= last || last > index_.size()) return true;
+  uint64_t stop = (last < index_.size()) ? index_[last].offset : data_end_;
+  return read_range(index_[first].offset, stop, 0, fn, ctx);
+}
+
+uint64_t BinlogReader::find_sync(uint64_t off, uint64_t stop) {
+  uint8_t marker[4];
+  put_le(marker, kBinlogSync, 4);
+  buf_.resize(kResyncWindow);
+  while (off + sizeof(marker) <= stop) {
+    size_t want = (size_t)std::min<uint64_t>(kResyncWindow, stop - off);
+    fseeko(f_, (off_t)off, SEEK_SET);
+    size_t got = std::fread(buf_.data(), 1, want, f_);
+    if (got < sizeof(marker)) break;
+    void* hit = memmem(buf_.data(), got, marker, sizeof(marker));
+    if (hit) return off + (uint64_t)(static_cast<uint8_t*>(hit) - buf_.data());
+    off += got - (sizeof(marker) - 1);  // a marker may straddle two windows
+  }
+  return stop;
+}
+
+bool BinlogReader::read_range(uint64_t off, uint64_t stop, uint64_t from_ms, SampleFn fn,
+                              void* ctx) {
+  bool resync = false;
+  uint8_t bh[kBinlogBlockHeaderSize];
+  while (off + kBinlogBlockHeaderSize <= stop) {
+    fseeko(f_, (off_t)off, SEEK_SET);
+    if (std::fread(bh, 1, sizeof(bh), f_) != sizeof(bh)) break;
+    uint32_t len = (uint32_t)get_le(bh + 8, 4);
+    uint32_t count = (uint32_t)get_le(bh + 12, 4);
+    bool sane = get_le(bh, 4) == kBinlogSync && len <= kMaxReadPayload;
+    if (sane && off + kBinlogBlockHeaderSize + len > stop) {
+      ERR << "[warn] " << path_ << ": truncated block at end of recording\n";
+      break;
+    }
+    if (sane) {
+      buf_.resize(len);
+      sane = std::fread(buf_.data(), 1, len, f_) == len &&
+             crc32(buf_.data(), len) == (uint32_t)get_le(bh + 24, 4);
+    }
+    if (!sane) {
+      // Footer and header between recordings appended to one another.
+      if (std::memcmp(bh + 8, kBinlogIndexMagic, sizeof(kBinlogIndexMagic)) == 0) {
+        off += kBinlogFooterSize;
+        continue;
+      }
+      if (std::memcmp(bh, kBinlogMagic, sizeof(kBinlogMagic)) == 0 &&
+          get_le(bh + 8, 2) == kBinlogVersion) {
+        off += kBinlogHeaderSize;
+        continue;
+      }
+      if (!resync) {
+        ++corrupt_blocks_;
+        ERR << "[warn] " << path_ << ": bad block at offset " << off << ", resyncing\n";
+      }
+      resync = true;
+      off = find_sync(off + 1, stop);
+      continue;
+    }
+    resync = false;
+    off += kBinlogBlockHeaderSize + len;
+
+    if (bh[4] == kBinlogDevice) {
+      set_device(buf_.data(), len);
+      continue;
+    }
+    if (bh[4] == kBinlogPmd && pmd_fn_) {
+      if (!read_pmd_block(buf_.data(), len, count, get_le(bh + 16, 8))) {
+        ++corrupt_blocks_;
+        ERR << "[warn] " << path_ << ": malformed PMD block at offset "
+            << (off - kBinlogBlockHeaderSize - len) << "\n";
+      }
+      continue;
+    }
+    if (bh[4] != kBinlogSamples) continue;  // index, PMD or unknown future type
+
+    Cursor c{buf_.data(), buf_.data() + len};
+    uint64_t ts = get_le(bh + 16, 8);
+    int prev_rr = 0;
+    HrmSample s;
+    for (uint32_t i = 0; i < count; ++i) {
+      ts += (uint64_t)unzigzag(c.varint());
+      uint32_t dev = (uint32_t)c.varint();
+      uint8_t h = c.byte();
+      s.ts_ms = ts;
+      uint64_t rr_count = h & 0x0f;
+      if (rr_count == kRRCountEscape) rr_count = c.varint();
+      if (rr_count > kHrmMaxRR) c.ok = false;
+      s.rr_count = (uint8_t)std::min<uint64_t>(rr_count, kHrmMaxRR);
+      s.bpm = (h & 0x10) ? (int)c.varint() : -1;
+      for (size_t k = 0; k < s.rr_count && c.ok; ++k) {
+        prev_rr += (int)unzigzag(c.varint());
+        s.rr_ms[k] = prev_rr;
+      }
+      if (!c.ok) {
+        ++corrupt_blocks_;
+        ERR << "[warn] " << path_ << ": malformed sample block at offset "
+            << (off - kBinlogBlockHeaderSize - len) << "\n";
+        break;
+      }
+      if (ts >= from_ms) fn(ctx, dev, s);
+    }
+  }
+  return corrupt_blocks_ == 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hrm.hpp"
+#include "output.hpp"
+#include "pmd.hpp"
+
+// Binary recording format (--format bin). All integers little-endian.
+//
+//   file   := header block* [footer]
+//   header := "PLRMBIN\0" u16 version u16 0 u64 created_epoch_ms
+//   block  := u32 kBinlogSync u8 type u8 0 u16 0 u32 payload_len
+//             u32 count u64 base_ts_ms u32 crc32(payload) payload
+//   footer := u64 offset_of_index_block "PLRMIDX\0"
+//
+// Sample block payload, `count` records of
+//   svarint ts - prev_ts   (prev_ts starts at base_ts_ms)
+//   varint  device id
+//   u8      min(rr_count, 15) | (bpm present) << 4
+//   [varint rr_count]      only when the low nibble is 15
+//   [varint bpm]
+//   svarint rr - prev_rr   per RR (prev_rr starts at 0 in each block)
+// Device block payload: varint id, str tag, str name, str address
+//   (str := varint length + bytes); a later block for the same id replaces it.
+// PMD block payload (--pmd; `count` samples, base_ts_ms = arrival time):
+//   varint device id, u8 measurement type, u8 channels, varint rate_hz,
+//   u64 sensor timestamp of the last sample (ns), then count * channels
+//   svarint deltas to the previous sample of the same channel (from 0).
+// Index block payload: varint device count + device entries as above, then
+//   `count` fixed entries of u64 first_ts, u64 last_ts, u64 offset, u32 records
+//   (one per sample block, in file order). Its base_ts_ms field holds the file
+//   offset of the recording's header; offsets are file offsets, so they stay
+//   right when the recording was appended to an existing file (">>").
+//
+// Blocks are self-delimiting and checksummed, so a recording that was cut off
+// (no footer) is still readable front to back, and so are recordings appended
+// to one another: the reader steps over their headers and footers.
+inline constexpr char kBinlogMagic[8] = {'P', 'L', 'R', 'M', 'B', 'I', 'N', '\0'};
+inline constexpr char kBinlogIndexMagic[8] = {'P', 'L', 'R', 'M', 'I', 'D', 'X', '\0'};
+inline constexpr uint16_t kBinlogVersion = 1;
+inline constexpr uint32_t kBinlogSync = 0x4b4c4250;  // "PBLK"
+inline constexpr size_t kBinlogHeaderSize = 20;
+inline constexpr size_t kBinlogBlockHeaderSize = 28;
+inline constexpr size_t kBinlogFooterSize = 16;
+
+enum BinlogBlockType : uint8_t {
+  kBinlogSamples = 1,
+  kBinlogDevice = 2,
+  kBinlogIndex = 3,
+  kBinlogPmd = 4,
+};
+
+struct BinlogDevice {
+  uint32_t id = 0;
+  std::string tag;
+  std::string name;
+  std::string address;
+};
+
+struct BinlogIndexEntry {
+  uint64_t first_ts = 0;
+  uint64_t last_ts = 0;
+  uint64_t offset = 0;
+  uint32_t records = 0;
+};
+
+// True when the first bytes of a file are a binlog header.
+bool binlog_detect(const std::string& path);
+
+// Writes samples as binary blocks. A block is closed when it is full or the
+// flush policy asks for it, so flush latency is bounded as for text output.
+class BinlogSink : public SampleSink {
+ public:
+  BinlogSink(int fd, const OutputOptions& opts);
+  ~BinlogSink() override;
+
+  void write_sample(std::string_view tag, const HrmSample& s) override;
+  void describe_device(std::string_view tag, std::string_view name,
+                       std::string_view address) override;
+  void write_pmd(std::string_view tag, const PmdFrame& f, uint64_t ts_ms) override;
+  bool flush() override;
+  bool close() override;
+  uint64_t deadline_ms() const override;
+
+ private:
+  uint32_t device_id(std::string_view tag);
+  void write_device_block(const BinlogDevice& d);
+  void close_block();
+
+  BufferedWriter w_;
+  uint64_t header_off_ = 0;  // file offset of our header
+  uint64_t flush_ms_;
+  std::vector<BinlogDevice> devices_;
+  std::vector<BinlogIndexEntry> index_;
+  std::vector<uint8_t> pmd_block_;  // reserved for the largest frame
+  // Open sample block.
+  std::vector<uint8_t> block_;
+  uint32_t block_count_ = 0;
+  uint64_t block_base_ts_ = 0;  // first record's ts
+  uint64_t block_prev_ts_ = 0;
+  uint64_t block_min_ts_ = 0;   // index entry range (clock steps may reorder)
+  uint64_t block_max_ts_ = 0;
+  int block_prev_rr_ = 0;
+  uint64_t block_first_ms_ = 0;  // monotonic, for the latency deadline
+  bool closed_ = false;
+};
+
+// Sequential/seekable reader. Sample callbacks receive the device id; look it
+// up in devices() for the tag.
+class BinlogReader {
+ public:
+  using SampleFn = void (*)(void* ctx, uint32_t device, const HrmSample& s);
+  using PmdFn = void (*)(void* ctx, uint32_t device, uint64_t ts_ms, const PmdFrame& f);
+
+  BinlogReader() = default;
+  ~BinlogReader();
+  BinlogReader(const BinlogReader&) = delete;
+  BinlogReader& operator=(const BinlogReader&) = delete;
+
+  bool open(const std::string& path, std::string* err);
+  uint64_t created_ms() const { return created_ms_; }
+  const std::vector<BinlogDevice>& devices() const { return devices_; }
+  const BinlogDevice* device(uint32_t id) const;
+  // Empty when the recording has no footer (e.g. interrupted capture).
+  const std::vector<BinlogIndexEntry>& index() const { return index_; }
+
+  // Delivers every sample with ts >= from_ms in file order, starting at the
+  // first indexed block that can contain from_ms. Corrupt blocks are skipped
+  // (resyncing on the next block marker) and counted in corrupt_blocks().
+  bool read_samples(SampleFn fn, void* ctx, uint64_t from_ms = 0);
+  // Samples of the indexed sample blocks [first, last) (and any device
+  // blocks between them); requires an index.
+  bool read_blocks(size_t first, size_t last, SampleFn fn, void* ctx);
+  uint64_t corrupt_blocks() const { return corrupt_blocks_; }
+  // PMD frames met by the reads above go to fn; without a handler they are
+  // skipped like any other block type the caller does not read.
+  void set_pmd_handler(PmdFn fn, void* ctx);
+
+ private:
+  bool load_index();
+  bool read_range(uint64_t off, uint64_t stop, uint64_t from_ms, SampleFn fn, void* ctx);
+  // Offset of the next block marker at or after `off`, or `stop`.
+  uint64_t find_sync(uint64_t off, uint64_t stop);
+  bool set_device(const uint8_t* p, size_t len);
+  bool read_pmd_block(const uint8_t* p, size_t len, uint32_t count, uint64_t ts_ms);
+
+  std::FILE* f_ = nullptr;
+  std::string path_;
+  uint64_t file_size_ = 0;
+  uint64_t created_ms_ = 0;
+  uint64_t data_end_ = 0;  // start of the index block, or file size
+  std::vector<BinlogDevice> devices_;
+  std::vector<BinlogIndexEntry> index_;
+  std::vector<uint8_t> buf_;
+  uint64_t corrupt_blocks_ = 0;
+  PmdFn pmd_fn_ = nullptr;
+  void* pmd_ctx_ = nullptr;
+  std::unique_ptr<PmdFrame> pmd_frame_;
+};
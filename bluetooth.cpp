@@ -1,35 +1,35 @@
 #include "bluetooth.hpp"
 
+#include <unistd.h>
+
 #include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
 #include <chrono>
+#include <functional>
+#include <map>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
-#include <iomanip>
-#include <sstream>
 #include <algorithm>
 #include <iostream>
 
 #include "feat_health.hpp"
+#include "hrm.hpp"
+#include "hrv.hpp"
+#include "metrics.hpp"
+#include "notify_fd.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "replay_bus.hpp"
+#include "trace.hpp"
 
 using namespace std::chrono_literals;
 
-// ---- constants ----
-static constexpr std::string_view kBluezService = "org.bluez";
-static constexpr std::string_view kObjManager = "org.freedesktop.DBus.ObjectManager";
-static constexpr std::string_view kProps = "org.freedesktop.DBus.Properties";
-static constexpr std::string_view kGattChar1 = "org.bluez.GattCharacteristic1";
-static constexpr std::string_view kDevice1 = "org.bluez.Device1";
-static constexpr std::string_view kAdapter1 = "org.bluez.Adapter1";
-static constexpr std::string_view kAdapterPath = "/org/bluez/hci0";
-static constexpr std::string_view kHRCharUUID = "00002a37-0000-1000-8000-00805f9b34fb";
-
 // ---- helpers ----
 [[noreturn]] static void die(const char* msg, int err) {
   ERR << "[fatal] " << msg << " (" << -err << "): " << strerror(-err) << "\n";
@@ -42,15 +42,6 @@ static std::string to_lower_uuid(std::string s) {
   return s;
 }
 
-static std::string to_hex(const std::vector<uint8_t>& v) {
-  std::ostringstream oss;
-  for (size_t i = 0; i < v.size(); ++i) {
-    if (i) oss << ' ';
-    oss << std::hex << std::setw(2) << std::setfill('0') << (int)v[i];
-  }
-  return oss.str();
-}
-
 static uint64_t now_ms() {
   auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
     std::chrono::system_clock::now().time_since_epoch());
@@ -59,21 +50,140 @@ static uint64_t now_ms() {
 
 // ---- Bus ----
 Bus::Bus() {
+  if (replay_enabled()) {
+    int r = replay_open_bus(&bus);
+    if (r < 0) die("--replay-trace bus", r);
+    return;
+  }
   int r = sd_bus_open_system(&bus);
   if (r < 0) die("sd_bus_open_system", r);
   DBG << "[dbg] sd_bus_open_system() ok\n";
 }
 Bus::~Bus() { if (bus) sd_bus_unref(bus); }
 
-// ---- Managed objects parsing ----
-struct ManagedObjectsEntry {
-  std::string path;
-  std::string interface;
-  std::optional<std::string> name;
-  std::optional<std::string> uuid;
+// ---- BlueZ object cache ----
+// Local mirror of the BlueZ object tree: filled once via GetManagedObjects and
+// kept current from ObjectManager.InterfacesAdded/InterfacesRemoved (plus
+// Device1 PropertiesChanged for late Name updates), so lookups are in-memory.
+using CachedIface = BluezProps;
+using CachedObject = std::map<std::string, CachedIface, std::less<>>;
+
+struct ObjectCache {
+  sd_bus* bus{};
+  bool loaded = false;
+  sd_bus_slot* added_slot{};
+  sd_bus_slot* removed_slot{};
+  sd_bus_slot* props_slot{};
+  std::map<std::string, CachedObject, std::less<>> objects;
 };
 
-static std::vector<ManagedObjectsEntry> get_managed_objects(sd_bus* bus) {
+static ObjectCache s_cache;
+
+// Event-driven maintenance: set when watched BlueZ state changes, plus the
+// earliest retry/timeout deadline that maintenance asked to be woken for.
+static bool s_maint_dirty = true;
+static auto s_maint_deadline = std::chrono::steady_clock::time_point::max();
+
+static std::vector<std::pair<void (*)(void*), void*>> s_cache_listeners;
+
+static void arm_maintenance_deadline(std::chrono::steady_clock::time_point tp) {
+  s_maint_deadline = std::min(s_maint_deadline, tp);
+}
+
+static void mark_maintenance_dirty() {
+  s_maint_dirty = true;
+  for (auto& [fn, userdata] : s_cache_listeners) fn(userdata);
+}
+
+// Reads an a{sv} property dict, keeping the properties we track.
+static int read_iface_props(sd_bus_message* m, CachedIface* out) {
+  int r = sd_bus_message_enter_container(m, 'a', "{sv}");
+  if (r < 0) return r;
+
+  while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+    const char* prop = nullptr;
+    r = sd_bus_message_read(m, "s", &prop);
+    if (r < 0) return r;
+
+    char vt;
+    const char* vtsig = nullptr;
+    r = sd_bus_message_peek_type(m, &vt, &vtsig);
+    if (r < 0) return r;
+
+    if (vtsig && std::strcmp(vtsig, "s") == 0) {
+      r = sd_bus_message_enter_container(m, 'v', "s");
+      if (r < 0) return r;
+      const char* sval = nullptr;
+      r = sd_bus_message_read_basic(m, 's', &sval);
+      if (r < 0) return r;
+      r = sd_bus_message_exit_container(m);
+      if (r < 0) return r;
+
+      if (prop && std::strcmp(prop, "Name") == 0) {
+        out->name = sval ? std::string(sval) : std::string();
+        DBG << "[dbg]       Name=" << *out->name << "\n";
+      } else if (prop && std::strcmp(prop, "UUID") == 0) {
+        std::string u = sval ? std::string(sval) : std::string();
+        out->uuid = to_lower_uuid(std::move(u));
+        DBG << "[dbg]       UUID=" << *out->uuid << "\n";
+      } else if (prop && std::strcmp(prop, "Address") == 0) {
+        out->address = sval ? std::string(sval) : std::string();
+      }
+    } else if (vtsig && std::strcmp(vtsig, "b") == 0) {
+      r = sd_bus_message_enter_container(m, 'v', "b");
+      if (r < 0) return r;
+      int bval = 0;
+      r = sd_bus_message_read_basic(m, 'b', &bval);
+      if (r < 0) return r;
+      r = sd_bus_message_exit_container(m);
+      if (r < 0) return r;
+
+      if (prop && std::strcmp(prop, "Connected") == 0) {
+        out->connected = bval != 0;
+      } else if (prop && std::strcmp(prop, "ServicesResolved") == 0) {
+        out->services_resolved = bval != 0;
+      } else if (prop && std::strcmp(prop, "Notifying") == 0) {
+        out->notifying = bval != 0;
+      }
+    } else {
+      r = sd_bus_message_skip(m, "v");
+      if (r < 0) return r;
+    }
+
+    r = sd_bus_message_exit_container(m); // end {sv}
+    if (r < 0) return r;
+  }
+  if (r < 0) return r;
+
+  return sd_bus_message_exit_container(m); // end a{sv}
+}
+
+// Reads the a{sa{sv}} interface map of one object into the cache.
+static int read_object_ifaces(sd_bus_message* m, const char* obj_path, bool snapshot) {
+  int r = sd_bus_message_enter_container(m, 'a', "{sa{sv}}");
+  if (r < 0) return r;
+
+  CachedObject& obj = s_cache.objects[obj_path ? obj_path : ""];
+  while ((r = sd_bus_message_enter_container(m, 'e', "sa{sv}")) > 0) {
+    const char* iface = nullptr;
+    r = sd_bus_message_read_basic(m, 's', &iface);
+    if (r < 0) return r;
+
+    CachedIface entry;
+    r = read_iface_props(m, &entry);
+    if (r < 0) return r;
+    if (g_trace_record) trace_object(obj_path ? obj_path : "", iface ? iface : "", entry, snapshot);
+    obj[iface ? iface : ""] = std::move(entry);
+
+    r = sd_bus_message_exit_container(m); // end (sa{sv})
+    if (r < 0) return r;
+  }
+  if (r < 0) return r;
+
+  return sd_bus_message_exit_container(m); // end a of interfaces
+}
+
+static void load_managed_objects(sd_bus* bus) {
   sd_bus_message* m = nullptr;
   sd_bus_message* reply = nullptr;
 
@@ -82,11 +192,15 @@ static std::vector<ManagedObjectsEntry> get_managed_objects(sd_bus* bus) {
     std::string(kObjManager).c_str(), "GetManagedObjects");
   if (r < 0) die("sd_bus_message_new_method_call(GetManagedObjects)", r);
 
+  uint64_t t0 = metrics_now_ns();
+  if (g_trace_record) trace_call_begin("/", "GetManagedObjects", t0);
   r = sd_bus_call(bus, m, 0, nullptr, &reply);
+  metrics_since(Metric::CallGetManagedObjects, t0);
   sd_bus_message_unref(m);
+  if (g_trace_record) trace_call_end("/", "GetManagedObjects", t0, trace_call_error(r, nullptr));
   if (r < 0) die("sd_bus_call(GetManagedObjects)", r);
 
-  std::vector<ManagedObjectsEntry> out;
+  s_cache.objects.clear();
 
   // Signature: a{oa{sa{sv}}}
   r = sd_bus_message_enter_container(reply, 'a', "{oa{sa{sv}}}");
@@ -98,68 +212,8 @@ static std::vector<ManagedObjectsEntry> get_managed_objects(sd_bus* bus) {
     if (r < 0) die("read object path", r);
     DBG << "[dbg] MO obj: " << (obj_path ? obj_path : "(null)") << "\n";
 
-    r = sd_bus_message_enter_container(reply, 'a', "{sa{sv}}");
-    if (r < 0) die("enter a of interfaces", r);
-
-    while ((r = sd_bus_message_enter_container(reply, 'e', "sa{sv}")) > 0) {
-      const char* iface = nullptr;
-      r = sd_bus_message_read_basic(reply, 's', &iface);
-      if (r < 0) die("read interface name", r);
-
-      r = sd_bus_message_enter_container(reply, 'a', "{sv}");
-      if (r < 0) die("enter a{sv}", r);
-
-      ManagedObjectsEntry entry;
-      entry.path = obj_path ? obj_path : "";
-      entry.interface = iface ? iface : "";
-
-      while ((r = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
-        const char* prop = nullptr;
-        r = sd_bus_message_read(reply, "s", &prop);
-        if (r < 0) die("read property name", r);
-
-        char vt;
-        const char* vtsig = nullptr;
-        r = sd_bus_message_peek_type(reply, &vt, &vtsig);
-        if (r < 0) die("peek variant type", r);
-
-        if (vtsig && std::strcmp(vtsig, "s") == 0) {
-          r = sd_bus_message_enter_container(reply, 'v', "s");
-          if (r < 0) die("enter v(s)", r);
-          const char* sval = nullptr;
-          r = sd_bus_message_read_basic(reply, 's', &sval);
-          if (r < 0) die("read v.s", r);
-          r = sd_bus_message_exit_container(reply);
-          if (r < 0) die("exit v(s)", r);
-
-          if (prop && std::strcmp(prop, "Name") == 0) {
-            entry.name = sval ? std::string(sval) : std::string();
-            DBG << "[dbg]       Name=" << *entry.name << "\n";
-          } else if (prop && std::strcmp(prop, "UUID") == 0) {
-            std::string u = sval ? std::string(sval) : std::string();
-            entry.uuid = to_lower_uuid(std::move(u));
-            DBG << "[dbg]       UUID=" << *entry.uuid << "\n";
-          }
-        } else {
-          r = sd_bus_message_skip(reply, "v");
-          if (r < 0) die("skip variant", r);
-        }
-
-        r = sd_bus_message_exit_container(reply); // end {sv}
-        if (r < 0) die("exit {sv}", r);
-      }
-
-      r = sd_bus_message_exit_container(reply); // end a{sv}
-      if (r < 0) die("exit a{sv}", r);
-
-      out.push_back(std::move(entry));
-
-      r = sd_bus_message_exit_container(reply); // end (sa{sv})
-      if (r < 0) die("exit (sa{sv})", r);
-    }
-
-    r = sd_bus_message_exit_container(reply); // end a of interfaces
-    if (r < 0) die("exit a of interfaces", r);
+    r = read_object_ifaces(reply, obj_path, true);
+    if (r < 0) die("read object interfaces", r);
 
     r = sd_bus_message_exit_container(reply); // end dict entry
     if (r < 0) die("exit dict entry", r);
@@ -171,36 +225,231 @@ static std::vector<ManagedObjectsEntry> get_managed_objects(sd_bus* bus) {
   if (r < 0) die("exit outer array", r);
 
   sd_bus_message_unref(reply);
-  DBG << "[dbg] GetManagedObjects -> " << out.size() << " iface entries\n";
-  return out;
+  DBG << "[dbg] GetManagedObjects -> " << s_cache.objects.size() << " objects\n";
+}
+
+static int interfaces_added_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  const char* obj_path = nullptr;
+  int r = sd_bus_message_read_basic(m, 'o', &obj_path);
+  if (r < 0) return 0;
+  DBG << "[dbg] InterfacesAdded: " << (obj_path ? obj_path : "(null)") << "\n";
+  r = read_object_ifaces(m, obj_path, false);
+  if (r < 0) DBG << "[dbg] InterfacesAdded parse error: " << -r << "\n";
+  mark_maintenance_dirty();
+  return 0;
+}
+
+static int interfaces_removed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  const char* obj_path = nullptr;
+  int r = sd_bus_message_read_basic(m, 'o', &obj_path);
+  if (r < 0 || !obj_path) return 0;
+  DBG << "[dbg] InterfacesRemoved: " << obj_path << "\n";
+
+  auto it = s_cache.objects.find(std::string_view(obj_path));
+  if (it == s_cache.objects.end()) return 0;
+
+  r = sd_bus_message_enter_container(m, 'a', "s");
+  if (r < 0) return 0;
+  const char* iface = nullptr;
+  while ((r = sd_bus_message_read_basic(m, 's', &iface)) > 0) {
+    if (!iface) continue;
+    if (g_trace_record) trace_removed(obj_path, iface);
+    auto entry = it->second.find(std::string_view(iface));
+    if (entry != it->second.end()) it->second.erase(entry);
+  }
+  sd_bus_message_exit_container(m);
+  if (it->second.empty()) s_cache.objects.erase(it);
+  mark_maintenance_dirty();
+  return 0;
+}
+
+// Device1 names may only show up after the object was announced; Connected
+// and ServicesResolved drive event-mode maintenance.
+static int device_props_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  const char* obj_path = sd_bus_message_get_path(m);
+  const char* iface = nullptr;
+  int r = sd_bus_message_read(m, "s", &iface);
+  if (r < 0 || !obj_path || !iface) return 0;
+
+  auto obj = s_cache.objects.find(std::string_view(obj_path));
+  if (obj == s_cache.objects.end()) return 0;
+  auto entry = obj->second.find(std::string_view(iface));
+  if (entry == obj->second.end()) return 0;
+
+  CachedIface changed;
+  r = read_iface_props(m, &changed);
+  if (r < 0) return 0;
+  if (g_trace_record) trace_props(obj_path, iface, changed);
+  if (changed.name) entry->second.name = std::move(changed.name);
+  if (changed.uuid) entry->second.uuid = std::move(changed.uuid);
+  if (changed.address) entry->second.address = std::move(changed.address);
+  if (changed.connected && changed.connected != entry->second.connected) {
+    DBG << "[dbg] " << obj_path << " Connected=" << *changed.connected << "\n";
+    entry->second.connected = changed.connected;
+    mark_maintenance_dirty();
+  }
+  if (changed.services_resolved &&
+      changed.services_resolved != entry->second.services_resolved) {
+    DBG << "[dbg] " << obj_path << " ServicesResolved=" << *changed.services_resolved << "\n";
+    entry->second.services_resolved = changed.services_resolved;
+    mark_maintenance_dirty();
+  }
+  if (changed.name) mark_maintenance_dirty();
+  return 0;
+}
+
+// Installs the ObjectManager matches and loads the initial snapshot on first
+// use, then applies any queued signals before a lookup is answered.
+static void sync_object_cache(sd_bus* bus) {
+  if (!s_cache.loaded || s_cache.bus != bus) {
+    if (s_cache.added_slot) s_cache.added_slot = sd_bus_slot_unref(s_cache.added_slot);
+    if (s_cache.removed_slot) s_cache.removed_slot = sd_bus_slot_unref(s_cache.removed_slot);
+    if (s_cache.props_slot) s_cache.props_slot = sd_bus_slot_unref(s_cache.props_slot);
+    s_cache.bus = bus;
+
+    // Matches go in before the snapshot so no change can slip in between.
+    std::string om_match =
+      "type='signal',sender='org.bluez',path='/',"
+      "interface='org.freedesktop.DBus.ObjectManager',";
+    int r = sd_bus_add_match(bus, &s_cache.added_slot,
+                             (om_match + "member='InterfacesAdded'").c_str(),
+                             interfaces_added_cb, nullptr);
+    if (r < 0) die("sd_bus_add_match(InterfacesAdded)", r);
+    r = sd_bus_add_match(bus, &s_cache.removed_slot,
+                         (om_match + "member='InterfacesRemoved'").c_str(),
+                         interfaces_removed_cb, nullptr);
+    if (r < 0) die("sd_bus_add_match(InterfacesRemoved)", r);
+    r = sd_bus_add_match(bus, &s_cache.props_slot,
+                         "type='signal',sender='org.bluez',"
+                         "interface='org.freedesktop.DBus.Properties',"
+                         "member='PropertiesChanged',arg0='org.bluez.Device1'",
+                         device_props_cb, nullptr);
+    if (r < 0) die("sd_bus_add_match(Device1 PropertiesChanged)", r);
+
+    load_managed_objects(bus);
+    s_cache.loaded = true;
+  }
+
+  // Dispatch whatever is queued. A bus attached to an sd_event loop (--async)
+  // is dispatched by that loop; processing it here would re-enter it.
+  if (sd_bus_get_event(bus)) return;
+  while (sd_bus_process(bus, nullptr) > 0) {}
+}
+
+static std::optional<bool> cached_flag(const std::string& path, std::string_view iface,
+                                       std::optional<bool> CachedIface::*field) {
+  auto obj = s_cache.objects.find(path);
+  if (obj == s_cache.objects.end()) return std::nullopt;
+  auto entry = obj->second.find(iface);
+  if (entry == obj->second.end()) return std::nullopt;
+  return entry->second.*field;
 }
 
 // ---- Public helpers ----
+void object_cache_sync(sd_bus* bus) { sync_object_cache(bus); }
+
+void add_object_cache_listener(void (*fn)(void*), void* userdata) {
+  s_cache_listeners.emplace_back(fn, userdata);
+}
+
+void remove_object_cache_listener(void (*fn)(void*), void* userdata) {
+  std::erase(s_cache_listeners, std::make_pair(fn, userdata));
+}
+
+std::optional<bool> cached_device_connected(const std::string& dev_path) {
+  return cached_flag(dev_path, kDevice1, &CachedIface::connected);
+}
+
+std::optional<bool> cached_services_resolved(const std::string& dev_path) {
+  return cached_flag(dev_path, kDevice1, &CachedIface::services_resolved);
+}
+
+std::optional<bool> cached_char_notifying(const std::string& char_path) {
+  return cached_flag(char_path, kGattChar1, &CachedIface::notifying);
+}
+
 std::optional<FoundDev> find_any_device_by_names(sd_bus* bus,
                                                  const std::vector<std::string_view>& names) {
-  auto objs = get_managed_objects(bus);
-  for (const auto& e : objs) {
-    if (e.interface == kDevice1 && e.name) {
-      for (auto n : names) {
-        if (*e.name == n) return FoundDev{e.path, std::string(n)};
+  sync_object_cache(bus);
+  for (auto n : names) {
+    for (const auto& [path, ifaces] : s_cache.objects) {
+      auto dev = ifaces.find(kDevice1);
+      if (dev != ifaces.end() && dev->second.name && *dev->second.name == n) {
+        return FoundDev{path, std::string(n)};
       }
     }
   }
   return std::nullopt;
 }
 
+static bool address_equal(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower((unsigned char)x) == std::tolower((unsigned char)y);
+         });
+}
+
+std::string device_address_from_path(std::string_view path) {
+  auto pos = path.rfind("/dev_");
+  if (pos == std::string_view::npos) return {};
+  std::string addr(path.substr(pos + 5));
+  std::replace(addr.begin(), addr.end(), '_', ':');
+  return addr;
+}
+
+std::optional<FoundDev> find_device(sd_bus* bus,
+                                    const std::vector<std::string_view>& keys,
+                                    const std::vector<std::string>& adapters,
+                                    std::string_view preferred_adapter) {
+  sync_object_cache(bus);
+  auto adapter_of = [&](const std::string& path) -> std::string_view {
+    for (const auto& a : adapters) {
+      if (path.size() > a.size() && path.compare(0, a.size(), a) == 0 && path[a.size()] == '/')
+        return a;
+    }
+    return {};
+  };
+  for (auto key : keys) {
+    std::optional<FoundDev> other;
+    for (const auto& [path, ifaces] : s_cache.objects) {
+      auto dev = ifaces.find(kDevice1);
+      if (dev == ifaces.end()) continue;
+      bool hit = (dev->second.name && *dev->second.name == key) ||
+                 (dev->second.address && address_equal(*dev->second.address, key));
+      if (!hit) continue;
+      std::string_view adapter = adapter_of(path);
+      if (adapter.empty()) continue;
+      if (adapter == preferred_adapter) return FoundDev{path, std::string(key)};
+      if (!other) other = FoundDev{path, std::string(key)};
+    }
+    if (other) return other;
+  }
+  return std::nullopt;
+}
+
 int call_void(sd_bus* bus, const std::string& path,
               std::string_view iface, std::string_view method,
               std::string* out_err_name,
               std::string* out_err_msg) {
   sd_bus_error error = SD_BUS_ERROR_NULL;
   sd_bus_message* reply = nullptr;
+  uint64_t t0 = metrics_now_ns();
+  if (g_trace_record) trace_call_begin(path, method, t0);
   int r = sd_bus_call_method(bus,
     std::string(kBluezService).c_str(),
     path.c_str(),
     std::string(iface).c_str(),
     std::string(method).data(),
     &error, &reply, "");
+  metrics_since(metrics_call_metric(method), t0);
+  if (g_trace_record)
+    trace_call_end(path, method, t0, trace_call_error(r, error.name));
   if (r < 0) {
     if (out_err_name) *out_err_name = error.name ? error.name : "";
     if (out_err_msg) *out_err_msg = error.message ? error.message : "";
@@ -230,7 +479,9 @@ bool get_device_connected(sd_bus* bus, const std::string& dev_path) {
     "Connected");
   if (r < 0) die("append Get args", r);
 
+  uint64_t t0 = metrics_now_ns();
   r = sd_bus_call(bus, m, 0, nullptr, &reply);
+  metrics_since(Metric::CallGet, t0);
   sd_bus_message_unref(m);
   if (r < 0) return false;
 
@@ -250,13 +501,14 @@ std::optional<std::string> find_char_by_uuid(sd_bus* bus,
                                              const std::string& dev_path,
                                              std::string_view uuid) {
   std::string needle = to_lower_uuid(std::string(uuid));
-  auto objs = get_managed_objects(bus);
-  for (const auto& e : objs) {
-    if (e.interface == kGattChar1) {
-      if (e.path.rfind(dev_path, 0) == 0 && e.uuid && *e.uuid == needle) {
-        DBG << "[dbg] Found characteristic " << needle << " at: " << e.path << "\n";
-        return e.path;
-      }
+  sync_object_cache(bus);
+  // Paths are ordered, so the device's GATT objects form one contiguous run.
+  for (auto it = s_cache.objects.lower_bound(dev_path);
+       it != s_cache.objects.end() && it->first.rfind(dev_path, 0) == 0; ++it) {
+    auto ch = it->second.find(kGattChar1);
+    if (ch != it->second.end() && ch->second.uuid && *ch->second.uuid == needle) {
+      DBG << "[dbg] Found characteristic " << needle << " at: " << it->first << "\n";
+      return it->first;
     }
   }
   return std::nullopt;
@@ -283,7 +535,9 @@ std::optional<bool> get_char_notifying(sd_bus* bus, const std::string& char_path
     "Notifying");
   if (r < 0) { sd_bus_message_unref(m); return std::nullopt; }
 
+  uint64_t t0 = metrics_now_ns();
   r = sd_bus_call(bus, m, 0, nullptr, &reply);
+  metrics_since(Metric::CallGet, t0);
   sd_bus_message_unref(m);
   if (r < 0) return std::nullopt;
 
@@ -300,18 +554,16 @@ std::optional<bool> get_char_notifying(sd_bus* bus, const std::string& char_path
 }
 
 bool path_has_interface(sd_bus* bus, const std::string& path, std::string_view iface) {
-  auto objs = get_managed_objects(bus);
-  for (const auto& e : objs) {
-    if (e.path == path && e.interface == iface) return true;
-  }
-  return false;
+  sync_object_cache(bus);
+  auto it = s_cache.objects.find(path);
+  return it != s_cache.objects.end() && it->second.count(iface) > 0;
 }
 
-int start_adapter_discovery(sd_bus* bus) {
-  return call_void(bus, std::string(kAdapterPath), kAdapter1, "StartDiscovery");
+int start_adapter_discovery(sd_bus* bus, std::string_view adapter) {
+  return call_void(bus, std::string(adapter), kAdapter1, "StartDiscovery");
 }
-int stop_adapter_discovery(sd_bus* bus) {
-  return call_void(bus, std::string(kAdapterPath), kAdapter1, "StopDiscovery");
+int stop_adapter_discovery(sd_bus* bus, std::string_view adapter) {
+  return call_void(bus, std::string(adapter), kAdapter1, "StopDiscovery");
 }
 
 std::optional<std::string> reacquire_device(sd_bus* bus,
@@ -333,6 +585,62 @@ std::optional<std::string> reacquire_device(sd_bus* bus,
   return dev ? std::optional<std::string>(dev->path) : std::nullopt;
 }
 
+// Legacy single-device matches pass no userdata and share this source.
+static HrmSource s_default_source;
+
+const HrmSource& hrm_default_source() { return s_default_source; }
+
+// --transport fd: the AcquireNotify socket for s_default_source.
+static int s_notify_fd = -1;
+static bool s_notify_fd_refused = false;
+
+static void close_default_notify_fd() {
+  if (s_notify_fd < 0) return;
+  close(s_notify_fd);
+  s_notify_fd = -1;
+}
+
+bool acquire_notify_default(sd_bus* bus, const std::string& char_path) {
+  if (!g_notify_fd || s_notify_fd_refused) return false;
+  close_default_notify_fd();
+  uint16_t mtu = 0;
+  std::string err_name;
+  int fd = acquire_notify(bus, char_path, &mtu, &err_name);
+  if (fd < 0) {
+    ERR << "[warn] AcquireNotify failed (" << err_name << "); using StartNotify.\n";
+    s_notify_fd_refused = true;
+    return false;
+  }
+  s_notify_fd = fd;
+  ERR << "[info] AcquireNotify ok (MTU " << mtu << ").\n";
+  return true;
+}
+
+int default_notify_fd() { return s_notify_fd; }
+
+void default_notify_fd_ready() {
+  if (s_notify_fd < 0 || notify_fd_read(s_notify_fd, &s_default_source) >= 0) return;
+  ERR << "[warn] Notification socket closed.\n";
+  close_default_notify_fd();
+  hrm_source_down(&s_default_source);
+  mark_maintenance_dirty();
+}
+
+static void install_value_match(sd_bus* bus, const std::string& ch_path, sd_bus_slot*& slot) {
+  if (slot) slot = sd_bus_slot_unref(slot);
+  std::string match =
+    "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties',"
+    "member='PropertiesChanged',path='" + ch_path + "'";
+  int r = sd_bus_add_match(bus, &slot, match.c_str(), props_changed_cb, nullptr);
+  if (r < 0) die("sd_bus_add_match(PropertiesChanged re-add)", r);
+  DBG << "[dbg] Reinstalled HR Value match for " << ch_path << " (slot=" << (void*)slot << ")\n";
+}
+
+void hrm_source_down(HrmSource* src) {
+  if (src->last_notify_ns && !src->down_since_ns) src->down_since_ns = metrics_now_ns();
+  src->stall.on_down();
+}
+
 void ensure_connected_and_notifying(sd_bus* bus,
                                     std::string& dev_path,
                                     std::string& ch_path,
@@ -342,32 +650,99 @@ void ensure_connected_and_notifying(sd_bus* bus,
   static auto next_reacquire_attempt = std::chrono::steady_clock::time_point::min();
   static auto next_connect_attempt = std::chrono::steady_clock::time_point::min();
   static int connect_failures = 0;
+  // Event mode only: pending discovery / Connect() completion windows.
+  static auto discovery_until = std::chrono::steady_clock::time_point::min();
+  static auto connect_wait_until = std::chrono::steady_clock::time_point::min();
 
+  const bool event = g_event_maintenance;
   auto now = std::chrono::steady_clock::now();
   if (dev_path.empty() || !path_has_interface(bus, dev_path, kDevice1)) {
-    if (now < next_reacquire_attempt) return;
-    ERR << "[warn] Device path missing; attempting reacquire...\n";
-    auto np = reacquire_device(bus, names);
-    if (np) {
-      dev_path = *np;
+    hrm_source_down(&s_default_source);
+    if (event) {
+      // Discovery runs in the background; InterfacesAdded wakes us up.
+      auto dev = find_any_device_by_names(bus, names);
+      if (!dev) {
+        if (discovery_until == std::chrono::steady_clock::time_point::min()) {
+          if (now < next_reacquire_attempt) {
+            arm_maintenance_deadline(next_reacquire_attempt);
+            return;
+          }
+          ERR << "[warn] Device path missing; scanning for it...\n";
+          if (start_adapter_discovery(bus) < 0)
+            ERR << "[warn] StartDiscovery failed while reacquiring\n";
+          discovery_until = now + 15s;
+        } else if (now >= discovery_until) {
+          stop_adapter_discovery(bus);
+          discovery_until = std::chrono::steady_clock::time_point::min();
+          ERR << "[warn] Device still not present.\n";
+          next_reacquire_attempt = now + 10s;
+          arm_maintenance_deadline(next_reacquire_attempt);
+          return;
+        }
+        arm_maintenance_deadline(discovery_until);
+        return;
+      }
+      if (discovery_until != std::chrono::steady_clock::time_point::min()) {
+        stop_adapter_discovery(bus);
+        discovery_until = std::chrono::steady_clock::time_point::min();
+      }
+      dev_path = dev->path;
       ERR << "[info] Reacquired device path: " << dev_path << "\n";
       next_reacquire_attempt = now;
       connect_failures = 0;
     } else {
-      ERR << "[warn] Device still not present.\n";
-      next_reacquire_attempt = now + 10s;
+      if (now < next_reacquire_attempt) return;
+      ERR << "[warn] Device path missing; attempting reacquire...\n";
+      auto np = reacquire_device(bus, names);
+      if (np) {
+        dev_path = *np;
+        ERR << "[info] Reacquired device path: " << dev_path << "\n";
+        next_reacquire_attempt = now;
+        connect_failures = 0;
+      } else {
+        ERR << "[warn] Device still not present.\n";
+        next_reacquire_attempt = now + 10s;
+        return;
+      }
+    }
+  }
+
+  bool connected = false;
+  if (event) {
+    auto c = cached_flag(dev_path, kDevice1, &CachedIface::connected);
+    connected = c.has_value() ? *c : get_device_connected(bus, dev_path);
+  } else {
+    connected = get_device_connected(bus, dev_path);
+  }
+
+  if (!connected && event &&
+      connect_wait_until != std::chrono::steady_clock::time_point::min()) {
+    // Connect() returned; wait for Connected=true instead of polling.
+    if (now < connect_wait_until) {
+      arm_maintenance_deadline(connect_wait_until);
       return;
     }
+    ERR << "[warn] Connect timeout in maintenance.\n";
+    connect_wait_until = std::chrono::steady_clock::time_point::min();
+    connect_failures++;
+    next_connect_attempt = now + 5s;
+    arm_maintenance_deadline(next_connect_attempt);
+    return;
   }
 
-  if (!get_device_connected(bus, dev_path)) {
-    if (now < next_connect_attempt) return;
+  if (!connected) {
+    hrm_source_down(&s_default_source);
+    if (now < next_connect_attempt) {
+      if (event) arm_maintenance_deadline(next_connect_attempt);
+      return;
+    }
     ERR << "[info] Connecting (maintenance)...\n";
     std::string err_name;
     if (call_void(bus, dev_path, kDevice1, "Connect", &err_name, nullptr) < 0) {
       ERR << "[warn] Connect() failed in maintenance.\n";
       if (err_name == "org.bluez.Error.InProgress") {
         next_connect_attempt = now + 3s;
+        if (event) arm_maintenance_deadline(next_connect_attempt);
         return;
       }
       connect_failures++;
@@ -377,51 +752,87 @@ void ensure_connected_and_notifying(sd_bus* bus,
         backoff = std::max(backoff, 5s);
       }
       next_connect_attempt = now + backoff;
+      if (event) arm_maintenance_deadline(next_connect_attempt);
       return;
     }
 
-    auto deadline = std::chrono::steady_clock::now() + 20s;
-    while (std::chrono::steady_clock::now() < deadline) {
-      if (get_device_connected(bus, dev_path)) break;
-      std::this_thread::sleep_for(500ms);
-    }
-    if (!get_device_connected(bus, dev_path)) {
-      ERR << "[warn] Connect timeout in maintenance.\n";
-      connect_failures++;
-      next_connect_attempt = std::chrono::steady_clock::now() + 5s;
-      return;
+    if (event) {
+      auto c = cached_flag(dev_path, kDevice1, &CachedIface::connected);
+      if (!c.value_or(false)) {
+        connect_wait_until = std::chrono::steady_clock::now() + 20s;
+        arm_maintenance_deadline(connect_wait_until);
+        return;
+      }
+    } else {
+      auto deadline = std::chrono::steady_clock::now() + 20s;
+      while (std::chrono::steady_clock::now() < deadline) {
+        if (get_device_connected(bus, dev_path)) break;
+        std::this_thread::sleep_for(500ms);
+      }
+      if (!get_device_connected(bus, dev_path)) {
+        ERR << "[warn] Connect timeout in maintenance.\n";
+        connect_failures++;
+        next_connect_attempt = std::chrono::steady_clock::now() + 5s;
+        return;
+      }
     }
     ERR << "[info] Connected (maintenance).\n";
     connect_failures = 0;
     next_connect_attempt = std::chrono::steady_clock::now();
+  } else if (connect_wait_until != std::chrono::steady_clock::time_point::min()) {
+    ERR << "[info] Connected (maintenance).\n";
+    connect_wait_until = std::chrono::steady_clock::time_point::min();
+    connect_failures = 0;
+    next_connect_attempt = now;
   }
 
   if (ch_path.empty() || !path_has_interface(bus, ch_path, kGattChar1)) {
     auto np = find_char_by_uuid(bus, dev_path, kHRCharUUID);
     if (!np) {
-      ERR << "[warn] HR characteristic not present yet.\n";
+      if (event) {
+        // GATT objects show up with ServicesResolved / InterfacesAdded.
+        auto resolved = cached_flag(dev_path, kDevice1, &CachedIface::services_resolved);
+        ERR << "[warn] HR characteristic not present yet"
+            << (resolved.value_or(false) ? "" : " (services not resolved)") << ".\n";
+      } else {
+        ERR << "[warn] HR characteristic not present yet.\n";
+      }
       return;
     }
     if (*np != ch_path) {
       ERR << "[info] HR characteristic path changed -> " << *np << "\n";
-      if (slot) { sd_bus_slot_unref(slot); slot = nullptr; }
+      if (slot) slot = sd_bus_slot_unref(slot);
+      close_default_notify_fd();
       ch_path = *np;
-      std::string match =
-        "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties',"
-        "member='PropertiesChanged',path='" + ch_path + "'";
-      int r = sd_bus_add_match(bus, &slot, match.c_str(), props_changed_cb, nullptr);
-      if (r < 0) die("sd_bus_add_match(PropertiesChanged re-add)", r);
-      DBG << "[dbg] Reinstalled HR Value match for " << ch_path << " (slot=" << (void*)slot << ")\n";
+      if (!g_notify_fd || s_notify_fd_refused) install_value_match(bus, ch_path, slot);
     }
   }
 
+  if (!ch_path.empty() && s_notify_fd >= 0) {
+    DBG << "[dbg] notification socket open\n";
+    return;
+  }
+  if (!ch_path.empty() && g_notify_fd && !s_notify_fd_refused) {
+    hrm_source_down(&s_default_source);
+    ERR << "[info] No notification socket. Calling AcquireNotify...\n";
+    if (acquire_notify_default(bus, ch_path)) {
+      if (slot) slot = sd_bus_slot_unref(slot);
+      return;
+    }
+  }
+  if (!ch_path.empty() && !slot) install_value_match(bus, ch_path, slot);
+
   if (!ch_path.empty()) {
-    auto n = get_char_notifying(bus, ch_path);
+    auto n = event ? cached_flag(ch_path, kGattChar1, &CachedIface::notifying)
+                   : std::optional<bool>();
+    if (!n.has_value()) n = get_char_notifying(bus, ch_path);
     if (!n.has_value() || !*n) {
+      hrm_source_down(&s_default_source);
       ERR << "[info] Notifying=false (or unknown). Calling StartNotify...\n";
       int r = start_notify(bus, ch_path);
       if (r < 0) {
         ERR << "[warn] StartNotify failed in maintenance.\n";
+        if (event) arm_maintenance_deadline(std::chrono::steady_clock::now() + 1s);
       } else {
         ERR << "[info] StartNotify ok (maintenance).\n";
       }
@@ -431,10 +842,136 @@ void ensure_connected_and_notifying(sd_bus* bus,
   }
 }
 
+uint64_t maintain_on_events(sd_bus* bus,
+                            std::string& dev_path,
+                            std::string& ch_path,
+                            sd_bus_slot*& slot,
+                            const std::vector<std::string_view>& names) {
+  sync_object_cache(bus);
+  auto now = std::chrono::steady_clock::now();
+  if (s_maint_dirty || now >= s_maint_deadline) {
+    s_maint_dirty = false;
+    s_maint_deadline = std::chrono::steady_clock::time_point::max();
+    ensure_connected_and_notifying(bus, dev_path, ch_path, slot, names);
+    // Apply signals triggered by our own calls; they may ask for another pass.
+    sync_object_cache(bus);
+    now = std::chrono::steady_clock::now();
+  }
+  if (s_maint_dirty) return 0;
+  if (s_maint_deadline == std::chrono::steady_clock::time_point::max()) return UINT64_MAX;
+  if (s_maint_deadline <= now) return 0;
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    s_maint_deadline - now).count();
+}
+
+uint64_t stall_maintain(sd_bus* bus, std::string& dev_path, std::string& ch_path,
+                        sd_bus_slot*& slot) {
+  StallWatchdog& w = s_default_source.stall;
+  uint64_t now = metrics_now_ns();
+  uint64_t due = w.deadline_ns();
+  if (due == UINT64_MAX) return UINT64_MAX;
+  if (now < due) return (due - now) / 1000;
+
+  const bool event = g_event_maintenance;
+  bool up = !dev_path.empty() && !ch_path.empty();
+  if (up) {
+    auto c = event ? cached_flag(dev_path, kDevice1, &CachedIface::connected)
+                   : std::optional<bool>();
+    up = c.has_value() ? *c : get_device_connected(bus, dev_path);
+  }
+  if (up && s_notify_fd < 0) {
+    auto n = event ? cached_flag(ch_path, kGattChar1, &CachedIface::notifying)
+                   : std::optional<bool>();
+    if (!n.has_value()) n = get_char_notifying(bus, ch_path);
+    up = n.value_or(false);
+  }
+
+  switch (w.check(s_default_source.tag, now, up)) {
+    case StallAction::None:
+      break;
+    case StallAction::Resubscribe:
+      // Maintenance re-acquires the socket; StartNotify is redone here.
+      if (s_notify_fd >= 0) {
+        close_default_notify_fd();
+      } else {
+        call_void(bus, ch_path, kGattChar1, "StopNotify");
+        if (start_notify(bus, ch_path) < 0) ERR << "[warn] StartNotify failed (stall).\n";
+      }
+      break;
+    case StallAction::Reconnect:
+      close_default_notify_fd();
+      call_void(bus, dev_path, kDevice1, "Disconnect");
+      break;
+    case StallAction::Reacquire:
+      close_default_notify_fd();
+      call_void(bus, dev_path, kDevice1, "Disconnect");
+      if (slot) slot = sd_bus_slot_unref(slot);
+      dev_path.clear();
+      ch_path.clear();
+      break;
+  }
+  mark_maintenance_dirty();
+  due = w.deadline_ns();
+  now = metrics_now_ns();
+  return due == UINT64_MAX ? UINT64_MAX : due > now ? (due - now) / 1000 : 0;
+}
+
 // ---- HRM notification -> stdout ----
+void hrm_deliver(HrmSource* src, const HrmSample& sample, uint64_t notify_ns) {
+  if (g_health_warnings) {
+    static HealthWarningSink* s_health_sink = health_live_sink();
+    src->health.push((long long)sample.ts_ms, sample.bpm, sample.rr(), s_health_sink);
+    health_live_advance((long long)sample.ts_ms);
+  }
+  if (g_hrv.enabled()) {
+    if (!src->hrv.enabled()) src->hrv = HrvMonitor(g_hrv, src->tag);
+    src->hrv.push((long long)sample.ts_ms, sample.rr(), hrv_output());
+  }
+  output_sample(src->tag, sample);
+  metrics_since(Metric::NotifyToOutput, notify_ns);
+}
+
+void hrm_on_value(HrmSource* src, const uint8_t* data, size_t len,
+                  uint64_t notify_ns, uint64_t ts_ms) {
+  if (src->last_notify_ns) metrics_record(Metric::NotifyInterval, notify_ns - src->last_notify_ns);
+  if (src->down_since_ns) {
+    metrics_record(Metric::Reconnect, notify_ns - src->down_since_ns);
+    src->down_since_ns = 0;
+  }
+  src->last_notify_ns = notify_ns;
+  src->stall.on_notify(src->tag, notify_ns);
+
+  HrmSample sample;
+  if (hrm_parse(data, len, ts_ms, &sample)) {
+    DBG << "[dbg] HRM notify: flags=0x" << std::hex << (int)sample.flags << std::dec
+        << " hr16=" << ((sample.flags & 0x01) != 0)
+        << " ee=" << ((sample.flags & 0x08) != 0)
+        << " rr=" << ((sample.flags & 0x10) != 0)
+        << " bpm=" << sample.bpm
+        << " rr_count=" << (int)sample.rr_count
+        << " raw=[" << LogHex{data, len} << "]\n";
+  } else {
+    DBG << "[dbg] HRM notify: empty payload\n";
+  }
+
+  // Suppress duplicates on the parsed fields, then emit the line.
+  if (src->has_last && hrm_same_fields(sample, src->last)) {
+    ++src->suppressed;
+    DBG << "[dbg] duplicate sample suppressed (" << src->suppressed << "): ts="
+        << sample.ts_ms << "\n";
+  } else {
+    if (pipeline_running()) pipeline_submit(src, sample, notify_ns);
+    else hrm_deliver(src, sample, notify_ns);
+    src->last = sample;
+    src->has_last = true;
+  }
+}
+
 int props_changed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
   (void)ret_error;
-  (void)userdata;
+  // Stamp on arrival, before any of the message is read.
+  const uint64_t t0 = metrics_now_ns();
+  const uint64_t ts_ms = now_ms();
 
   const char* interface = nullptr;
   int r = sd_bus_message_read(m, "s", &interface);
@@ -444,9 +981,8 @@ int props_changed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error)
   r = sd_bus_message_enter_container(m, 'a', "{sv}");
   if (r < 0) return 0;
 
-  // Deduplication state (per-process, single-threaded loop)
-  static std::string s_last_line;
-  static uint64_t s_suppressed = 0;
+  // Deduplication state lives in the source (one per device).
+  HrmSource* src = userdata ? static_cast<HrmSource*>(userdata) : &s_default_source;
 
   while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
     const char* prop = nullptr;
@@ -461,88 +997,34 @@ int props_changed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error)
     if (prop && std::strcmp(prop, "Value") == 0 && vtsig && std::strcmp(vtsig, "ay") == 0) {
       r = sd_bus_message_enter_container(m, 'v', "ay");
       if (r < 0) break;
-      r = sd_bus_message_enter_container(m, 'a', "y");
+      // Bulk read: points into the message, no copy.
+      const void* data = nullptr;
+      size_t len = 0;
+      r = sd_bus_message_read_array(m, 'y', &data, &len);
       if (r < 0) break;
-
-      std::vector<uint8_t> bytes;
-      for (;;) {
-        uint8_t b = 0;
-        int rr = sd_bus_message_read_basic(m, 'y', &b);
-        if (rr <= 0) break;
-        bytes.push_back(b);
-      }
-      sd_bus_message_exit_container(m); // end array
       sd_bus_message_exit_container(m); // end variant
 
-      uint64_t t = now_ms();
-
-      // Parse Heart Rate Measurement
-      int bpm = -1;
-      std::vector<int> rr_ms;
-
-      if (!bytes.empty()) {
-        uint8_t flags = bytes[0];
-        size_t idx = 1;
-
-        bool hr_16bit   = (flags & 0x01) != 0;
-        bool ee_present = (flags & 0x08) != 0;
-        bool rr_present = (flags & 0x10) != 0;
-
-        if (hr_16bit) {
-          if (bytes.size() >= idx + 2) {
-            bpm = (int)bytes[idx] | ((int)bytes[idx + 1] << 8);
-            idx += 2;
-          }
-        } else if (bytes.size() >= idx + 1) {
-          bpm = bytes[idx];
-          idx += 1;
-        }
-
-        if (ee_present && bytes.size() >= idx + 2) idx += 2; // skip EE
-
-        if (rr_present) {
-          while (bytes.size() >= idx + 2) {
-            uint16_t rr1024 = (uint16_t)bytes[idx] | ((uint16_t)bytes[idx + 1] << 8);
-            idx += 2;
-            int rr_val_ms = (int)((rr1024 * 1000ULL + 512ULL) / 1024ULL);
-            rr_ms.push_back(rr_val_ms);
-          }
-        }
-
-        DBG << "[dbg] HRM notify: flags=0x" << std::hex << (int)flags << std::dec
-            << " hr16=" << hr_16bit
-            << " ee=" << ee_present
-            << " rr=" << rr_present
-            << " bpm=" << bpm
-            << " rr_count=" << rr_ms.size()
-            << " raw=[" << to_hex(bytes) << "]\n";
-      } else {
-        DBG << "[dbg] HRM notify: empty payload\n";
+      if (g_trace_record && sd_bus_message_get_path(m))
+        trace_value(sd_bus_message_get_path(m), static_cast<const uint8_t*>(data), len);
+      hrm_on_value(src, static_cast<const uint8_t*>(data), len, t0, ts_ms);
+    } else if (prop && std::strcmp(prop, "Notifying") == 0 && vtsig && std::strcmp(vtsig, "b") == 0) {
+      int notifying = 0;
+      r = sd_bus_message_read(m, "v", "b", &notifying);
+      if (r < 0) break;
+      DBG << "[dbg] HR Notifying=" << notifying << "\n";
+      const char* path = sd_bus_message_get_path(m);
+      if (g_trace_record && path) {
+        BluezProps changed;
+        changed.notifying = notifying != 0;
+        trace_props(path, kGattChar1, changed);
       }
-
-      // Build output line and suppress duplicates
-      std::ostringstream line_oss;
-      line_oss << t;
-      if (bpm >= 0) line_oss << "," << bpm;
-      for (int v : rr_ms) line_oss << "," << v;
-      std::string out = line_oss.str();
-
-      if (!s_last_line.empty() && out == s_last_line) {
-        ++s_suppressed;
-        DBG << "[dbg] duplicate line suppressed (" << s_suppressed << "): " << out << "\n";
-      } else {
-        if (g_health_warnings) {
-          if (bpm >= 0) {
-            health_check_bradycardia(bpm, t);
-            health_check_tachycardia(bpm, t);
-          }
-          if (!rr_ms.empty()) {
-            health_check_arrhythmia(rr_ms, t);
-          }
+      auto obj = path ? s_cache.objects.find(std::string_view(path)) : s_cache.objects.end();
+      if (obj != s_cache.objects.end()) {
+        auto entry = obj->second.find(kGattChar1);
+        if (entry != obj->second.end() && entry->second.notifying != (notifying != 0)) {
+          entry->second.notifying = notifying != 0;
+          mark_maintenance_dirty();
         }
-        std::cout << out << "\n";
-        std::cout.flush();
-        s_last_line = std::move(out);
       }
     } else {
       r = sd_bus_message_skip(m, "v");
@@ -552,5 +1034,6 @@ int props_changed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error)
   }
   sd_bus_message_exit_container(m); // end dict
   sd_bus_message_skip(m, "as");
+  metrics_since(Metric::Callback, t0);
   return 0;
 }
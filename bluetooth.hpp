@@ -6,6 +6,22 @@
 #include <vector>
 
 #include "debug.hpp"
+#include "feat_health.hpp"
+#include "hrm.hpp"
+#include "hrv.hpp"
+#include "stall.hpp"
+
+// --maintenance event: react to BlueZ signals instead of the 0.5s poll tick.
+extern bool g_event_maintenance;
+
+inline constexpr std::string_view kBluezService = "org.bluez";
+inline constexpr std::string_view kObjManager = "org.freedesktop.DBus.ObjectManager";
+inline constexpr std::string_view kProps = "org.freedesktop.DBus.Properties";
+inline constexpr std::string_view kGattChar1 = "org.bluez.GattCharacteristic1";
+inline constexpr std::string_view kDevice1 = "org.bluez.Device1";
+inline constexpr std::string_view kAdapter1 = "org.bluez.Adapter1";
+inline constexpr std::string_view kAdapterPath = "/org/bluez/hci0";
+inline constexpr std::string_view kHRCharUUID = "00002a37-0000-1000-8000-00805f9b34fb";
 
 struct Bus {
   sd_bus* bus{};
@@ -19,9 +35,44 @@ struct FoundDev {
   std::string name;
 };
 
+// Per-device output state handed to props_changed_cb as match userdata.
+struct HrmSource {
+  std::string tag;          // prefixed as "<tag> " to each line; empty = untagged
+  HrmSample last;           // duplicate suppression on parsed fields
+  bool has_last = false;
+  uint64_t suppressed = 0;
+  HealthMonitor health;     // --health-warnings detectors, source = tag
+  HrvMonitor hrv;           // --hrv windows, set up on the first sample
+  int lane = -1;            // --pipeline worker, assigned on the first sample
+  uint64_t last_notify_ns = 0;  // metrics: previous notification
+  uint64_t down_since_ns = 0;   // metrics: link lost after notifying, 0 if up
+  StallWatchdog stall;          // --stall-timeout
+};
+
+// Maintenance found the link disconnected or not notifying; the next
+// notification records the reconnect time. Only counts once samples flowed.
+void hrm_source_down(HrmSource* src);
+// What props_changed_cb uses for matches installed without userdata.
+const HrmSource& hrm_default_source();
+
+// --transport fd for the default source (notify_fd.hpp). acquire_notify_default
+// returns false, and StartNotify is used from then on, when BlueZ refuses.
+bool acquire_notify_default(sd_bus* bus, const std::string& char_path);
+int default_notify_fd();  // -1 unless acquired
+// Reads what is queued; on close marks the link down for maintenance.
+void default_notify_fd_ready();
+
 // Core BlueZ helpers
 std::optional<FoundDev> find_any_device_by_names(sd_bus* bus,
                                                  const std::vector<std::string_view>& names);
+// Matches advertised name or address (keys in priority order) among devices
+// under `adapters`, preferring the copy seen by `preferred_adapter`.
+std::optional<FoundDev> find_device(sd_bus* bus,
+                                    const std::vector<std::string_view>& keys,
+                                    const std::vector<std::string>& adapters,
+                                    std::string_view preferred_adapter);
+// "/org/bluez/hci0/dev_AA_BB_..." -> "AA:BB:..." (empty if not a device path).
+std::string device_address_from_path(std::string_view path);
 int call_void(sd_bus* bus, const std::string& path,
               std::string_view iface, std::string_view method,
               std::string* out_err_name = nullptr,
@@ -34,9 +85,20 @@ int start_notify(sd_bus* bus, const std::string& char_path);
 std::optional<bool> get_char_notifying(sd_bus* bus, const std::string& char_path);
 bool path_has_interface(sd_bus* bus, const std::string& path, std::string_view iface);
 
+// Object cache (loaded on first use, then kept current from BlueZ signals;
+// lookups dispatch queued signals unless the bus has an sd_event loop).
+// Listeners run whenever Connected/ServicesResolved/Notifying or the object
+// tree changes.
+void object_cache_sync(sd_bus* bus);
+void add_object_cache_listener(void (*fn)(void*), void* userdata);
+void remove_object_cache_listener(void (*fn)(void*), void* userdata);
+std::optional<bool> cached_device_connected(const std::string& dev_path);
+std::optional<bool> cached_services_resolved(const std::string& dev_path);
+std::optional<bool> cached_char_notifying(const std::string& char_path);
+
 // Discovery helpers
-int start_adapter_discovery(sd_bus* bus);
-int stop_adapter_discovery(sd_bus* bus);
+int start_adapter_discovery(sd_bus* bus, std::string_view adapter = kAdapterPath);
+int stop_adapter_discovery(sd_bus* bus, std::string_view adapter = kAdapterPath);
 
 // Maintenance
 std::optional<std::string> reacquire_device(sd_bus* bus,
@@ -46,6 +108,28 @@ void ensure_connected_and_notifying(sd_bus* bus,
                                     std::string& ch_path,
                                     sd_bus_slot*& slot,
                                     const std::vector<std::string_view>& names);
+// Event-mode maintenance step: runs ensure_connected_and_notifying() only when
+// Connected/ServicesResolved/Notifying or the object tree changed, or a retry
+// deadline expired. Returns the sd_bus_wait() timeout in usec.
+uint64_t maintain_on_events(sd_bus* bus,
+                            std::string& dev_path,
+                            std::string& ch_path,
+                            sd_bus_slot*& slot,
+                            const std::vector<std::string_view>& names);
+
+// --stall-timeout for the default loop: checks s_default_source's watchdog
+// and takes its recovery step with blocking calls (the paths and match are
+// updated for the next maintenance pass). Returns the wait timeout in usec.
+uint64_t stall_maintain(sd_bus* bus, std::string& dev_path, std::string& ch_path,
+                        sd_bus_slot*& slot);
 
-// HRM notification callback -> prints lines to stdout
+// One Heart Rate Measurement value from either transport: metrics, parse,
+// duplicate suppression, then the pipeline or hrm_deliver().
+void hrm_on_value(HrmSource* src, const uint8_t* data, size_t len,
+                  uint64_t notify_ns, uint64_t ts_ms);
+// HRM notification callback -> output stream (userdata: HrmSource*)
 int props_changed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error);
+// What happens to a new (non-duplicate) sample: health checks, HRV, output.
+// Runs in props_changed_cb, or on the strap's worker with --pipeline;
+// `notify_ns` is when the callback started (metrics_now_ns()).
+void hrm_deliver(HrmSource* src, const HrmSample& sample, uint64_t notify_ns);
@@ -0,0 +1,638 @@
+#include "bluetooth_async.hpp"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bluetooth.hpp"
+#include "metrics.hpp"
+#include "notify_fd.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "trace.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Re-check for the HR characteristic this often while it is missing.
+constexpr auto kCharRetry = 2s;
+
+// ---- per-device link state ----
+struct AsyncLink;
+using ReplyFn = void (*)(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err);
+
+struct AsyncLink {
+  sd_bus* bus{};
+  sd_event* event{};
+  std::vector<std::string> keys;
+  std::vector<std::string_view> key_views;
+  std::string adapter;         // preferred adapter for this device
+  HrmSource source;            // output tag + dedup, props_changed_cb userdata
+  std::string dev_path;
+  std::string ch_path;
+
+  sd_bus_slot* value_slot{};   // PropertiesChanged match on ch_path
+  int notify_fd = -1;          // --transport fd: AcquireNotify socket
+  sd_event_source* notify_io{};
+  bool notify_fd_refused = false;
+  sd_bus_slot* call_slot{};    // in-flight BlueZ method call, if any
+  std::string call_method;
+  std::string call_path;
+  ReplyFn on_reply{};
+  Metric call_metric = Metric::CallOther;
+  uint64_t call_start_ns = 0;
+
+  sd_event_source* timer{};    // single deadline timer (CLOCK_MONOTONIC)
+  sd_event_source* kick{};     // deferred maintenance pass
+  sd_event_source* stall_timer{};  // --stall-timeout check (CLOCK_MONOTONIC)
+  Clock::time_point deadline = Clock::time_point::max();
+
+  Clock::time_point next_reacquire_attempt = Clock::time_point::min();
+  Clock::time_point next_connect_attempt = Clock::time_point::min();
+  Clock::time_point next_notify_attempt = Clock::time_point::min();
+  Clock::time_point discovery_until = Clock::time_point::min();
+  Clock::time_point connect_wait_until = Clock::time_point::min();
+  int connect_failures = 0;
+  bool discovering = false;
+};
+
+static void maintain(AsyncLink* l);
+
+// ---- shared discovery ----
+// BlueZ tracks discovery per client, so links share one refcounted session
+// per adapter instead of issuing their own Start/StopDiscovery.
+struct DiscoveryRef {
+  std::string adapter;
+  int users = 0;
+};
+
+static sd_bus* s_bus = nullptr;
+static std::vector<DiscoveryRef> s_discovery;
+static std::vector<std::string> s_adapters;
+
+static int discovery_reply_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  if (sd_bus_message_is_method_error(m, nullptr)) {
+    const sd_bus_error* err = sd_bus_message_get_error(m);
+    ERR << "[warn] " << sd_bus_message_get_path(m) << " discovery: "
+        << (err && err->name ? err->name : "unknown") << "\n";
+  }
+  return 0;
+}
+
+static void discovery_call(const std::string& adapter, const char* method) {
+  int r = sd_bus_call_method_async(s_bus, nullptr,
+    std::string(kBluezService).c_str(), adapter.c_str(),
+    std::string(kAdapter1).c_str(), method,
+    discovery_reply_cb, nullptr, "");
+  if (r < 0) ERR << "[warn] " << method << " on " << adapter << ": " << strerror(-r) << "\n";
+  else DBG << "[dbg] " << method << " on " << adapter << "\n";
+}
+
+static void discovery_acquire() {
+  for (auto& d : s_discovery) {
+    if (d.users++ == 0) discovery_call(d.adapter, "StartDiscovery");
+  }
+}
+
+static void discovery_release() {
+  for (auto& d : s_discovery) {
+    if (d.users > 0 && --d.users == 0) discovery_call(d.adapter, "StopDiscovery");
+  }
+}
+
+static uint64_t to_usec(Clock::time_point tp) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    tp.time_since_epoch()).count();
+}
+
+static void schedule_kick(AsyncLink* l) {
+  sd_event_source_set_enabled(l->kick, SD_EVENT_ONESHOT);
+}
+
+static void arm(AsyncLink* l, Clock::time_point tp) {
+  if (tp >= l->deadline) return;
+  l->deadline = tp;
+  sd_event_source_set_time(l->timer, to_usec(tp));
+  sd_event_source_set_enabled(l->timer, SD_EVENT_ONESHOT);
+}
+
+static int kick_cb(sd_event_source* s, void* userdata) {
+  (void)s;
+  maintain(static_cast<AsyncLink*>(userdata));
+  return 0;
+}
+
+static int timer_cb(sd_event_source* s, uint64_t usec, void* userdata) {
+  (void)s;
+  (void)usec;
+  auto* l = static_cast<AsyncLink*>(userdata);
+  l->deadline = Clock::time_point::max();
+  maintain(l);
+  return 0;
+}
+
+static void cache_changed_cb(void* userdata) {
+  schedule_kick(static_cast<AsyncLink*>(userdata));
+}
+
+// ---- async BlueZ calls ----
+static int reply_trampoline(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)ret_error;
+  auto* l = static_cast<AsyncLink*>(userdata);
+  metrics_since(l->call_metric, l->call_start_ns);
+  ReplyFn fn = l->on_reply;
+  l->on_reply = nullptr;
+  l->call_slot = sd_bus_slot_unref(l->call_slot);
+
+  const sd_bus_error* err = sd_bus_message_is_method_error(m, nullptr)
+    ? sd_bus_message_get_error(m) : nullptr;
+  if (g_trace_record) {
+    std::string_view member = std::string_view(l->call_method).substr(l->call_method.rfind('.') + 1);
+    trace_call_end(l->call_path, member, l->call_start_ns,
+                   err ? (err->name ? err->name : "unknown") : "");
+  }
+  if (err) {
+    ERR << "[err] D-Bus: " << (err->name ? err->name : "unknown")
+        << " - " << (err->message ? err->message : "") << "\n";
+  } else {
+    DBG << "[dbg] async " << l->call_method << " -> ok\n";
+  }
+  if (fn) fn(l, m, err);
+  schedule_kick(l);
+  return 0;
+}
+
+// One call in flight per link; its reply schedules the next maintenance pass.
+static void call_async(AsyncLink* l, const std::string& path,
+                       std::string_view iface, std::string_view method, ReplyFn fn) {
+  l->call_method = std::string(iface) + "." + std::string(method);
+  l->on_reply = fn;
+  l->call_metric = metrics_call_metric(method);
+  l->call_start_ns = metrics_now_ns();
+  l->call_path = path;
+  sd_bus_message* m = nullptr;
+  int r = sd_bus_message_new_method_call(l->bus, &m,
+    std::string(kBluezService).c_str(),
+    path.c_str(),
+    std::string(iface).c_str(),
+    std::string(method).c_str());
+  // AcquireNotify takes an (empty) options dict; the others no arguments.
+  if (r >= 0 && method == "AcquireNotify") r = sd_bus_message_append(m, "a{sv}", 0);
+  if (r >= 0) r = sd_bus_call_async(l->bus, &l->call_slot, m, reply_trampoline, l, 0);
+  sd_bus_message_unref(m);
+  if (r >= 0 && g_trace_record) trace_call_begin(path, method, l->call_start_ns);
+  if (r < 0) {
+    ERR << "[err] sd_bus_call_async(" << l->call_method << "): " << strerror(-r) << "\n";
+    l->on_reply = nullptr;
+    sd_bus_error err = SD_BUS_ERROR_NULL;
+    err.name = "org.freedesktop.DBus.Error.Failed";
+    err.message = strerror(-r);
+    if (fn) fn(l, nullptr, &err);
+    // Retry on the next deadline rather than spinning on a broken bus.
+    arm(l, Clock::now() + 1s);
+  } else {
+    DBG << "[dbg] async call " << l->call_method << " on " << path << "\n";
+  }
+}
+
+static void on_connect(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  (void)reply;
+  auto now = Clock::now();
+  if (err) {
+    ERR << "[warn] Connect() failed (async).\n";
+    std::string_view name = err->name ? err->name : "";
+    if (name == "org.bluez.Error.InProgress") {
+      l->next_connect_attempt = now + 3s;
+      return;
+    }
+    l->connect_failures++;
+    auto backoff = std::min(30s, std::chrono::seconds(1 << std::min(l->connect_failures, 5)));
+    if (name == "org.freedesktop.DBus.Error.Timeout" || name == "org.bluez.Error.Failed") {
+      backoff = std::max(backoff, 5s);
+    }
+    l->next_connect_attempt = now + backoff;
+    return;
+  }
+  // Connected=true normally arrives just before the reply; wait for it if not.
+  if (!cached_device_connected(l->dev_path).value_or(false)) {
+    l->connect_wait_until = now + 20s;
+  } else {
+    ERR << "[info] Connected (async).\n";
+    l->connect_failures = 0;
+    l->next_connect_attempt = now;
+  }
+}
+
+static void on_start_notify(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  (void)reply;
+  if (err) {
+    ERR << "[warn] StartNotify failed (async).\n";
+    l->next_notify_attempt = Clock::now() + 1s;
+  } else {
+    ERR << "[info] StartNotify ok (async).\n";
+  }
+}
+
+static int match_installed_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  if (sd_bus_message_is_method_error(m, nullptr)) {
+    const sd_bus_error* err = sd_bus_message_get_error(m);
+    ERR << "[err] AddMatch(PropertiesChanged) failed: "
+        << (err && err->message ? err->message : "unknown") << "\n";
+  }
+  return 0;
+}
+
+static void install_value_match(AsyncLink* l) {
+  if (l->value_slot) l->value_slot = sd_bus_slot_unref(l->value_slot);
+  std::string match =
+    "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties',"
+    "member='PropertiesChanged',path='" + l->ch_path + "'";
+  int r = sd_bus_add_match_async(l->bus, &l->value_slot, match.c_str(),
+                                 props_changed_cb, match_installed_cb, &l->source);
+  if (r < 0) {
+    ERR << "[err] sd_bus_add_match_async: " << strerror(-r) << "\n";
+  } else {
+    DBG << "[dbg] Installed HR Value match for " << l->ch_path << "\n";
+  }
+}
+
+static void release_notify_fd(AsyncLink* l) {
+  if (l->notify_io) l->notify_io = sd_event_source_unref(l->notify_io);
+  if (l->notify_fd >= 0) close(l->notify_fd);
+  l->notify_fd = -1;
+}
+
+static bool use_notify_fd(const AsyncLink* l) {
+  return g_notify_fd && !l->notify_fd_refused;
+}
+
+static int notify_io_cb(sd_event_source* s, int fd, uint32_t revents, void* userdata) {
+  (void)s;
+  (void)revents;
+  auto* l = static_cast<AsyncLink*>(userdata);
+  if (notify_fd_read(fd, &l->source) >= 0) return 0;
+  ERR << "[warn] Notification socket closed (async).\n";
+  release_notify_fd(l);
+  hrm_source_down(&l->source);
+  schedule_kick(l);
+  return 0;
+}
+
+static void refuse_notify_fd(AsyncLink* l) {
+  ERR << "[warn] AcquireNotify failed (async); using StartNotify.\n";
+  l->notify_fd_refused = true;
+  install_value_match(l);
+}
+
+static void on_acquire_notify(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  if (err || !reply) {
+    refuse_notify_fd(l);
+    return;
+  }
+  uint16_t mtu = 0;
+  int fd = acquire_notify_reply(reply, &mtu);
+  if (fd < 0) {
+    refuse_notify_fd(l);
+    return;
+  }
+  int r = sd_event_add_io(l->event, &l->notify_io, fd, EPOLLIN, notify_io_cb, l);
+  if (r < 0) {
+    ERR << "[err] sd_event_add_io: " << strerror(-r) << "\n";
+    close(fd);
+    refuse_notify_fd(l);
+    return;
+  }
+  l->notify_fd = fd;
+  if (g_trace_record) trace_notify_fd(fd, l->ch_path);
+  ERR << "[info] AcquireNotify ok (async, MTU " << mtu << ").\n";
+}
+
+// ---- maintenance state machine ----
+// Mirrors ensure_connected_and_notifying(), but every step that would block
+// issues an async call or arms the deadline timer and returns.
+static void maintain(AsyncLink* l) {
+  if (l->call_slot) return;
+  auto now = Clock::now();
+  if (l->deadline <= now) l->deadline = Clock::time_point::max();
+
+  if (l->dev_path.empty() || !path_has_interface(l->bus, l->dev_path, kDevice1)) {
+    hrm_source_down(&l->source);
+    auto dev = find_device(l->bus, l->key_views, s_adapters, l->adapter);
+    if (!dev) {
+      if (!l->discovering) {
+        if (now < l->next_reacquire_attempt) {
+          arm(l, l->next_reacquire_attempt);
+          return;
+        }
+        ERR << "[info] " << l->keys.front() << ": starting discovery...\n";
+        l->discovering = true;
+        l->discovery_until = now + 15s;
+        discovery_acquire();
+      } else if (now >= l->discovery_until) {
+        ERR << "[warn] " << l->keys.front() << ": device still not present.\n";
+        l->discovering = false;
+        discovery_release();
+        l->next_reacquire_attempt = now + 10s;
+        arm(l, l->next_reacquire_attempt);
+        return;
+      }
+      arm(l, l->discovery_until);
+      return;
+    }
+    l->dev_path = dev->path;
+    l->connect_failures = 0;
+    ERR << "[info] Found device: " << dev->name << " path: " << l->dev_path << "\n";
+    output_device(l->source.tag, dev->name, device_address_from_path(l->dev_path));
+    if (l->discovering) {
+      l->discovering = false;
+      discovery_release();
+    }
+  }
+
+  if (!cached_device_connected(l->dev_path).value_or(false)) {
+    hrm_source_down(&l->source);
+    if (l->connect_wait_until != Clock::time_point::min()) {
+      if (now < l->connect_wait_until) {
+        arm(l, l->connect_wait_until);
+        return;
+      }
+      ERR << "[warn] Connect timeout (async).\n";
+      l->connect_wait_until = Clock::time_point::min();
+      l->connect_failures++;
+      l->next_connect_attempt = now + 5s;
+    }
+    if (now < l->next_connect_attempt) {
+      arm(l, l->next_connect_attempt);
+      return;
+    }
+    ERR << "[info] Connecting...\n";
+    call_async(l, l->dev_path, kDevice1, "Connect", on_connect);
+    return;
+  }
+  if (l->connect_wait_until != Clock::time_point::min()) {
+    ERR << "[info] Connected (async).\n";
+    l->connect_wait_until = Clock::time_point::min();
+    l->connect_failures = 0;
+    l->next_connect_attempt = now;
+  }
+
+  if (l->ch_path.empty() || !path_has_interface(l->bus, l->ch_path, kGattChar1)) {
+    auto np = find_char_by_uuid(l->bus, l->dev_path, kHRCharUUID);
+    if (!np) {
+      // GATT objects show up with ServicesResolved / InterfacesAdded, which
+      // kick us; the timer covers a device that never resolves them.
+      DBG << "[dbg] HR characteristic not present yet (resolved="
+          << cached_services_resolved(l->dev_path).value_or(false) << ")\n";
+      arm(l, now + kCharRetry);
+      return;
+    }
+    if (*np != l->ch_path) {
+      ERR << "[info] Heart Rate characteristic: " << *np << "\n";
+      l->ch_path = *np;
+      release_notify_fd(l);
+      if (use_notify_fd(l)) {
+        if (l->value_slot) l->value_slot = sd_bus_slot_unref(l->value_slot);
+      } else {
+        install_value_match(l);
+      }
+    }
+  }
+
+  if (l->notify_fd >= 0) {
+    DBG << "[dbg] notification socket open\n";
+    return;
+  }
+  if (use_notify_fd(l)) {
+    hrm_source_down(&l->source);
+    ERR << "[info] Calling AcquireNotify...\n";
+    call_async(l, l->ch_path, kGattChar1, "AcquireNotify", on_acquire_notify);
+    return;
+  }
+
+  if (!cached_char_notifying(l->ch_path).value_or(false)) {
+    hrm_source_down(&l->source);
+    if (now < l->next_notify_attempt) {
+      arm(l, l->next_notify_attempt);
+      return;
+    }
+    ERR << "[info] Notifying=false (or unknown). Calling StartNotify...\n";
+    call_async(l, l->ch_path, kGattChar1, "StartNotify", on_start_notify);
+    return;
+  }
+  DBG << "[dbg] Notifying=true\n";
+}
+
+// ---- entry point ----
+static int shutdown_signal_cb(sd_event_source* s, const struct signalfd_siginfo* si, void* userdata) {
+  (void)si;
+  (void)userdata;
+  ERR << "[info] Shutdown requested; flushing output.\n";
+  sd_event_exit(sd_event_source_get_event(s), 0);
+  return 0;
+}
+
+static int stats_signal_cb(sd_event_source* s, const struct signalfd_siginfo* si, void* userdata) {
+  (void)s;
+  (void)si;
+  (void)userdata;
+  metrics_dump();
+  return 0;
+}
+
+static int stats_timer_cb(sd_event_source* s, uint64_t usec, void* userdata) {
+  (void)userdata;
+  metrics_dump();
+  sd_event_source_set_time(s, usec + (uint64_t)g_stats_interval_s * 1000000ULL);
+  sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+  return 0;
+}
+
+// ---- --stall-timeout ----
+// The watchdog's deadline moves with every notification; the timer is only
+// re-armed when it fires, so the notification path never touches it.
+static void arm_stall(AsyncLink* l) {
+  uint64_t due = l->source.stall.deadline_ns();
+  // Nothing received yet: look again after one timeout.
+  if (due == UINT64_MAX) due = metrics_now_ns() + (uint64_t)g_stall_timeout_s * 1000000000ULL;
+  sd_event_source_set_time(l->stall_timer, due / 1000);
+  sd_event_source_set_enabled(l->stall_timer, SD_EVENT_ONESHOT);
+}
+
+static void on_stall_stop_notify(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  (void)reply;
+  (void)err;
+  call_async(l, l->ch_path, kGattChar1, "StartNotify", on_start_notify);
+}
+
+static void on_stall_disconnect(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  (void)reply;
+  (void)err;
+  l->next_connect_attempt = Clock::now();
+}
+
+static void on_stall_reacquire(AsyncLink* l, sd_bus_message* reply, const sd_bus_error* err) {
+  (void)reply;
+  (void)err;
+  if (l->value_slot) l->value_slot = sd_bus_slot_unref(l->value_slot);
+  l->dev_path.clear();
+  l->ch_path.clear();
+  l->next_reacquire_attempt = Clock::now();
+}
+
+static int stall_timer_cb(sd_event_source* s, uint64_t usec, void* userdata) {
+  (void)s;
+  (void)usec;
+  auto* l = static_cast<AsyncLink*>(userdata);
+  // A call in flight means maintenance is already acting on this link.
+  bool up = !l->call_slot && !l->dev_path.empty() && !l->ch_path.empty() &&
+            cached_device_connected(l->dev_path).value_or(false) &&
+            (l->notify_fd >= 0 || cached_char_notifying(l->ch_path).value_or(false));
+  switch (l->source.stall.check(l->source.tag, metrics_now_ns(), up)) {
+    case StallAction::None:
+      break;
+    case StallAction::Resubscribe:
+      if (l->notify_fd >= 0) {
+        release_notify_fd(l);
+        schedule_kick(l);  // maintenance re-acquires the socket
+      } else {
+        call_async(l, l->ch_path, kGattChar1, "StopNotify", on_stall_stop_notify);
+      }
+      break;
+    case StallAction::Reconnect:
+      release_notify_fd(l);
+      call_async(l, l->dev_path, kDevice1, "Disconnect", on_stall_disconnect);
+      break;
+    case StallAction::Reacquire:
+      release_notify_fd(l);
+      call_async(l, l->dev_path, kDevice1, "Disconnect", on_stall_reacquire);
+      break;
+  }
+  arm_stall(l);
+  return 0;
+}
+
+static void release_link(AsyncLink* l) {
+  remove_object_cache_listener(cache_changed_cb, l);
+  if (l->call_slot) l->call_slot = sd_bus_slot_unref(l->call_slot);
+  if (l->value_slot) l->value_slot = sd_bus_slot_unref(l->value_slot);
+  release_notify_fd(l);
+  if (l->timer) l->timer = sd_event_source_unref(l->timer);
+  if (l->kick) l->kick = sd_event_source_unref(l->kick);
+  if (l->stall_timer) l->stall_timer = sd_event_source_unref(l->stall_timer);
+}
+
+int run_async(sd_bus* bus,
+              const std::vector<AsyncDeviceSpec>& devices,
+              const std::vector<std::string>& adapters) {
+  if (devices.empty() || adapters.empty()) {
+    ERR << "[err] run_async: no devices or adapters\n";
+    return EXIT_FAILURE;
+  }
+
+  sd_event* event = nullptr;
+  int r = sd_event_default(&event);
+  if (r < 0) {
+    ERR << "[err] sd_event_default: " << strerror(-r) << "\n";
+    return EXIT_FAILURE;
+  }
+  r = sd_bus_attach_event(bus, event, SD_EVENT_PRIORITY_NORMAL);
+  if (r < 0) {
+    ERR << "[err] sd_bus_attach_event: " << strerror(-r) << "\n";
+    sd_event_unref(event);
+    return EXIT_FAILURE;
+  }
+
+  // Initial snapshot and signal matches; the only blocking call we make.
+  object_cache_sync(bus);
+
+  // sd_event signal sources need the signals blocked for the process.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+  sd_event_add_signal(event, nullptr, SIGINT, shutdown_signal_cb, nullptr);
+  sd_event_add_signal(event, nullptr, SIGTERM, shutdown_signal_cb, nullptr);
+  sd_event_add_signal(event, nullptr, SIGHUP, shutdown_signal_cb, nullptr);
+  sd_event_add_signal(event, nullptr, SIGUSR1, stats_signal_cb, nullptr);
+  if (g_stats_interval_s) {
+    uint64_t first = metrics_now_ns() / 1000 + (uint64_t)g_stats_interval_s * 1000000ULL;
+    sd_event_add_time(event, nullptr, CLOCK_MONOTONIC, first, 0, stats_timer_cb, nullptr);
+  }
+  // Pipeline workers poll the output deadline themselves.
+  if (!pipeline_running()) output_attach_event(event);
+
+  s_bus = bus;
+  s_adapters = adapters;
+  s_discovery.clear();
+  for (const auto& a : adapters) s_discovery.push_back(DiscoveryRef{a, 0});
+
+  std::vector<std::unique_ptr<AsyncLink>> links;
+  for (size_t i = 0; i < devices.size(); ++i) {
+    auto l = std::make_unique<AsyncLink>();
+    l->bus = bus;
+    l->event = event;
+    l->keys = devices[i].keys;
+    for (const auto& k : l->keys) l->key_views.emplace_back(k);
+    l->adapter = adapters[i % adapters.size()];
+    l->source.tag = devices[i].tag;
+    l->source.health = HealthMonitor(devices[i].tag, devices[i].health);
+
+    r = sd_event_add_time(event, &l->timer, CLOCK_MONOTONIC, UINT64_MAX, 0, timer_cb, l.get());
+    if (r >= 0) r = sd_event_source_set_enabled(l->timer, SD_EVENT_OFF);
+    if (r >= 0) r = sd_event_add_defer(event, &l->kick, kick_cb, l.get());  // starts ONESHOT
+    if (r >= 0 && g_stall_timeout_s) {
+      r = sd_event_add_time(event, &l->stall_timer, CLOCK_MONOTONIC, UINT64_MAX, 0,
+                            stall_timer_cb, l.get());
+      if (r >= 0) arm_stall(l.get());
+    }
+    if (r < 0) {
+      ERR << "[err] sd_event source setup: " << strerror(-r) << "\n";
+      release_link(l.get());
+      for (auto& p : links) release_link(p.get());
+      sd_bus_detach_event(bus);
+      sd_event_unref(event);
+      return EXIT_FAILURE;
+    }
+    add_object_cache_listener(cache_changed_cb, l.get());
+    DBG << "[dbg] link " << i << ": " << l->keys.front() << " -> " << l->adapter << "\n";
+    links.push_back(std::move(l));
+  }
+
+  ERR << "[info] Async maintenance running for " << links.size()
+      << " device(s) on " << adapters.size() << " adapter(s) (Ctrl+C to quit)...\n";
+  r = sd_event_loop(event);
+
+  // Queued samples point at the links' sources.
+  pipeline_stop();
+  output_detach_event();
+  output_flush();
+  for (auto& l : links) release_link(l.get());
+  sd_bus_detach_event(bus);
+  sd_event_unref(event);
+  if (r < 0) {
+    ERR << "[fatal] sd_event_loop: " << strerror(-r) << "\n";
+    return EXIT_FAILURE;
+  }
+  return r;
+}
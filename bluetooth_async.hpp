@@ -0,0 +1,28 @@
+#pragma once
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "feat_health.hpp"
+
+// --async: run connection maintenance on an sd_event loop. Every BlueZ call
+// goes through sd_bus_call_async and continues from its reply callback, and
+// every wait is an event-loop timer, so HRM notifications keep being
+// dispatched while Connect/StartNotify/discovery are in flight.
+extern bool g_async;
+
+struct AsyncDeviceSpec {
+  std::vector<std::string> keys;  // advertised names or addresses, priority order
+  std::string tag;                // output line tag; empty = untagged
+  HealthThresholds health = g_health_thresholds;  // --health-profile
+};
+
+// Drives discovery, connect, characteristic lookup and StartNotify for every
+// device in `devices` on one bus and one event loop, then keeps them
+// streaming. Device i prefers adapters[i % adapters.size()], which spreads
+// connections across controllers. Returns only when the event loop exits.
+int run_async(sd_bus* bus,
+              const std::vector<AsyncDeviceSpec>& devices,
+              const std::vector<std::string>& adapters);
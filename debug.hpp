@@ -1,26 +1,20 @@
 #pragma once
-#include <ctime>
-#include <iostream>
+#include "log.hpp"
 
 extern bool g_debug;
 
-inline const char* timestamp_now_s() {
-  static thread_local char buf[20];
-  std::time_t t = std::time(nullptr);
-  std::tm tm {};
-  localtime_r(&t, &tm);
-  std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
-  return buf;
-}
+// Builds with -DPOLARM_LOG_DEBUG=0 (meson -Ddebug_log=false) drop every DBG
+// statement at compile time; otherwise a disabled DBG is one branch on
+// g_debug and its arguments are not evaluated.
+#ifndef POLARM_LOG_DEBUG
+#define POLARM_LOG_DEBUG 1
+#endif
 
-inline const char* timestamp_from_ms(long long ms) {
-  static thread_local char buf[20];
-  std::time_t t = static_cast<std::time_t>(ms / 1000);
-  std::tm tm {};
-  localtime_r(&t, &tm);
-  std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
-  return buf;
-}
+// Turns "DBG << ..." into a void expression, so it nests in if/else freely.
+struct LogVoidify {
+  void operator&(const LogLine&) {}
+};
 
-#define ERR (std::cerr << "[" << timestamp_now_s() << "] ")
-#define DBG if (::g_debug) ERR
+#define ERR ::LogLine()
+#define DBG \
+  !(POLARM_LOG_DEBUG && __builtin_expect(::g_debug, 0)) ? (void)0 : ::LogVoidify() & ::LogLine()
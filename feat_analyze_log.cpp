@@ -1,66 +1,1012 @@
-#include <cctype>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "binlog.hpp"
 #include "feat_health.hpp"
 #include "feat_analyze_log.hpp"
-
-extern std::string g_health_warning_prefix;
-extern long long g_health_warning_ts_ms;
+#include "hrv.hpp"
+#include "logscan.hpp"
+#include "outfile.hpp"
+#include "rollup.hpp"
+#include "zstd_stream.hpp"
 
 namespace {
 
-bool parse_log_line(const std::string& line, std::vector<long long>* out) {
-  out->clear();
-  if (line.empty()) return false;
-  size_t i = 0;
-  while (i < line.size()) {
-    if (!std::isdigit(static_cast<unsigned char>(line[i]))) return false;
-    long long v = 0;
-    while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) {
-      v = v * 10 + (line[i] - '0');
-      ++i;
+// Detectors per device tag ("" for untagged lines).
+struct TagState {
+  HealthMonitor health;
+  HrvMonitor hrv;  // disabled unless --hrv
+  bool operator==(const TagState&) const = default;
+};
+using StateMap = std::map<std::string, TagState, std::less<>>;
+
+constexpr size_t kMinChunkBytes = 4u << 20;         // text
+constexpr uint64_t kMinChunkRecords = 200000;       // binary
+constexpr size_t kGapSearchBytes = 64u << 10;
+constexpr size_t kGapSearchBlocks = 64;
+// Warm-up before a chunk: refills the longest window several times over, so
+// that short episodes running across the cut are reproduced too. Anything
+// longer is caught by the entry/exit state comparison and re-run.
+constexpr size_t kWarmupRRFactor = 4;
+constexpr uint64_t kWarmupRecordFactor = 8;
+// A chunk spans at least this many warm-ups; fewer chunks otherwise.
+constexpr uint64_t kChunkWarmups = 2;
+// Lower bound on the text bytes per RR value (",ddd").
+constexpr uint64_t kMinTextBytesPerRR = 4;
+constexpr size_t kBatchReadings = 256;
+constexpr size_t kStreamReadBytes = 256u << 10;
+
+struct LogFile {
+  std::string path;
+  std::string label;  // warning prefix; empty when there is a single input
+  bool binary = false;
+  // Streamed text, read front to back in order: a zstd file, or the parts
+  // of a rotated --out set (one recording, so state carries across them).
+  std::vector<std::string> parts;
+  MappedFile text;
+  std::vector<BinlogIndexEntry> index;  // binary: for chunk planning
+};
+
+// A slice of one file: byte offsets (text) or indexed blocks (binary).
+struct Chunk {
+  size_t file = 0;
+  uint64_t warm_begin = 0;
+  uint64_t begin = 0;
+  uint64_t end = 0;
+  bool sequential = false;  // binary without index, or streamed text
+  StateMap entry;           // state reached at `begin` by the warm-up
+  StateMap exit;
+  HealthWarningCollector warnings;
+  HrvCollector hrv;
+  bool failed = false;
+};
+
+class NullWarningSink : public HealthWarningSink {
+ public:
+  void on_warning(const HealthWarning&) override {}
+};
+
+TagState new_tag_state(const LogFile& file, std::string_view tag) {
+  std::string source = file.label;
+  if (!source.empty() && !tag.empty()) source += ' ';
+  source += tag;
+  TagState st{HealthMonitor(source, health_thresholds_for(tag)), HrvMonitor()};
+  if (g_hrv.enabled()) st.hrv = HrvMonitor(g_hrv, std::move(source));
+  return st;
+}
+
+// Feeds readings to the per-tag monitors in batches; consecutive readings of
+// the same tag share a push_batch call.
+struct Runner {
+  Runner(const LogFile* f, StateMap* s, HealthWarningSink* w, HrvSink* h)
+      : file(f), states(s), sink(w), hrv_sink(h) {}
+
+  const LogFile* file;
+  StateMap* states;
+  HealthWarningSink* sink;
+  HrvSink* hrv_sink;  // nullptr drops the reports
+  std::vector<long long> tag_fields;
+  TagState* pending = nullptr;  // monitors of the readings below
+  std::string_view tag_of_pending;
+  std::vector<long long> ts;
+  std::vector<int> bpm;
+  std::vector<uint32_t> rr_offsets{0};
+  std::vector<int> rr;
+
+  template <class T>
+  void sample(std::string_view tag, long long ts_ms, int bpm_value, std::span<const T> rr_ms) {
+    TagState* m = monitor(tag);
+    if (m != pending || ts.size() == kBatchReadings) flush();
+    pending = m;
+    ts.push_back(ts_ms);
+    bpm.push_back(bpm_value);
+    for (T v : rr_ms) rr.push_back(static_cast<int>(v));
+    rr_offsets.push_back(static_cast<uint32_t>(rr.size()));
+  }
+
+  void flush() {
+    if (pending) {
+      pending->health.push_batch(ts, bpm, rr_offsets, rr, sink);
+      pending->hrv.push_batch(ts, rr_offsets, rr, hrv_sink);
+    }
+    pending = nullptr;
+    ts.clear();
+    bpm.clear();
+    rr_offsets.resize(1);
+    rr.clear();
+  }
+
+  TagState* monitor(std::string_view tag) {
+    if (pending && tag == tag_of_pending) return pending;
+    auto it = states->find(tag);
+    if (it == states->end()) it = states->emplace(std::string(tag), new_tag_state(*file, tag)).first;
+    tag_of_pending = it->first;
+    return &it->second;
+  }
+};
+
+// "<epoch_ms>,<bpm>[,<rr_ms>...]", optionally behind a "<tag> " prefix.
+bool split_tagged(const LineScanner& lines, std::vector<long long>* tag_fields,
+                  std::string_view* tag, std::span<const long long>* fields) {
+  if (lines.ok()) {
+    *tag = {};
+    *fields = lines.fields();
+    return true;
+  }
+  std::string_view line = lines.line();
+  size_t sp = line.find(' ');
+  if (sp == std::string_view::npos || sp == 0) return false;
+  if (!logscan_parse_fields(line.data() + sp + 1, line.data() + line.size(), tag_fields))
+    return false;
+  *tag = line.substr(0, sp);
+  *fields = *tag_fields;
+  return true;
+}
+
+void run_lines(Runner* r, const char* data, size_t size) {
+  LineScanner lines(data, size);
+  std::string_view tag;
+  std::span<const long long> fields;
+  while (lines.next()) {
+    if (!split_tagged(lines, &r->tag_fields, &tag, &fields)) continue;
+    r->sample(tag, fields[0], static_cast<int>(fields[1]), fields.subspan(2));
+  }
+}
+
+void run_text(Runner* r, uint64_t begin, uint64_t end) {
+  run_lines(r, r->file->text.data() + begin, (size_t)(end - begin));
+}
+
+// Calls fn(data, size) on whole lines of `path`, decompressing zstd input;
+// an unterminated last line comes last.
+template <class Fn>
+bool stream_text(const std::string& path, Fn&& fn) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ERR << "[err] cannot open " << path << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  std::vector<char> in(kStreamReadBytes);
+  std::string out, err;
+  ZstdDecoder dec;
+  bool first = true, zstd = false, ok = true;
+  for (;;) {
+    ssize_t n = ::read(fd, in.data(), in.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) err = path + ": " + strerror(errno);
+    if (n <= 0) break;
+    if (first) {
+      first = false;
+      zstd = zstd_detect(in.data(), (size_t)n);
+      if (zstd && !dec.init(&err)) break;
+    }
+    if (!zstd) out.append(in.data(), (size_t)n);
+    else if (!dec.decompress(std::string_view(in.data(), (size_t)n), &out, &err)) break;
+    size_t nl = out.rfind('\n');
+    if (nl == std::string::npos) continue;
+    fn(out.data(), nl + 1);
+    out.erase(0, nl + 1);
+  }
+  ::close(fd);
+  if (!err.empty()) {
+    ERR << "[err] " << (err.starts_with(path) ? "" : path + ": ") << err << "\n";
+    ok = false;
+  }
+  if (!out.empty()) fn(out.data(), out.size());
+  if (ok && zstd && !dec.at_frame_end()) {
+    ERR << "[warn] " << path << ": ends inside a zstd frame; analyzed up to its last flush\n";
+  }
+  return ok;
+}
+
+bool run_parts(Runner* r) {
+  bool ok = true;
+  for (const auto& part : r->file->parts) {
+    ok &= stream_text(part, [&](const char* data, size_t size) { run_lines(r, data, size); });
+  }
+  return ok;
+}
+
+struct BinRun {
+  Runner* runner;
+  const BinlogReader* reader;
+};
+
+void run_binlog_sample(void* ctx, uint32_t device, const HrmSample& s) {
+  auto* b = static_cast<BinRun*>(ctx);
+  if (s.bpm < 0) return;  // the text analyzer needs epoch and BPM as well
+  const BinlogDevice* d = b->reader->device(device);
+  b->runner->sample(d ? std::string_view(d->tag) : std::string_view(),
+                    (long long)s.ts_ms, s.bpm, s.rr());
+}
+
+bool run_binary(Runner* r, const Chunk& c, uint64_t begin, uint64_t end) {
+  BinlogReader reader;
+  std::string err;
+  if (!reader.open(r->file->path, &err)) {
+    ERR << "[err] " << err << "\n";
+    return false;
+  }
+  BinRun ctx{r, &reader};
+  if (c.sequential) reader.read_samples(run_binlog_sample, &ctx);
+  else reader.read_blocks((size_t)begin, (size_t)end, run_binlog_sample, &ctx);
+  return true;
+}
+
+bool run_range(Runner* r, const Chunk& c, uint64_t begin, uint64_t end) {
+  bool ok = true;
+  if (r->file->binary) ok = run_binary(r, c, begin, end);
+  else if (!r->file->parts.empty()) ok = run_parts(r);
+  else run_text(r, begin, end);
+  r->flush();
+  return ok;
+}
+
+// Speculative run: warm up from empty state, then analyze [begin, end).
+void run_chunk(const std::vector<std::unique_ptr<LogFile>>& files, Chunk* c) {
+  StateMap states;
+  NullWarningSink discard;
+  Runner r(files[c->file].get(), &states, &discard, nullptr);
+  if (c->warm_begin < c->begin) c->failed |= !run_range(&r, *c, c->warm_begin, c->begin);
+  c->entry = states;
+  r.sink = &c->warnings;
+  r.hrv_sink = &c->hrv;
+  c->failed |= !run_range(&r, *c, c->begin, c->end);
+  c->exit = std::move(states);
+}
+
+// Re-run from the true entry state after a speculation miss.
+void rerun_chunk(const std::vector<std::unique_ptr<LogFile>>& files, Chunk* c,
+                 const StateMap& entry) {
+  StateMap states = entry;
+  c->warnings.warnings.clear();
+  c->hrv.reports.clear();
+  Runner r(files[c->file].get(), &states, &c->warnings, &c->hrv);
+  c->failed |= !run_range(&r, *c, c->begin, c->end);
+  c->entry = entry;
+  c->exit = std::move(states);
+}
+
+// ---- chunk planning ----
+bool line_ts(std::string_view line, std::vector<long long>* tmp, long long* ts) {
+  size_t sp = line.find(' ');
+  const char* p = line.data() + ((sp == std::string_view::npos) ? 0 : sp + 1);
+  if (!logscan_parse_fields(p, line.data() + line.size(), tmp)) return false;
+  *ts = (*tmp)[0];
+  return true;
+}
+
+uint64_t line_start_at_or_after(const char* data, uint64_t size, uint64_t pos) {
+  if (pos == 0 || pos >= size || data[pos - 1] == '\n') return pos;
+  const void* nl = std::memchr(data + pos, '\n', (size_t)(size - pos));
+  return nl ? (uint64_t)(static_cast<const char*>(nl) - data) + 1 : size;
+}
+
+// First line start after `target`, moved to the largest time gap found
+// within the next kGapSearchBytes.
+uint64_t pick_text_cut(const char* data, uint64_t size, uint64_t target) {
+  uint64_t start = line_start_at_or_after(data, size, target);
+  uint64_t limit = std::min<uint64_t>(size, start + kGapSearchBytes);
+  uint64_t best = start;
+  long long best_gap = -1;
+  long long prev_ts = 0;
+  bool have_prev = false;
+  std::vector<long long> tmp;
+  uint64_t p = start;
+  while (p < limit) {
+    const void* nl = std::memchr(data + p, '\n', (size_t)(size - p));
+    uint64_t e = nl ? (uint64_t)(static_cast<const char*>(nl) - data) : size;
+    long long ts = 0;
+    if (line_ts(std::string_view(data + p, (size_t)(e - p)), &tmp, &ts)) {
+      if (have_prev && ts - prev_ts > best_gap) {
+        best_gap = ts - prev_ts;
+        best = p;
+      }
+      prev_ts = ts;
+      have_prev = true;
+    }
+    p = e + 1;
+  }
+  return best;
+}
+
+// Beats a warm-up has to cover: the health RR window, or the longest --hrv
+// window at the shortest plausible RR.
+uint64_t warmup_beats() {
+  uint64_t beats = kHealthRRWindow;
+  for (uint32_t w : g_hrv.windows_s)
+    beats = std::max<uint64_t>(beats, (uint64_t)w * 1000 / kHealthMinRRms);
+  return beats;
+}
+
+// Line start before `cut` (not below `lo`) covering `want` RR values; sets
+// *short_of when the span ran out first.
+uint64_t text_warmup(const char* data, uint64_t lo, uint64_t cut, uint64_t want,
+                     bool* short_of) {
+  uint64_t p = cut;
+  uint64_t rr = 0;
+  std::vector<long long> tmp;
+  while (p > lo && rr < want) {
+    uint64_t e = p - 1;  // newline ending the previous line
+    uint64_t s = e;
+    while (s > lo && data[s - 1] != '\n') --s;
+    long long ts = 0;
+    if (line_ts(std::string_view(data + s, (size_t)(e - s)), &tmp, &ts) && tmp.size() > 2)
+      rr += tmp.size() - 2;
+    p = s;
+  }
+  *short_of = rr < want;
+  return p;
+}
+
+void plan_text(size_t fi, const LogFile& f, unsigned jobs, std::vector<Chunk>* out) {
+  uint64_t size = f.text.size();
+  uint64_t want = kWarmupRRFactor * warmup_beats();
+  uint64_t min_chunk =
+      std::max<uint64_t>(kMinChunkBytes, kChunkWarmups * want * kMinTextBytesPerRR);
+  uint64_t n = (jobs > 1) ? std::min<uint64_t>((uint64_t)jobs * 4, size / min_chunk) : 1;
+  n = std::max<uint64_t>(n, 1);
+  std::vector<uint64_t> cuts{0};
+  for (uint64_t k = 1; k < n; ++k) {
+    uint64_t c = pick_text_cut(f.text.data(), size, k * size / n);
+    if (c > cuts.back() && c < size) cuts.push_back(c);
+  }
+  cuts.push_back(size);
+  std::vector<Chunk> planned;
+  for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+    Chunk c;
+    c.file = fi;
+    c.begin = cuts[i];
+    c.end = cuts[i + 1];
+    bool short_of = false;
+    if (i > 0) c.warm_begin = text_warmup(f.text.data(), cuts[i - 1], cuts[i], want, &short_of);
+    if (short_of) {
+      // Sparse RR: the warm-up would not fit, and every chunk would be re-run.
+      Chunk whole;
+      whole.file = fi;
+      whole.end = size;
+      out->push_back(std::move(whole));
+      return;
     }
-    out->push_back(v);
-    if (i == line.size()) break;
-    if (line[i] != ',') return false;
-    ++i;
+    planned.push_back(std::move(c));
   }
-  return out->size() >= 2;
+  for (auto& c : planned) out->push_back(std::move(c));
 }
 
+void plan_binary(size_t fi, const LogFile& f, unsigned jobs, std::vector<Chunk>* out) {
+  const auto& idx = f.index;
+  if (idx.empty()) {
+    Chunk c;
+    c.file = fi;
+    c.sequential = true;
+    out->push_back(std::move(c));
+    return;
+  }
+  uint64_t records = 0;
+  for (const auto& e : idx) records += e.records;
+  uint64_t want = kWarmupRecordFactor * warmup_beats();
+  uint64_t min_chunk = std::max<uint64_t>(kMinChunkRecords, kChunkWarmups * want);
+  uint64_t n = (jobs > 1) ? std::min<uint64_t>((uint64_t)jobs * 4, records / min_chunk) : 1;
+  n = std::max<uint64_t>(n, 1);
+
+  std::vector<uint64_t> cuts{0};
+  uint64_t acc = 0;
+  size_t b = 0;
+  for (uint64_t k = 1; k < n; ++k) {
+    while (b < idx.size() && acc < k * records / n) acc += idx[b++].records;
+    size_t best = b;
+    long long best_gap = -1;
+    for (size_t j = b; j < std::min(idx.size(), b + kGapSearchBlocks); ++j) {
+      if (j == 0) continue;
+      long long gap = (long long)idx[j].first_ts - (long long)idx[j - 1].last_ts;
+      if (gap > best_gap) {
+        best_gap = gap;
+        best = j;
+      }
+    }
+    if (best > cuts.back() && best < idx.size()) cuts.push_back(best);
+  }
+  cuts.push_back(idx.size());
+  for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+    Chunk c;
+    c.file = fi;
+    c.begin = cuts[i];
+    c.end = cuts[i + 1];
+    uint64_t w = c.begin;
+    uint64_t warm = 0;
+    while (i > 0 && w > cuts[i - 1] && warm < want) warm += idx[--w].records;
+    c.warm_begin = w;
+    out->push_back(std::move(c));
+  }
+}
+
+void expand_inputs(const std::vector<std::string>& paths, std::vector<std::string>* out) {
+  namespace fs = std::filesystem;
+  for (const auto& p : paths) {
+    std::error_code ec;
+    if (!fs::is_directory(p, ec)) {
+      out->push_back(p);
+      continue;
+    }
+    std::vector<std::string> found;
+    for (fs::recursive_directory_iterator it(p, ec), end; !ec && it != end; it.increment(ec)) {
+      if (it->is_regular_file(ec)) found.push_back(it->path().string());
+    }
+    std::sort(found.begin(), found.end());
+    out->insert(out->end(), found.begin(), found.end());
+  }
+}
+
+bool file_is_zstd(const std::string& path) {
+  char magic[4];
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  ssize_t n = ::read(fd, magic, sizeof magic);
+  ::close(fd);
+  return n == (ssize_t)sizeof magic && zstd_detect(magic, sizeof magic);
+}
+
+// One analysis input: a plain file, or the streamed parts of a recording.
+struct Input {
+  std::string path;
+  std::vector<std::string> parts;
+};
+
+Input plain_input(std::string path) {
+  if (file_is_zstd(path)) return Input{path, {path}};
+  return Input{std::move(path), {}};
+}
+
+// Parts of a rotated --out set (<base>.<NNNNNN>[.zst]) become one input, in
+// sequence order, at the position of the first part seen. Only consecutive
+// numbers form a set, and it must include a six-digit part (a set passes
+// 999999 before it reaches seven digits), so dated names such as
+// hr.20261014 and hr.20261015 stay separate files; so does a lone part.
+std::vector<Input> group_inputs(const std::vector<std::string>& paths) {
+  std::map<std::string, std::vector<std::pair<uint32_t, std::string>>> sets;
+  std::vector<std::string> bases(paths.size());  // empty: not a part
+  for (size_t i = 0; i < paths.size(); ++i) {
+    uint32_t seq = 0;
+    if (!binlog_detect(paths[i]) && fileset_parse_part(paths[i], &bases[i], &seq))
+      sets[bases[i]].emplace_back(seq, paths[i]);
+  }
+  std::vector<Input> out;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (bases[i].empty()) {
+      out.push_back(plain_input(paths[i]));
+      continue;
+    }
+    auto it = sets.find(bases[i]);
+    if (it == sets.end()) continue;  // placed with its first part
+    auto& parts = it->second;
+    std::sort(parts.begin(), parts.end());
+    for (size_t b = 0, e; b < parts.size(); b = e) {
+      e = b + 1;
+      while (e < parts.size() && parts[e].first == parts[e - 1].first + 1) ++e;
+      if (e - b < 2 || parts[b].first > 999999) {
+        for (size_t k = b; k < e; ++k) out.push_back(plain_input(parts[k].second));
+        continue;
+      }
+      Input in{it->first, {}};
+      for (size_t k = b; k < e; ++k) in.parts.push_back(std::move(parts[k].second));
+      out.push_back(std::move(in));
+    }
+    sets.erase(it);
+  }
+  return out;
+}
+
+long long record_ts(const HealthWarningRecord& w) { return w.ts_ms; }
+long long record_ts(const HrvRecord& r) { return r.report.ts_ms; }
+
+// Emits the records collected per chunk (chunk.*collector.*list): file order
+// within a file, earliest timestamp across files, ties to the earlier input.
+template <class Collector, class Record, class Emit>
+void merge_chunks(size_t nfiles, const std::vector<Chunk>& chunks, Collector Chunk::*collector,
+                  std::vector<Record> Collector::*list, Emit emit) {
+  struct Cursor {
+    size_t chunk, pos;
+  };
+  auto records = [&](size_t c) -> const std::vector<Record>& {
+    return chunks[c].*collector.*list;
+  };
+  std::vector<Cursor> heads(nfiles, Cursor{SIZE_MAX, 0});
+  std::vector<size_t> last_chunk(nfiles, 0);
+  for (size_t i = chunks.size(); i-- > 0;) {
+    heads[chunks[i].file] = Cursor{i, 0};
+    last_chunk[chunks[i].file] = std::max(last_chunk[chunks[i].file], i);
+  }
+  auto current = [&](size_t f) -> const Record* {
+    Cursor& h = heads[f];
+    while (h.chunk != SIZE_MAX && h.pos == records(h.chunk).size()) {
+      h.chunk = (h.chunk < last_chunk[f]) ? h.chunk + 1 : SIZE_MAX;
+      h.pos = 0;
+    }
+    return (h.chunk == SIZE_MAX) ? nullptr : &records(h.chunk)[h.pos];
+  };
+  using Key = std::pair<long long, size_t>;
+  std::priority_queue<Key, std::vector<Key>, std::greater<Key>> heap;
+  for (size_t f = 0; f < nfiles; ++f) {
+    if (const Record* r = current(f)) heap.push({record_ts(*r), f});
+  }
+  while (!heap.empty()) {
+    size_t f = heap.top().second;
+    heap.pop();
+    emit(*current(f));
+    ++heads[f].pos;
+    if (const Record* n = current(f)) heap.push({record_ts(*n), f});
+  }
+}
+
+// ---- --rollup builder ----
+struct RollupRun {
+  RollupWriter* writer;
+  const BinlogReader* reader;
+  uint64_t samples = 0;
+};
+
+void rollup_binlog_sample(void* ctx, uint32_t device, const HrmSample& s) {
+  auto* r = static_cast<RollupRun*>(ctx);
+  const BinlogDevice* d = r->reader->device(device);
+  r->writer->add(d ? std::string_view(d->tag) : std::string_view(), (int64_t)s.ts_ms, s.bpm, s.rr());
+  ++r->samples;
+}
+
+// ---- --follow / --checkpoint ----
+constexpr char kCheckpointMagic[8] = {'P', 'L', 'R', 'M', 'C', 'K', 'P', 'T'};
+constexpr uint32_t kCheckpointVersion = 1;
+constexpr size_t kFingerprintBytes = 4096;
+constexpr size_t kFollowReadBytes = 1u << 20;
+constexpr int kFollowPollMs = 1000;
+constexpr auto kCheckpointEvery = std::chrono::seconds(5);
+
+template <class T>
+void put(std::string* out, const T& v) {
+  out->append(reinterpret_cast<const char*>(&v), sizeof v);
+}
+
+template <class T>
+bool get(std::string_view* in, T* v) {
+  if (in->size() < sizeof *v) return false;
+  std::memcpy(v, in->data(), sizeof *v);
+  in->remove_prefix(sizeof *v);
+  return true;
+}
+
+bool get_string(std::string_view* in, std::string* s) {
+  uint32_t n = 0;
+  if (!get(in, &n) || in->size() < n) return false;
+  s->assign(in->data(), n);
+  in->remove_prefix(n);
+  return true;
+}
+
+// FNV-1a over the kFingerprintBytes before `offset`: tells a file that was
+// only appended to since the checkpoint from one rewritten or replaced.
+bool fingerprint(int fd, uint64_t offset, uint64_t* out) {
+  size_t n = (size_t)std::min<uint64_t>(offset, kFingerprintBytes);
+  char buf[kFingerprintBytes];
+  if (pread(fd, buf, n, (off_t)(offset - n)) != (ssize_t)n) return false;
+  uint64_t h = 1469598103934665603ULL;
+  for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)buf[i]) * 1099511628211ULL;
+  *out = h;
+  return true;
+}
+
+// One growing text recording, analyzed up to its last complete line. The
+// offset and per-tag detector state can be saved and restored, so a resumed
+// run continues exactly where the previous one stopped.
+class FollowedLog {
+ public:
+  explicit FollowedLog(const std::string& path)
+      : runner_(&file_, &states_, g_health_alert_window_ms > 0 ? (HealthWarningSink*)&alerts_
+                                                               : &printer_,
+                hrv_output()) {
+    file_.path = path;
+  }
+  ~FollowedLog() {
+    alerts_.flush();
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  bool open(std::string* err) {
+    int fd = ::open(file_.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      *err = "cannot open " + file_.path + ": " + strerror(errno);
+      return false;
+    }
+    struct stat st {};
+    fstat(fd, &st);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = fd;
+    ino_ = st.st_ino;
+    dev_ = st.st_dev;
+    return true;
+  }
+
+  // A missing checkpoint starts from the beginning; one for another file or
+  // other thresholds is an error.
+  bool load_checkpoint(const std::string& ck, std::string* err) {
+    std::ifstream in(ck, std::ios::binary);
+    if (!in) return true;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string_view v = data;
+    char magic[8];
+    uint32_t version = 0, ntags = 0;
+    std::string path;
+    uint64_t offset = 0, print = 0;
+    if (!get(&v, &magic) || std::memcmp(magic, kCheckpointMagic, 8) != 0 ||
+        !get(&v, &version) || version != kCheckpointVersion) {
+      *err = ck + ": not a checkpoint";
+      return false;
+    }
+    if (!get_string(&v, &path) || !get(&v, &offset) || !get(&v, &print) || !get(&v, &ntags)) {
+      *err = ck + ": truncated";
+      return false;
+    }
+    if (path != file_.path) {
+      *err = ck + ": checkpoint is for " + path;
+      return false;
+    }
+    uint64_t now_print = 0;
+    struct stat st {};
+    if (fstat(fd_, &st) < 0 || (uint64_t)st.st_size < offset ||
+        !fingerprint(fd_, offset, &now_print) || now_print != print) {
+      ERR << "[warn] " << file_.path << " changed since checkpoint " << ck
+          << "; analyzing from the start\n";
+      return true;
+    }
+    StateMap states;
+    for (uint32_t i = 0; i < ntags; ++i) {
+      std::string tag;
+      if (!get_string(&v, &tag)) {
+        *err = ck + ": truncated";
+        return false;
+      }
+      TagState st = new_tag_state(file_, tag);
+      std::string why;
+      if (!health_load_state(&v, &st.health, &why)) {
+        *err = ck + ": " + why;
+        return false;
+      }
+      states.emplace(std::move(tag), std::move(st));
+    }
+    states_ = std::move(states);
+    offset_ = offset;
+    saved_offset_ = offset;
+    lseek(fd_, (off_t)offset_, SEEK_SET);
+    DBG << "[dbg] resuming " << file_.path << " at byte " << offset_ << " with "
+        << states_.size() << " tag(s)\n";
+    return true;
+  }
+
+  // Written to <ck>.tmp and renamed over <ck>.
+  bool save_checkpoint(const std::string& ck) {
+    std::string data(kCheckpointMagic, sizeof kCheckpointMagic);
+    uint64_t print = 0;
+    fingerprint(fd_, offset_, &print);
+    put(&data, kCheckpointVersion);
+    put(&data, (uint32_t)file_.path.size());
+    data += file_.path;
+    put(&data, offset_);
+    put(&data, print);
+    put(&data, (uint32_t)states_.size());
+    for (const auto& [tag, st] : states_) {
+      put(&data, (uint32_t)tag.size());
+      data += tag;
+      health_save_state(st.health, &data);
+    }
+    std::string tmp = ck + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    for (size_t done = 0; ok && done < data.size();) {
+      ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR) continue;
+      ok = n > 0;
+      if (ok) done += (size_t)n;
+    }
+    if (fd >= 0) {
+      ok = fsync(fd) == 0 && ok;
+      ok = ::close(fd) == 0 && ok;
+    }
+    if (!ok || rename(tmp.c_str(), ck.c_str()) < 0) {
+      ERR << "[err] cannot write checkpoint " << ck << ": " << strerror(errno) << "\n";
+      return false;
+    }
+    saved_offset_ = offset_;
+    saved_at_ = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  bool checkpoint_due() const {
+    return offset_ != saved_offset_ &&
+           std::chrono::steady_clock::now() - saved_at_ >= kCheckpointEvery;
+  }
+
+  // Analyzes every complete line appended since the last call. An
+  // unterminated last line waits for its newline.
+  bool read_new() {
+    struct stat st {};
+    if (fstat(fd_, &st) == 0 && (uint64_t)st.st_size < offset_ + pending_.size()) {
+      restart("was truncated");
+    }
+    for (;;) {
+      size_t have = pending_.size();
+      pending_.resize(have + kFollowReadBytes);
+      ssize_t n = ::read(fd_, pending_.data() + have, kFollowReadBytes);
+      if (n < 0 && errno == EINTR) n = 0;
+      pending_.resize(have + (size_t)std::max<ssize_t>(n, 0));
+      if (n < 0) {
+        ERR << "[err] " << file_.path << ": " << strerror(errno) << "\n";
+        return false;
+      }
+      if (n == 0) return true;
+      auto nl = std::find(pending_.rbegin(), pending_.rend(), '\n');
+      if (nl == pending_.rend()) continue;
+      size_t complete = (size_t)(pending_.rend() - nl);
+      run_lines(&runner_, pending_.data(), complete);
+      runner_.flush();
+      pending_.erase(pending_.begin(), pending_.begin() + (ptrdiff_t)complete);
+      offset_ += complete;
+    }
+  }
+
+  // After a rename/create in the directory: if the path now names another
+  // file, finish the old one and start over on the new one.
+  bool check_replaced() {
+    struct stat st {};
+    if (stat(file_.path.c_str(), &st) < 0 || (st.st_ino == ino_ && st.st_dev == dev_)) return true;
+    if (!read_new()) return false;
+    std::string err;
+    if (!open(&err)) {
+      ERR << "[err] " << err << "\n";
+      return false;
+    }
+    restart("was replaced");
+    return true;
+  }
+
+ private:
+  // A new recording under the same name: fresh detectors, from byte 0.
+  void restart(const char* why) {
+    ERR << "[info] " << file_.path << " " << why << "; analyzing from the start\n";
+    states_.clear();
+    pending_.clear();
+    offset_ = 0;
+    lseek(fd_, 0, SEEK_SET);
+  }
+
+  LogFile file_;
+  StateMap states_;
+  HealthWarningPrinter printer_{true};
+  HealthAlertCoalescer alerts_{&printer_, g_health_alert_window_ms};
+  Runner runner_;
+  int fd_ = -1;
+  ino_t ino_ = 0;
+  dev_t dev_ = 0;
+  uint64_t offset_ = 0;         // end of the last analyzed line
+  std::vector<char> pending_;   // read past offset_, not yet a full line
+  uint64_t saved_offset_ = UINT64_MAX;
+  std::chrono::steady_clock::time_point saved_at_{};
+};
+
 }  // namespace
 
 int analyze_log(const std::string& path) {
-  std::ifstream in(path);
-  if (!in) {
-    ERR << "[err] Unable to open log file: " << path << "\n";
-    return EXIT_FAILURE;
+  return analyze_logs({path}, 1);
+}
+
+int analyze_logs(const std::vector<std::string>& paths, unsigned jobs) {
+  if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> inputs;
+  expand_inputs(paths, &inputs);
+
+  bool failed = false;
+  std::vector<Input> grouped = group_inputs(inputs);
+  std::vector<std::unique_ptr<LogFile>> files;
+  for (auto& in : grouped) {
+    const std::string& path = in.path;
+    auto f = std::make_unique<LogFile>();
+    f->path = path;
+    if (grouped.size() > 1) f->label = path;
+    f->parts = std::move(in.parts);
+    f->binary = f->parts.empty() && binlog_detect(path);
+    std::string err;
+    if (f->binary) {
+      BinlogReader reader;
+      if (!reader.open(path, &err)) {
+        ERR << "[err] " << err << "\n";
+        failed = true;
+        continue;
+      }
+      f->index = reader.index();
+    } else if (f->parts.empty() && !f->text.open(path, &err)) {
+      ERR << "[err] " << err << "\n";
+      failed = true;
+      continue;
+    }
+    files.push_back(std::move(f));
   }
 
-  std::string line;
-  std::vector<long long> fields;
-  while (std::getline(in, line)) {
-    if (!parse_log_line(line, &fields)) continue;
-    long long ts = fields[0];
-    int bpm = static_cast<int>(fields[1]);
-    std::vector<int> rr_ms;
-    rr_ms.reserve(fields.size() > 2 ? (fields.size() - 2) : 0);
-    for (size_t i = 2; i < fields.size(); ++i) {
-      rr_ms.push_back(static_cast<int>(fields[i]));
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!files[i]->parts.empty()) {
+      Chunk c;
+      c.file = i;
+      c.sequential = true;
+      chunks.push_back(std::move(c));
+    } else if (files[i]->binary) {
+      plan_binary(i, *files[i], jobs, &chunks);
+    } else {
+      plan_text(i, *files[i], jobs, &chunks);
     }
+  }
+  DBG << "[dbg] analyze_logs(): " << files.size() << " file(s), " << chunks.size()
+      << " chunk(s), " << jobs << " job(s), " << logscan_kernel_name() << " scanner\n";
+
+  // A single chunk streams its warnings as it goes.
+  HealthWarningPrinter printer(true);
+  HealthAlertCoalescer alerts(&printer, g_health_alert_window_ms);
+  HealthWarningSink* warnings = (g_health_alert_window_ms > 0) ? (HealthWarningSink*)&alerts
+                                                               : &printer;
+  if (chunks.size() == 1) {
+    StateMap states;
+    Runner r(files[0].get(), &states, warnings, hrv_output());
+    if (!run_range(&r, chunks[0], chunks[0].begin, chunks[0].end)) failed = true;
+    alerts.flush();
+    hrv_output_flush();
+    return failed ? EXIT_FAILURE : 0;
+  }
 
-    g_health_warning_prefix = "ts=" + std::to_string(ts);
-    g_health_warning_ts_ms = ts;
-    health_check_bradycardia(bpm, ts);
-    health_check_tachycardia(bpm, ts);
-    if (!rr_ms.empty()) {
-      health_check_arrhythmia(rr_ms, ts);
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < chunks.size();) run_chunk(files, &chunks[i]);
+  };
+  std::vector<std::thread> pool;
+  size_t nthreads = std::min<size_t>(jobs, chunks.size());
+  for (size_t t = 1; t < nthreads; ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& t : pool) t.join();
+
+  // Chunks of a file are adjacent. Whenever a warm-up did not reproduce the
+  // state the previous chunk actually ended in, redo the chunk from it.
+  size_t reruns = 0;
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    if (chunks[i].file != chunks[i - 1].file) continue;
+    if (chunks[i].entry == chunks[i - 1].exit) continue;
+    rerun_chunk(files, &chunks[i], chunks[i - 1].exit);
+    ++reruns;
+  }
+  DBG << "[dbg] analyze_logs(): " << reruns << " chunk(s) re-run after warm-up mismatch\n";
+  for (const auto& c : chunks) failed |= c.failed;
+
+  // Merge: file order within a file, then earliest timestamp across files.
+  merge_chunks(files.size(), chunks, &Chunk::warnings, &HealthWarningCollector::warnings,
+               [&](const HealthWarningRecord& w) { warnings->on_warning(w.view()); });
+  alerts.flush();
+  if (HrvSink* out = hrv_output()) {
+    merge_chunks(files.size(), chunks, &Chunk::hrv, &HrvCollector::reports,
+                 [&](const HrvRecord& r) { out->on_report(r.view()); });
+    hrv_output_flush();
+  }
+
+  return failed ? EXIT_FAILURE : 0;
+}
+
+int follow_log(const std::string& path, const FollowOptions& opts) {
+  if (binlog_detect(path)) {
+    ERR << "[err] " << path << ": --follow/--checkpoint take text recordings\n";
+    return EXIT_FAILURE;
+  }
+  FollowedLog log(path);
+  std::string err;
+  if (!log.open(&err) || (!opts.checkpoint.empty() && !log.load_checkpoint(opts.checkpoint, &err))) {
+    ERR << "[err] " << err << "\n";
+    return EXIT_FAILURE;
+  }
+  bool ok = log.read_new();
+  hrv_output_flush();
+  if (ok && opts.follow) {
+    // inotify only wakes the loop: appends to the file, and files created or
+    // renamed into its directory (a replacement). Without it the loop still
+    // re-reads every kFollowPollMs.
+    int in = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    std::filesystem::path p(path);
+    std::string dir = p.has_parent_path() ? p.parent_path().string() : ".";
+    if (in < 0 || inotify_add_watch(in, path.c_str(), IN_MODIFY) < 0 ||
+        inotify_add_watch(in, dir.c_str(), IN_CREATE | IN_MOVED_TO) < 0) {
+      ERR << "[warn] inotify: " << strerror(errno) << "; polling " << path << "\n";
+    }
+    DBG << "[dbg] following " << path << "\n";
+    alignas(inotify_event) char buf[4096];
+    while (ok && !(opts.stop && *opts.stop)) {
+      pollfd pfd{in, POLLIN, 0};
+      poll(&pfd, in >= 0 ? 1 : 0, kFollowPollMs);
+      while (in >= 0 && read(in, buf, sizeof buf) > 0) {}
+      ok = log.read_new() && log.check_replaced();
+      hrv_output_flush();
+      if (ok && !opts.checkpoint.empty() && log.checkpoint_due()) log.save_checkpoint(opts.checkpoint);
     }
-    g_health_warning_prefix.clear();
-    g_health_warning_ts_ms = -1;
+    if (in >= 0) ::close(in);
   }
+  if (!opts.checkpoint.empty() && !log.save_checkpoint(opts.checkpoint)) ok = false;
+  return ok ? 0 : EXIT_FAILURE;
+}
 
-  return 0;
+int build_rollup(const std::vector<std::string>& paths, const std::string& dir) {
+  std::vector<std::string> expanded;
+  expand_inputs(paths, &expanded);
+  std::vector<Input> inputs = group_inputs(expanded);
+  RollupWriter writer;
+  std::string err;
+  if (!writer.open(dir, true, true, &err)) {
+    ERR << "[err] --rollup: " << err << "\n";
+    return EXIT_FAILURE;
+  }
+  bool failed = false;
+  uint64_t samples = 0;
+  for (const auto& in : inputs) {
+    const std::string& path = in.path;
+    if (in.parts.empty() && binlog_detect(path)) {
+      BinlogReader reader;
+      if (!reader.open(path, &err)) {
+        ERR << "[err] " << err << "\n";
+        failed = true;
+        continue;
+      }
+      RollupRun run{&writer, &reader};
+      reader.read_samples(rollup_binlog_sample, &run);
+      samples += run.samples;
+      continue;
+    }
+    std::vector<long long> tag_fields;
+    std::vector<int> rr;
+    auto add_lines = [&](const char* data, size_t size) {
+      LineScanner lines(data, size);
+      std::string_view tag;
+      std::span<const long long> fields;
+      while (lines.next()) {
+        if (!split_tagged(lines, &tag_fields, &tag, &fields)) continue;
+        rr.assign(fields.begin() + 2, fields.end());
+        writer.add(tag, fields[0], static_cast<int>(fields[1]), rr);
+        ++samples;
+      }
+    };
+    if (!in.parts.empty()) {  // zstd file or --out parts, in sequence order
+      for (const auto& part : in.parts) failed |= !stream_text(part, add_lines);
+      continue;
+    }
+    MappedFile text;
+    if (!text.open(path, &err)) {
+      ERR << "[err] " << err << "\n";
+      failed = true;
+      continue;
+    }
+    add_lines(text.data(), text.size());
+  }
+  if (writer.late()) {
+    ERR << "[warn] rollup: " << writer.late()
+        << " sample(s) older than their device's newest bucket were counted there\n";
+  }
+  failed |= !writer.close();
+  ERR << "[info] rollup: " << samples << " sample(s) from " << expanded.size()
+      << " file(s) into " << dir << "\n";
+  return failed ? EXIT_FAILURE : 0;
 }
@@ -1,5 +1,28 @@
 #pragma once
 
+#include <csignal>
 #include <string>
+#include <vector>
 
 int analyze_log(const std::string& path);
+// Text or binary recordings and directories of them (searched recursively),
+// analyzed on up to `jobs` threads (0 = one per CPU). Large files are split
+// into chunks; warnings are printed merged in timestamp order and match a
+// sequential run file by file. zstd files and rotated --out sets
+// (outfile.hpp) are streamed, each set as one recording.
+int analyze_logs(const std::vector<std::string>& paths, unsigned jobs);
+
+struct FollowOptions {
+  bool follow = false;     // keep tailing the file (inotify) until *stop
+  std::string checkpoint;  // resume from / save offset and detector state
+  const volatile sig_atomic_t* stop = nullptr;
+};
+
+// --follow / --checkpoint: one text recording analyzed incrementally. Only
+// complete lines are analyzed; warnings are those of a full run over the
+// same lines. Truncation or replacement of the file starts over.
+int follow_log(const std::string& path, const FollowOptions& opts);
+
+// --analyze-log with --rollup: (re)builds the rollup store in `dir` from text
+// and binary recordings, one sequential pass per file in input order.
+int build_rollup(const std::vector<std::string>& paths, const std::string& dir);
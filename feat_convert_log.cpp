@@ -0,0 +1,95 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "binlog.hpp"
+#include "debug.hpp"
+#include "feat_convert_log.hpp"
+#include "output.hpp"
+
+namespace {
+
+// Offline conversion: only the size threshold matters.
+OutputOptions convert_options(OutputFormat format) {
+  OutputOptions o;
+  o.format = format;
+  o.flush_ms = 60000;
+  o.flush_bytes = 1 << 20;
+  return o;
+}
+
+struct BinToText {
+  BinlogReader* reader;
+  SampleSink* sink;
+  uint64_t samples = 0;
+};
+
+void bin_to_text_sample(void* ctx, uint32_t device, const HrmSample& s) {
+  auto* c = static_cast<BinToText*>(ctx);
+  const BinlogDevice* d = c->reader->device(device);
+  c->sink->write_sample(d ? std::string_view(d->tag) : std::string_view(), s);
+  ++c->samples;
+}
+
+int open_output(const std::string& path) {
+  if (path == "-") return STDOUT_FILENO;
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) ERR << "[err] Unable to create " << path << ": " << strerror(errno) << "\n";
+  return fd;
+}
+
+}  // namespace
+
+int convert_log(const std::string& in_path, const std::string& out_path) {
+  bool from_bin = binlog_detect(in_path);
+  int fd = open_output(out_path);
+  if (fd < 0) return EXIT_FAILURE;
+
+  bool ok = true;
+  uint64_t samples = 0;
+  if (from_bin) {
+    BinlogReader reader;
+    std::string err;
+    if (!reader.open(in_path, &err)) {
+      ERR << "[err] " << err << "\n";
+      if (fd != STDOUT_FILENO) ::close(fd);
+      return EXIT_FAILURE;
+    }
+    TextSink sink(fd, convert_options(OutputFormat::Text));
+    BinToText ctx{&reader, &sink};
+    reader.read_samples(bin_to_text_sample, &ctx);
+    ok = sink.close();
+    samples = ctx.samples;
+  } else {
+    std::ifstream in(in_path);
+    if (!in) {
+      ERR << "[err] Unable to open log file: " << in_path << "\n";
+      if (fd != STDOUT_FILENO) ::close(fd);
+      return EXIT_FAILURE;
+    }
+    BinlogSink sink(fd, convert_options(OutputFormat::Binary));
+    std::string line;
+    std::string_view tag;
+    HrmSample s;
+    uint64_t skipped = 0;
+    while (std::getline(in, line)) {
+      if (!hrm_parse_text_line(line, &tag, &s)) {
+        if (!line.empty()) ++skipped;
+        continue;
+      }
+      sink.write_sample(tag, s);
+      ++samples;
+    }
+    if (skipped) ERR << "[warn] Skipped " << skipped << " unparseable lines\n";
+    ok = sink.close();
+  }
+  if (fd != STDOUT_FILENO && ::close(fd) < 0) ok = false;
+  ERR << "[info] Converted " << samples << " samples to "
+      << (from_bin ? "text" : "binary") << ": " << out_path << "\n";
+  return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+// Text <-> binary recording conversion; the direction follows the input.
+int convert_log(const std::string& in_path, const std::string& out_path);
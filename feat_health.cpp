@@ -1,6 +1,25 @@
 #include "feat_health.hpp"
 
+#include <charconv>
+#include <cstring>
+#include <fstream>
 #include <sstream>
+#include <type_traits>
+
+void HealthWarningPrinter::on_warning(const HealthWarning& w) {
+  // One log record per warning, so --pipeline workers never interleave.
+  bool at_sample = replay_ && w.ts_ms >= 0;
+  LogLine line = at_sample ? LogLine(w.ts_ms / 1000) : LogLine();
+  line << '\a' << "[warn] ";
+  if (replay_) {
+    line << "[";
+    if (!w.source.empty()) line << w.source << " ";
+    line << "ts=" << w.ts_ms << "] ";
+  } else if (!w.source.empty()) {
+    line << "[" << w.source << "] ";
+  }
+  line << w.message() << "\n";
+}
 
 std::string health_format_duration(long long ms) {
   long long total_s = (ms >= 0) ? (ms / 1000) : 0;
@@ -14,3 +33,137 @@ std::string health_format_duration(long long ms) {
   }
   return oss.str();
 }
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+  return s;
+}
+
+template <class T>
+void put(std::string* out, const T& v) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out->append(reinterpret_cast<const char*>(&v), sizeof v);
+}
+
+template <class T>
+bool get(std::string_view* in, T* v) {
+  if (in->size() < sizeof *v) return false;
+  std::memcpy(v, in->data(), sizeof *v);
+  in->remove_prefix(sizeof *v);
+  return true;
+}
+
+template <class T>
+bool parse_number(std::string_view s, T* out) {
+  auto r = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return r.ec == std::errc() && r.ptr == s.data() + s.size();
+}
+
+}  // namespace
+
+bool health_load_profile(const std::string& path, HealthThresholds* out, std::string* err) {
+  std::ifstream in(path);
+  if (!in) {
+    *err = "cannot open health profile " + path;
+    return false;
+  }
+  HealthThresholds t = *out;
+  std::string raw;
+  for (int lineno = 1; std::getline(in, raw); ++lineno) {
+    std::string_view line = raw;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) continue;
+    size_t eq = line.find('=');
+    std::string_view key = trim(line.substr(0, eq));
+    std::string_view value = (eq == std::string_view::npos) ? "" : trim(line.substr(eq + 1));
+    bool ok = false;
+    if (key == "brady_bpm") ok = parse_number(value, &t.brady_bpm);
+    else if (key == "tachy_bpm") ok = parse_number(value, &t.tachy_bpm);
+    else if (key == "min_rr_ms") ok = parse_number(value, &t.min_rr_ms);
+    else if (key == "max_rr_ms") ok = parse_number(value, &t.max_rr_ms);
+    else if (key == "af_rmssd_ratio") ok = parse_number(value, &t.af_rmssd_ratio);
+    else if (key == "af_tpr_min") ok = parse_number(value, &t.af_tpr_min);
+    else if (key == "af_tpr_max") ok = parse_number(value, &t.af_tpr_max);
+    else if (key == "af_entropy") ok = parse_number(value, &t.af_entropy);
+    else if (key == "recovery_min_ms") ok = parse_number(value, &t.recovery_min_ms);
+    if (!ok) {
+      *err = path + ":" + std::to_string(lineno) + ": bad setting '" + std::string(line) + "'";
+      return false;
+    }
+  }
+  if (t.brady_bpm < 0 || t.tachy_bpm < 0 || t.recovery_min_ms < 0 ||
+      t.min_rr_ms < kHealthMinRRms || t.max_rr_ms > kHealthMaxRRms || t.min_rr_ms >= t.max_rr_ms) {
+    *err = path + ": thresholds out of range (RR limits must lie within " +
+           std::to_string(kHealthMinRRms) + ".." + std::to_string(kHealthMaxRRms) + " ms)";
+    return false;
+  }
+  *out = t;
+  return true;
+}
+
+void health_save_state(const HealthMonitor& m, std::string* out) {
+  put(out, m.limits());
+  const auto& brady = m.pipeline().get<BradycardiaDetector>().state;
+  put(out, brady.active);
+  put(out, brady.start_ms);
+  put(out, brady.lowest_bpm);
+  const auto& tachy = m.pipeline().get<TachycardiaDetector>().state;
+  put(out, tachy.active);
+  put(out, tachy.start_ms);
+  put(out, tachy.highest_bpm);
+  const auto& a = m.pipeline().get<ArrhythmiaDetector>().state;
+  put(out, a.possible_af);
+  put(out, a.af_start_ms);
+  put(out, a.pause_active);
+  put(out, a.pause_start_ms);
+  put(out, a.pause_min_rr);
+  put(out, a.pause_max_rr);
+  put(out, a.ectopic_active);
+  put(out, a.ectopic_start_ms);
+  put(out, a.ectopic_count);
+  // The AF window's cleaning and sums follow from the raw values.
+  std::span<const int> raw = a.af.raw();
+  put(out, (uint32_t)raw.size());
+  out->append(reinterpret_cast<const char*>(raw.data()), raw.size_bytes());
+}
+
+bool health_load_state(std::string_view* in, HealthMonitor* m, std::string* err) {
+  HealthThresholds limits;
+  BradycardiaState brady;
+  TachycardiaState tachy;
+  ArrhythmiaState a;
+  uint32_t n = 0;
+  bool ok = get(in, &limits) &&
+            get(in, &brady.active) && get(in, &brady.start_ms) && get(in, &brady.lowest_bpm) &&
+            get(in, &tachy.active) && get(in, &tachy.start_ms) && get(in, &tachy.highest_bpm) &&
+            get(in, &a.possible_af) && get(in, &a.af_start_ms) &&
+            get(in, &a.pause_active) && get(in, &a.pause_start_ms) &&
+            get(in, &a.pause_min_rr) && get(in, &a.pause_max_rr) &&
+            get(in, &a.ectopic_active) && get(in, &a.ectopic_start_ms) &&
+            get(in, &a.ectopic_count) && get(in, &n) &&
+            n <= kHealthRRWindow && in->size() >= n * sizeof(int);
+  if (!ok) {
+    *err = "truncated detector state";
+    return false;
+  }
+  if (!(limits == m->limits())) {
+    *err = "written with different detector thresholds (--health-profile)";
+    return false;
+  }
+  for (uint32_t i = 0; i < n; ++i) {
+    int rr = 0;
+    get(in, &rr);
+    if (rr < kHealthMinRRms || rr > kHealthMaxRRms) {
+      *err = "RR value out of range in detector state";
+      return false;
+    }
+    a.af.push(rr);
+  }
+  m->pipeline().get<BradycardiaDetector>().state = brady;
+  m->pipeline().get<TachycardiaDetector>().state = tachy;
+  m->pipeline().get<ArrhythmiaDetector>().state = std::move(a);
+  return true;
+}
@@ -1,26 +1,399 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "debug.hpp"
+#include "feat_health_af.hpp"
 
 extern bool g_health_warnings;
-extern std::string g_health_warning_prefix;
-extern long long g_health_warning_ts_ms;
-
-inline void health_emit_warning(std::string_view msg) {
-  const char* ts = (g_health_warning_ts_ms >= 0)
-    ? timestamp_from_ms(g_health_warning_ts_ms)
-    : timestamp_now_s();
-  std::cerr << "[" << ts << "] " << '\a' << "[warn] ";
-  if (!g_health_warning_prefix.empty()) {
-    std::cerr << "[" << g_health_warning_prefix << "] ";
-  }
-  std::cerr << msg << "\n";
+
+// Detector limits. The defaults are the built-in screening thresholds; a
+// --health-profile file overrides them. The RR range can only be narrowed:
+// AfScreen's value histogram covers kHealthMinRRms..kHealthMaxRRms.
+struct HealthThresholds {
+  int brady_bpm = 60;   // bradycardia below
+  int tachy_bpm = 100;  // tachycardia above
+  int min_rr_ms = kHealthMinRRms;  // outside [min_rr_ms, max_rr_ms]: pause/artifact
+  int max_rr_ms = kHealthMaxRRms;
+  double af_rmssd_ratio = 0.1;  // possible AF above
+  double af_tpr_min = 0.54;     // ... with the turning point ratio in between
+  double af_tpr_max = 0.77;
+  double af_entropy = 0.7;      // ... and the entropy above
+  long long recovery_min_ms = 1000;  // shorter episodes end without a summary
+  bool operator==(const HealthThresholds&) const = default;
+};
+
+// Thresholds new monitors start from (main.cpp, --health-profile).
+extern HealthThresholds g_health_thresholds;
+// Per-device thresholds (main.cpp, --health-profile <device>=<file>), keyed by
+// the --device argument, which is also the device tag in recordings.
+extern std::map<std::string, HealthThresholds, std::less<>> g_health_profiles;
+
+// The device's own profile, else g_health_thresholds.
+inline const HealthThresholds& health_thresholds_for(std::string_view device) {
+  auto it = g_health_profiles.find(device);
+  return (it != g_health_profiles.end()) ? it->second : g_health_thresholds;
 }
 
-void health_check_bradycardia(int bpm, long long ts_ms);
-void health_check_tachycardia(int bpm, long long ts_ms);
-void health_check_arrhythmia(const std::vector<int>& rr_ms, long long ts_ms);
+// "key = value" lines named like the HealthThresholds fields ('#' starts a
+// comment); unknown keys and out-of-range values fail with *err set.
+bool health_load_profile(const std::string& path, HealthThresholds* out, std::string* err);
+
+enum class HealthCondition {
+  Bradycardia,
+  Tachycardia,
+  PauseArtifact,
+  Ectopic,
+  PossibleAF,
+};
+
+// One warning as reported by HealthMonitor. The views are only valid for the
+// duration of the sink call.
+// Frequent warnings defer their text: `format` writes it when a sink asks
+// for message(), so warnings a sink only counts, coalesces or collects cost
+// no formatting.
+struct HealthWarning {
+  long long ts_ms = -1;     // timestamp of the reading that raised it
+  std::string_view source;  // HealthMonitor::source(), may be empty
+  HealthCondition condition = HealthCondition::Bradycardia;
+  bool recovered = false;   // end-of-episode summary
+  std::string_view text;    // the message, unless `format` is set
+  std::span<const int> rr;  // RR values behind a pause/artifact or ectopic warning
+  void (*format)(const void* args, std::string* out) = nullptr;
+  const void* args = nullptr;
+  int max_rr_ms = 0;        // limit a deferred pause/artifact RR was judged against
+
+  void append_message(std::string* out) const {
+    if (format) format(args, out);
+    else out->append(text);
+  }
+  std::string message() const {
+    std::string m;
+    append_message(&m);
+    return m;
+  }
+};
+
+// The text of a deferred (per-beat) warning, from its condition, RR values
+// and max_rr_ms; what `format` writes for the detectors' own warnings.
+void health_append_beat_message(HealthCondition c, std::span<const int> rr, int max_rr_ms,
+                                std::string* out);
+
+class HealthWarningSink {
+ public:
+  virtual ~HealthWarningSink() = default;
+  virtual void on_warning(const HealthWarning& w) = 0;
+};
+
+// Prints "[time] \a[warn] [source] message" to stderr. Replay mode takes the
+// time from the reading and appends "ts=<ms>" to the source; live mode uses
+// the wall clock.
+class HealthWarningPrinter : public HealthWarningSink {
+ public:
+  explicit HealthWarningPrinter(bool replay) : replay_(replay) {}
+  void on_warning(const HealthWarning& w) override;
+
+ private:
+  bool replay_;
+};
+
+// Coalesces the per-beat warnings (pause/artifact, ectopic) per source and
+// condition; other conditions pass through unchanged. The first one is
+// passed on and opens a window of window_ms (reading time); repeats inside
+// it are only counted (RR range, span) and go out as one "repeated" summary
+// once the window has passed (checked by advance() and on every warning),
+// before the episode's recovery summary, or at flush(). Recovery summaries
+// always pass. Thread-safe.
+class HealthAlertCoalescer : public HealthWarningSink {
+ public:
+  HealthAlertCoalescer(HealthWarningSink* out, long long window_ms)
+      : out_(out), window_ms_(window_ms) {}
+  void on_warning(const HealthWarning& w) override;
+  // Closes the windows that ended by now_ms (reading time), so a burst is
+  // summarised once its window is over rather than at the next warning.
+  void advance(long long now_ms);
+  // Summaries of every open window (end of input, shutdown).
+  void flush();
+
+ private:
+  struct Window {
+    std::string source;
+    HealthCondition condition;
+    long long start_ms = 0;
+    long long last_ms = 0;
+    uint64_t repeats = 0;
+    int rr_min = 0;
+    int rr_max = 0;
+  };
+  void emit_summary(Window* win);
+  void close_expired(long long now_ms);
+
+  HealthWarningSink* out_;
+  long long window_ms_;
+  std::mutex mu_;
+  std::vector<Window> windows_;
+};
+
+// --alert-window in ms (0: every warning is printed).
+extern long long g_health_alert_window_ms;
+
+// Where live captures send warnings: the stderr printer, behind a
+// HealthAlertCoalescer when g_health_alert_window_ms is set (flushed at exit).
+HealthWarningSink* health_live_sink();
+// Reading time of a live sample; closes the live coalescer's ended windows.
+void health_live_advance(long long now_ms);
+
+// Owned copy of a warning, for sinks that keep them.
+// Per-beat warnings keep their text deferred: only the RR values and the
+// limit are stored, and view() formats them when a sink asks.
+struct HealthWarningRecord {
+  long long ts_ms = -1;
+  std::string source;
+  HealthCondition condition = HealthCondition::Bradycardia;
+  bool recovered = false;
+  std::string message;      // empty when deferred
+  std::array<int, 4> rr{};  // HealthWarning::rr (at most four values)
+  uint8_t rr_count = 0;
+  bool deferred = false;
+  int max_rr_ms = 0;
+  HealthWarning view() const {
+    HealthWarning w{ts_ms, source, condition, recovered, message, {rr.data(), rr_count}};
+    if (deferred) {
+      w.format = [](const void* self, std::string* out) {
+        auto* r = static_cast<const HealthWarningRecord*>(self);
+        health_append_beat_message(r->condition, {r->rr.data(), r->rr_count}, r->max_rr_ms,
+                                   out);
+      };
+      w.args = this;
+      w.max_rr_ms = max_rr_ms;
+    }
+    return w;
+  }
+};
+
+class HealthWarningCollector : public HealthWarningSink {
+ public:
+  void on_warning(const HealthWarning& w) override {
+    HealthWarningRecord& r = warnings.emplace_back();
+    r.ts_ms = w.ts_ms;
+    r.source = w.source;
+    r.condition = w.condition;
+    r.recovered = w.recovered;
+    r.rr_count = (uint8_t)std::min(w.rr.size(), r.rr.size());
+    std::copy_n(w.rr.begin(), r.rr_count, r.rr.begin());
+    r.deferred = w.format != nullptr;
+    if (r.deferred) r.max_rr_ms = w.max_rr_ms;
+    else r.message = w.text;
+  }
+  std::vector<HealthWarningRecord> warnings;
+};
+
+// Detector state, one set per strap (live) or per file/device (analysis).
+// operator== compares what can still influence future warnings: episode
+// details are ignored while their episode is not active.
+struct BradycardiaState {
+  bool active = false;
+  long long start_ms = 0;
+  int lowest_bpm = 0;
+  bool operator==(const BradycardiaState& o) const {
+    return active == o.active && (!active || (start_ms == o.start_ms && lowest_bpm == o.lowest_bpm));
+  }
+};
+
+struct TachycardiaState {
+  bool active = false;
+  long long start_ms = 0;
+  int highest_bpm = 0;
+  bool operator==(const TachycardiaState& o) const {
+    return active == o.active && (!active || (start_ms == o.start_ms && highest_bpm == o.highest_bpm));
+  }
+};
+
+struct ArrhythmiaState {
+  AfScreen af;  // last kHealthRRWindow plausible RR values
+  bool possible_af = false;
+  long long af_start_ms = 0;
+  bool pause_active = false;
+  long long pause_start_ms = 0;
+  int pause_min_rr = 0;
+  int pause_max_rr = 0;
+  bool ectopic_active = false;
+  long long ectopic_start_ms = 0;
+  int ectopic_count = 0;
+  bool operator==(const ArrhythmiaState& o) const {
+    return af == o.af && possible_af == o.possible_af &&
+           (!possible_af || af_start_ms == o.af_start_ms) &&
+           pause_active == o.pause_active &&
+           (!pause_active || (pause_start_ms == o.pause_start_ms &&
+                              pause_min_rr == o.pause_min_rr && pause_max_rr == o.pause_max_rr)) &&
+           ectopic_active == o.ectopic_active &&
+           (!ectopic_active || (ectopic_start_ms == o.ectopic_start_ms &&
+                                ectopic_count == o.ectopic_count));
+  }
+};
+
+// The reading a detector is looking at, and where its warnings go.
+class HealthContext {
+ public:
+  HealthContext(long long ts_ms, std::string_view source, const HealthThresholds& limits,
+                HealthWarningSink* sink)
+      : ts_ms_(ts_ms), source_(source), limits_(limits), sink_(sink) {}
+
+  long long ts_ms() const { return ts_ms_; }
+  const HealthThresholds& limits() const { return limits_; }
+  // Milliseconds since `start_ms` (0 if the clock went back).
+  long long since(long long start_ms) const { return (ts_ms_ >= start_ms) ? ts_ms_ - start_ms : 0; }
+  void warn(HealthCondition c, bool recovered, std::string_view message) const {
+    sink_->on_warning(HealthWarning{ts_ms_, source_, c, recovered, message, {}});
+  }
+  // Deferred per-beat text (health_append_beat_message): formatted only if
+  // the sink asks for it.
+  void warn(HealthCondition c, std::span<const int> rr) const {
+    HealthWarning w{ts_ms_, source_, c, false, {}, rr};
+    w.format = [](const void* self, std::string* out) {
+      auto* w = static_cast<const HealthWarning*>(self);
+      health_append_beat_message(w->condition, w->rr, w->max_rr_ms, out);
+    };
+    w.args = &w;
+    w.max_rr_ms = limits_.max_rr_ms;
+    sink_->on_warning(w);
+  }
+
+ private:
+  long long ts_ms_;
+  std::string_view source_;
+  const HealthThresholds& limits_;
+  HealthWarningSink* sink_;
+};
+
+// A pipeline stage: detector state plus on_bpm (readings with BPM) and/or
+// on_rr (readings with RR values) hooks. operator== compares what can still
+// influence future warnings (replay chunks are checked against it).
+template <class D>
+concept HealthDetector =
+    std::copyable<D> && std::equality_comparable<D> &&
+    (requires(D d, const HealthContext& c, int bpm) { d.on_bpm(c, bpm); } ||
+     requires(D d, const HealthContext& c, std::span<const int> rr) { d.on_rr(c, rr); });
+
+// The common case (BPM out of range and no episode) is decided inline; the
+// rest is in feat_health_*.cpp.
+struct BradycardiaDetector {
+  BradycardiaState state;
+  void on_bpm(const HealthContext& c, int bpm) {
+    bool now = (bpm > 0) && (bpm < c.limits().brady_bpm);
+    if (now || state.active) update(c, bpm, now);
+  }
+  void update(const HealthContext& c, int bpm, bool now);
+  bool operator==(const BradycardiaDetector&) const = default;
+};
+
+struct TachycardiaDetector {
+  TachycardiaState state;
+  void on_bpm(const HealthContext& c, int bpm) {
+    bool now = (bpm > 0) && (bpm > c.limits().tachy_bpm);
+    if (now || state.active) update(c, bpm, now);
+  }
+  void update(const HealthContext& c, int bpm, bool now);
+  bool operator==(const TachycardiaDetector&) const = default;
+};
+
+// Pause/artifact, ectopic-like patterns and AF screening over the RR window.
+struct ArrhythmiaDetector {
+  ArrhythmiaState state;
+  void on_rr(const HealthContext& c, std::span<const int> rr_ms);
+  bool operator==(const ArrhythmiaDetector&) const = default;
+};
+
+// Detectors chosen at compile time: each reading runs the on_bpm hooks, then
+// the on_rr hooks, in stage order, as direct calls.
+template <HealthDetector... Stages>
+class HealthPipeline {
+ public:
+  void push(const HealthContext& c, int bpm, std::span<const int> rr_ms) {
+    if (bpm >= 0) std::apply([&](Stages&... s) { (bpm_hook(s, c, bpm), ...); }, stages_);
+    if (!rr_ms.empty()) std::apply([&](Stages&... s) { (rr_hook(s, c, rr_ms), ...); }, stages_);
+  }
+
+  template <class D>
+  const D& get() const { return std::get<D>(stages_); }
+  template <class D>
+  D& get() { return std::get<D>(stages_); }
+  bool operator==(const HealthPipeline&) const = default;
+
+ private:
+  template <class D>
+  static void bpm_hook(D& d, const HealthContext& c, int bpm) {
+    if constexpr (requires { d.on_bpm(c, bpm); }) d.on_bpm(c, bpm);
+  }
+  template <class D>
+  static void rr_hook(D& d, const HealthContext& c, std::span<const int> rr_ms) {
+    if constexpr (requires { d.on_rr(c, rr_ms); }) d.on_rr(c, rr_ms);
+  }
+
+  std::tuple<Stages...> stages_;
+};
+
+// The detectors every monitor runs; a new one is added here.
+using DefaultHealthPipeline =
+    HealthPipeline<BradycardiaDetector, TachycardiaDetector, ArrhythmiaDetector>;
+
+// Runs a pipeline over the readings of one strap (live) or one file/device
+// (analysis). Readings are fed in order, one at a time or in batches; the
+// warnings they raise go to the sink passed with them.
+template <class Pipeline>
+class BasicHealthMonitor {
+ public:
+  explicit BasicHealthMonitor(std::string source = {},
+                              const HealthThresholds& limits = g_health_thresholds)
+      : source_(std::move(source)), limits_(limits) {}
+
+  const std::string& source() const { return source_; }
+  const HealthThresholds& limits() const { return limits_; }
+  const Pipeline& pipeline() const { return pipeline_; }
+  Pipeline& pipeline() { return pipeline_; }
+  // Same source, limits and detector state.
+  bool operator==(const BasicHealthMonitor&) const = default;
+
+  // BPM checks when bpm >= 0, RR checks when rr_ms is non-empty.
+  void push(long long ts_ms, int bpm, std::span<const int> rr_ms, HealthWarningSink* sink) {
+    pipeline_.push(HealthContext(ts_ms, source_, limits_, sink), bpm, rr_ms);
+  }
+  // Reading i is ts_ms[i], bpm[i] and rr_ms[rr_offsets[i], rr_offsets[i + 1]);
+  // rr_offsets has one entry more than ts_ms.
+  void push_batch(std::span<const long long> ts_ms, std::span<const int> bpm,
+                  std::span<const uint32_t> rr_offsets, std::span<const int> rr_ms,
+                  HealthWarningSink* sink) {
+    for (size_t i = 0; i < ts_ms.size(); ++i) {
+      push(ts_ms[i], bpm[i], rr_ms.subspan(rr_offsets[i], rr_offsets[i + 1] - rr_offsets[i]),
+           sink);
+    }
+  }
+
+ private:
+  std::string source_;
+  HealthThresholds limits_;
+  Pipeline pipeline_;
+};
+
+using HealthMonitor = BasicHealthMonitor<DefaultHealthPipeline>;
+
+// Detector state and thresholds of a monitor as bytes (host byte order), for
+// --checkpoint. A new detector's state is added to both functions.
+void health_save_state(const HealthMonitor& m, std::string* out);
+// Restores health_save_state() output into `m`, constructed with the same
+// source, and advances *in past it. Fails with *err set on malformed input
+// or when the thresholds differ from m's.
+bool health_load_state(std::string_view* in, HealthMonitor* m, std::string* err);
+
 std::string health_format_duration(long long ms);
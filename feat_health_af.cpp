@@ -0,0 +1,265 @@
+#include "feat_health_af.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "rrkern.hpp"
+
+namespace {
+
+inline bool turning_point(int a, int b, int c) {
+  return (b > a && b > c) || (b < a && b < c);
+}
+
+inline int64_t sq_diff(int a, int b) {
+  int64_t d = (int64_t)a - b;
+  return d * d;
+}
+
+// p * log(p) for p = c / total, as the entropy sum uses it.
+template <int total>
+struct PLogP {
+  double v[total + 1];
+  PLogP() {
+    v[0] = 0.0;
+    for (int c = 1; c <= total; ++c) {
+      double p = static_cast<double>(c) / static_cast<double>(total);
+      v[c] = p * std::log(p);
+    }
+  }
+};
+
+constexpr int kTrim = 8;
+constexpr int kBins = 16;
+constexpr size_t kMinSegment = 32;
+
+// Normalized Shannon entropy of trimmed bin counts summing to total.
+double entropy16(const int (&counts)[kBins], int total) {
+  constexpr int kSegTotal = (int)kHealthAfWindow - 2 * kTrim;
+  static const PLogP<kSegTotal> plogp;
+  static const double norm = std::log(1.0 / kBins);
+  double se = 0.0;
+  for (int c : counts) {
+    if (c == 0) continue;
+    if (total == kSegTotal) {
+      se -= plogp.v[c];
+    } else {
+      double p = static_cast<double>(c) / static_cast<double>(total);
+      se -= p * std::log(p);
+    }
+  }
+  return se / norm;
+}
+
+}  // namespace
+
+// Short-long-short pattern starting at raw_[i] (needs raw_[i - 1 .. i + 2]).
+bool AfScreen::pattern_at(size_t i) const {
+  double r_prev = static_cast<double>(raw_[i]) / raw_[i - 1];
+  double r_next = static_cast<double>(raw_[i + 1]) / raw_[i];
+  double r_next2 = static_cast<double>(raw_[i + 2]) / raw_[i + 1];
+  return (r_prev <= 0.8) && (r_next >= 1.3) && (r_next2 <= 0.9);
+}
+
+void AfScreen::push(int rr_ms) {
+  if (raw_.full()) {
+    // The first beat is always kept. A pattern at the second one no longer
+    // counts once the first leaves, which brings its two beats back.
+    bool restore = pattern_at(1);
+    raw_.pop_front();
+    kept_pop_front();
+    if (restore) {
+      kept_push_front(raw_[1]);
+      kept_push_front(raw_[0]);
+    }
+  }
+  raw_.push_back(rr_ms);
+  size_t n = raw_.size();
+  // The pattern at n - 3 can be decided now; its two beats are the last kept.
+  if (n >= 4 && pattern_at(n - 3)) {
+    kept_pop_back();
+    kept_pop_back();
+  }
+  kept_push_back(rr_ms);
+}
+
+// ---- kept_ with its trailing segment ----
+void AfScreen::kept_push_back(int v) {
+  kept_.push_back(v);
+  seg_add_back();
+  if (seg_n_ > kHealthAfWindow) seg_remove_front();
+}
+
+void AfScreen::kept_pop_back() {
+  seg_remove_back();
+  kept_.pop_back();
+  if (kept_.size() > seg_n_) seg_add_front();
+}
+
+void AfScreen::kept_push_front(int v) {
+  kept_.push_front(v);
+  if (seg_n_ < kHealthAfWindow) seg_add_front();
+}
+
+void AfScreen::kept_pop_front() {
+  if (seg_n_ == kept_.size()) seg_remove_front();
+  kept_.pop_front();
+}
+
+// kept_.back() joins the segment.
+void AfScreen::seg_add_back() {
+  size_t m = kept_.size();
+  int x = kept_[m - 1];
+  seg_sum_ += x;
+  hist_add(x, 1);
+  if (seg_n_ >= 1) seg_sq_ += sq_diff(x, kept_[m - 2]);
+  if (seg_n_ >= 2) seg_tp_ += turning_point(kept_[m - 3], kept_[m - 2], x);
+  ++seg_n_;
+}
+
+// kept_.back() leaves the segment.
+void AfScreen::seg_remove_back() {
+  size_t m = kept_.size();
+  int x = kept_[m - 1];
+  seg_sum_ -= x;
+  hist_add(x, -1);
+  if (seg_n_ >= 2) seg_sq_ -= sq_diff(x, kept_[m - 2]);
+  if (seg_n_ >= 3) seg_tp_ -= turning_point(kept_[m - 3], kept_[m - 2], x);
+  --seg_n_;
+}
+
+// The value before the segment joins it.
+void AfScreen::seg_add_front() {
+  size_t b = kept_.size() - seg_n_ - 1;
+  int y = kept_[b];
+  seg_sum_ += y;
+  hist_add(y, 1);
+  if (seg_n_ >= 1) seg_sq_ += sq_diff(kept_[b + 1], y);
+  if (seg_n_ >= 2) seg_tp_ += turning_point(y, kept_[b + 1], kept_[b + 2]);
+  ++seg_n_;
+}
+
+// The segment's first value leaves it.
+void AfScreen::seg_remove_front() {
+  size_t b = kept_.size() - seg_n_;
+  int y = kept_[b];
+  seg_sum_ -= y;
+  hist_add(y, -1);
+  if (seg_n_ >= 2) seg_sq_ -= sq_diff(kept_[b + 1], y);
+  if (seg_n_ >= 3) seg_tp_ -= turning_point(y, kept_[b + 1], kept_[b + 2]);
+  --seg_n_;
+}
+
+// ---- value histogram ----
+void AfScreen::hist_add(int v, int d) {
+  for (size_t i = (size_t)(v - kHealthMinRRms) + 1; i < kHistSize; i += i & (~i + 1)) {
+    hist_[i] = (uint16_t)(hist_[i] + d);
+  }
+}
+
+int AfScreen::hist_less(int v) const {
+  if (v <= kHealthMinRRms) return 0;
+  size_t i = std::min((size_t)(v - kHealthMinRRms), kHistSize - 1);
+  int n = 0;
+  for (; i; i &= i - 1) n += hist_[i];
+  return n;
+}
+
+int AfScreen::hist_kth(int k) const {
+  size_t pos = 0;
+  for (size_t step = kHistSize / 2; step; step >>= 1) {
+    if (pos + step < kHistSize && hist_[pos + step] <= k) {
+      pos += step;
+      k -= hist_[pos];
+    }
+  }
+  return (int)pos + kHealthMinRRms;
+}
+
+AfMetrics AfScreen::metrics() const {
+  AfMetrics m;
+  const size_t n = kHealthAfWindow;
+  double rmssd = std::sqrt((double)seg_sq_ / static_cast<double>(n - 1));
+  double meanrr = (double)seg_sum_ / (double)n;
+  m.rmssd_ratio = (meanrr > 0.0) ? (rmssd / meanrr) : std::numeric_limits<double>::quiet_NaN();
+  m.tpr = static_cast<double>(seg_tp_) / static_cast<double>(n - 2);
+
+  // 16 equal-width bins over the segment without its 8 lowest and 8 highest
+  // values. Bins are contiguous value ranges, so each count is a difference
+  // of trimmed ranks at the bin edges.
+  const int total = (int)n - 2 * kTrim;
+  int lo = hist_kth(kTrim);
+  int hi = hist_kth((int)n - kTrim - 1);
+  if (hi <= lo) {
+    m.entropy = 0.0;
+    return m;
+  }
+  auto bin_of = [&](int x) {
+    double t = (double)(x - lo) / (double)(hi - lo);
+    return static_cast<int>(t * kBins);
+  };
+  auto trimmed_less = [&](int v) {
+    return std::clamp(hist_less(v), kTrim, kTrim + total) - kTrim;
+  };
+  int counts[kBins] = {0};
+  int prev = trimmed_less(lo);
+  for (int b = 0; b < kBins; ++b) {
+    int edge = hi + 1;  // first value of the next bin
+    if (b + 1 < kBins) {
+      edge = lo + (int)(((long long)(b + 1) * (hi - lo) + kBins - 1) / kBins);
+      while (edge > lo && bin_of(edge - 1) >= b + 1) --edge;
+      while (bin_of(edge) < b + 1) ++edge;
+    }
+    int cur = trimmed_less(edge);
+    counts[b] = cur - prev;
+    prev = cur;
+  }
+  m.entropy = entropy16(counts, total);
+  return m;
+}
+
+AfMetrics af_segment_metrics(std::span<const int32_t> seg) {
+  AfMetrics m;
+  const RrKernels& k = rr_kernels();
+  const size_t n = seg.size();
+  if (n < kMinSegment) {
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    m.rmssd_ratio = m.tpr = m.entropy = nan;
+    return m;
+  }
+  double rmssd = std::sqrt((double)k.sum_sq_diff(seg.data(), n) / static_cast<double>(n - 1));
+  double meanrr = (double)k.sum(seg.data(), n) / (double)n;
+  m.rmssd_ratio = (meanrr > 0.0) ? (rmssd / meanrr) : std::numeric_limits<double>::quiet_NaN();
+  m.tpr = static_cast<double>(k.turning_points(seg.data(), n)) / static_cast<double>(n - 2);
+
+  thread_local std::vector<int32_t> sorted;
+  sorted.assign(seg.begin(), seg.end());
+  std::nth_element(sorted.begin(), sorted.begin() + kTrim, sorted.end());
+  int32_t lo = sorted[kTrim];
+  std::nth_element(sorted.begin() + kTrim, sorted.end() - kTrim - 1, sorted.end());
+  int32_t hi = sorted[n - kTrim - 1];
+  if (hi <= lo) {
+    m.entropy = 0.0;
+    return m;
+  }
+  // All values in [lo, hi], less the copies of lo and hi that were trimmed.
+  RrHistogram16 h;
+  k.histogram16(seg.data(), n, lo, hi, &h);
+  int counts[kBins];
+  for (int b = 0; b < kBins; ++b) counts[b] = (int)h.bins[b];
+  counts[0] -= kTrim - (int)h.below;
+  counts[kBins - 1] -= kTrim - (int)h.above;
+  m.entropy = entropy16(counts, (int)n - 2 * kTrim);
+  return m;
+}
+
+void af_segment_metrics_batch(std::span<const int32_t> cleaned, size_t window, size_t step,
+                              std::vector<AfMetrics>* out) {
+  out->clear();
+  if (window == 0 || step == 0) return;
+  for (size_t i = 0; i + window <= cleaned.size(); i += step) {
+    out->push_back(af_segment_metrics(cleaned.subspan(i, window)));
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "ringbuf.hpp"
+
+// Plausible RR values kept for the arrhythmia/AF checks.
+inline constexpr size_t kHealthRRWindow = 512;
+inline constexpr int kHealthMinRRms = 250;
+inline constexpr int kHealthMaxRRms = 2500;
+// Cleaned beats the AF metrics are computed over.
+inline constexpr size_t kHealthAfWindow = 128;
+
+struct AfMetrics {
+  double rmssd_ratio = 0.0;  // RMSSD / mean RR
+  double tpr = 0.0;          // turning point ratio
+  double entropy = 0.0;      // normalized Shannon entropy, 16 bins, 8+8 trimmed
+};
+
+// Sliding RR window for the AF screening.
+//
+// Holds the last kHealthRRWindow plausible RR values and keeps the Dash-style
+// cleaning (drop both beats of a short-long-short pattern) and the metrics of
+// the last kHealthAfWindow cleaned beats up to date as values enter and leave,
+// instead of recomputing them per notification. Two patterns cannot start at
+// adjacent beats, so a beat is dropped iff a pattern starts at it or at the
+// beat before; the cleaned sequence therefore only changes at its ends.
+// Sums are kept in integers and the entropy's order statistics come from a
+// value histogram, so the metrics are exactly those of a from-scratch pass.
+class AfScreen {
+ public:
+  // rr_ms in [kHealthMinRRms, kHealthMaxRRms].
+  void push(int rr_ms);
+
+  // Oldest first, contiguous.
+  std::span<const int> raw() const { return raw_.view(); }
+  std::span<const int> cleaned() const { return kept_.view(); }
+  size_t cleaned_size() const { return kept_.size(); }
+  // The last min(kHealthAfWindow, cleaned_size()) cleaned beats.
+  std::span<const int> segment() const { return kept_.last(seg_n_); }
+  // Requires cleaned_size() >= kHealthAfWindow.
+  AfMetrics metrics() const;
+
+  // The rest of the state follows from the raw window.
+  bool operator==(const AfScreen& o) const { return raw_ == o.raw_; }
+
+ private:
+  bool pattern_at(size_t i) const;
+  void kept_push_back(int v);
+  void kept_pop_back();
+  void kept_push_front(int v);
+  void kept_pop_front();
+  void seg_add_back();
+  void seg_remove_back();
+  void seg_add_front();
+  void seg_remove_front();
+  void hist_add(int v, int d);
+  int hist_less(int v) const;  // segment values < v
+  int hist_kth(int k) const;   // k-th smallest segment value, 0-based
+
+  MirroredRing<int, kHealthRRWindow> raw_;
+  MirroredRing<int, kHealthRRWindow> kept_;  // cleaned raw_
+  // Segment: the last seg_n_ values of kept_.
+  size_t seg_n_ = 0;
+  int64_t seg_sum_ = 0;
+  int64_t seg_sq_ = 0;  // sum of squared successive differences
+  int seg_tp_ = 0;      // turning points
+  // Fenwick tree over kHealthMinRRms..kHealthMaxRRms.
+  static constexpr size_t kHistSize = 4096;
+  std::array<uint16_t, kHistSize> hist_{};
+};
+
+// From-scratch metrics of one cleaned segment (at least 32 beats; NaN below)
+// with the vector kernels of rrkern.hpp; for kHealthAfWindow beats this is
+// exactly AfScreen::metrics() of the same segment.
+AfMetrics af_segment_metrics(std::span<const int32_t> seg);
+// Metrics of every `window`-beat segment starting at a multiple of `step` in
+// a cleaned recording (see rr_dash_clean).
+void af_segment_metrics_batch(std::span<const int32_t> cleaned, size_t window, size_t step,
+                              std::vector<AfMetrics>* out);
@@ -0,0 +1,114 @@
+#include "feat_health.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+const char* condition_name(HealthCondition c) {
+  switch (c) {
+    case HealthCondition::PauseArtifact: return "Arrhythmia: pause/artifact";
+    case HealthCondition::Ectopic: return "Arrhythmia: ectopic";
+    default: return "Warning";
+  }
+}
+
+}  // namespace
+
+void HealthAlertCoalescer::on_warning(const HealthWarning& w) {
+  // Episode starts of the other conditions come once per episode already.
+  if (w.condition != HealthCondition::PauseArtifact && w.condition != HealthCondition::Ectopic) {
+    out_->on_warning(w);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  close_expired(w.ts_ms);
+  auto it = std::find_if(windows_.begin(), windows_.end(), [&](const Window& win) {
+    return win.condition == w.condition && win.source == w.source;
+  });
+  if (w.recovered) {
+    if (it != windows_.end()) {
+      emit_summary(&*it);
+      windows_.erase(it);
+    }
+    out_->on_warning(w);
+    return;
+  }
+  if (it != windows_.end() && w.ts_ms - it->start_ms < window_ms_) {
+    // Inside the window (or the clock went back): count only.
+    if (it->repeats++ == 0 && !w.rr.empty()) it->rr_min = it->rr_max = w.rr[0];
+    for (int rr : w.rr) {
+      it->rr_min = std::min(it->rr_min, rr);
+      it->rr_max = std::max(it->rr_max, rr);
+    }
+    it->last_ms = w.ts_ms;
+    return;
+  }
+  if (it == windows_.end()) {
+    windows_.push_back(Window{std::string(w.source), w.condition});
+    it = windows_.end() - 1;
+  }
+  emit_summary(&*it);
+  it->start_ms = it->last_ms = w.ts_ms;
+  out_->on_warning(w);
+}
+
+void HealthAlertCoalescer::advance(long long now_ms) {
+  std::lock_guard<std::mutex> lock(mu_);
+  close_expired(now_ms);
+}
+
+void HealthAlertCoalescer::close_expired(long long now_ms) {
+  std::erase_if(windows_, [&](Window& win) {
+    if (now_ms - win.start_ms < window_ms_) return false;
+    emit_summary(&win);
+    return true;
+  });
+}
+
+void HealthAlertCoalescer::flush() {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto& win : windows_) emit_summary(&win);
+  windows_.clear();
+}
+
+void HealthAlertCoalescer::emit_summary(Window* win) {
+  if (win->repeats == 0) return;
+  char buf[160];
+  int n = std::snprintf(buf, sizeof buf, "%s repeated: count=%llu span=%s",
+                        condition_name(win->condition), (unsigned long long)win->repeats,
+                        health_format_duration(win->last_ms - win->start_ms).c_str());
+  if (win->rr_max > 0) {
+    n += std::snprintf(buf + n, sizeof buf - n, " min_rr=%d max_rr=%d", win->rr_min, win->rr_max);
+  }
+  out_->on_warning(HealthWarning{win->last_ms, win->source, win->condition, false,
+                                 std::string_view(buf, (size_t)n), {}});
+  win->repeats = 0;
+  win->rr_min = win->rr_max = 0;
+}
+
+namespace {
+
+HealthWarningPrinter* live_printer() {
+  static HealthWarningPrinter s_printer(false);
+  return &s_printer;
+}
+
+HealthAlertCoalescer* live_coalescer() {
+  static HealthAlertCoalescer s_coalescer(live_printer(), g_health_alert_window_ms);
+  static bool s_registered = (std::atexit([] { s_coalescer.flush(); }), true);
+  (void)s_registered;
+  return &s_coalescer;
+}
+
+}  // namespace
+
+HealthWarningSink* health_live_sink() {
+  if (g_health_alert_window_ms <= 0) return live_printer();
+  return live_coalescer();
+}
+
+void health_live_advance(long long now_ms) {
+  if (g_health_alert_window_ms > 0) live_coalescer()->advance(now_ms);
+}
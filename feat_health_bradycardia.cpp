@@ -4,25 +4,23 @@
 #include <sstream>
 #include <string>
 
-void health_check_bradycardia(int bpm, long long ts_ms) {
-  static bool s_active = false;
-  static long long s_start_ms = 0;
-  static int s_lowest_bpm = 0;
-  bool now = (bpm > 0) && (bpm < 60);
-  if (now && !s_active) {
-    s_start_ms = ts_ms;
-    s_lowest_bpm = bpm;
-    health_emit_warning("Bradycardia (bpm < 60)");
-  } else if (now && s_active) {
-    s_lowest_bpm = std::min(s_lowest_bpm, bpm);
-  } else if (!now && s_active) {
-    long long dur_ms = (ts_ms >= s_start_ms) ? (ts_ms - s_start_ms) : 0;
-    if (dur_ms > 1000) {
+void BradycardiaDetector::update(const HealthContext& c, int bpm, bool now) {
+  BradycardiaState* st = &state;
+  if (now && !st->active) {
+    st->start_ms = c.ts_ms();
+    st->lowest_bpm = bpm;
+    c.warn(HealthCondition::Bradycardia, false,
+           "Bradycardia (bpm < " + std::to_string(c.limits().brady_bpm) + ")");
+  } else if (now && st->active) {
+    st->lowest_bpm = std::min(st->lowest_bpm, bpm);
+  } else if (!now && st->active) {
+    long long dur_ms = c.since(st->start_ms);
+    if (dur_ms > c.limits().recovery_min_ms) {
       std::ostringstream oss;
-      oss << "Bradycardia recovered: lowest_bpm=" << s_lowest_bpm
+      oss << "Bradycardia recovered: lowest_bpm=" << st->lowest_bpm
           << " duration=" << health_format_duration(dur_ms);
-      health_emit_warning(oss.str());
+      c.warn(HealthCondition::Bradycardia, true, oss.str());
     }
   }
-  s_active = now;
+  st->active = now;
 }
@@ -0,0 +1,122 @@
+#include "feat_query_rollup.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "debug.hpp"
+#include "rollup.hpp"
+
+namespace {
+
+// "<n><s|m|h|d>" in ms.
+bool parse_duration(std::string_view s, int64_t* out) {
+  if (s.size() < 2) return false;
+  int64_t unit = 0;
+  switch (s.back()) {
+    case 's': unit = 1000; break;
+    case 'm': unit = 60 * 1000; break;
+    case 'h': unit = 60 * 60 * 1000; break;
+    case 'd': unit = 24 * 60 * 60 * 1000; break;
+    default: return false;
+  }
+  int64_t n = 0;
+  auto r = std::from_chars(s.data(), s.data() + s.size() - 1, n);
+  if (r.ec != std::errc() || r.ptr != s.data() + s.size() - 1 || n <= 0) return false;
+  *out = n * unit;
+  return true;
+}
+
+bool parse_time(std::string_view s, int64_t now_ms, int64_t* out) {
+  if (s == "now") {
+    *out = now_ms;
+    return true;
+  }
+  int64_t d = 0;
+  if (!s.empty() && s.front() == '-' && parse_duration(s.substr(1), &d)) {
+    *out = now_ms - d;
+    return true;
+  }
+  auto r = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return r.ec == std::errc() && r.ptr == s.data() + s.size() && *out >= 0;
+}
+
+void print_line(std::string_view stem, int64_t from, int64_t to, const RollupBucket& b) {
+  char line[512];
+  int n = std::snprintf(line, sizeof line, "rollup ");
+  if (stem != "default")
+    n += std::snprintf(line + n, sizeof line - n, "%.*s ", (int)std::min<size_t>(stem.size(), 256),
+                       stem.data());
+  n += std::snprintf(line + n, sizeof line - n, "from=%lld to=%lld samples=%u", (long long)from,
+                     (long long)to, b.samples);
+  if (b.samples) {
+    n += std::snprintf(line + n, sizeof line - n, " bpm_min=%u bpm_max=%u bpm_mean=%.1f",
+                       b.bpm_min, b.bpm_max, (double)b.bpm_sum / b.samples);
+  }
+  n += std::snprintf(line + n, sizeof line - n, " rr=%u", b.rr_count);
+  if (b.rr_count) {
+    double mean = (double)b.rr_sum / b.rr_count;
+    double var = (double)b.rr_sq_sum / b.rr_count - mean * mean;
+    n += std::snprintf(line + n, sizeof line - n, " rr_min=%u rr_max=%u rr_mean=%.1f rr_sd=%.1f",
+                       b.rr_min, b.rr_max, mean, std::sqrt(std::max(var, 0.0)));
+  }
+  std::snprintf(line + n, sizeof line - n, "\n");
+  std::fputs(line, stdout);
+}
+
+}  // namespace
+
+int query_rollup(const RollupQuery& q) {
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t from = 0, to = 0, step = 0;
+  if (!parse_time(q.from, now_ms, &from) || !parse_time(q.to, now_ms, &to)) {
+    ERR << "[err] --query: times are <epoch_ms>, 'now' or -<n><s|m|h|d>\n";
+    return EXIT_FAILURE;
+  }
+  if (!q.step.empty() && !parse_duration(q.step, &step)) {
+    ERR << "[err] --query-step requires <n><s|m|h|d>\n";
+    return EXIT_FAILURE;
+  }
+  // Whole seconds: the finest tier.
+  from -= from % 1000;
+  to += (1000 - to % 1000) % 1000;
+  if (to <= from) {
+    ERR << "[err] --query: empty range\n";
+    return EXIT_FAILURE;
+  }
+  if (step == 0) step = to - from;
+
+  std::vector<std::string> stems;
+  if (!q.device.empty()) stems.push_back(rollup_file_stem(q.device));
+  else stems = rollup_list_devices(q.dir);
+  if (stems.empty()) {
+    ERR << "[err] --query: no rollups in " << q.dir << "\n";
+    return EXIT_FAILURE;
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t reads[kRollupTiers] = {};
+  for (const auto& stem : stems) {
+    RollupReader reader;
+    std::string err;
+    if (!reader.open(q.dir, stem, &err)) {
+      ERR << "[err] " << err << "\n";
+      return EXIT_FAILURE;
+    }
+    for (int64_t a = from; a < to; a += step) {
+      int64_t b = std::min(a + step, to);
+      print_line(stem, a, b, reader.range(a, b, reads));
+    }
+  }
+  std::fflush(stdout);
+  DBG << "[dbg] --query: read " << reads[0] << "/" << reads[1] << "/" << reads[2]
+      << " 1s/1m/1h records in "
+      << std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - t0).count()
+      << " us\n";
+  return 0;
+}
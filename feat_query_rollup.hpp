@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+// --query <dir> <from> <to>: aggregates over the rollup store. Times are
+// epoch milliseconds, "now", or "-<n><s|m|h|d>" before now.
+struct RollupQuery {
+  std::string dir;
+  std::string from;
+  std::string to;
+  std::string step;    // --query-step "<n><s|m|h|d>": one line per step
+  std::string device;  // --query-device; empty: every device in dir
+};
+
+int query_rollup(const RollupQuery& q);
@@ -0,0 +1,102 @@
+#include "hrm.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+bool hrm_same_fields(const HrmSample& a, const HrmSample& b) {
+  if (a.ts_ms != b.ts_ms || a.bpm != b.bpm || a.rr_count != b.rr_count) return false;
+  for (size_t i = 0; i < a.rr_count; ++i) {
+    if (a.rr_ms[i] != b.rr_ms[i]) return false;
+  }
+  return true;
+}
+
+bool hrm_parse(const uint8_t* data, size_t len, uint64_t ts_ms, HrmSample* out) {
+  out->ts_ms = ts_ms;
+  out->bpm = -1;
+  out->flags = 0;
+  out->rr_count = 0;
+  out->rr_truncated = 0;
+  if (len == 0) return false;
+
+  uint8_t flags = data[0];
+  size_t idx = 1;
+  out->flags = flags;
+
+  bool hr_16bit   = (flags & 0x01) != 0;
+  bool ee_present = (flags & 0x08) != 0;
+  bool rr_present = (flags & 0x10) != 0;
+
+  if (hr_16bit) {
+    if (len >= idx + 2) {
+      out->bpm = (int)data[idx] | ((int)data[idx + 1] << 8);
+      idx += 2;
+    }
+  } else if (len >= idx + 1) {
+    out->bpm = data[idx];
+    idx += 1;
+  }
+
+  if (ee_present && len >= idx + 2) idx += 2; // skip EE
+
+  if (rr_present) {
+    len = std::min(len, kHrmValueMax);
+    while (len >= idx + 2) {
+      uint16_t rr1024 = (uint16_t)data[idx] | ((uint16_t)data[idx + 1] << 8);
+      idx += 2;
+      out->rr_ms[out->rr_count++] = (int)((rr1024 * 1000ULL + 512ULL) / 1024ULL);
+    }
+  }
+  return true;
+}
+
+static bool parse_uint(std::string_view s, size_t* i, uint64_t* out) {
+  auto r = std::from_chars(s.data() + *i, s.data() + s.size(), *out);
+  if (r.ec != std::errc() || r.ptr == s.data() + *i) return false;
+  *i = (size_t)(r.ptr - s.data());
+  return true;
+}
+
+bool hrm_parse_text_line(std::string_view line, std::string_view* tag, HrmSample* out) {
+  *out = HrmSample{};
+  *tag = {};
+  if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+  size_t sp = line.find(' ');
+  if (sp != std::string_view::npos) {
+    *tag = line.substr(0, sp);
+    line.remove_prefix(sp + 1);
+  }
+  size_t i = 0;
+  uint64_t v = 0;
+  if (!parse_uint(line, &i, &v)) return false;
+  out->ts_ms = v;
+  for (size_t field = 1; i < line.size(); ++field) {
+    if (line[i] != ',') return false;
+    ++i;
+    if (!parse_uint(line, &i, &v) || v > 0x7fffffff) return false;
+    if (field == 1) {
+      out->bpm = (int)v;
+    } else if (out->rr_count < kHrmMaxRR) {
+      out->rr_ms[out->rr_count++] = (int)v;
+    } else {
+      ++out->rr_truncated;
+    }
+  }
+  return true;
+}
+
+size_t hrm_format_line(const HrmSample& s, char* buf, size_t cap) {
+  char* p = buf;
+  char* end = buf + cap;
+  auto r = std::to_chars(p, end, s.ts_ms);
+  p = r.ptr;
+  if (s.bpm >= 0 && p < end) {
+    *p++ = ',';
+    p = std::to_chars(p, end, s.bpm).ptr;
+  }
+  for (size_t i = 0; i < s.rr_count && p < end; ++i) {
+    *p++ = ',';
+    p = std::to_chars(p, end, s.rr_ms[i]).ptr;
+  }
+  return (size_t)(p - buf);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Heart Rate Measurement (0x2a37) payload, parsed without allocation.
+// An ATT attribute value is at most 512 bytes; after the flags byte and an
+// 8-bit BPM that leaves room for 255 RR intervals, so rr_ms holds every RR
+// value a notification can carry. Strap firmware sizes the value for the
+// default MTU (9 RR values at most), so rr_count is usually small.
+inline constexpr size_t kHrmValueMax = 512;
+inline constexpr size_t kHrmMaxRR = (kHrmValueMax - 2) / 2;
+
+struct HrmSample {
+  uint64_t ts_ms = 0;
+  int bpm = -1;             // -1 when the payload is too short
+  uint8_t flags = 0;
+  uint8_t rr_count = 0;
+  uint8_t rr_truncated = 0; // RR values that did not fit (text lines only)
+  int rr_ms[kHrmMaxRR]{};
+
+  std::span<const int> rr() const { return {rr_ms, rr_count}; }
+};
+
+// Same values as the output line would carry (timestamp, BPM, RR list).
+bool hrm_same_fields(const HrmSample& a, const HrmSample& b);
+
+// Parses a raw 2a37 value (at most kHrmValueMax bytes are read); returns
+// false for an empty payload.
+bool hrm_parse(const uint8_t* data, size_t len, uint64_t ts_ms, HrmSample* out);
+
+// "<epoch_ms>[,<bpm>][,<rr_ms>...]" without newline; 20 digits for the
+// timestamp plus ",<int>" per field.
+inline constexpr size_t kHrmLineMax = 20 + (1 + kHrmMaxRR) * 12;
+size_t hrm_format_line(const HrmSample& s, char* buf, size_t cap);
+
+// Inverse of the output line, with the optional "<tag> " prefix of
+// multi-device captures; false for anything else. RR values beyond
+// kHrmMaxRR are counted in rr_truncated.
+bool hrm_parse_text_line(std::string_view line, std::string_view* tag, HrmSample* out);
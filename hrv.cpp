@@ -0,0 +1,378 @@
+#include "hrv.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "debug.hpp"
+#include "feat_health_af.hpp"
+#include "output.hpp"
+
+namespace {
+
+constexpr double kResampleHz = 4.0;
+constexpr long long kResampleStepMs = 250;
+constexpr double kLfLo = 0.04, kLfHi = 0.15, kHfHi = 0.4;
+// Spectral values need the beats to cover this much of the window.
+constexpr double kMinCoverage = 0.9;
+// A sample this much older than the latest one restarts the windows (clock
+// step, or concatenated recordings); less is notification reordering.
+constexpr long long kMaxBackstepMs = 2000;
+
+size_t pow2_at_least(size_t n) {
+  size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+}  // namespace
+
+// ---- FFT ----
+// Real input of length n runs as an n/2-point complex transform of the
+// even/odd pairs; the n-point twiddles serve both (stride 2 for the half).
+FftPlan::FftPlan(size_t n) : n_(n), rev_(n / 2), tw_(n / 2) {
+  size_t h = n / 2;
+  int bits = 0;
+  while (((size_t)1 << bits) < h) ++bits;
+  for (size_t i = 0; i < h; ++i) {
+    uint32_t r = 0;
+    for (int b = 0; b < bits; ++b) r |= (uint32_t)((i >> b) & 1) << (bits - 1 - b);
+    rev_[i] = r;
+  }
+  for (size_t k = 0; k < h; ++k) {
+    double a = -2.0 * M_PI * (double)k / (double)n;
+    tw_[k] = {std::cos(a), std::sin(a)};
+  }
+}
+
+void FftPlan::forward_real(const double* in, std::complex<double>* out) const {
+  const size_t h = n_ / 2;
+  const uint32_t* rev = rev_.data();
+  const std::complex<double>* tw = tw_.data();
+  for (size_t j = 0; j < h; ++j) out[rev[j]] = {in[2 * j], in[2 * j + 1]};
+  for (size_t len = 2; len <= h; len <<= 1) {
+    size_t half = len / 2, stride = 2 * (h / len);
+    for (size_t i = 0; i < h; i += len) {
+      for (size_t j = 0; j < half; ++j) {
+        // Spelled out: std::complex multiplication goes through the
+        // NaN-checking __muldc3 path.
+        const std::complex<double> w = tw[j * stride];
+        const std::complex<double> b = out[i + j + half];
+        std::complex<double> t(w.real() * b.real() - w.imag() * b.imag(),
+                               w.real() * b.imag() + w.imag() * b.real());
+        out[i + j + half] = out[i + j] - t;
+        out[i + j] += t;
+      }
+    }
+  }
+  // Split into the spectra of the even and odd samples and combine.
+  std::complex<double> z0 = out[0];
+  out[0] = {z0.real() + z0.imag(), 0.0};
+  out[h] = {z0.real() - z0.imag(), 0.0};
+  for (size_t k = 1; k <= h / 2; ++k) {
+    std::complex<double> zk = out[k], zm = std::conj(out[h - k]);
+    std::complex<double> e = 0.5 * (zk + zm);
+    std::complex<double> d = zk - zm;
+    std::complex<double> o(0.5 * d.imag(), -0.5 * d.real());  // d / 2i
+    const std::complex<double> w = tw[k];
+    std::complex<double> wo(w.real() * o.real() - w.imag() * o.imag(),
+                            w.real() * o.imag() + w.imag() * o.real());
+    out[k] = e + wo;
+    out[h - k] = std::conj(e - wo);
+  }
+}
+
+const FftPlan& fft_plan(size_t n) {
+  static std::mutex mu;
+  static std::map<size_t, std::unique_ptr<FftPlan>> plans;
+  std::lock_guard<std::mutex> lock(mu);
+  auto& p = plans[n];
+  if (!p) p = std::make_unique<FftPlan>(n);
+  return *p;
+}
+
+// ---- HrvMonitor ----
+HrvMonitor::HrvMonitor(const HrvOptions& opts, std::string source)
+    : source_(std::move(source)), interval_ms_(std::max<uint32_t>(opts.interval_s, 1) * 1000) {
+  std::vector<uint32_t> spans = opts.windows_s;
+  std::sort(spans.begin(), spans.end());
+  spans.erase(std::unique(spans.begin(), spans.end()), spans.end());
+  spans.erase(std::remove(spans.begin(), spans.end(), 0u), spans.end());
+  for (uint32_t s : spans) {
+    Window w;
+    w.span_ms = (long long)s * 1000;
+    size_t samples = (size_t)(w.span_ms / kResampleStepMs) + 1;
+    w.plan = &fft_plan(pow2_at_least(std::max<size_t>(samples, 4)));
+    w.resampled.resize(w.plan->size());
+    w.spectrum.resize(w.plan->size() / 2 + 1);
+    windows_.push_back(std::move(w));
+  }
+  // One beat per kHealthMinRRms over the longest window, plus slack.
+  if (!windows_.empty())
+    ring_.resize(pow2_at_least((size_t)(windows_.back().span_ms / kHealthMinRRms) + 16));
+}
+
+void HrvMonitor::push(long long ts_ms, std::span<const int> rr_ms, HrvSink* sink) {
+  if (windows_.empty()) return;
+  if (ts_ms < now_ms_ - kMaxBackstepMs) {
+    for (Window& w : windows_) {
+      w.first = head_;
+      w.n = w.sum = w.sum_sq = w.pairs = w.sum_sq_diff = w.nn50 = 0;
+    }
+    now_ms_ = ts_ms;
+    next_report_ms_ = -1;
+  }
+  // The last RR ends at ts; walk back to where the first one ends.
+  long long t = ts_ms;
+  for (size_t i = rr_ms.size(); i-- > 1;) t -= rr_ms[i];
+  for (size_t i = 0; i < rr_ms.size(); ++i) {
+    if (i) t += rr_ms[i];
+    add_beat(t, rr_ms[i]);
+  }
+  now_ms_ = std::max(now_ms_, ts_ms);
+  expire(now_ms_);
+
+  // Reports fall on multiples of the interval, so a replay chunk warmed up
+  // from any point reports at the same times.
+  long long next = (now_ms_ / interval_ms_ + 1) * interval_ms_;
+  if (next_report_ms_ >= 0 && now_ms_ >= next_report_ms_ && sink) {
+    for (size_t i = 0; i < windows_.size(); ++i) {
+      if (windows_[i].n >= 2) sink->on_report(report(i));
+    }
+  }
+  next_report_ms_ = next;
+}
+
+void HrvMonitor::push_batch(std::span<const long long> ts_ms, std::span<const uint32_t> rr_offsets,
+                            std::span<const int> rr_ms, HrvSink* sink) {
+  for (size_t i = 0; i < ts_ms.size(); ++i) {
+    push(ts_ms[i], rr_ms.subspan(rr_offsets[i], rr_offsets[i + 1] - rr_offsets[i]), sink);
+  }
+}
+
+void HrvMonitor::add_beat(long long t_ms, int rr_ms) {
+  if (rr_ms < kHealthMinRRms || rr_ms > kHealthMaxRRms) return;
+  bool joined = false;
+  Window& all = windows_.back();
+  if (all.n > 0) {
+    const Beat& prev = beat(head_ - 1);
+    if (t_ms <= prev.t_ms) return;  // overlaps what we have (duplicate or clock step)
+    // Notification jitter moves beat ends a little; a missing beat moves
+    // them by at least a whole RR.
+    long long gap = std::llabs(t_ms - rr_ms - prev.t_ms);
+    joined = gap <= std::min(rr_ms, prev.rr_ms) / 2;
+  }
+  if (head_ - all.first == ring_.size()) {
+    std::vector<Beat> grown(ring_.size() * 2);
+    for (uint64_t i = all.first; i < head_; ++i) grown[i & (grown.size() - 1)] = beat(i);
+    ring_ = std::move(grown);
+  }
+  uint64_t i = head_++;
+  ring_[i & (ring_.size() - 1)] = Beat{t_ms, rr_ms, joined};
+  for (Window& w : windows_) add_to(w, i);
+}
+
+void HrvMonitor::add_to(Window& w, uint64_t i) {
+  const Beat& b = beat(i);
+  if (w.n > 0 && b.joined) {
+    int64_t d = b.rr_ms - beat(i - 1).rr_ms;
+    ++w.pairs;
+    w.sum_sq_diff += d * d;
+    w.nn50 += (d > 50 || d < -50);
+  }
+  ++w.n;
+  w.sum += b.rr_ms;
+  w.sum_sq += (int64_t)b.rr_ms * b.rr_ms;
+}
+
+// Beat i is the oldest in w.
+void HrvMonitor::remove_from(Window& w, uint64_t i) {
+  const Beat& b = beat(i);
+  if (i + 1 < head_ && beat(i + 1).joined) {
+    int64_t d = beat(i + 1).rr_ms - b.rr_ms;
+    --w.pairs;
+    w.sum_sq_diff -= d * d;
+    w.nn50 -= (d > 50 || d < -50);
+  }
+  --w.n;
+  w.sum -= b.rr_ms;
+  w.sum_sq -= (int64_t)b.rr_ms * b.rr_ms;
+}
+
+void HrvMonitor::expire(long long now_ms) {
+  for (Window& w : windows_) {
+    while (w.first < head_ && beat(w.first).t_ms <= now_ms - w.span_ms) {
+      remove_from(w, w.first);
+      ++w.first;
+    }
+  }
+}
+
+HrvReport HrvMonitor::report(size_t i) const {
+  const Window& w = windows_[i];
+  HrvReport r;
+  r.ts_ms = now_ms_;
+  r.source = source_;
+  r.window_s = (uint32_t)(w.span_ms / 1000);
+  r.beats = (uint32_t)w.n;
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  r.mean_rr = w.n ? (double)w.sum / (double)w.n : nan;
+  r.sdnn = (w.n >= 2) ? std::sqrt((double)(w.n * w.sum_sq - w.sum * w.sum) /
+                                  ((double)w.n * (double)(w.n - 1)))
+                      : nan;
+  r.rmssd = w.pairs ? std::sqrt((double)w.sum_sq_diff / (double)w.pairs) : nan;
+  r.pnn50 = w.pairs ? 100.0 * (double)w.nn50 / (double)w.pairs : nan;
+  spectral(w, &r.lf, &r.hf);
+  return r;
+}
+
+// Periodogram of the window: mean removed, Hann-windowed, zero-padded.
+void HrvMonitor::spectral(const Window& w, double* lf, double* hf) const {
+  *lf = *hf = std::numeric_limits<double>::quiet_NaN();
+  if (w.n < 4) return;
+  const Beat& first = beat(w.first);
+  const Beat& last = beat(head_ - 1);
+  if ((double)(last.t_ms - (first.t_ms - first.rr_ms)) < kMinCoverage * (double)w.span_ms) return;
+
+  // Linear interpolation of the tachogram at 4 Hz.
+  size_t m = std::min(w.resampled.size(), (size_t)((last.t_ms - first.t_ms) / kResampleStepMs) + 1);
+  uint64_t k = w.first;
+  double mean = 0.0;
+  for (size_t j = 0; j < m; ++j) {
+    long long t = first.t_ms + (long long)j * kResampleStepMs;
+    while (k + 2 < head_ && beat(k + 1).t_ms < t) ++k;
+    const Beat& a = beat(k);
+    const Beat& b = beat(std::min(k + 1, head_ - 1));
+    double v = a.rr_ms;
+    if (b.t_ms > a.t_ms) {
+      double f = std::clamp((double)(t - a.t_ms) / (double)(b.t_ms - a.t_ms), 0.0, 1.0);
+      v += f * (double)(b.rr_ms - a.rr_ms);
+    }
+    w.resampled[j] = v;
+    mean += v;
+  }
+  mean /= (double)m;
+  if (m < 4) return;
+
+  // Hann window, with the cosine advanced by rotation.
+  size_t n = w.plan->size();
+  double step = 2.0 * M_PI / (double)(m - 1);
+  double rc = std::cos(step), rs = std::sin(step);
+  double c = 1.0, sn = 0.0;
+  double u = 0.0;
+  for (size_t j = 0; j < m; ++j) {
+    double hann = 0.5 * (1.0 - c);
+    u += hann * hann;
+    w.resampled[j] = (w.resampled[j] - mean) * hann;
+    double c2 = c * rc - sn * rs;
+    sn = sn * rc + c * rs;
+    c = c2;
+  }
+  std::fill(w.resampled.begin() + (ptrdiff_t)m, w.resampled.end(), 0.0);
+  w.plan->forward_real(w.resampled.data(), w.spectrum.data());
+
+  // One-sided power per bin: 2 |X_k|^2 / (N * sum w^2), in ms^2.
+  double lf_sum = 0.0, hf_sum = 0.0;
+  double df = kResampleHz / (double)n;
+  for (size_t b = 1; b < n / 2; ++b) {
+    double f = (double)b * df;
+    if (f < kLfLo || f >= kHfHi) continue;
+    double p = 2.0 * std::norm(w.spectrum[b]) / ((double)n * u);
+    (f < kLfHi ? lf_sum : hf_sum) += p;
+  }
+  *lf = lf_sum;
+  *hf = hf_sum;
+}
+
+bool HrvMonitor::operator==(const HrvMonitor& o) const {
+  if (windows_.size() != o.windows_.size() || now_ms_ != o.now_ms_ ||
+      next_report_ms_ != o.next_report_ms_)
+    return false;
+  if (windows_.empty()) return true;
+  for (size_t i = 0; i < windows_.size(); ++i) {
+    if (windows_[i].span_ms != o.windows_[i].span_ms) return false;
+    if (head_ - windows_[i].first != o.head_ - o.windows_[i].first) return false;
+  }
+  uint64_t n = head_ - windows_.back().first;
+  for (uint64_t i = 1; i <= n; ++i) {
+    const Beat& a = beat(head_ - i);
+    const Beat& b = o.beat(o.head_ - i);
+    // The oldest beat's join flag no longer counts.
+    if (a.t_ms != b.t_ms || a.rr_ms != b.rr_ms || (i < n && a.joined != b.joined)) return false;
+  }
+  return true;
+}
+
+// ---- output ----
+size_t hrv_format_line(const HrvReport& r, char* buf, size_t cap) {
+  int n = std::snprintf(buf, cap,
+                        "hrv %.*s%sts=%lld window=%us beats=%u mean_rr=%.1f sdnn=%.1f rmssd=%.1f "
+                        "pnn50=%.1f lf=%.1f hf=%.1f lf_hf=%.3f\n",
+                        (int)r.source.size(), r.source.data(), r.source.empty() ? "" : " ",
+                        r.ts_ms, r.window_s, r.beats, r.mean_rr, r.sdnn, r.rmssd, r.pnn50, r.lf,
+                        r.hf, r.lf / r.hf);
+  if (n < 0) return 0;
+  return std::min((size_t)n, cap - 1);
+}
+
+namespace {
+
+class HrvWriter : public HrvSink {
+ public:
+  HrvWriter(int fd, const OutputOptions& opts) : w_(fd, opts) {}
+  // --pipeline workers share the stream.
+  void on_report(const HrvReport& r) override {
+    char line[512];
+    size_t n = hrv_format_line(r, line, sizeof(line));
+    std::lock_guard<std::mutex> lock(mu_);
+    w_.append(std::string_view(line, n));
+  }
+  void flush() {
+    std::lock_guard<std::mutex> lock(mu_);
+    w_.flush();
+  }
+
+ private:
+  std::mutex mu_;
+  BufferedWriter w_;
+};
+
+std::unique_ptr<HrvWriter> s_hrv_out;
+
+}  // namespace
+
+bool hrv_output_open(std::string_view path, int default_fd, bool batched) {
+  int fd = default_fd;
+  if (path == "-") {
+    fd = STDOUT_FILENO;
+  } else if (!path.empty()) {
+    fd = ::open(std::string(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      ERR << "[err] cannot open HRV output " << path << ": " << strerror(errno) << "\n";
+      return false;
+    }
+  }
+  OutputOptions opts;
+  if (batched) opts.flush_ms = UINT64_MAX / 2;
+  opts.buffer_bytes = 64 * 1024;
+  s_hrv_out = std::make_unique<HrvWriter>(fd, opts);
+  return true;
+}
+
+HrvSink* hrv_output() {
+  return s_hrv_out.get();
+}
+
+void hrv_output_flush() {
+  if (s_hrv_out) s_hrv_out->flush();
+}
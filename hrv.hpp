@@ -0,0 +1,140 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Rolling-window heart rate variability (--hrv) from the RR stream.
+//
+// Beats are timed from the sample timestamp: the last RR of a notification
+// ends at its ts, earlier ones are counted back from it. Successive
+// differences are only taken between beats that join up (no missing beat in
+// between), and the time-domain sums are updated as beats enter and leave a
+// window. LF/HF come from the tachogram resampled at 4 Hz through a
+// preallocated radix-2 FFT, once per report.
+
+struct HrvOptions {
+  std::vector<uint32_t> windows_s;  // e.g. {60, 300}; empty disables HRV
+  uint32_t interval_s = 10;         // report cadence in sample time
+  bool enabled() const { return !windows_s.empty(); }
+};
+
+// --hrv / --hrv-interval (main.cpp).
+extern HrvOptions g_hrv;
+
+struct HrvReport {
+  long long ts_ms = 0;
+  std::string_view source;
+  uint32_t window_s = 0;
+  uint32_t beats = 0;
+  double mean_rr = 0.0;  // ms
+  double sdnn = 0.0;     // ms
+  double rmssd = 0.0;    // ms
+  double pnn50 = 0.0;    // %
+  double lf = 0.0;       // ms^2, 0.04-0.15 Hz; NaN until the window is covered
+  double hf = 0.0;       // ms^2, 0.15-0.4 Hz
+};
+
+class HrvSink {
+ public:
+  virtual ~HrvSink() = default;
+  virtual void on_report(const HrvReport& r) = 0;
+};
+
+// Owned copy of a report, for replay chunks merged later.
+struct HrvRecord {
+  HrvReport report;
+  std::string source;
+  HrvReport view() const {
+    HrvReport r = report;
+    r.source = source;
+    return r;
+  }
+};
+
+class HrvCollector : public HrvSink {
+ public:
+  void on_report(const HrvReport& r) override {
+    reports.push_back(HrvRecord{r, std::string(r.source)});
+  }
+  std::vector<HrvRecord> reports;
+};
+
+// "hrv [<source> ]ts=<ms> window=<s>s beats=<n> mean_rr=... sdnn=... rmssd=...
+// pnn50=... lf=... hf=... lf_hf=..." lines.
+size_t hrv_format_line(const HrvReport& r, char* buf, size_t cap);
+
+// Process-wide HRV stream. `path` "-" is stdout, empty keeps `default_fd`.
+// `batched` buffers until flushed (or exit) instead of writing each line.
+bool hrv_output_open(std::string_view path, int default_fd, bool batched);
+HrvSink* hrv_output();  // nullptr until opened
+void hrv_output_flush();
+
+// Radix-2 FFT of real input of one size, with precomputed twiddles and bit
+// reversal; plans are built once per size and shared.
+class FftPlan {
+ public:
+  explicit FftPlan(size_t n);  // n a power of two, at least 4
+  size_t size() const { return n_; }
+  // Bins 0..n/2 of the DFT of in[0..n).
+  void forward_real(const double* in, std::complex<double>* out) const;
+
+ private:
+  size_t n_;
+  std::vector<uint32_t> rev_;             // n / 2 point bit reversal
+  std::vector<std::complex<double>> tw_;  // e^(-2 pi i k / n), k < n / 2
+};
+const FftPlan& fft_plan(size_t n);  // thread-safe
+
+class HrvMonitor {
+ public:
+  HrvMonitor() = default;
+  HrvMonitor(const HrvOptions& opts, std::string source);
+
+  bool enabled() const { return !windows_.empty(); }
+  const std::string& source() const { return source_; }
+
+  void push(long long ts_ms, std::span<const int> rr_ms, HrvSink* sink);
+  void push_batch(std::span<const long long> ts_ms, std::span<const uint32_t> rr_offsets,
+                  std::span<const int> rr_ms, HrvSink* sink);
+  // Report for window i as of the last push.
+  HrvReport report(size_t i) const;
+
+  // Same beats in every window and the same next report time.
+  bool operator==(const HrvMonitor& o) const;
+
+ private:
+  struct Beat {
+    long long t_ms;  // end of the beat
+    int rr_ms;
+    bool joined;     // follows the previous beat without a gap
+  };
+  struct Window {
+    long long span_ms = 0;
+    uint64_t first = 0;  // absolute index of the oldest beat inside
+    int64_t n = 0, sum = 0, sum_sq = 0;
+    int64_t pairs = 0, sum_sq_diff = 0, nn50 = 0;
+    // Spectral scratch, sized for the window at construction.
+    const FftPlan* plan = nullptr;
+    mutable std::vector<double> resampled;
+    mutable std::vector<std::complex<double>> spectrum;
+  };
+
+  const Beat& beat(uint64_t i) const { return ring_[i & (ring_.size() - 1)]; }
+  void add_beat(long long t_ms, int rr_ms);
+  void add_to(Window& w, uint64_t i);
+  void remove_from(Window& w, uint64_t i);
+  void expire(long long now_ms);
+  void spectral(const Window& w, double* lf, double* hf) const;
+
+  std::string source_;
+  std::vector<Window> windows_;  // ascending span; the last one holds every beat
+  uint32_t interval_ms_ = 0;
+  std::vector<Beat> ring_;       // power-of-two size, grows when full
+  uint64_t head_ = 0;            // absolute index one past the newest beat
+  long long now_ms_ = 0;          // latest sample ts
+  long long next_report_ms_ = -1;
+};
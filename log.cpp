@@ -0,0 +1,404 @@
+#include "log.hpp"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Record encoding: a tag byte and its payload.
+constexpr char kStr = 's';    // u16 length + bytes
+constexpr char kInt = 'i';    // int64
+constexpr char kUint = 'u';   // uint64
+constexpr char kDouble = 'd';
+constexpr char kPtr = 'p';    // uintptr_t
+constexpr char kBytes = 'x';  // u16 length + bytes, dumped as hex
+constexpr char kHexOn = 'h';
+constexpr char kHexOff = 'z';
+
+constexpr size_t kSlots = 1024;  // power of two
+
+struct Slot {
+  std::atomic<uint64_t> seq;
+  long long sec;
+  uint16_t len;
+  bool truncated;
+  char data[kLogRecordBytes];
+};
+
+// Bounded MPSC ring (per-slot sequence numbers): a producer claims a
+// position with one CAS, fills the slot and publishes it through its
+// sequence; the single consumer hands the slot back the same way.
+struct Logger {
+  Slot slots[kSlots];
+  alignas(64) std::atomic<uint64_t> enqueue_pos{0};
+  alignas(64) std::atomic<uint64_t> consumed{0};
+  uint64_t dequeue_pos = 0;  // log thread only
+
+  std::mutex mu;
+  std::condition_variable wake;
+  std::condition_variable drained;
+  std::atomic<bool> consumer_idle{false};
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> inline_mode{false};  // after shutdown: format in the caller
+  std::atomic<bool> started{false};
+  std::thread thread;
+
+  // Formatting state; the log thread's, or the caller's under inline_mu.
+  std::mutex inline_mu;
+  long long stamp_sec = -1;
+  char stamp[32];
+  size_t stamp_len = 0;
+  std::string out;
+
+  Logger() {
+    for (size_t i = 0; i < kSlots; ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+};
+
+// Never destroyed: threads may still log while statics go away at exit.
+Logger& logger() {
+  static Logger* l = new Logger;
+  return *l;
+}
+
+void write_all(const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t w = ::write(STDERR_FILENO, p, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return;
+    p += w;
+    n -= (size_t)w;
+  }
+}
+
+template <class T>
+T read_raw(const char*& p) {
+  T v;
+  std::memcpy(&v, p, sizeof(v));
+  p += sizeof(v);
+  return v;
+}
+
+void append_stamp(Logger& l, long long sec) {
+  if (sec != l.stamp_sec) {
+    std::time_t t = static_cast<std::time_t>(sec);
+    std::tm tm{};
+    localtime_r(&t, &tm);
+    l.stamp[0] = '[';
+    size_t n = std::strftime(l.stamp + 1, sizeof(l.stamp) - 3, "%Y-%m-%d %H:%M:%S", &tm);
+    l.stamp[n + 1] = ']';
+    l.stamp[n + 2] = ' ';
+    l.stamp_len = n + 3;
+    l.stamp_sec = sec;
+  }
+  l.out.append(l.stamp, l.stamp_len);
+}
+
+void format_record(Logger& l, long long sec, const char* p, size_t len, bool truncated) {
+  append_stamp(l, sec);
+  const char* end = p + len;
+  bool hex = false;
+  char num[32];
+  while (p < end) {
+    char tag = *p++;
+    switch (tag) {
+      case kStr: {
+        uint16_t n = read_raw<uint16_t>(p);
+        l.out.append(p, n);
+        p += n;
+        break;
+      }
+      case kBytes: {
+        static const char kDigits[] = "0123456789abcdef";
+        uint16_t n = read_raw<uint16_t>(p);
+        for (uint16_t i = 0; i < n; ++i) {
+          uint8_t b = (uint8_t)p[i];
+          if (i) l.out.push_back(' ');
+          l.out.push_back(kDigits[b >> 4]);
+          l.out.push_back(kDigits[b & 15]);
+        }
+        p += n;
+        break;
+      }
+      case kInt: {
+        int64_t v = read_raw<int64_t>(p);
+        // Like ostream: negative values print as two's complement in hex.
+        auto r = hex ? std::to_chars(num, num + sizeof(num), (uint64_t)v, 16)
+                     : std::to_chars(num, num + sizeof(num), v);
+        l.out.append(num, r.ptr);
+        break;
+      }
+      case kUint: {
+        uint64_t v = read_raw<uint64_t>(p);
+        auto r = std::to_chars(num, num + sizeof(num), v, hex ? 16 : 10);
+        l.out.append(num, r.ptr);
+        break;
+      }
+      case kDouble: {
+        int n = std::snprintf(num, sizeof(num), "%g", read_raw<double>(p));
+        l.out.append(num, (size_t)n);
+        break;
+      }
+      case kPtr: {
+        uintptr_t v = read_raw<uintptr_t>(p);
+        if (v) {
+          l.out += "0x";
+          auto r = std::to_chars(num, num + sizeof(num), (uint64_t)v, 16);
+          l.out.append(num, r.ptr);
+        } else {
+          l.out.push_back('0');
+        }
+        break;
+      }
+      case kHexOn: hex = true; break;
+      case kHexOff: hex = false; break;
+      default: p = end; break;
+    }
+  }
+  if (truncated) l.out += " [...]\n";
+}
+
+void log_thread_main(Logger* l) {
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+  for (;;) {
+    size_t n = 0;
+    for (;;) {
+      Slot& s = l->slots[l->dequeue_pos & (kSlots - 1)];
+      if (s.seq.load(std::memory_order_acquire) != l->dequeue_pos + 1) break;
+      format_record(*l, s.sec, s.data, s.len, s.truncated);
+      s.seq.store(l->dequeue_pos + kSlots, std::memory_order_release);
+      ++l->dequeue_pos;
+      ++n;
+      if (l->out.size() >= 64 * 1024) break;
+    }
+    if (!l->out.empty()) {
+      write_all(l->out.data(), l->out.size());
+      l->out.clear();
+    }
+    if (n) {
+      l->consumed.store(l->dequeue_pos, std::memory_order_release);
+      std::lock_guard<std::mutex> lock(l->mu);
+      l->drained.notify_all();
+      continue;
+    }
+    if (l->stopping.load(std::memory_order_acquire)) break;
+
+    std::unique_lock<std::mutex> lock(l->mu);
+    l->consumer_idle.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Slot& s = l->slots[l->dequeue_pos & (kSlots - 1)];
+    if (s.seq.load(std::memory_order_acquire) != l->dequeue_pos + 1 &&
+        !l->stopping.load(std::memory_order_acquire)) {
+      l->wake.wait_for(lock, std::chrono::milliseconds(200));
+    }
+    l->consumer_idle.store(false, std::memory_order_relaxed);
+  }
+}
+
+void wake_consumer(Logger& l) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (l.consumer_idle.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(l.mu);
+    l.wake.notify_one();
+  }
+}
+
+void log_shutdown() {
+  Logger& l = logger();
+  l.stopping.store(true, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(l.mu);
+    l.wake.notify_one();
+  }
+  if (l.started.load(std::memory_order_acquire)) l.thread.join();
+  l.inline_mode.store(true, std::memory_order_release);
+  // Records published between the last drain and the flag above.
+  std::lock_guard<std::mutex> lock(l.inline_mu);
+  for (;; ++l.dequeue_pos) {
+    Slot& s = l.slots[l.dequeue_pos & (kSlots - 1)];
+    if (s.seq.load(std::memory_order_acquire) != l.dequeue_pos + 1) break;
+    format_record(l, s.sec, s.data, s.len, s.truncated);
+    s.seq.store(l.dequeue_pos + kSlots, std::memory_order_release);
+  }
+  write_all(l.out.data(), l.out.size());
+  l.out.clear();
+}
+
+void start_thread() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    Logger& l = logger();
+    l.thread = std::thread(log_thread_main, &l);
+    l.started.store(true, std::memory_order_release);
+    std::atexit(log_shutdown);
+  });
+}
+
+long long now_sec() {
+  timespec ts{};
+#ifdef CLOCK_REALTIME_COARSE
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+  clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+  return (long long)ts.tv_sec;
+}
+
+}  // namespace
+
+LogLine::LogLine() : sec_(now_sec()) {}
+LogLine::LogLine(long long epoch_s) : sec_(epoch_s) {}
+
+LogLine::~LogLine() {
+  Logger& l = logger();
+  if (l.inline_mode.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(l.inline_mu);
+    format_record(l, sec_, buf_, len_, truncated_);
+    write_all(l.out.data(), l.out.size());
+    l.out.clear();
+    return;
+  }
+  start_thread();
+
+  uint64_t pos = l.enqueue_pos.load(std::memory_order_relaxed);
+  Slot* s;
+  for (;;) {
+    s = &l.slots[pos & (kSlots - 1)];
+    uint64_t seq = s->seq.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)(seq - pos);
+    if (diff == 0) {
+      if (l.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      // Full: let the log thread catch up.
+      wake_consumer(l);
+      std::this_thread::yield();
+      pos = l.enqueue_pos.load(std::memory_order_relaxed);
+    } else {
+      pos = l.enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  s->sec = sec_;
+  s->len = len_;
+  s->truncated = truncated_;
+  std::memcpy(s->data, buf_, len_);
+  s->seq.store(pos + 1, std::memory_order_release);
+  wake_consumer(l);
+}
+
+bool LogLine::reserve(size_t n) {
+  if (len_ + n <= kLogRecordBytes) return true;
+  truncated_ = true;
+  return false;
+}
+
+void LogLine::put_bytes(char tag, const void* p, size_t n) {
+  if (truncated_) return;
+  // Strings are cut to what fits rather than dropped.
+  size_t room = kLogRecordBytes - len_;
+  if (room < 1 + sizeof(uint16_t)) {
+    truncated_ = true;
+    return;
+  }
+  if (n > room - 1 - sizeof(uint16_t)) {
+    n = room - 1 - sizeof(uint16_t);
+    truncated_ = true;
+  }
+  uint16_t n16 = (uint16_t)n;
+  buf_[len_++] = tag;
+  std::memcpy(buf_ + len_, &n16, sizeof(n16));
+  len_ += sizeof(n16);
+  std::memcpy(buf_ + len_, p, n);
+  len_ += n16;
+}
+
+LogLine& LogLine::operator<<(const char* s) {
+  if (!s) s = "(null)";
+  put_bytes(kStr, s, std::strlen(s));
+  return *this;
+}
+
+LogLine& LogLine::operator<<(std::string_view s) {
+  put_bytes(kStr, s.data(), s.size());
+  return *this;
+}
+
+LogLine& LogLine::operator<<(char c) {
+  put_bytes(kStr, &c, 1);
+  return *this;
+}
+
+LogLine& LogLine::operator<<(LogHex h) {
+  put_bytes(kBytes, h.data, h.size);
+  return *this;
+}
+
+void LogLine::put_int(int64_t v) {
+  if (truncated_ || !reserve(1 + sizeof(v))) return;
+  buf_[len_++] = kInt;
+  std::memcpy(buf_ + len_, &v, sizeof(v));
+  len_ += sizeof(v);
+}
+
+void LogLine::put_uint(uint64_t v) {
+  if (truncated_ || !reserve(1 + sizeof(v))) return;
+  buf_[len_++] = kUint;
+  std::memcpy(buf_ + len_, &v, sizeof(v));
+  len_ += sizeof(v);
+}
+
+LogLine& LogLine::operator<<(double v) {
+  if (truncated_ || !reserve(1 + sizeof(v))) return *this;
+  buf_[len_++] = kDouble;
+  std::memcpy(buf_ + len_, &v, sizeof(v));
+  len_ += sizeof(v);
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const void* p) {
+  uintptr_t v = (uintptr_t)p;
+  if (truncated_ || !reserve(1 + sizeof(v))) return *this;
+  buf_[len_++] = kPtr;
+  std::memcpy(buf_ + len_, &v, sizeof(v));
+  len_ += sizeof(v);
+  return *this;
+}
+
+LogLine& LogLine::operator<<(std::ios_base& (*manip)(std::ios_base&)) {
+  char tag = 0;
+  if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::hex)) tag = kHexOn;
+  else if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::dec)) tag = kHexOff;
+  if (tag && !truncated_ && reserve(1)) buf_[len_++] = tag;
+  return *this;
+}
+
+void log_flush() {
+  Logger& l = logger();
+  if (l.inline_mode.load(std::memory_order_acquire) ||
+      !l.started.load(std::memory_order_acquire)) return;
+  uint64_t target = l.enqueue_pos.load(std::memory_order_acquire);
+  {
+    std::lock_guard<std::mutex> lock(l.mu);
+    l.wake.notify_one();
+  }
+  std::unique_lock<std::mutex> lock(l.mu);
+  while (l.consumed.load(std::memory_order_acquire) < target) {
+    l.drained.wait_for(lock, std::chrono::milliseconds(10));
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <string_view>
+
+// Stderr logging behind ERR/DBG (debug.hpp). A log statement only encodes
+// its arguments (strings are copied, numbers stored raw) into one fixed-size
+// record; a background thread takes records off a lock-free multi-producer
+// ring, formats them and writes them out in batches. The "[date time] "
+// prefix is formatted once per second. Each record is written whole, so
+// lines from different threads never interleave.
+//
+// Records are drained at exit; from then on, and when the ring is full,
+// nothing is lost: the exit path formats inline and a full ring makes the
+// caller wait for room.
+
+inline constexpr size_t kLogRecordBytes = 496;
+
+// "raw=[01 02 ...]" style dump of bytes, formatted on the log thread.
+struct LogHex {
+  const uint8_t* data;
+  size_t size;
+};
+
+class LogLine {
+ public:
+  LogLine();                       // stamped with the current second
+  explicit LogLine(long long epoch_s);  // stamped with a given second (replay)
+  ~LogLine();
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  LogLine& operator<<(const char* s);
+  LogLine& operator<<(std::string_view s);
+  LogLine& operator<<(char c);
+  LogLine& operator<<(signed char c) { return *this << (char)c; }
+  LogLine& operator<<(unsigned char c) { return *this << (char)c; }
+  LogLine& operator<<(bool b) { return *this << (b ? '1' : '0'); }
+  LogLine& operator<<(double v);
+  LogLine& operator<<(const void* p);
+  LogLine& operator<<(LogHex h);
+  // std::hex and std::dec; other manipulators are ignored.
+  LogLine& operator<<(std::ios_base& (*manip)(std::ios_base&));
+
+  template <std::integral T>
+  LogLine& operator<<(T v) {
+    if constexpr (std::is_signed_v<T>) put_int((int64_t)v);
+    else put_uint((uint64_t)v);
+    return *this;
+  }
+
+ private:
+  void put_int(int64_t v);
+  void put_uint(uint64_t v);
+  bool reserve(size_t n);
+  void put_bytes(char tag, const void* p, size_t n);
+
+  long long sec_;
+  uint16_t len_ = 0;
+  bool truncated_ = false;
+  char buf_[kLogRecordBytes];
+};
+
+// Blocks until everything logged so far is written.
+void log_flush();
@@ -0,0 +1,291 @@
+#include "logscan.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LOGSCAN_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LOGSCAN_NEON 1
+#endif
+
+// ---- MappedFile ----
+MappedFile::~MappedFile() {
+  if (mapped_) munmap(const_cast<char*>(data_), size_);
+}
+
+bool MappedFile::open(const std::string& path, std::string* err) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *err = "Unable to open log file: " + path;
+    return false;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    size_ = (size_t)st.st_size;
+    if (size_ == 0) {
+      ::close(fd);
+      return true;
+    }
+    void* m = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      madvise(m, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(m);
+      mapped_ = true;
+      ::close(fd);
+      return true;
+    }
+  }
+  // Not mappable (pipe, /dev/stdin, ...): read it all.
+  char buf[1 << 16];
+  for (;;) {
+    ssize_t n = ::read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      *err = "Read failed: " + path + ": " + std::strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    if (n == 0) break;
+    copy_.insert(copy_.end(), buf, buf + n);
+  }
+  ::close(fd);
+  data_ = copy_.data();
+  size_ = copy_.size();
+  return true;
+}
+
+// ---- kernels ----
+namespace {
+
+// Bit i of each mask describes byte p[i], 0 <= i < 32.
+struct Masks {
+  uint32_t newline;
+  uint32_t comma;
+  uint32_t digit;
+};
+
+// 1..8 ASCII digits at s (8 bytes readable) to their value.
+inline uint64_t swar8(const char* s, size_t len) {
+  uint64_t v;
+  std::memcpy(&v, s, 8);
+  v <<= 8 * (8 - len);  // little-endian: pad with leading zero digits
+  v &= 0x0f0f0f0f0f0f0f0fULL;
+  v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffULL;
+  v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffULL;
+  v = (v * 10000 + (v >> 32)) & 0x00000000ffffffffULL;
+  return v;
+}
+
+long long parse_digits(const char* s, size_t len) {
+  if (len <= 8) return (long long)swar8(s, len);
+  if (len <= 16) return (long long)(swar8(s, len - 8) * 100000000ULL + swar8(s + len - 8, 8));
+  unsigned long long v = 0;
+  for (size_t i = 0; i < len; ++i) v = v * 10 + (unsigned long long)(s[i] - '0');
+  return (long long)v;
+}
+
+// Reference grammar, also used for lines the vector path does not cover.
+bool parse_scalar(const char* p, const char* end, std::vector<long long>* out) {
+  out->clear();
+  if (p == end) return false;
+  while (p < end) {
+    if ((unsigned char)(*p - '0') >= 10u) return false;
+    unsigned long long v = 0;
+    while (p < end && (unsigned char)(*p - '0') < 10u) v = v * 10 + (unsigned long long)(*p++ - '0');
+    out->push_back((long long)v);
+    if (p == end) break;
+    if (*p != ',') return false;
+    ++p;
+  }
+  return out->size() >= 2;
+}
+
+// Decodes the line starting at p from its window masks into the next batch
+// slot. Returns the bytes consumed (line + newline), or 0 when the line does
+// not end inside the window.
+__attribute__((always_inline)) inline size_t decode_window(const char* p, Masks m,
+                                                          LineScanner::Batch* b) {
+  if (!m.newline) return 0;
+  unsigned len = (unsigned)__builtin_ctz(m.newline);
+  uint32_t in_line = (1u << len) - 1;
+  uint32_t comma = m.comma & in_line;
+  uint32_t digit = m.digit & in_line;
+  size_t slot = b->count++;
+  b->line[slot] = p;
+  b->len[slot] = (uint8_t)len;
+  // Only digits and commas, a digit first, no empty field.
+  if (len == 0 || (digit | comma) != in_line || !(digit & 1) || (comma & (comma >> 1))) {
+    b->nfields[slot] = 0;
+    return len + 1;
+  }
+  long long* f = b->fields[slot];
+  unsigned n = 0;
+  unsigned start = 0;
+  while (comma) {
+    unsigned pos = (unsigned)__builtin_ctz(comma);
+    f[n++] = parse_digits(p + start, pos - start);
+    start = pos + 1;
+    comma &= comma - 1;
+  }
+  if (start < len) f[n++] = parse_digits(p + start, len - start);
+  b->nfields[slot] = (n >= 2) ? (uint8_t)n : 0;
+  return len + 1;
+}
+
+// 32 bytes to classify plus 8 bytes of SWAR overread past the window.
+constexpr ptrdiff_t kWindowReadable = 40;
+
+#define LOGSCAN_BATCH_LOOP(classify)                                          \
+  const char* start = p;                                                     \
+  while (out->count < LineScanner::kBatchLines && end - p >= kWindowReadable) { \
+    size_t n = decode_window(p, classify(p), out);                           \
+    if (!n) break;                                                           \
+    p += n;                                                                  \
+  }                                                                          \
+  return (size_t)(p - start)
+
+inline Masks classify_scalar(const char* p) {
+  Masks m{0, 0, 0};
+  for (unsigned i = 0; i < 32; ++i) {
+    unsigned char c = (unsigned char)p[i];
+    m.newline |= (uint32_t)(c == '\n') << i;
+    m.comma |= (uint32_t)(c == ',') << i;
+    m.digit |= (uint32_t)((unsigned)(c - '0') < 10u) << i;
+  }
+  return m;
+}
+
+#if LOGSCAN_X86
+__attribute__((target("sse2"), always_inline)) inline Masks classify_sse2(const char* p) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i nine = _mm_set1_epi8(9);
+  Masks m{0, 0, 0};
+  for (int half = 0; half < 2; ++half) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * half));
+    __m128i d = _mm_sub_epi8(v, zero);
+    int shift = 16 * half;
+    m.newline |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << shift;
+    m.comma |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << shift;
+    m.digit |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine)) << shift;
+  }
+  return m;
+}
+
+__attribute__((target("avx2"), always_inline)) inline Masks classify_avx2(const char* p) {
+  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+  __m256i nine = _mm256_set1_epi8(9);
+  Masks m;
+  m.newline = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+  m.comma = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+  m.digit = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(d, nine), nine));
+  return m;
+}
+#endif
+
+#if LOGSCAN_NEON
+inline uint32_t neon_movemask16(uint8x16_t m) {
+  static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t t = vandq_u8(m, vld1q_u8(kBits));
+  return (uint32_t)vaddv_u8(vget_low_u8(t)) | ((uint32_t)vaddv_u8(vget_high_u8(t)) << 8);
+}
+
+inline Masks classify_neon(const char* p) {
+  Masks m{0, 0, 0};
+  for (int half = 0; half < 2; ++half) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + 16 * half));
+    int shift = 16 * half;
+    m.newline |= neon_movemask16(vceqq_u8(v, vdupq_n_u8('\n'))) << shift;
+    m.comma |= neon_movemask16(vceqq_u8(v, vdupq_n_u8(','))) << shift;
+    m.digit |= neon_movemask16(vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9))) << shift;
+  }
+  return m;
+}
+#endif
+
+using ScanFn = size_t (*)(const char* p, const char* end, LineScanner::Batch* out);
+
+size_t scan_scalar(const char* p, const char* end, LineScanner::Batch* out) {
+  LOGSCAN_BATCH_LOOP(classify_scalar);
+}
+#if LOGSCAN_X86
+__attribute__((target("sse2"))) size_t scan_sse2(const char* p, const char* end,
+                                                 LineScanner::Batch* out) {
+  LOGSCAN_BATCH_LOOP(classify_sse2);
+}
+__attribute__((target("avx2"))) size_t scan_avx2(const char* p, const char* end,
+                                                 LineScanner::Batch* out) {
+  LOGSCAN_BATCH_LOOP(classify_avx2);
+}
+#endif
+#if LOGSCAN_NEON
+size_t scan_neon(const char* p, const char* end, LineScanner::Batch* out) {
+  LOGSCAN_BATCH_LOOP(classify_neon);
+}
+#endif
+
+struct Kernel {
+  ScanFn fn;
+  const char* name;
+};
+
+Kernel pick_kernel() {
+#if LOGSCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return {scan_avx2, "avx2"};
+  if (__builtin_cpu_supports("sse2")) return {scan_sse2, "sse2"};
+#elif LOGSCAN_NEON
+  return {scan_neon, "neon"};
+#endif
+  return {scan_scalar, "scalar"};
+}
+
+const Kernel& kernel() {
+  static const Kernel k = pick_kernel();
+  return k;
+}
+
+}  // namespace
+
+const char* logscan_kernel_name() { return kernel().name; }
+
+bool logscan_parse_fields(const char* p, const char* end, std::vector<long long>* out) {
+  return parse_scalar(p, end, out);
+}
+
+LineScanner::LineScanner(const char* data, size_t size)
+    : p_(data), end_(data + size), scan_(kernel().fn) {}
+
+bool LineScanner::next() {
+  if (batch_pos_ == batch_.count) {
+    if (p_ >= end_) return false;
+    batch_.count = 0;
+    batch_pos_ = 0;
+    p_ += scan_(p_, end_, &batch_);
+    if (batch_.count == 0) {
+      // Long line or the last bytes of the input.
+      const char* nl = static_cast<const char*>(std::memchr(p_, '\n', (size_t)(end_ - p_)));
+      const char* line_end = nl ? nl : end_;
+      ok_ = parse_scalar(p_, line_end, &slow_);
+      fields_ = slow_;
+      line_ = std::string_view(p_, (size_t)(line_end - p_));
+      p_ = nl ? nl + 1 : end_;
+      return true;
+    }
+  }
+  size_t i = batch_pos_++;
+  ok_ = batch_.nfields[i] != 0;
+  fields_ = std::span<const long long>(batch_.fields[i], batch_.nfields[i]);
+  line_ = std::string_view(batch_.line[i], batch_.len[i]);
+  return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only view of a whole file: mmap for regular files, a heap copy for
+// pipes and other unmappable inputs.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& path, std::string* err);
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<char> copy_;
+};
+
+// Splits a text log into lines and each line into unsigned decimal fields
+// ("<uint>,<uint>[,<uint>...][,]", the --analyze-log line grammar).
+//
+// Lines that fit into one 32-byte window are classified with a single vector
+// pass (newline, comma and digit masks via AVX2, SSE2 or NEON, picked at
+// startup) and their fields converted eight digits at a time (SWAR). Longer
+// lines and the last bytes of the buffer take the scalar path; both paths
+// accept exactly the same lines.
+class LineScanner {
+ public:
+  // Lines decoded per vector-kernel call; each window line has <= 16 fields.
+  static constexpr size_t kBatchLines = 64;
+  static constexpr size_t kWindowFields = 16;
+
+  LineScanner(const char* data, size_t size);
+
+  // Advances to the next line; false at end of input.
+  bool next();
+  // Whether the current line matched the grammar with at least two fields.
+  bool ok() const { return ok_; }
+  std::span<const long long> fields() const { return fields_; }
+  // Current line without its newline.
+  std::string_view line() const { return line_; }
+
+  // Decoded window lines, filled by the ISA kernels.
+  struct Batch {
+    size_t count = 0;
+    uint8_t nfields[kBatchLines];  // 0 = malformed line
+    uint8_t len[kBatchLines];
+    const char* line[kBatchLines];
+    long long fields[kBatchLines][kWindowFields];
+  };
+
+ private:
+  const char* p_;
+  const char* end_;
+  size_t (*scan_)(const char* p, const char* end, Batch* out);
+  Batch batch_;
+  size_t batch_pos_ = 0;
+  bool ok_ = false;
+  std::span<const long long> fields_;
+  std::string_view line_;
+  std::vector<long long> slow_;  // lines outside the vector window
+};
+
+// The line grammar on [p, end) without the vector path; used for the part
+// after a "<tag> " prefix.
+bool logscan_parse_fields(const char* p, const char* end, std::vector<long long>* out);
+
+// Name of the kernel LineScanner uses on this CPU ("avx2", "sse2", "neon",
+// "scalar").
+const char* logscan_kernel_name();
@@ -1,24 +1,86 @@
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <map>
 #include <string>
 #include <string_view>
 #include <vector>
-#include <thread>
-#include <chrono>
 
 #include "debug.hpp"
+#include "backend_att.hpp"
 #include "bluetooth.hpp"
+#include "bluetooth_async.hpp"
 #include "device_polar.hpp"
 #include "feat_health.hpp"
 #include "feat_analyze_log.hpp"
-
-using namespace std::chrono_literals;
+#include "feat_convert_log.hpp"
+#include "feat_query_rollup.hpp"
+#include "hrv.hpp"
+#include "metrics.hpp"
+#include "notify_fd.hpp"
+#include "outfile.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "pmd_capture.hpp"
+#include "replay_bus.hpp"
+#include "startup.hpp"
+#include "trace.hpp"
 
 bool g_debug = false;  // defined for debug.hpp / other TUs
+bool g_event_maintenance = false;
+bool g_async = false;
+bool g_notify_fd = false;
+PmdOptions g_pmd;
+AttBackendOptions g_att;
 bool g_health_warnings = false;
-std::string g_health_warning_prefix;
-long long g_health_warning_ts_ms = -1;
+HealthThresholds g_health_thresholds;
+std::map<std::string, HealthThresholds, std::less<>> g_health_profiles;
+long long g_health_alert_window_ms = 0;
+unsigned g_stall_timeout_s = 5;
+bool g_trace_record = false;
+HrvOptions g_hrv;
+unsigned g_stats_interval_s = 0;
+static bool s_backend_att = false;
+
+// Multi-device mode (--device/--adapters)
+static std::vector<std::string> s_device_specs;
+static std::vector<std::string> s_adapters;
+
+static volatile sig_atomic_t s_stop_requested = 0;
+static volatile sig_atomic_t s_stats_requested = 0;
+
+static void on_shutdown_signal(int) { s_stop_requested = 1; }
+static void on_stats_signal(int) { s_stats_requested = 1; }
+
+// No SA_RESTART: sd_bus_wait() returns -EINTR and the loop can flush and exit.
+static void install_shutdown_handlers() {
+  struct sigaction sa {};
+  sa.sa_handler = on_shutdown_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGHUP, &sa, nullptr);
+}
+
+// Installed before discovery so a SIGUSR1 never takes the default action;
+// no SA_RESTART, so sd_bus_wait() wakes for it. The --async loop reads it
+// from a signalfd instead.
+static void install_stats_handler() {
+  struct sigaction sa {};
+  sa.sa_handler = on_stats_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, nullptr);
+}
 
 static void print_help(const char* prog) {
+  log_flush();  // pending errors go out before the usage text
   const char* p = (prog && *prog) ? prog : "polarm";
   std::cout
     << "polarm — Minimal Polar H9/H10 heart-rate recorder\n\n"
@@ -28,150 +90,302 @@ static void print_help(const char* prog) {
     << "  -d, --debug     Verbose debug logs to stderr\n"
     << "  -hw, --health-warning, --health-warnings\n"
     << "                 Emit brady/tachy/arrhythmia warnings\n"
-    << "  --analyze-log <path>  Analyze stdout log and emit warnings\n\n"
+    << "  --health-profile [<device>=]<file>\n"
+    << "                 Detector thresholds as key = value lines (brady_bpm,\n"
+    << "                 tachy_bpm, min_rr_ms, max_rr_ms, af_*, recovery_min_ms);\n"
+    << "                 with <device>= only for that --device / device tag\n"
+    << "                 (repeatable)\n"
+    << "  --alert-window <s>\n"
+    << "                 Print repeats of a warning within <s> seconds as one\n"
+    << "                 'repeated' summary (default 0: print every warning)\n"
+    << "  --maintenance <poll|event>\n"
+    << "                 Connection upkeep: 0.5s poll tick (default) or\n"
+    << "                 driven by BlueZ Connected/ServicesResolved/Notifying signals\n"
+    << "  --transport <signal|fd>\n"
+    << "                 HR notifications as PropertiesChanged signals (default)\n"
+    << "                 or read from an AcquireNotify socket; fd falls back to\n"
+    << "                 signals when BlueZ refuses it\n"
+    << "  --trace-record <file>\n"
+    << "                 Record the BlueZ objects, signals, call outcomes and HR\n"
+    << "                 values of this run as a replayable trace\n"
+    << "  --replay-trace <file>\n"
+    << "                 Run against a mock BlueZ that plays <file> back instead\n"
+    << "                 of the system bus (startup/reconnect benchmarks)\n"
+    << "  --stall-timeout <s>\n"
+    << "                 Resubscribe, then reconnect, then rescan when a connected\n"
+    << "                 strap sends nothing for <s> seconds (default 5, 0 = off)\n"
+    << "  --backend <bluez|att>\n"
+    << "                 Talk to the strap through bluetoothd (default) or\n"
+    << "                 directly over the kernel's mgmt and L2CAP ATT sockets\n"
+    << "                 (needs CAP_NET_ADMIN; adapter from --adapters)\n"
+    << "  --conn-interval <ms>[,<max_ms>]\n"
+    << "                 Request this LE connection interval (7.5-4000 ms;\n"
+    << "                 --backend att)\n"
+    << "  --pmd <ecg|acc|ecg,acc>\n"
+    << "                 Also record the H10's raw ECG (130 Hz) and/or\n"
+    << "                 accelerometer streams (requires --format bin)\n"
+    << "  --pmd-acc-rate <25|50|100|200>\n"
+    << "                 Accelerometer sample rate in Hz (default 200)\n"
+    << "  --async         Non-blocking maintenance on an sd_event loop (async\n"
+    << "                 D-Bus calls, timers instead of sleeps)\n"
+    << "  --device <name|address>\n"
+    << "                 Capture this strap (repeatable; implies --async). Lines\n"
+    << "                 are tagged '<device> <epoch_ms>,...' when more than one\n"
+    << "  --adapters <hci0,hci1,...>\n"
+    << "                 Spread --device connections across these adapters\n"
+    << "  --pipeline <n>  Run health checks, HRV and output on <n> worker threads\n"
+    << "                 fed through lock-free rings (default 0: inline)\n"
+    << "  --pipeline-depth <n>\n"
+    << "                 Samples each worker ring holds (default 1024)\n"
+    << "  --pipeline-full <wait|drop>\n"
+    << "                 When a ring is full: wait for room (default) or drop\n"
+    << "  --stats-interval <s>\n"
+    << "                 Print latency histograms to stderr every <s> seconds\n"
+    << "                 (always on SIGUSR1)\n"
+    << "  --flush-ms <ms>  Batch output lines and flush at least every <ms>\n"
+    << "                 (default 0: flush after every sample)\n"
+    << "  --flush-bytes <n>\n"
+    << "                 Flush once <n> bytes are buffered (default 65536)\n"
+    << "  --format <text|bin>\n"
+    << "                 Output format (default text; bin flushes every 1000 ms\n"
+    << "                 unless --flush-ms is given)\n"
+    << "  --out <path>    Write the text recording to <path>.000001, <path>.000002,\n"
+    << "                 ... instead of stdout (flushes every 1000 ms unless\n"
+    << "                 --flush-ms is given)\n"
+    << "  --compress <none|zstd>\n"
+    << "                 zstd-compress the --out files (.zst); compressed on a\n"
+    << "                 writer thread\n"
+    << "  --rotate-size <n>[K|M|G]\n"
+    << "                 Start a new --out file once this many bytes are on disk\n"
+    << "  --rotate-time <s>\n"
+    << "                 Start a new --out file every <s> seconds\n"
+    << "  --shm <name>    Also publish samples to the shared-memory ring\n"
+    << "                 /dev/shm/<name> for local readers (shm_ring.hpp)\n"
+    << "  --rollup <dir>  Keep 1 s / 1 min / 1 h BPM and RR rollups per device in\n"
+    << "                 <dir> (with --analyze-log: rebuild them from the logs)\n"
+    << "  --query <dir> <from> <to>\n"
+    << "                 Print BPM/RR aggregates from a rollup store; times are\n"
+    << "                 epoch ms, 'now' or -<n><s|m|h|d>\n"
+    << "  --query-step <n><s|m|h|d>\n"
+    << "                 One --query line per step (default: the whole range)\n"
+    << "  --query-device <tag>\n"
+    << "                 Only this device (default: every device in <dir>)\n"
+    << "  --shm-records <n>\n"
+    << "                 Records the ring holds (default 65536, 64 bytes each)\n"
+    << "  --hrv <s[,s...]>\n"
+    << "                 Report SDNN/RMSSD/pNN50/LF/HF over rolling windows of\n"
+    << "                 these lengths in seconds (e.g. 60,300)\n"
+    << "  --hrv-interval <s>\n"
+    << "                 Seconds of recording between HRV reports (default 10)\n"
+    << "  --hrv-out <path>\n"
+    << "                 HRV report lines go here ('-' for stdout; default\n"
+    << "                 stderr, or stdout with --analyze-log)\n"
+    << "  --analyze-log <path>  Analyze a text or binary log and emit warnings\n"
+    << "                 (repeatable; directories are searched recursively)\n"
+    << "  --jobs <n>      Threads for --analyze-log (default: one per CPU)\n"
+    << "  --follow        Keep analyzing lines appended to the --analyze-log\n"
+    << "                 file until interrupted\n"
+    << "  --checkpoint <path>\n"
+    << "                 Resume --analyze-log from, and save, the file offset and\n"
+    << "                 detector state here (one text file)\n"
+    << "  --convert <in> <out>\n"
+    << "                 Convert a recording text->binary or binary->text\n"
+    << "                 (direction follows <in>; '-' writes to stdout)\n\n"
     << "Output:\n"
     << "  Lines to stdout in the form: <epoch_ms>,<bpm>[,<rr_ms>...]\n"
     << "  RR values are converted from 1/1024 s ticks to milliseconds.\n";
 }
 
-static int run_impl() {
-  DBG << "[dbg] run_impl(): starting\n";
-  DBG << "[dbg] assuming default adapter at /org/bluez/hci0\n";
-  Bus bus;
+// What both default-mode loops do around each wait: output flushes, the
+// first-sample timing line and --stats-interval / SIGUSR1 dumps.
+struct LoopUpkeep {
+  const uint64_t stats_every_us = (uint64_t)g_stats_interval_s * 1000000ULL;
+  uint64_t next_stats_us = metrics_now_ns() / 1000 + stats_every_us;
+  bool first_sample_logged = false;
 
-  // Prefer H10 if both appear
-  std::vector<std::string_view> names = { polar_h10_name(), polar_h9_name() };
-  DBG << "[dbg] target device names (priority order): '"
-      << names[0] << "', '" << names[1] << "'\n";
-  auto dev = find_any_device_by_names(bus, names);
-
-  // Scan if not found
-  if (!dev) {
-    ERR << "[info] Starting discovery...\n";
-    if (start_adapter_discovery(bus) < 0) {
-      ERR << "[err] StartDiscovery failed\n";
-      return EXIT_FAILURE;
-    }
-    auto deadline = std::chrono::steady_clock::now() + 90s;
-    int iter = 0;
-    while (std::chrono::steady_clock::now() < deadline) {
-      std::this_thread::sleep_for(2s);
-      dev = find_any_device_by_names(bus, names);
-      if (dev) break;
-      DBG << "[dbg] scan iteration " << (++iter) << " ... not yet found\n";
-    }
-    stop_adapter_discovery(bus);
-    if (!dev) {
-      ERR << "[err] Device not found after scan.\n";
-      return EXIT_FAILURE;
-    }
-  }
-
-  ERR << "[info] Found device: " << dev->name << " path: " << dev->path << "\n";
-
-  // Connect if needed
-  if (!get_device_connected(bus, dev->path)) {
-    ERR << "[info] Connecting...\n";
-    if (call_void(bus, dev->path, "org.bluez.Device1", "Connect") < 0) {
-      ERR << "[err] Connect failed\n";
-      return EXIT_FAILURE;
-    }
-    auto deadline = std::chrono::steady_clock::now() + 20s;
-    while (std::chrono::steady_clock::now() < deadline) {
-      if (get_device_connected(bus, dev->path)) break;
-      std::this_thread::sleep_for(500ms);
-    }
-    if (!get_device_connected(bus, dev->path)) {
-      ERR << "[err] Failed to connect (timeout).\n";
-      return EXIT_FAILURE;
-    }
-  }
-  ERR << "[info] Connected.\n";
-
-  // Find Heart Rate Measurement characteristic (retryable on some devices)
-  static constexpr std::string_view kHRCharUUID =
-    "00002a37-0000-1000-8000-00805f9b34fb";
-  DBG << "[dbg] searching for HRM characteristic uuid=" << kHRCharUUID << "\n";
-  auto ch_path_opt = find_char_by_uuid(bus, dev->path, kHRCharUUID);
-  if (!ch_path_opt) {
-    ERR << "[warn] Heart Rate Measurement characteristic not found; retrying...\n";
-    auto deadline = std::chrono::steady_clock::now() + 60s;
-    while (std::chrono::steady_clock::now() < deadline) {
-      if (!get_device_connected(bus, dev->path)) {
-        ERR << "[info] Reconnecting while waiting for HR characteristic...\n";
-        if (call_void(bus, dev->path, "org.bluez.Device1", "Connect") < 0) {
-          ERR << "[warn] Connect failed during HR characteristic retry.\n";
-        } else {
-          auto conn_deadline = std::chrono::steady_clock::now() + 20s;
-          while (std::chrono::steady_clock::now() < conn_deadline) {
-            if (get_device_connected(bus, dev->path)) break;
-            std::this_thread::sleep_for(500ms);
-          }
-          if (get_device_connected(bus, dev->path)) {
-            ERR << "[info] Connected (retry).\n";
-          } else {
-            ERR << "[warn] Connect timeout during HR characteristic retry.\n";
-          }
-        }
-      }
+  uint64_t timeout_us(uint64_t t) const {
+    t = std::min(t, output_timeout_us());
+    if (stats_every_us) {
+      uint64_t now_us = metrics_now_ns() / 1000;
+      t = std::min(t, next_stats_us > now_us ? next_stats_us - now_us : 0);
+    }
+    return t;
+  }
 
-      ch_path_opt = find_char_by_uuid(bus, dev->path, kHRCharUUID);
-      if (ch_path_opt) break;
-      std::this_thread::sleep_for(1s);
+  void after_wait(const StartupTimes& times, const HrmSource& src) {
+    output_poll();
+    if (!first_sample_logged && src.last_notify_ns) {
+      first_sample_logged = true;
+      startup_log_first_sample(times, src.last_notify_ns);
     }
-    if (!ch_path_opt) {
-      ERR << "[err] Heart Rate Measurement characteristic not found (timeout).\n";
-      return EXIT_FAILURE;
+    if (stats_every_us && metrics_now_ns() / 1000 >= next_stats_us) {
+      s_stats_requested = 1;
+      next_stats_us = metrics_now_ns() / 1000 + stats_every_us;
+    }
+    if (s_stats_requested) {
+      s_stats_requested = 0;
+      metrics_dump();
     }
   }
-  std::string ch_path = *ch_path_opt;
-  ERR << "[info] Heart Rate characteristic: " << ch_path << "\n";
+};
 
-  // Start notifications
-  if (start_notify(bus, ch_path) < 0) {
-    ERR << "[err] StartNotify failed\n";
+// --backend att: the same loop around the ATT socket instead of the bus.
+static int run_att_impl(const std::vector<std::string_view>& names) {
+  AttBackend att;
+  std::string err;
+  if (!att.open(&err)) {
+    ERR << "[err] --backend att: " << err << "\n";
     return EXIT_FAILURE;
   }
-  DBG << "[dbg] StartNotify returned ok; subscribing to PropertiesChanged\n";
-
-  // Subscribe to PropertiesChanged on that HR path
-  std::string match =
-    "type='signal',"
-    "sender='org.bluez',"
-    "interface='org.freedesktop.DBus.Properties',"
-    "member='PropertiesChanged',"
-    "path='" + ch_path + "'";
-  DBG << "[dbg] Installing HR D-Bus match: " << match << "\n";
-
-  sd_bus_slot* slot = nullptr;
-  int r = sd_bus_add_match(bus, &slot, match.c_str(), props_changed_cb, nullptr);
-  if (r < 0) {
-    ERR << "[err] sd_bus_add_match failed: " << -r << "\n";
+  StartupTimes times;
+  if (!att.startup(names, &times)) {
+    pipeline_stop();  // queued samples point at att's source
     return EXIT_FAILURE;
   }
+  output_device({}, att.name(), att.address());
+
+  install_shutdown_handlers();
+  ERR << "[info] Listening for BPM/RR notifications (Ctrl+C to quit)...\n";
+  LoopUpkeep upkeep;
+  while (!s_stop_requested) {
+    uint64_t timeout_us = upkeep.timeout_us(att.maintain());
+    pollfd p{att.fd(), att.events(), 0};
+    timespec ts{};
+    if (timeout_us != UINT64_MAX) {
+      ts.tv_sec = (time_t)(timeout_us / 1000000);
+      ts.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+    }
+    int r = ppoll(&p, 1, timeout_us == UINT64_MAX ? nullptr : &ts, nullptr);
+    if (r < 0 && errno != EINTR) {
+      ERR << "[fatal] ppoll: " << strerror(errno) << "\n";
+      pipeline_stop();
+      return EXIT_FAILURE;
+    }
+    if (r > 0 && p.revents) att.ready();
+    upkeep.after_wait(times, att.source());
+  }
+  ERR << "[info] Shutdown requested; flushing output.\n";
+  pipeline_stop();
+  output_flush();
+  return 0;
+}
+
+static int run_impl() {
+  DBG << "[dbg] run_impl(): starting\n";
+  install_stats_handler();
+  // Prefer H10 if both appear
+  std::vector<std::string_view> names = { polar_h10_name(), polar_h9_name() };
+  DBG << "[dbg] target device names (priority order): '"
+      << names[0] << "', '" << names[1] << "'\n";
+  if (s_backend_att) return run_att_impl(names);
+  DBG << "[dbg] assuming default adapter at /org/bluez/hci0\n";
+  Bus bus;
+  std::vector<std::string> adapters = s_adapters;
+  if (adapters.empty()) adapters.emplace_back(kAdapterPath);
+  if (!s_device_specs.empty()) {
+    std::vector<AsyncDeviceSpec> devices;
+    for (const auto& spec : s_device_specs) {
+      AsyncDeviceSpec d;
+      d.keys.push_back(spec);
+      std::string tag = spec;
+      std::replace(tag.begin(), tag.end(), ' ', '_');
+      d.health = health_thresholds_for(g_health_profiles.count(spec) ? spec : tag);
+      if (s_device_specs.size() > 1) d.tag = std::move(tag);
+      devices.push_back(std::move(d));
+    }
+    return run_async(bus, devices, adapters);
+  }
+  if (g_async) {
+    AsyncDeviceSpec d;
+    for (auto n : names) d.keys.emplace_back(n);
+    return run_async(bus, {d}, adapters);
+  }
+
+  auto started = startup_connect(bus, names);
+  if (!started) return EXIT_FAILURE;
+  FoundDev* dev = &started->dev;
+  std::string ch_path = started->ch_path;
+  sd_bus_slot* slot = started->slot;
+  output_device({}, dev->name, device_address_from_path(dev->path));
 
+  install_shutdown_handlers();
   ERR << "[info] Listening for BPM/RR notifications (Ctrl+C to quit)...\n";
-  // Event loop with maintenance (0.5s tick)
-  for (;;) {
-    r = sd_bus_process(bus, nullptr);
+  // Event loop with maintenance (0.5s tick, or only on BlueZ state changes)
+  LoopUpkeep upkeep;
+  while (!s_stop_requested) {
+    int r = sd_bus_process(bus, nullptr);
     if (r < 0) {
       ERR << "[fatal] sd_bus_process: " << -r << "\n";
       return EXIT_FAILURE;
     }
     if (r == 0) {
-      ensure_connected_and_notifying(bus, dev->path, ch_path, slot, names);
-      r = sd_bus_wait(bus, 500000); // 0.5s
-      if (r < 0) {
+      uint64_t timeout_us = 500000; // 0.5s
+      if (g_event_maintenance) {
+        timeout_us = maintain_on_events(bus, dev->path, ch_path, slot, names);
+      } else {
+        ensure_connected_and_notifying(bus, dev->path, ch_path, slot, names);
+      }
+      timeout_us = std::min(timeout_us, pmd_maintain(bus, dev->path));
+      timeout_us = std::min(timeout_us, stall_maintain(bus, dev->path, ch_path, slot));
+      timeout_us = upkeep.timeout_us(timeout_us);
+      bool fd_ready = false;
+      r = bus_wait_fd(bus, default_notify_fd(), timeout_us, &fd_ready);
+      if (r < 0 && r != -EINTR) {
         ERR << "[fatal] sd_bus_wait: " << -r << "\n";
         return EXIT_FAILURE;
       }
+      if (fd_ready) default_notify_fd_ready();
     }
+    upkeep.after_wait(started->times, hrm_default_source());
   }
+  ERR << "[info] Shutdown requested; flushing output.\n";
+  pmd_shutdown(bus);
+  output_flush();
+  return 0;
+}
+
+static bool parse_u64(const char* s, uint64_t* out) {
+  char* end = nullptr;
+  errno = 0;
+  unsigned long long v = std::strtoull(s, &end, 10);
+  if (errno || !end || *end || end == s) return false;
+  *out = v;
+  return true;
+}
+
+// "<n>[K|M|G]", binary units.
+static bool parse_size(const char* s, uint64_t* out) {
+  std::string n(s);
+  int shift = 0;
+  if (!n.empty()) {
+    switch (n.back()) {
+      case 'K': case 'k': shift = 10; break;
+      case 'M': case 'm': shift = 20; break;
+      case 'G': case 'g': shift = 30; break;
+    }
+  }
+  if (shift) n.pop_back();
+  uint64_t v = 0;
+  if (!parse_u64(n.c_str(), &v) || v > (UINT64_MAX >> shift)) return false;
+  *out = v << shift;
+  return true;
 }
 
 int main(int argc, char** argv) {
   bool show_help = false;
-  std::string analyze_log_path;
+  std::vector<std::string> analyze_log_paths;
+  unsigned analyze_jobs = 0;
+  FollowOptions follow;
+  std::string convert_in, convert_out;
+  OutputOptions out_opts;
+  bool flush_ms_given = false;
+  std::string hrv_out;
+  FileSetOptions out_file;
+  std::string shm_name;
+  std::string rollup_dir;
+  RollupQuery query;
+  uint64_t shm_records = 65536;
+  std::string trace_record_path, replay_trace_path;
 
   // Parse flags
   for (int i = 1; i < argc; ++i) {
@@ -180,6 +394,321 @@ int main(int argc, char** argv) {
       g_debug = true;
     } else if (arg == "--health-warnings" || arg == "--health-warning" || arg == "-hw") {
       g_health_warnings = true;
+    } else if (arg == "--health-profile") {
+      std::string err;
+      if (i + 1 >= argc) {
+        ERR << "[err] --health-profile requires a file\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      // "<device>=<file>" applies to that device only; a path may hold '='
+      // after its first '/'.
+      std::string_view v = argv[++i];
+      size_t eq = v.find('=');
+      bool per_device = eq != std::string_view::npos && eq > 0 &&
+                        v.substr(0, eq).find('/') == std::string_view::npos;
+      HealthThresholds* out = &g_health_thresholds;
+      if (per_device) {
+        out = &g_health_profiles[std::string(v.substr(0, eq))];
+        v.remove_prefix(eq + 1);
+      }
+      if (!health_load_profile(std::string(v), out, &err)) {
+        ERR << "[err] " << err << "\n";
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--alert-window") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v > 86400) {
+        ERR << "[err] --alert-window requires a number of seconds\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_health_alert_window_ms = (long long)v * 1000;
+      ++i;
+    } else if (arg == "--trace-record" || arg == "--replay-trace") {
+      if (i + 1 >= argc || !*argv[i + 1]) {
+        ERR << "[err] " << arg << " requires a file\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      (arg == "--trace-record" ? trace_record_path : replay_trace_path) = argv[++i];
+    } else if (arg == "--stall-timeout") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v > 3600) {
+        ERR << "[err] --stall-timeout requires a number of seconds\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_stall_timeout_s = (unsigned)v;
+      ++i;
+    } else if (arg == "--maintenance") {
+      std::string_view mode = (i + 1 < argc) ? std::string_view(argv[i + 1]) : "";
+      if (mode != "poll" && mode != "event") {
+        ERR << "[err] --maintenance requires 'poll' or 'event'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_event_maintenance = (mode == "event");
+      ++i;
+    } else if (arg == "--transport") {
+      std::string_view mode = (i + 1 < argc) ? std::string_view(argv[i + 1]) : "";
+      if (mode != "signal" && mode != "fd") {
+        ERR << "[err] --transport requires 'signal' or 'fd'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_notify_fd = (mode == "fd");
+      ++i;
+    } else if (arg == "--backend") {
+      std::string_view mode = (i + 1 < argc) ? std::string_view(argv[i + 1]) : "";
+      if (mode != "bluez" && mode != "att") {
+        ERR << "[err] --backend requires 'bluez' or 'att'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      s_backend_att = (mode == "att");
+      ++i;
+    } else if (arg == "--conn-interval") {
+      std::string_view v = (i + 1 < argc) ? std::string_view(argv[++i]) : "";
+      auto comma = v.find(',');
+      std::string lo(v.substr(0, comma));
+      std::string hi(comma == std::string_view::npos ? lo : std::string(v.substr(comma + 1)));
+      char* end1 = nullptr;
+      char* end2 = nullptr;
+      double min_ms = std::strtod(lo.c_str(), &end1);
+      double max_ms = std::strtod(hi.c_str(), &end2);
+      if (lo.empty() || hi.empty() || *end1 || *end2 || min_ms < 7.5 || max_ms > 4000 ||
+          min_ms > max_ms) {
+        ERR << "[err] --conn-interval requires <ms>[,<max_ms>] between 7.5 and 4000\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      // 1.25 ms units
+      g_att.interval_min = (uint16_t)(min_ms / 1.25 + 0.5);
+      g_att.interval_max = (uint16_t)(max_ms / 1.25 + 0.5);
+    } else if (arg == "--pmd") {
+      std::string_view list = (i + 1 < argc) ? std::string_view(argv[++i]) : "";
+      g_pmd.ecg = g_pmd.acc = false;
+      while (!list.empty()) {
+        auto comma = list.find(',');
+        std::string_view stream = list.substr(0, comma);
+        if (stream == "ecg") g_pmd.ecg = true;
+        else if (stream == "acc") g_pmd.acc = true;
+        else break;
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+      }
+      if (!list.empty() || !g_pmd.enabled()) {
+        ERR << "[err] --pmd requires 'ecg', 'acc' or 'ecg,acc'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--pmd-acc-rate") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) ||
+          (v != 25 && v != 50 && v != 100 && v != 200)) {
+        ERR << "[err] --pmd-acc-rate requires 25, 50, 100 or 200\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_pmd.acc_rate_hz = (uint16_t)v;
+      ++i;
+    } else if (arg == "--async") {
+      g_async = true;
+    } else if (arg == "--device") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --device requires a name or address\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      s_device_specs.emplace_back(argv[++i]);
+    } else if (arg == "--adapters") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --adapters requires a comma-separated list\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      std::string_view list = argv[++i];
+      while (!list.empty()) {
+        auto comma = list.find(',');
+        std::string_view a = list.substr(0, comma);
+        if (!a.empty()) {
+          s_adapters.emplace_back(a.front() == '/' ? std::string(a)
+                                                   : "/org/bluez/" + std::string(a));
+        }
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+      }
+    } else if (arg == "--flush-ms" || arg == "--flush-bytes") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v)) {
+        ERR << "[err] " << arg << " requires a non-negative integer\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      ++i;
+      if (arg == "--flush-ms") {
+        out_opts.flush_ms = v;
+        flush_ms_given = true;
+      } else {
+        out_opts.flush_bytes = (size_t)std::max<uint64_t>(v, 1);
+      }
+    } else if (arg == "--pipeline" || arg == "--pipeline-depth") {
+      uint64_t v = 0;
+      uint64_t max = (arg == "--pipeline") ? 64 : (1u << 24);
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v > max) {
+        ERR << "[err] " << arg << " requires a count up to " << max << "\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      ++i;
+      if (arg == "--pipeline") g_pipeline.workers = (unsigned)v;
+      else g_pipeline.depth = (size_t)std::max<uint64_t>(v, 2);
+    } else if (arg == "--stats-interval") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v == 0 || v > 86400) {
+        ERR << "[err] --stats-interval requires a positive number of seconds\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_stats_interval_s = (unsigned)v;
+      ++i;
+    } else if (arg == "--pipeline-full") {
+      std::string_view mode = (i + 1 < argc) ? std::string_view(argv[i + 1]) : "";
+      if (mode != "wait" && mode != "drop") {
+        ERR << "[err] --pipeline-full requires 'wait' or 'drop'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_pipeline.drop_when_full = (mode == "drop");
+      ++i;
+    } else if (arg == "--format" || arg.starts_with("--format=")) {
+      std::string_view fmt;
+      if (arg == "--format") fmt = (i + 1 < argc) ? std::string_view(argv[++i]) : "";
+      else fmt = arg.substr(9);
+      if (fmt != "text" && fmt != "bin") {
+        ERR << "[err] --format requires 'text' or 'bin'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      out_opts.format = (fmt == "bin") ? OutputFormat::Binary : OutputFormat::Text;
+    } else if (arg == "--hrv") {
+      std::string_view list = (i + 1 < argc) ? std::string_view(argv[++i]) : "";
+      g_hrv.windows_s.clear();
+      while (!list.empty()) {
+        auto comma = list.find(',');
+        std::string w(list.substr(0, comma));
+        uint64_t v = 0;
+        if (!parse_u64(w.c_str(), &v) || v == 0 || v > 86400) {
+          ERR << "[err] --hrv requires window lengths in seconds, e.g. 60,300\n";
+          print_help(argv[0]);
+          return EXIT_FAILURE;
+        }
+        g_hrv.windows_s.push_back((uint32_t)v);
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+      }
+      if (g_hrv.windows_s.empty()) {
+        ERR << "[err] --hrv requires window lengths in seconds, e.g. 60,300\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--out") {
+      if (i + 1 >= argc || !*argv[i + 1]) {
+        ERR << "[err] --out requires a path\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      out_file.path = argv[++i];
+    } else if (arg == "--compress") {
+      std::string_view c = (i + 1 < argc) ? std::string_view(argv[++i]) : "";
+      if (c != "none" && c != "zstd") {
+        ERR << "[err] --compress requires 'none' or 'zstd'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      out_file.compress = (c == "zstd");
+    } else if (arg == "--rotate-size" || arg == "--rotate-time") {
+      uint64_t v = 0;
+      bool ok = i + 1 < argc && (arg == "--rotate-size" ? parse_size(argv[i + 1], &v)
+                                                          : parse_u64(argv[i + 1], &v));
+      if (!ok || v == 0 || (arg == "--rotate-time" && v > 366ULL * 86400)) {
+        ERR << "[err] " << arg
+            << (arg == "--rotate-size" ? " requires a size such as 64M\n"
+                                       : " requires a positive number of seconds\n");
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      ++i;
+      if (arg == "--rotate-size") out_file.rotate_bytes = v;
+      else out_file.rotate_ms = v * 1000;
+    } else if (arg == "--shm") {
+      if (i + 1 >= argc || !*argv[i + 1] || std::strchr(argv[i + 1] + 1, '/')) {
+        ERR << "[err] --shm requires a name without '/'\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      shm_name = argv[++i];
+    } else if (arg == "--rollup") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --rollup requires a directory\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      rollup_dir = argv[++i];
+    } else if (arg == "--query") {
+      if (i + 3 >= argc) {
+        ERR << "[err] --query requires a rollup directory, a start and an end time\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      query.dir = argv[++i];
+      query.from = argv[++i];
+      query.to = argv[++i];
+    } else if (arg == "--query-step") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --query-step requires a duration\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      query.step = argv[++i];
+    } else if (arg == "--query-device") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --query-device requires a device tag\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      query.device = argv[++i];
+    } else if (arg == "--shm-records") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v < 64 || v > (1ULL << 24)) {
+        ERR << "[err] --shm-records requires a count between 64 and 16777216\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      shm_records = v;
+      ++i;
+    } else if (arg == "--hrv-interval") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v == 0 || v > 86400) {
+        ERR << "[err] --hrv-interval requires a positive number of seconds\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_hrv.interval_s = (uint32_t)v;
+      ++i;
+    } else if (arg == "--hrv-out") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --hrv-out requires a path\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      hrv_out = argv[++i];
+    } else if (arg == "--convert") {
+      if (i + 2 >= argc) {
+        ERR << "[err] --convert requires an input and an output path\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      convert_in = argv[++i];
+      convert_out = argv[++i];
     } else if (arg == "-h" || arg == "--help") {
       show_help = true;
     } else if (arg == "--analyze-log") {
@@ -188,7 +717,25 @@ int main(int argc, char** argv) {
         print_help(argv[0]);
         return EXIT_FAILURE;
       }
-      analyze_log_path = argv[++i];
+      analyze_log_paths.emplace_back(argv[++i]);
+    } else if (arg == "--follow") {
+      follow.follow = true;
+    } else if (arg == "--checkpoint") {
+      if (i + 1 >= argc) {
+        ERR << "[err] --checkpoint requires a path\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      follow.checkpoint = argv[++i];
+    } else if (arg == "--jobs") {
+      uint64_t v = 0;
+      if (i + 1 >= argc || !parse_u64(argv[i + 1], &v) || v > 1024) {
+        ERR << "[err] --jobs requires a thread count\n";
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+      }
+      analyze_jobs = (unsigned)v;
+      ++i;
     } else {
       ERR << "[err] Unknown option: " << arg << "\n";
       print_help(argv[0]);
@@ -201,14 +748,135 @@ int main(int argc, char** argv) {
     return 0;
   }
 
-  if (!analyze_log_path.empty()) {
-    return analyze_log(analyze_log_path);
+  if (!query.dir.empty()) {
+    return query_rollup(query);
+  }
+  if (follow.follow || !follow.checkpoint.empty()) {
+    if (!rollup_dir.empty()) {
+      ERR << "[err] --rollup is not supported with --follow/--checkpoint\n";
+      return EXIT_FAILURE;
+    }
+    std::error_code ec;
+    if (analyze_log_paths.size() != 1 || std::filesystem::is_directory(analyze_log_paths[0], ec)) {
+      ERR << "[err] --follow/--checkpoint need exactly one --analyze-log file\n";
+      return EXIT_FAILURE;
+    }
+    if (!follow.checkpoint.empty() && g_hrv.enabled()) {
+      ERR << "[err] --checkpoint does not save --hrv windows\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (g_hrv.enabled()) {
+    bool replay = !analyze_log_paths.empty();
+    if (!hrv_output_open(hrv_out, replay ? STDOUT_FILENO : STDERR_FILENO, replay))
+      return EXIT_FAILURE;
+  }
+  if (follow.follow || !follow.checkpoint.empty()) {
+    follow.stop = &s_stop_requested;
+    install_shutdown_handlers();
+    return follow_log(analyze_log_paths[0], follow);
+  }
+  if (!analyze_log_paths.empty()) {
+    if (rollup_dir.empty()) return analyze_logs(analyze_log_paths, analyze_jobs);
+    // Building only, unless warnings or HRV were asked for as well.
+    int rc = build_rollup(analyze_log_paths, rollup_dir);
+    if (!g_health_warnings && !g_hrv.enabled()) return rc;
+    return std::max(rc, analyze_logs(analyze_log_paths, analyze_jobs));
+  }
+  if (!convert_in.empty()) {
+    return convert_log(convert_in, convert_out);
+  }
+  if (s_backend_att && (!trace_record_path.empty() || !replay_trace_path.empty())) {
+    ERR << "[err] --trace-record/--replay-trace trace BlueZ; not available with --backend att\n";
+    return EXIT_FAILURE;
+  }
+  if (s_backend_att) {
+    if (g_async || !s_device_specs.empty() || g_pmd.enabled() || g_notify_fd) {
+      ERR << "[err] --backend att does not support --async/--device/--pmd/--transport fd\n";
+      return EXIT_FAILURE;
+    }
+    if (!s_adapters.empty()) {
+      std::string_view a = s_adapters.front();
+      auto pos = a.rfind("hci");
+      uint64_t v = 0;
+      if (pos == std::string_view::npos || !parse_u64(std::string(a.substr(pos + 3)).c_str(), &v) ||
+          v > 0xfffe) {
+        ERR << "[err] --backend att: adapter must be hciN\n";
+        return EXIT_FAILURE;
+      }
+      g_att.hci_index = (uint16_t)v;
+    }
+  } else if (g_att.interval_min) {
+    ERR << "[err] --conn-interval requires --backend att\n";
+    return EXIT_FAILURE;
+  }
+  if (g_pmd.enabled()) {
+    // Text lines would be the per-packet formatting PMD rates cannot afford.
+    if (out_opts.format != OutputFormat::Binary) {
+      ERR << "[err] --pmd requires --format bin\n";
+      return EXIT_FAILURE;
+    }
+    if (g_async || !s_device_specs.empty()) {
+      ERR << "[err] --pmd is only supported without --async/--device\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (out_file.path.empty()) {
+    if (out_file.compress || out_file.rotate_bytes || out_file.rotate_ms) {
+      ERR << "[err] --compress/--rotate-size/--rotate-time require --out\n";
+      return EXIT_FAILURE;
+    }
+  } else {
+    // A binary recording keeps its own block index; splitting it would break that.
+    if (out_opts.format == OutputFormat::Binary) {
+      ERR << "[err] --out only writes text recordings\n";
+      return EXIT_FAILURE;
+    }
+    if (out_file.compress && !kHaveZstd) {
+      ERR << "[err] --compress zstd: built without zstd\n";
+      return EXIT_FAILURE;
+    }
+  }
+  // One block per sample would double the size of a binary recording, and
+  // one zstd flush per sample would undo most of the compression.
+  if ((out_opts.format == OutputFormat::Binary || !out_file.path.empty()) && !flush_ms_given)
+    out_opts.flush_ms = 1000;
+
+  std::ios::sync_with_stdio(false);
+  output_init(out_opts);
+  if (!out_file.path.empty()) {
+    auto sink = std::make_unique<FileSetSink>(out_file, out_opts);
+    std::string err;
+    if (!sink->open(&err)) {
+      ERR << "[err] --out: " << err << "\n";
+      return EXIT_FAILURE;
+    }
+    output_set_sink(std::move(sink));
+  }
+  if (!shm_name.empty() && !output_publish_shm(shm_name, shm_records)) return EXIT_FAILURE;
+  if (!rollup_dir.empty() && !output_rollup(rollup_dir)) return EXIT_FAILURE;
+  if (!trace_record_path.empty()) {
+    std::string err;
+    if (!trace_open(trace_record_path, &err)) {
+      ERR << "[err] --trace-record: " << err << "\n";
+      return EXIT_FAILURE;
+    }
+    g_trace_record = true;
+  }
+  if (!replay_trace_path.empty()) {
+    std::string err;
+    if (!replay_init(replay_trace_path, &err)) {
+      ERR << "[err] --replay-trace: " << err << "\n";
+      return EXIT_FAILURE;
+    }
   }
+  pipeline_start(g_pipeline);
 
   DBG << "[dbg] main(): debug enabled\n";
   DBG << "[dbg] main(): compiler=" << __VERSION__
       << ", __cplusplus=" << __cplusplus << ", file=" << __FILE__ << "\n";
   int rc = run_impl();
+  pipeline_stop();
   DBG << "[dbg] main(): run_impl() returned " << rc << "\n";
   return rc;
 }
@@ -0,0 +1,141 @@
+#include "metrics.hpp"
+
+#include <ctime>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "debug.hpp"
+#include "pipeline.hpp"
+
+namespace {
+
+// Values below 16 ns get a bucket each; above, bucket (s + 1) * 16 + m holds
+// [(16 + m) << s, (17 + m) << s). Values from 2^63 on share the last bucket.
+constexpr unsigned kSub = 16;
+constexpr size_t kBuckets = (64 - 4) * kSub;
+
+inline size_t bucket_of(uint64_t v) {
+  if (v < kSub) return (size_t)v;
+  unsigned shift = 63u - (unsigned)__builtin_clzll(v) - 4u;
+  size_t i = (size_t)(shift + 1) * kSub + (size_t)((v >> shift) - kSub);
+  return std::min(i, kBuckets - 1);
+}
+
+inline uint64_t bucket_mid(size_t i) {
+  if (i < kSub) return i;
+  unsigned shift = (unsigned)(i / kSub) - 1;
+  uint64_t lo = (uint64_t)(i % kSub + kSub) << shift;
+  return lo + ((1ULL << shift) >> 1);
+}
+
+struct Histogram {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+  std::atomic<uint64_t> buckets[kBuckets]{};
+};
+
+Histogram s_hist[(size_t)Metric::Count];
+
+const char* const kNames[] = {
+  "notify_interval",
+  "callback",
+  "notify_to_output",
+  "call_connect",
+  "call_start_notify",
+  "call_get_managed_objects",
+  "call_get",
+  "call_other",
+  "reconnect",
+  "stall_gap",
+  "stall_recover",
+  "flush",
+};
+static_assert(sizeof(kNames) / sizeof(kNames[0]) == (size_t)Metric::Count);
+
+// "850ns", "12.3us", "4.56ms", "1.02s".
+void format_ns(uint64_t ns, char* buf, size_t cap) {
+  if (ns < 1000) std::snprintf(buf, cap, "%lluns", (unsigned long long)ns);
+  else if (ns < 1000000) std::snprintf(buf, cap, "%.1fus", (double)ns / 1e3);
+  else if (ns < 1000000000) std::snprintf(buf, cap, "%.2fms", (double)ns / 1e6);
+  else std::snprintf(buf, cap, "%.2fs", (double)ns / 1e9);
+}
+
+}  // namespace
+
+uint64_t metrics_now_ns() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_record(Metric m, uint64_t ns) {
+  Histogram& h = s_hist[(size_t)m];
+  h.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.sum.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t cur = h.max.load(std::memory_order_relaxed);
+  while (ns > cur && !h.max.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {
+  }
+}
+
+Metric metrics_call_metric(std::string_view method) {
+  if (method == "Connect") return Metric::CallConnect;
+  if (method == "StartNotify") return Metric::CallStartNotify;
+  if (method == "GetManagedObjects") return Metric::CallGetManagedObjects;
+  if (method == "Get") return Metric::CallGet;
+  return Metric::CallOther;
+}
+
+const char* metrics_name(Metric m) {
+  return kNames[(size_t)m];
+}
+
+MetricSummary metrics_summary(Metric m) {
+  const Histogram& h = s_hist[(size_t)m];
+  MetricSummary s;
+  // Copy first: writers keep going while we walk the buckets.
+  uint64_t counts[kBuckets];
+  uint64_t total = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    counts[i] = h.buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  s.count = total;
+  s.sum_ns = h.sum.load(std::memory_order_relaxed);
+  s.max_ns = h.max.load(std::memory_order_relaxed);
+  if (total == 0) return s;
+
+  const struct { double q; uint64_t* out; } qs[] = {
+    {0.5, &s.p50_ns}, {0.9, &s.p90_ns}, {0.99, &s.p99_ns}, {0.999, &s.p999_ns},
+  };
+  uint64_t seen = 0;
+  size_t qi = 0;
+  for (size_t i = 0; i < kBuckets && qi < 4; ++i) {
+    seen += counts[i];
+    while (qi < 4 && (double)seen >= qs[qi].q * (double)total) {
+      *qs[qi].out = std::min(bucket_mid(i), s.max_ns);
+      ++qi;
+    }
+  }
+  return s;
+}
+
+void metrics_dump() {
+  for (size_t i = 0; i < (size_t)Metric::Count; ++i) {
+    MetricSummary s = metrics_summary((Metric)i);
+    if (s.count == 0) continue;
+    char p50[16], p90[16], p99[16], p999[16], max[16], mean[16];
+    format_ns(s.p50_ns, p50, sizeof(p50));
+    format_ns(s.p90_ns, p90, sizeof(p90));
+    format_ns(s.p99_ns, p99, sizeof(p99));
+    format_ns(s.p999_ns, p999, sizeof(p999));
+    format_ns(s.max_ns, max, sizeof(max));
+    format_ns(s.sum_ns / s.count, mean, sizeof(mean));
+    ERR << "[stats] " << kNames[i] << " n=" << s.count << " p50=" << p50 << " p90=" << p90
+        << " p99=" << p99 << " p999=" << p999 << " max=" << max << " mean=" << mean << "\n";
+  }
+  pipeline_log_stats();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Always-on latency histograms. Each metric is a log-linear histogram over
+// nanoseconds (16 sub-buckets per power of two, so a bucket is at most 1/16
+// of its value wide) made of relaxed atomic counters: recording is one clock
+// read and a few uncontended increments, from any thread.
+enum class Metric : unsigned {
+  NotifyInterval,         // between HR notifications of one strap
+  Callback,               // props_changed_cb, entry to return
+  NotifyToOutput,         // callback entry to the line reaching the output stream
+  CallConnect,            // D-Bus method calls, request to reply
+  CallStartNotify,
+  CallGetManagedObjects,
+  CallGet,
+  CallOther,
+  Reconnect,              // link seen down to the next notification
+  StallGap,               // notification gap that the stall watchdog acted on
+  StallRecover,           // stall detected to the next notification
+  Flush,                  // BufferedWriter::flush with data buffered
+  Count
+};
+
+// --stats-interval (main.cpp); 0 dumps only on SIGUSR1.
+extern unsigned g_stats_interval_s;
+
+uint64_t metrics_now_ns();  // CLOCK_MONOTONIC
+void metrics_record(Metric m, uint64_t ns);
+inline void metrics_since(Metric m, uint64_t start_ns) {
+  metrics_record(m, metrics_now_ns() - start_ns);
+}
+// D-Bus member name -> Call* metric.
+Metric metrics_call_metric(std::string_view method);
+
+struct MetricSummary {
+  uint64_t count = 0;
+  uint64_t sum_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t p50_ns = 0, p90_ns = 0, p99_ns = 0, p999_ns = 0;
+};
+MetricSummary metrics_summary(Metric m);
+const char* metrics_name(Metric m);
+
+// "[stats] <metric> n=... p50=... ..." lines on stderr for every metric with
+// samples, followed by the pipeline lanes when --pipeline is running.
+void metrics_dump();
@@ -0,0 +1,220 @@
+#include "mgmt.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "debug.hpp"
+
+namespace {
+
+constexpr int kBtProtoHci = 1;
+constexpr uint16_t kHciChannelControl = 3;
+constexpr uint16_t kHciDevNone = 0xffff;
+
+struct SockaddrHci {
+  sa_family_t hci_family;
+  uint16_t hci_dev;
+  uint16_t hci_channel;
+};
+
+constexpr uint16_t kOpReadInfo = 0x0004;
+constexpr uint16_t kOpStartDiscovery = 0x0023;
+constexpr uint16_t kOpStopDiscovery = 0x0024;
+constexpr uint16_t kOpLoadConnParam = 0x0035;
+constexpr uint16_t kEvCmdComplete = 0x0001;
+constexpr uint16_t kEvCmdStatus = 0x0002;
+constexpr uint16_t kEvDeviceFound = 0x0012;
+constexpr uint8_t kStatusBusy = 0x0a;
+constexpr uint8_t kDiscoverLe = (1 << kBdaddrLePublic) | (1 << kBdaddrLeRandom);
+constexpr size_t kHeader = 6;  // u16 opcode/event, u16 index, u16 length
+
+inline uint16_t le16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+inline void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+
+}  // namespace
+
+std::string bt_addr_string(const BtAddr& a) {
+  char s[18];
+  std::snprintf(s, sizeof s, "%02X:%02X:%02X:%02X:%02X:%02X",
+                a.b[5], a.b[4], a.b[3], a.b[2], a.b[1], a.b[0]);
+  return s;
+}
+
+bool bt_addr_parse(std::string_view s, BtAddr* out) {
+  if (s.size() != 17) return false;
+  uint8_t b[6];
+  for (int i = 0; i < 6; ++i) {
+    unsigned v = 0;
+    for (int k = 0; k < 2; ++k) {
+      char c = s[(size_t)i * 3 + k];
+      v <<= 4;
+      if (c >= '0' && c <= '9') v |= (unsigned)(c - '0');
+      else if (c >= 'a' && c <= 'f') v |= (unsigned)(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F') v |= (unsigned)(c - 'A' + 10);
+      else return false;
+    }
+    if (i < 5 && s[(size_t)i * 3 + 2] != ':') return false;
+    b[5 - i] = (uint8_t)v;
+  }
+  std::memcpy(out->b, b, 6);
+  return true;
+}
+
+MgmtSocket::~MgmtSocket() {
+  close();
+}
+
+bool MgmtSocket::open(uint16_t index, std::string* err) {
+  close();
+  fd_ = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, kBtProtoHci);
+  if (fd_ < 0) {
+    *err = std::string("mgmt socket: ") + strerror(errno);
+    return false;
+  }
+  SockaddrHci a{AF_BLUETOOTH, kHciDevNone, kHciChannelControl};
+  if (bind(fd_, reinterpret_cast<sockaddr*>(&a), sizeof a) < 0) {
+    *err = std::string("mgmt bind: ") + strerror(errno);
+    close();
+    return false;
+  }
+  index_ = index;
+  return true;
+}
+
+void MgmtSocket::close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+int MgmtSocket::recv_event() {
+  ssize_t n = recv(fd_, buf_, sizeof buf_, 0);
+  if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  if ((size_t)n < kHeader || kHeader + le16(buf_ + 4) > (size_t)n) return 0;
+  len_ = (size_t)n;
+  return 1;
+}
+
+bool MgmtSocket::command(uint16_t op, const uint8_t* params, size_t len, uint8_t* status) {
+  uint8_t msg[kHeader + 256];
+  if (len > sizeof msg - kHeader) return false;
+  put16(msg, op);
+  put16(msg + 2, index_);
+  put16(msg + 4, (uint16_t)len);
+  if (len) std::memcpy(msg + kHeader, params, len);
+  if (send(fd_, msg, kHeader + len, 0) < 0) {
+    ERR << "[err] mgmt command 0x" << std::hex << op << std::dec << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  for (;;) {
+    int r = recv_event();
+    if (r < 0) return false;
+    if (r > 0) {
+      uint16_t ev = le16(buf_);
+      const uint8_t* p = buf_ + kHeader;
+      size_t plen = le16(buf_ + 4);
+      // Other events (reports included) are dropped while a command waits.
+      if ((ev == kEvCmdComplete || ev == kEvCmdStatus) && plen >= 3 &&
+          le16(buf_ + 2) == index_ && le16(p) == op) {
+        *status = p[2];
+        reply_ = p + 3;
+        reply_len_ = plen - 3;
+        if (*status) {
+          DBG << "[dbg] mgmt 0x" << std::hex << op << " status 0x" << (int)*status
+              << std::dec << "\n";
+        }
+        return true;
+      }
+      continue;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0) {
+      ERR << "[err] mgmt command 0x" << std::hex << op << std::dec << ": no reply\n";
+      return false;
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    poll(&pfd, 1, (int)left);
+  }
+}
+
+bool MgmtSocket::read_address(BtAddr* out) {
+  uint8_t status = 0;
+  if (!command(kOpReadInfo, nullptr, 0, &status) || status || reply_len_ < 6) return false;
+  std::memcpy(out->b, reply_, 6);
+  out->type = kBdaddrLePublic;
+  return true;
+}
+
+bool MgmtSocket::start_le_discovery() {
+  uint8_t type = kDiscoverLe;
+  uint8_t status = 0;
+  if (!command(kOpStartDiscovery, &type, 1, &status)) return false;
+  if (status == kStatusBusy) {
+    DBG << "[dbg] mgmt: discovery already running\n";
+    return true;
+  }
+  if (status) {
+    ERR << "[err] mgmt StartDiscovery: status 0x" << std::hex << (int)status << std::dec << "\n";
+  }
+  return status == 0;
+}
+
+void MgmtSocket::stop_le_discovery() {
+  uint8_t type = kDiscoverLe;
+  uint8_t status = 0;
+  command(kOpStopDiscovery, &type, 1, &status);
+}
+
+bool MgmtSocket::load_conn_param(const BtAddr& addr, uint16_t min_interval,
+                                 uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+  uint8_t p[2 + 15];
+  put16(p, 1);
+  std::memcpy(p + 2, addr.b, 6);
+  p[8] = addr.type;
+  put16(p + 9, min_interval);
+  put16(p + 11, max_interval);
+  put16(p + 13, latency);
+  put16(p + 15, timeout);
+  uint8_t status = 0;
+  if (!command(kOpLoadConnParam, p, sizeof p, &status)) return false;
+  if (status) {
+    ERR << "[warn] mgmt LoadConnectionParameters: status 0x" << std::hex << (int)status
+        << std::dec << "\n";
+  }
+  return status == 0;
+}
+
+int MgmtSocket::read_event(MgmtDeviceFound* found) {
+  int r = recv_event();
+  if (r <= 0) return r;
+  if (le16(buf_) != kEvDeviceFound || le16(buf_ + 2) != index_) return 0;
+  // addr(6) type(1) rssi(1) flags(4) eir_len(2) eir
+  const uint8_t* p = buf_ + kHeader;
+  size_t plen = le16(buf_ + 4);
+  if (plen < 14) return 0;
+  std::memcpy(found->addr.b, p, 6);
+  found->addr.type = p[6];
+  found->rssi = (int8_t)p[7];
+  size_t eir_len = le16(p + 12);
+  const uint8_t* eir = p + 14;
+  if (14 + eir_len > plen) eir_len = plen - 14;
+  found->name = {};
+  for (size_t i = 0; i + 1 < eir_len;) {
+    size_t field = eir[i];
+    if (field == 0 || i + 1 + field > eir_len) break;
+    uint8_t type = eir[i + 1];
+    // 0x09 complete local name wins over 0x08 shortened.
+    if (type == 0x09 || (type == 0x08 && found->name.empty())) {
+      found->name = std::string_view(reinterpret_cast<const char*>(eir + i + 2), field - 1);
+    }
+    i += 1 + field;
+  }
+  return 1;
+}
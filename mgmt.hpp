@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Kernel Bluetooth management socket (HCI_CHANNEL_CONTROL) for --backend att:
+// LE discovery and per-device connection parameters, without bluetoothd.
+// Needs CAP_NET_ADMIN. Structures are declared here rather than taken from
+// BlueZ's headers, which the build does not depend on.
+
+inline constexpr uint8_t kBdaddrLePublic = 1;
+inline constexpr uint8_t kBdaddrLeRandom = 2;
+
+struct BtAddr {
+  uint8_t b[6]{};    // little-endian, as on the wire and in bdaddr_t
+  uint8_t type = kBdaddrLePublic;
+};
+
+// "AA:BB:CC:DD:EE:FF"
+std::string bt_addr_string(const BtAddr& a);
+bool bt_addr_parse(std::string_view s, BtAddr* out);  // keeps out->type
+
+// One advertising report. `name` points into the socket's buffer and is
+// only valid until the next read.
+struct MgmtDeviceFound {
+  BtAddr addr;
+  int8_t rssi = 0;
+  std::string_view name;  // complete or shortened local name; may be empty
+};
+
+class MgmtSocket {
+ public:
+  MgmtSocket() = default;
+  ~MgmtSocket();
+  MgmtSocket(const MgmtSocket&) = delete;
+  MgmtSocket& operator=(const MgmtSocket&) = delete;
+
+  // `index` is the N of hciN.
+  bool open(uint16_t index, std::string* err);
+  void close();
+  int fd() const { return fd_; }
+
+  bool read_address(BtAddr* out);
+  // Another client scanning (Busy) counts as started: reports reach every
+  // management socket.
+  bool start_le_discovery();
+  void stop_le_discovery();
+  // Connection parameters the kernel uses for later connections to `addr`:
+  // interval in 1.25 ms units, supervision timeout in 10 ms units.
+  bool load_conn_param(const BtAddr& addr, uint16_t min_interval, uint16_t max_interval,
+                       uint16_t latency, uint16_t timeout);
+
+  // Reads one queued event without blocking. 1: an advertising report in
+  // *found; 0: another event or nothing queued; -1: socket error.
+  int read_event(MgmtDeviceFound* found);
+
+ private:
+  // Sends a command and waits up to 2 s for its completion; reply
+  // parameters land in reply_/reply_len_.
+  bool command(uint16_t op, const uint8_t* params, size_t len, uint8_t* status);
+  int recv_event();
+
+  int fd_ = -1;
+  uint16_t index_ = 0;
+  uint8_t buf_[1024];
+  size_t len_ = 0;
+  const uint8_t* reply_ = nullptr;
+  size_t reply_len_ = 0;
+};
@@ -0,0 +1,143 @@
+#include "notify_fd.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+
+#include "bluetooth.hpp"
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+namespace {
+
+constexpr unsigned kBatch = 16;
+constexpr size_t kValueMax = kHrmValueMax;
+
+int own_fd(int fd) {
+  int owned = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+  if (owned < 0) return -errno;
+  int flags = fcntl(owned, F_GETFL);
+  if (flags < 0 || fcntl(owned, F_SETFL, flags | O_NONBLOCK) < 0) {
+    int e = errno;
+    close(owned);
+    return -e;
+  }
+  return owned;
+}
+
+}  // namespace
+
+int acquire_notify_reply(sd_bus_message* reply, uint16_t* mtu) {
+  int fd = -1;
+  int r = sd_bus_message_read(reply, "hq", &fd, mtu);
+  if (r < 0) return r;
+  // The message owns the received fd.
+  return own_fd(fd);
+}
+
+int acquire_notify(sd_bus* bus, const std::string& char_path, uint16_t* mtu,
+                   std::string* err_name) {
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+  sd_bus_message* reply = nullptr;
+  uint64_t t0 = metrics_now_ns();
+  if (g_trace_record) trace_call_begin(char_path, "AcquireNotify", t0);
+  int r = sd_bus_call_method(bus,
+    std::string(kBluezService).c_str(),
+    char_path.c_str(),
+    std::string(kGattChar1).c_str(),
+    "AcquireNotify",
+    &error, &reply, "a{sv}", 0);
+  metrics_since(Metric::CallOther, t0);
+  if (g_trace_record)
+    trace_call_end(char_path, "AcquireNotify", t0, trace_call_error(r, error.name));
+  if (r < 0) {
+    if (err_name) *err_name = error.name ? error.name : "";
+    ERR << "[err] D-Bus: " << (error.name ? error.name : "unknown")
+        << " - " << (error.message ? error.message : "") << "\n";
+  } else {
+    r = acquire_notify_reply(reply, mtu);
+    if (r < 0 && err_name) *err_name = strerror(-r);
+    if (r >= 0 && g_trace_record) trace_notify_fd(r, char_path);
+  }
+  sd_bus_error_free(&error);
+  sd_bus_message_unref(reply);
+  return r;
+}
+
+int notify_fd_read(int fd, HrmSource* src) {
+  uint8_t bufs[kBatch][kValueMax];
+  iovec iov[kBatch];
+  mmsghdr msgs[kBatch];
+  int total = 0;
+  for (;;) {
+    for (unsigned i = 0; i < kBatch; ++i) {
+      iov[i] = {bufs[i], kValueMax};
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(fd, msgs, kBatch, MSG_DONTWAIT, nullptr);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return total;
+      ERR << "[warn] notification socket: " << strerror(errno) << "\n";
+      return -1;
+    }
+    // Stamp the batch once, as props_changed_cb does per signal.
+    const uint64_t t0 = metrics_now_ns();
+    const uint64_t ts_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    for (int i = 0; i < n; ++i) {
+      // A zero-length message is end-of-file on a SEQPACKET socket.
+      if (msgs[i].msg_len == 0) return -1;
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        ERR << "[warn] notification longer than " << kValueMax << " bytes; truncated\n";
+      }
+      size_t len = std::min<size_t>(msgs[i].msg_len, kValueMax);
+      if (g_trace_record) trace_fd_value(fd, bufs[i], len);
+      hrm_on_value(src, bufs[i], len, t0, ts_ms);
+    }
+    if (n == 0) return -1;
+    metrics_since(Metric::Callback, t0);
+    total += n;
+    if ((unsigned)n < kBatch) return total;
+  }
+}
+
+int bus_wait_fd(sd_bus* bus, int fd, uint64_t timeout_us, bool* fd_ready) {
+  *fd_ready = false;
+  if (fd < 0) return sd_bus_wait(bus, timeout_us);
+
+  int bus_fd = sd_bus_get_fd(bus);
+  if (bus_fd < 0) return bus_fd;
+  int events = sd_bus_get_events(bus);
+  if (events < 0) return events;
+  uint64_t until = 0;  // CLOCK_MONOTONIC, UINT64_MAX if none
+  int r = sd_bus_get_timeout(bus, &until);
+  if (r < 0) return r;
+  if (until != UINT64_MAX) {
+    uint64_t now_us = metrics_now_ns() / 1000;
+    timeout_us = std::min(timeout_us, until > now_us ? until - now_us : 0);
+  }
+
+  pollfd p[2] = {{bus_fd, (short)events, 0}, {fd, POLLIN, 0}};
+  timespec ts{};
+  timespec* tsp = nullptr;
+  if (timeout_us != UINT64_MAX) {
+    ts.tv_sec = (time_t)(timeout_us / 1000000);
+    ts.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+    tsp = &ts;
+  }
+  r = ppoll(p, 2, tsp, nullptr);
+  if (r < 0) return -errno;
+  *fd_ready = p[1].revents != 0;
+  return r > 0 ? 1 : 0;
+}
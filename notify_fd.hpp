@@ -0,0 +1,28 @@
+#pragma once
+#include <systemd/sd-bus.h>
+#include <cstdint>
+#include <string>
+
+struct HrmSource;
+
+// --transport fd (main.cpp): take HR notifications from the socket that
+// GattCharacteristic1.AcquireNotify hands out instead of PropertiesChanged
+// signals. BlueZ writes each ATT value as one SOCK_SEQPACKET message, so a
+// sample costs one recvmmsg slot instead of a bus-daemon hop and a{sv}
+// unmarshalling. Callers fall back to StartNotify when BlueZ refuses.
+extern bool g_notify_fd;
+
+// Blocking AcquireNotify. Returns an owned non-blocking, close-on-exec fd and
+// the ATT MTU, or negative errno with *err_name set to the D-Bus error.
+int acquire_notify(sd_bus* bus, const std::string& char_path, uint16_t* mtu,
+                   std::string* err_name = nullptr);
+// The fd and MTU from an AcquireNotify reply (async callers), as above.
+int acquire_notify_reply(sd_bus_message* reply, uint16_t* mtu);
+
+// Feeds every value queued on fd to hrm_on_value() for src, up to 16 per
+// recvmmsg. Returns how many were read, or -1 once the socket is closed
+// (link dropped, or BlueZ released it); the caller then closes fd.
+int notify_fd_read(int fd, HrmSource* src);
+
+// sd_bus_wait() that also returns when `fd` is readable (-1: bus only).
+int bus_wait_fd(sd_bus* bus, int fd, uint64_t timeout_us, bool* fd_ready);
@@ -0,0 +1,191 @@
+#include "outfile.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "debug.hpp"
+
+std::string fileset_part_path(const std::string& base, uint32_t seq, bool compressed) {
+  char suffix[24];
+  std::snprintf(suffix, sizeof suffix, ".%06u%s", seq, compressed ? ".zst" : "");
+  return base + suffix;
+}
+
+bool fileset_parse_part(std::string_view path, std::string* base, uint32_t* seq) {
+  if (path.ends_with(".zst")) path.remove_suffix(4);
+  size_t dot = path.rfind('.');
+  if (dot == std::string_view::npos) return false;
+  std::string_view digits = path.substr(dot + 1);
+  uint32_t v = 0;
+  auto r = std::from_chars(digits.data(), digits.data() + digits.size(), v);
+  if (r.ec != std::errc() || r.ptr != digits.data() + digits.size()) return false;
+  // Exactly what fileset_part_path() writes: no sign, six digits or more,
+  // zero-padded only up to six.
+  char canon[16];
+  std::snprintf(canon, sizeof canon, "%06u", v);
+  if (digits != canon) return false;
+  *seq = v;
+  base->assign(path.substr(0, dot));
+  return true;
+}
+
+FileSetSink::~FileSetSink() {
+  close();
+}
+
+bool FileSetSink::open(std::string* err) {
+  if (fs_.compress && !enc_.init(fs_.level, err)) return false;
+  // Continue the numbering of an existing set.
+  namespace fsys = std::filesystem;
+  fsys::path p(fs_.path);
+  fsys::path dir = p.has_parent_path() ? p.parent_path() : fsys::path(".");
+  std::error_code ec;
+  for (fsys::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    std::string base;
+    uint32_t seq = 0;
+    if (fileset_parse_part(it->path().string(), &base, &seq) &&
+        fsys::path(base).filename() == p.filename()) {
+      seq_ = std::max(seq_, seq);
+    }
+  }
+  ++seq_;
+  if (!open_part(err)) return false;
+  thread_ = std::thread([this] { run(); });
+  return true;
+}
+
+bool FileSetSink::open_part(std::string* err) {
+  std::string path = fileset_part_path(fs_.path, seq_, fs_.compress);
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    *err = "cannot create " + path + ": " + strerror(errno);
+    return false;
+  }
+  part_bytes_ = 0;
+  part_opened_ms_ = monotonic_ms();
+  DBG << "[dbg] output: writing " << path << "\n";
+  return true;
+}
+
+void FileSetSink::write_sample(std::string_view tag, const HrmSample& s) {
+  char line[256 + kHrmLineMax + 2];
+  size_t n = 0;
+  if (!tag.empty()) {
+    n = std::min(tag.size(), (size_t)256);
+    std::memcpy(line, tag.data(), n);
+    line[n++] = ' ';
+  }
+  n += hrm_format_line(s, line + n, kHrmLineMax);
+  line[n++] = '\n';
+  if (stage_.empty()) stage_first_ms_ = monotonic_ms();
+  stage_.append(line, n);
+  if (opts_.flush_ms == 0 || stage_.size() >= opts_.flush_bytes) flush();
+}
+
+bool FileSetSink::flush() {
+  if (stage_.empty()) return true;
+  std::unique_lock<std::mutex> lock(mu_);
+  if (stop_) return false;
+  // Backpressure only if the disk has been stalled for a long while.
+  room_.wait(lock, [&] { return queued_bytes_ < kMaxQueuedBytes; });
+  queued_bytes_ += stage_.size();
+  queue_.push_back(std::move(stage_));
+  stage_ = std::string();
+  stage_.reserve(opts_.flush_bytes);
+  work_.notify_one();
+  return true;
+}
+
+uint64_t FileSetSink::deadline_ms() const {
+  return stage_.empty() ? 0 : stage_first_ms_ + opts_.flush_ms;
+}
+
+bool FileSetSink::close() {
+  if (!thread_.joinable()) return !failed_;
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  work_.notify_one();
+  thread_.join();
+  return !failed_;
+}
+
+void FileSetSink::run() {
+  std::unique_lock<std::mutex> lock(mu_);
+  for (;;) {
+    work_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) break;
+    std::string chunk = std::move(queue_.front());
+    queue_.pop_front();
+    queued_bytes_ -= chunk.size();
+    room_.notify_one();
+    lock.unlock();
+    write_chunk(chunk);
+    lock.lock();
+  }
+  lock.unlock();
+  end_part();
+}
+
+void FileSetSink::write_chunk(const std::string& chunk) {
+  if (failed_) return;
+  bool rotate = part_bytes_ > 0 &&
+                ((fs_.rotate_bytes && part_bytes_ >= fs_.rotate_bytes) ||
+                 (fs_.rotate_ms && monotonic_ms() - part_opened_ms_ >= fs_.rotate_ms));
+  if (rotate) {
+    end_part();
+    ++seq_;
+    std::string err;
+    if (!open_part(&err)) {
+      ERR << "[err] output: " << err << "; dropping further samples\n";
+      failed_ = true;
+      return;
+    }
+  }
+  if (!fs_.compress) {
+    write_out(chunk);
+    return;
+  }
+  zbuf_.clear();
+  if (!enc_.compress(chunk, enc_.frame_bytes() + chunk.size() >= kFrameBytes, &zbuf_)) {
+    ERR << "[err] output: zstd compression failed; dropping further samples\n";
+    failed_ = true;
+    return;
+  }
+  write_out(zbuf_);
+}
+
+void FileSetSink::end_part() {
+  if (fd_ < 0) return;
+  if (fs_.compress && enc_.frame_bytes() && !failed_) {
+    zbuf_.clear();
+    if (enc_.compress({}, true, &zbuf_)) write_out(zbuf_);
+  }
+  ::close(fd_);
+  fd_ = -1;
+}
+
+bool FileSetSink::write_out(std::string_view bytes) {
+  while (!bytes.empty()) {
+    ssize_t n = ::write(fd_, bytes.data(), bytes.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      ERR << "[err] output: write to " << fileset_part_path(fs_.path, seq_, fs_.compress)
+          << " failed: " << (n < 0 ? strerror(errno) : "short write")
+          << "; dropping further samples\n";
+      failed_ = true;
+      return false;
+    }
+    bytes.remove_prefix((size_t)n);
+    part_bytes_ += (uint64_t)n;
+  }
+  return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "output.hpp"
+#include "zstd_stream.hpp"
+
+// --out: the text recording goes to a numbered set of files instead of
+// stdout, optionally zstd-compressed and rotated by size or age.
+struct FileSetOptions {
+  std::string path;           // parts are <path>.<NNNNNN>[.zst]
+  bool compress = false;      // --compress zstd
+  int level = 3;
+  uint64_t rotate_bytes = 0;  // --rotate-size: bytes on disk per part; 0 = no limit
+  uint64_t rotate_ms = 0;     // --rotate-time
+};
+
+// Part `seq` of the set at `base`, and the inverse (false for other names,
+// including other digit suffixes such as dates or unpadded numbers).
+std::string fileset_part_path(const std::string& base, uint32_t seq, bool compressed);
+bool fileset_parse_part(std::string_view path, std::string* base, uint32_t* seq);
+
+// Lines are formatted into a staging buffer on the caller's thread; each
+// flush hands the buffer to a writer thread, which compresses and writes it,
+// so neither zstd nor disk I/O runs on the notification path. Every flush is
+// a zstd flush (a crash loses at most what was staged since), and a frame is
+// ended at the first flush after kFrameBytes of input and at rotation.
+// Parts are rotated at flush points, so every part holds whole lines and
+// whole frames; numbering continues after the highest existing part.
+class FileSetSink : public SampleSink {
+ public:
+  static constexpr uint64_t kFrameBytes = 1u << 20;
+
+  FileSetSink(const FileSetOptions& fs, const OutputOptions& opts) : fs_(fs), opts_(opts) {}
+  ~FileSetSink() override;
+
+  // Opens the first part and starts the writer thread.
+  bool open(std::string* err);
+  void write_sample(std::string_view tag, const HrmSample& s) override;
+  bool flush() override;
+  // Flushes, ends the frame and waits for the writer thread.
+  bool close() override;
+  uint64_t deadline_ms() const override;
+
+ private:
+  static constexpr size_t kMaxQueuedBytes = 64u << 20;
+
+  // Writer thread.
+  void run();
+  void write_chunk(const std::string& chunk);
+  bool open_part(std::string* err);
+  void end_part();
+  bool write_out(std::string_view bytes);
+
+  FileSetOptions fs_;
+  OutputOptions opts_;
+  std::string stage_;
+  uint64_t stage_first_ms_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable work_;
+  std::condition_variable room_;
+  std::deque<std::string> queue_;
+  size_t queued_bytes_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+
+  // Owned by the writer thread once started.
+  ZstdEncoder enc_;
+  std::string zbuf_;
+  int fd_ = -1;
+  uint32_t seq_ = 0;
+  uint64_t part_bytes_ = 0;
+  uint64_t part_opened_ms_ = 0;
+  bool failed_ = false;
+};
@@ -0,0 +1,334 @@
+#include "output.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <systemd/sd-event.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+#include <mutex>
+
+#include "binlog.hpp"
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "rollup.hpp"
+#include "shm_publish.hpp"
+
+uint64_t monotonic_ms() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+// ---- BufferedWriter ----
+BufferedWriter::BufferedWriter(int fd, const OutputOptions& opts) : fd_(fd), opts_(opts) {
+  // With O_APPEND (">> file") the offset only moves to the end on write.
+  int fl = fcntl(fd, F_GETFL);
+  off_t at = lseek(fd, 0, (fl >= 0 && (fl & O_APPEND)) ? SEEK_END : SEEK_CUR);
+  if (at > 0) start_ = (uint64_t)at;
+  cap_ = 4096;
+  while (cap_ < opts_.buffer_bytes) cap_ <<= 1;
+  opts_.flush_bytes = std::min(opts_.flush_bytes, cap_);
+  buf_ = static_cast<char*>(std::malloc(cap_));
+  if (!buf_) {
+    ERR << "[fatal] output buffer allocation failed (" << cap_ << " bytes)\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+BufferedWriter::~BufferedWriter() {
+  flush();
+  std::free(buf_);
+}
+
+// EINTR is retried at once, EAGAIN once the fd is writable, a full disk
+// every 100 ms. Anything else, or a transient error that lasts
+// kWriteRetryMs, ends the run: a recorder that silently stops recording is
+// worse than one that stops. _exit because this runs under the output lock
+// that the atexit flush would take again.
+void BufferedWriter::write_failed(ssize_t n, size_t pending) {
+  int err = n < 0 ? errno : EIO;  // a zero-byte write makes no progress either
+  if (err == EINTR) return;
+  uint64_t now = monotonic_ms();
+  if (stall_since_ms_ == 0) stall_since_ms_ = now;
+  bool transient = err == EAGAIN || err == EWOULDBLOCK || err == ENOSPC || err == EDQUOT;
+  if (!transient || now - stall_since_ms_ >= kWriteRetryMs) {
+    ERR << "[fatal] output write failed: " << strerror(err) << "; " << pending
+        << " bytes not written, exiting\n";
+    log_flush();
+    _exit(EXIT_FAILURE);
+  }
+  if (!stall_warned_) {
+    ERR << "[warn] output write: " << strerror(err) << "; retrying for up to "
+        << kWriteRetryMs / 1000 << " s\n";
+    stall_warned_ = true;
+  }
+  if (err == EAGAIN || err == EWOULDBLOCK) {
+    pollfd p{fd_, POLLOUT, 0};
+    poll(&p, 1, 100);
+  } else {
+    timespec ts{0, 100 * 1000000L};
+    nanosleep(&ts, nullptr);
+  }
+}
+
+void BufferedWriter::write_ok() {
+  if (stall_warned_) ERR << "[info] output write recovered\n";
+  stall_since_ms_ = 0;
+  stall_warned_ = false;
+}
+
+void BufferedWriter::append(std::string_view bytes) {
+  if (bytes.size() > cap_ - buffered()) flush();
+  if (bytes.size() > cap_ - buffered()) {
+    // Larger than the whole ring: bypass the buffer (after draining it).
+    size_t off = 0;
+    while (off < bytes.size()) {
+      ssize_t n = ::write(fd_, bytes.data() + off, bytes.size() - off);
+      if (n <= 0) {
+        write_failed(n, bytes.size() - off);
+        continue;
+      }
+      write_ok();
+      off += (size_t)n;
+    }
+    return;
+  }
+
+  if (buffered() == 0) first_ms_ = monotonic_ms();
+  size_t pos = (size_t)(head_ & (cap_ - 1));
+  size_t first = std::min(bytes.size(), cap_ - pos);
+  std::memcpy(buf_ + pos, bytes.data(), first);
+  std::memcpy(buf_, bytes.data() + first, bytes.size() - first);
+  head_ += bytes.size();
+
+  if (opts_.flush_ms == 0 || buffered() >= opts_.flush_bytes) flush();
+}
+
+bool BufferedWriter::flush() {
+  if (buffered() == 0) return true;
+  uint64_t t0 = metrics_now_ns();
+  while (buffered() > 0) {
+    size_t pos = (size_t)(tail_ & (cap_ - 1));
+    size_t len = (size_t)buffered();
+    iovec iov[2];
+    int cnt = 1;
+    iov[0].iov_base = buf_ + pos;
+    iov[0].iov_len = std::min(len, cap_ - pos);
+    if (iov[0].iov_len < len) {
+      iov[1].iov_base = buf_;
+      iov[1].iov_len = len - iov[0].iov_len;
+      cnt = 2;
+    }
+    ssize_t n = ::writev(fd_, iov, cnt);
+    if (n <= 0) {
+      write_failed(n, len);
+      continue;
+    }
+    write_ok();
+    tail_ += (uint64_t)n;
+  }
+  metrics_since(Metric::Flush, t0);
+  return true;
+}
+
+// ---- TextSink ----
+void TextSink::write_sample(std::string_view tag, const HrmSample& s) {
+  char line[256 + kHrmLineMax + 2];
+  size_t n = 0;
+  if (!tag.empty()) {
+    n = std::min(tag.size(), (size_t)256);
+    std::memcpy(line, tag.data(), n);
+    line[n++] = ' ';
+  }
+  n += hrm_format_line(s, line + n, kHrmLineMax);
+  line[n++] = '\n';
+  w_.append(std::string_view(line, n));
+}
+
+// ---- process-wide stream ----
+// Locked so that --pipeline workers and the bus thread can share it; the
+// sd_event flush timer is only attached when a single thread drives output.
+static std::mutex s_mu;
+static std::unique_ptr<SampleSink> s_sink;
+static std::unique_ptr<ShmPublisher> s_shm;
+static std::unique_ptr<RollupWriter> s_rollup;
+static sd_event_source* s_flush_timer = nullptr;
+static bool s_timer_armed = false;
+
+static bool s_closed = false;
+
+static void output_atexit() {
+  output_close();
+}
+
+static void set_sink_locked(std::unique_ptr<SampleSink> sink) {
+  if (s_sink) s_sink->flush();
+  s_sink = std::move(sink);
+}
+
+static std::unique_ptr<SampleSink> make_sink(const OutputOptions& opts) {
+  if (opts.format == OutputFormat::Binary) return std::make_unique<BinlogSink>(STDOUT_FILENO, opts);
+  return std::make_unique<TextSink>(STDOUT_FILENO, opts);
+}
+
+static void register_atexit() {
+  static bool registered = false;
+  if (!registered) {
+    std::atexit(output_atexit);
+    registered = true;
+  }
+}
+
+void output_init(const OutputOptions& opts) {
+  {
+    std::lock_guard<std::mutex> lock(s_mu);
+    set_sink_locked(make_sink(opts));
+  }
+  register_atexit();
+}
+
+void output_set_sink(std::unique_ptr<SampleSink> sink) {
+  std::lock_guard<std::mutex> lock(s_mu);
+  set_sink_locked(std::move(sink));
+}
+
+bool output_publish_shm(const std::string& name, uint64_t records) {
+  auto shm = std::make_unique<ShmPublisher>();
+  std::string err;
+  if (!shm->open(name, records, &err)) {
+    ERR << "[err] --shm: " << err << "\n";
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(s_mu);
+  s_shm = std::move(shm);
+  register_atexit();
+  return true;
+}
+
+bool output_rollup(const std::string& dir) {
+  auto rollup = std::make_unique<RollupWriter>();
+  std::string err;
+  if (!rollup->open(dir, false, false, &err)) {
+    ERR << "[err] --rollup: " << err << "\n";
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(s_mu);
+  s_rollup = std::move(rollup);
+  register_atexit();
+  return true;
+}
+
+static void ensure_sink_locked() {
+  if (s_sink) return;
+  s_sink = make_sink(OutputOptions{});
+  register_atexit();
+}
+
+static void arm_flush_timer() {
+  if (!s_flush_timer || s_timer_armed || !s_sink) return;
+  uint64_t deadline = s_sink->deadline_ms();
+  if (!deadline) return;
+  sd_event_source_set_time(s_flush_timer, deadline * 1000ULL);
+  sd_event_source_set_enabled(s_flush_timer, SD_EVENT_ONESHOT);
+  s_timer_armed = true;
+}
+
+void output_sample(std::string_view tag, const HrmSample& s) {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (s_closed) return;
+  ensure_sink_locked();
+  if (s_shm) s_shm->publish_sample(tag, s);
+  if (s_rollup) s_rollup->add(tag, (int64_t)s.ts_ms, s.bpm, s.rr());
+  s_sink->write_sample(tag, s);
+  arm_flush_timer();
+}
+
+void output_device(std::string_view tag, std::string_view name, std::string_view address) {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (s_closed) return;
+  ensure_sink_locked();
+  if (s_shm) s_shm->describe_device(tag, name, address);
+  s_sink->describe_device(tag, name, address);
+  arm_flush_timer();
+}
+
+void output_pmd(std::string_view tag, const PmdFrame& f, uint64_t ts_ms) {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (s_closed) return;
+  ensure_sink_locked();
+  s_sink->write_pmd(tag, f, ts_ms);
+  arm_flush_timer();
+}
+
+static void poll_locked() {
+  if (!s_sink) return;
+  uint64_t deadline = s_sink->deadline_ms();
+  if (deadline && monotonic_ms() >= deadline) s_sink->flush();
+}
+
+void output_poll() {
+  std::lock_guard<std::mutex> lock(s_mu);
+  poll_locked();
+}
+
+void output_flush() {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (s_sink) s_sink->flush();
+}
+
+void output_close() {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (s_closed) return;
+  s_closed = true;
+  if (s_sink) s_sink->close();
+  s_shm.reset();
+  if (s_rollup) s_rollup->close();
+  s_rollup.reset();
+}
+
+uint64_t output_timeout_us() {
+  std::lock_guard<std::mutex> lock(s_mu);
+  if (!s_sink) return UINT64_MAX;
+  uint64_t deadline = s_sink->deadline_ms();
+  if (!deadline) return UINT64_MAX;
+  uint64_t now = monotonic_ms();
+  return (deadline > now) ? (deadline - now) * 1000ULL : 0;
+}
+
+static int flush_timer_cb(sd_event_source* s, uint64_t usec, void* userdata) {
+  (void)s;
+  (void)usec;
+  (void)userdata;
+  std::lock_guard<std::mutex> lock(s_mu);
+  s_timer_armed = false;
+  poll_locked();
+  arm_flush_timer();
+  return 0;
+}
+
+void output_attach_event(sd_event* event) {
+  if (s_flush_timer) return;
+  int r = sd_event_add_time(event, &s_flush_timer, CLOCK_MONOTONIC, UINT64_MAX, 0,
+                            flush_timer_cb, nullptr);
+  if (r < 0) {
+    ERR << "[warn] output flush timer: " << strerror(-r) << "\n";
+    s_flush_timer = nullptr;
+    return;
+  }
+  sd_event_source_set_enabled(s_flush_timer, SD_EVENT_OFF);
+  std::lock_guard<std::mutex> lock(s_mu);
+  s_timer_armed = false;
+  arm_flush_timer();
+}
+
+void output_detach_event() {
+  if (s_flush_timer) s_flush_timer = sd_event_source_unref(s_flush_timer);
+  s_timer_armed = false;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "hrm.hpp"
+
+struct PmdFrame;
+struct sd_event;
+
+enum class OutputFormat { Text, Binary };
+
+// Flush policy for the sample stream. flush_ms == 0 keeps the historical
+// behaviour of one write per sample (lowest latency for live dashboards);
+// larger values batch samples until flush_bytes are buffered or the oldest
+// buffered byte is flush_ms old.
+struct OutputOptions {
+  OutputFormat format = OutputFormat::Text;
+  uint64_t flush_ms = 0;
+  size_t flush_bytes = 64 * 1024;
+  size_t buffer_bytes = 1 << 20;  // rounded up to a power of two
+};
+
+// Ring-buffered fd writer. Partial writes leave the unwritten bytes in the
+// ring, so a slow pipe only costs memory, never reordering.
+class BufferedWriter {
+ public:
+  BufferedWriter(int fd, const OutputOptions& opts);
+  ~BufferedWriter();
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+  // Both retry transient write errors and exit the process on a persistent
+  // one, so flush() only returns once everything is written.
+  void append(std::string_view bytes);
+  bool flush();
+
+  size_t buffered() const { return head_ - tail_; }
+  // File offset of the next appended byte: bytes appended so far plus where
+  // the fd stood when the writer was created (0 for pipes and terminals).
+  uint64_t position() const { return start_ + head_; }
+  // Monotonic ms at which the buffered data must be flushed; 0 when empty.
+  uint64_t deadline_ms() const { return buffered() ? first_ms_ + opts_.flush_ms : 0; }
+  int fd() const { return fd_; }
+  const OutputOptions& options() const { return opts_; }
+
+ private:
+  int fd_;
+  OutputOptions opts_;
+  char* buf_ = nullptr;
+  size_t cap_ = 0;        // power of two
+  uint64_t start_ = 0;    // file offset of the first appended byte
+  uint64_t head_ = 0;     // total bytes appended
+  uint64_t tail_ = 0;     // total bytes written out
+  uint64_t first_ms_ = 0; // when the ring went from empty to non-empty
+  uint64_t stall_since_ms_ = 0;  // first failed write of the current stall
+  bool stall_warned_ = false;
+
+  static constexpr uint64_t kWriteRetryMs = 10000;
+  void write_failed(ssize_t n, size_t pending);
+  void write_ok();
+};
+
+// Destination for parsed samples; formats and forwards to a writer.
+class SampleSink {
+ public:
+  virtual ~SampleSink() = default;
+  virtual void write_sample(std::string_view tag, const HrmSample& s) = 0;
+  // Identity of the strap behind `tag`; sinks without a header ignore it.
+  virtual void describe_device(std::string_view tag, std::string_view name,
+                               std::string_view address) {
+    (void)tag; (void)name; (void)address;
+  }
+  // A --pmd ECG/ACC frame that arrived at ts_ms; only binary sinks keep them.
+  virtual void write_pmd(std::string_view tag, const PmdFrame& f, uint64_t ts_ms) {
+    (void)tag; (void)f; (void)ts_ms;
+  }
+  virtual bool flush() = 0;
+  // Final flush; formats with a trailer write it here.
+  virtual bool close() { return flush(); }
+  virtual uint64_t deadline_ms() const = 0;
+};
+
+// "<tag> <epoch_ms>,<bpm>[,<rr_ms>...]\n" lines (tag omitted when empty).
+class TextSink : public SampleSink {
+ public:
+  TextSink(int fd, const OutputOptions& opts) : w_(fd, opts) {}
+  void write_sample(std::string_view tag, const HrmSample& s) override;
+  bool flush() override { return w_.flush(); }
+  uint64_t deadline_ms() const override { return w_.deadline_ms(); }
+
+ private:
+  BufferedWriter w_;
+};
+
+// Process-wide output stream (stdout unless replaced).
+void output_init(const OutputOptions& opts);
+void output_set_sink(std::unique_ptr<SampleSink> sink);
+// --shm: samples and device identities also go to this shared-memory ring
+// (shm_ring.hpp), ahead of the sink; removed again by output_close().
+bool output_publish_shm(const std::string& name, uint64_t records);
+// --rollup: samples are also added to the rollup store in `dir`
+// (rollup.hpp); its open buckets are written by output_close().
+bool output_rollup(const std::string& dir);
+void output_sample(std::string_view tag, const HrmSample& s);
+void output_device(std::string_view tag, std::string_view name, std::string_view address);
+void output_pmd(std::string_view tag, const PmdFrame& f, uint64_t ts_ms);
+// Flushes if the latency threshold has passed.
+void output_poll();
+void output_flush();
+// Flush and finalize (binary index); further samples are dropped.
+void output_close();
+// Microseconds until output_poll() has work; UINT64_MAX when nothing is buffered.
+uint64_t output_timeout_us();
+// Arms an sd_event timer for latency flushes (--async loop).
+void output_attach_event(sd_event* event);
+void output_detach_event();
+
+uint64_t monotonic_ms();
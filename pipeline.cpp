@@ -0,0 +1,173 @@
+#include "pipeline.hpp"
+
+#include <pthread.h>
+
+#include <csignal>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "bluetooth.hpp"
+#include "debug.hpp"
+#include "output.hpp"
+#include "spsc.hpp"
+
+namespace {
+
+// Upper bound on a worker's sleep, so buffered output still meets its flush
+// deadline when no samples arrive.
+constexpr auto kIdleWait = std::chrono::milliseconds(500);
+// Safety net for the full-ring wait; normally the worker wakes the producer.
+constexpr auto kFullWait = std::chrono::milliseconds(10);
+
+struct Item {
+  HrmSource* src = nullptr;
+  HrmSample sample;
+  uint64_t notify_ns = 0;
+};
+
+struct Lane {
+  explicit Lane(size_t depth) : ring(depth) {}
+
+  SpscRing<Item> ring;
+  std::thread thread;
+  // Sleeping on either side goes through the mutex; the fast path never does.
+  std::mutex mu;
+  std::condition_variable has_items;
+  std::condition_variable has_room;
+  std::atomic<bool> worker_idle{false};
+  std::atomic<bool> producer_blocked{false};
+  // Written by the producer only.
+  std::atomic<uint64_t> queued{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> full_waits{0};
+  std::atomic<size_t> max_depth{0};
+};
+
+std::vector<std::unique_ptr<Lane>> s_lanes;
+std::atomic<bool> s_stopping{false};
+bool s_drop_when_full = false;
+unsigned s_next_lane = 0;
+
+void worker_main(Lane* lane) {
+  // Signals belong to the bus thread (sigaction flags or sd_event signalfd).
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+  Item item;
+  for (;;) {
+    while (lane->ring.try_pop(&item)) {
+      hrm_deliver(item.src, item.sample, item.notify_ns);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (lane->producer_blocked.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(lane->mu);
+        lane->has_room.notify_one();
+      }
+    }
+    output_poll();
+    if (s_stopping.load(std::memory_order_acquire) && lane->ring.empty()) break;
+
+    std::unique_lock<std::mutex> lock(lane->mu);
+    lane->worker_idle.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (lane->ring.empty() && !s_stopping.load(std::memory_order_acquire)) {
+      auto wait = kIdleWait;
+      uint64_t us = output_timeout_us();
+      if (us != UINT64_MAX) wait = std::min<decltype(wait)>(wait, std::chrono::milliseconds(us / 1000));
+      lane->has_items.wait_for(lock, wait);
+    }
+    lane->worker_idle.store(false, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+PipelineOptions g_pipeline;
+
+bool pipeline_running() {
+  return !s_lanes.empty();
+}
+
+void pipeline_start(const PipelineOptions& opts) {
+  if (opts.workers == 0 || !s_lanes.empty()) return;
+  s_stopping.store(false);
+  s_drop_when_full = opts.drop_when_full;
+  for (unsigned i = 0; i < opts.workers; ++i) s_lanes.push_back(std::make_unique<Lane>(opts.depth));
+  for (auto& l : s_lanes) l->thread = std::thread(worker_main, l.get());
+  DBG << "[dbg] pipeline: " << s_lanes.size() << " worker(s), " << s_lanes[0]->ring.capacity()
+      << " samples per ring, " << (s_drop_when_full ? "drop" : "wait") << " when full\n";
+}
+
+bool pipeline_submit(HrmSource* src, const HrmSample& s, uint64_t notify_ns) {
+  if (src->lane < 0) src->lane = (int)(s_next_lane++ % s_lanes.size());
+  Lane* lane = s_lanes[(size_t)src->lane].get();
+  Item item{src, s, notify_ns};
+  if (!lane->ring.try_push(item)) {
+    if (s_drop_when_full) {
+      lane->dropped.store(lane->dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      return false;
+    }
+    lane->full_waits.store(lane->full_waits.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(lane->mu);
+    lane->producer_blocked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!lane->ring.try_push(item)) lane->has_room.wait_for(lock, kFullWait);
+    lane->producer_blocked.store(false, std::memory_order_relaxed);
+  }
+  lane->queued.store(lane->queued.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  size_t depth = lane->ring.producer_size();
+  if (depth > lane->max_depth.load(std::memory_order_relaxed))
+    lane->max_depth.store(depth, std::memory_order_relaxed);
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (lane->worker_idle.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(lane->mu);
+    lane->has_items.notify_one();
+  }
+  return true;
+}
+
+void pipeline_stop() {
+  if (s_lanes.empty()) return;
+  s_stopping.store(true, std::memory_order_release);
+  for (auto& l : s_lanes) {
+    std::lock_guard<std::mutex> lock(l->mu);
+    l->has_items.notify_one();
+  }
+  for (auto& l : s_lanes) l->thread.join();
+  pipeline_log_stats();
+  s_lanes.clear();
+  output_flush();
+}
+
+std::vector<PipelineLaneStats> pipeline_stats() {
+  std::vector<PipelineLaneStats> out;
+  for (const auto& l : s_lanes) {
+    PipelineLaneStats st;
+    st.queued = l->queued.load(std::memory_order_relaxed);
+    st.dropped = l->dropped.load(std::memory_order_relaxed);
+    st.full_waits = l->full_waits.load(std::memory_order_relaxed);
+    st.depth = l->ring.producer_size();
+    st.max_depth = l->max_depth.load(std::memory_order_relaxed);
+    st.capacity = l->ring.capacity();
+    out.push_back(st);
+  }
+  return out;
+}
+
+void pipeline_log_stats() {
+  std::vector<PipelineLaneStats> stats = pipeline_stats();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    const PipelineLaneStats& st = stats[i];
+    ERR << "[info] pipeline lane " << i << ": queued=" << st.queued << " dropped=" << st.dropped
+        << " full_waits=" << st.full_waits << " depth=" << st.depth << " max_depth="
+        << st.max_depth << "/" << st.capacity << "\n";
+  }
+}
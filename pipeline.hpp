@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hrm.hpp"
+
+struct HrmSource;
+
+// --pipeline: props_changed_cb only parses and de-duplicates, then hands the
+// sample to a worker thread through a lock-free SPSC ring (one ring per
+// worker, the bus thread being the only producer). Workers run the health
+// detectors, HRV and output formatting. Each strap sticks to one worker, so
+// its samples stay in order.
+struct PipelineOptions {
+  unsigned workers = 0;       // 0: everything inline on the bus thread
+  size_t depth = 1024;        // samples per ring, rounded up to a power of two
+  bool drop_when_full = false;  // default: the bus thread waits for room
+};
+
+extern PipelineOptions g_pipeline;
+
+struct PipelineLaneStats {
+  uint64_t queued = 0;      // samples accepted
+  uint64_t dropped = 0;     // rejected because the ring was full (drop mode)
+  uint64_t full_waits = 0;  // times the bus thread had to wait for room
+  size_t depth = 0;         // samples waiting now
+  size_t max_depth = 0;
+  size_t capacity = 0;
+};
+
+bool pipeline_running();
+void pipeline_start(const PipelineOptions& opts);
+// Bus thread only. False when the sample was dropped.
+bool pipeline_submit(HrmSource* src, const HrmSample& s, uint64_t notify_ns);
+// Drains every ring, joins the workers and flushes the output. Called before
+// the HrmSources of queued samples go away; later calls do nothing.
+void pipeline_stop();
+// One entry per worker; empty when not running.
+std::vector<PipelineLaneStats> pipeline_stats();
+// "[info] pipeline lane <i>: ..." lines on stderr.
+void pipeline_log_stats();
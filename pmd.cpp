@@ -0,0 +1,173 @@
+#include "pmd.hpp"
+
+namespace {
+
+constexpr size_t kFrameHeader = 10;
+
+inline uint64_t le(const uint8_t* p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; ++i) v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+inline int32_t sign_extend(uint64_t v, unsigned bits) {
+  uint64_t m = 1ULL << (bits - 1);
+  return (int32_t)(int64_t)((v ^ m) - m);
+}
+
+size_t put_setting(uint8_t* out, uint8_t kind, uint16_t value) {
+  out[0] = kind;
+  out[1] = 1;  // one value
+  out[2] = (uint8_t)(value & 0xff);
+  out[3] = (uint8_t)(value >> 8);
+  return 4;
+}
+
+// Fixed-width samples: n bytes per value, `channels` values per sample.
+PmdDecode decode_raw(const uint8_t* p, size_t len, unsigned bytes, PmdFrame* out) {
+  size_t per_sample = (size_t)bytes * out->channels;
+  size_t samples = len / per_sample;
+  if (samples * out->channels > kPmdMaxValues) return PmdDecode::Overflow;
+  size_t values = samples * out->channels;
+  int32_t* v = out->v;
+  if (bytes == 3) {
+    for (size_t i = 0; i < values; ++i, p += 3)
+      v[i] = sign_extend((uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16, 24);
+  } else if (bytes == 2) {
+    for (size_t i = 0; i < values; ++i, p += 2) v[i] = (int16_t)(p[0] | p[1] << 8);
+  } else {
+    for (size_t i = 0; i < values; ++i) v[i] = (int8_t)p[i];
+  }
+  out->samples = (uint32_t)samples;
+  return PmdDecode::Ok;
+}
+
+// Reference sample, then (bit width, count, packed deltas) blocks until the
+// value ends; each delta accumulates onto the previous sample's channel.
+PmdDecode decode_delta(const uint8_t* p, size_t len, unsigned ref_bytes, PmdFrame* out) {
+  const unsigned ch = out->channels;
+  const uint8_t* end = p + len;
+  if (len < (size_t)ref_bytes * ch) return PmdDecode::Short;
+  int32_t* v = out->v;
+  for (unsigned c = 0; c < ch; ++c, p += ref_bytes) v[c] = sign_extend(le(p, ref_bytes), ref_bytes * 8);
+  size_t n = ch;
+
+  while (end - p >= 2) {
+    unsigned bits = p[0];
+    size_t count = p[1];
+    p += 2;
+    if (bits == 0 || bits > 32) return PmdDecode::UnknownFrame;
+    size_t deltas = count * ch;
+    size_t bytes = (deltas * bits + 7) / 8;
+    if ((size_t)(end - p) < bytes) return PmdDecode::Short;
+    if (n + deltas > kPmdMaxValues) return PmdDecode::Overflow;
+
+    uint64_t acc = 0;
+    unsigned have = 0;
+    const uint64_t mask = (bits == 32) ? 0xffffffffULL : ((1ULL << bits) - 1);
+    const uint8_t* q = p;
+    for (size_t i = 0; i < deltas; ++i) {
+      while (have < bits) {
+        acc |= (uint64_t)*q++ << have;
+        have += 8;
+      }
+      int32_t d = sign_extend(acc & mask, bits);
+      acc >>= bits;
+      have -= bits;
+      v[n] = v[n - ch] + d;
+      ++n;
+    }
+    p += bytes;
+  }
+  out->samples = (uint32_t)(n / ch);
+  return PmdDecode::Ok;
+}
+
+}  // namespace
+
+PmdSettings pmd_default_settings(PmdType t) {
+  if (t == PmdType::Ecg) return PmdSettings{130, 14, 0};
+  return PmdSettings{200, 16, 8};
+}
+
+const char* pmd_type_name(PmdType t) {
+  return t == PmdType::Ecg ? "ecg" : "acc";
+}
+
+size_t pmd_start_command(PmdType t, const PmdSettings& s, uint8_t* out) {
+  size_t n = 0;
+  out[n++] = kPmdOpStart;
+  out[n++] = (uint8_t)t;
+  n += put_setting(out + n, 0x00, s.rate_hz);
+  n += put_setting(out + n, 0x01, s.resolution_bits);
+  if (t == PmdType::Acc && s.range_g) n += put_setting(out + n, 0x02, s.range_g);
+  return n;
+}
+
+size_t pmd_stop_command(PmdType t, uint8_t* out) {
+  out[0] = kPmdOpStop;
+  out[1] = (uint8_t)t;
+  return 2;
+}
+
+bool pmd_parse_response(const uint8_t* p, size_t n, PmdResponse* out) {
+  if (n < 4 || p[0] != 0xf0) return false;
+  out->op = p[1];
+  out->type = p[2];
+  out->status = p[3];
+  return true;
+}
+
+const char* pmd_status_name(uint8_t status) {
+  static const char* const kNames[] = {
+    "success", "invalid op code", "invalid measurement type", "not supported",
+    "invalid length", "invalid parameter", "already in state", "invalid resolution",
+    "invalid sample rate", "invalid range", "invalid MTU", "invalid number of channels",
+    "invalid state", "device in charger",
+  };
+  return status < sizeof(kNames) / sizeof(kNames[0]) ? kNames[status] : "unknown error";
+}
+
+const char* pmd_decode_name(PmdDecode d) {
+  switch (d) {
+    case PmdDecode::Ok: return "ok";
+    case PmdDecode::Short: return "short frame";
+    case PmdDecode::UnknownType: return "unknown measurement type";
+    case PmdDecode::UnknownFrame: return "unknown frame type";
+    case PmdDecode::Overflow: return "too many samples";
+  }
+  return "?";
+}
+
+void PmdDecoder::set(PmdType t, const PmdSettings& s) {
+  (t == PmdType::Ecg ? ecg_ : acc_) = s;
+}
+
+PmdDecode PmdDecoder::decode(const uint8_t* p, size_t n, PmdFrame* out) const {
+  if (n < kFrameHeader) return PmdDecode::Short;
+  const PmdSettings* s = nullptr;
+  if (p[0] == (uint8_t)PmdType::Ecg) s = &ecg_;
+  else if (p[0] == (uint8_t)PmdType::Acc) s = &acc_;
+  else return PmdDecode::UnknownType;
+
+  out->type = (PmdType)p[0];
+  out->channels = (out->type == PmdType::Ecg) ? 1 : 3;
+  out->rate_hz = s->rate_hz;
+  out->sensor_ts_ns = le(p + 1, 8);
+  out->samples = 0;
+  const uint8_t frame = p[9];
+  const uint8_t* data = p + kFrameHeader;
+  const size_t len = n - kFrameHeader;
+
+  if (frame & 0x80) {
+    unsigned ref_bytes = (s->resolution_bits + 7u) / 8u;
+    if (ref_bytes == 0 || ref_bytes > 4) return PmdDecode::UnknownFrame;
+    return decode_delta(data, len, ref_bytes, out);
+  }
+  if (out->type == PmdType::Ecg) {
+    if (frame != 0) return PmdDecode::UnknownFrame;
+    return decode_raw(data, len, 3, out);
+  }
+  if (frame > 2) return PmdDecode::UnknownFrame;
+  return decode_raw(data, len, frame + 1u, out);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Polar Measurement Data (PMD): the H10's raw ECG and accelerometer streams.
+// A stream is started by writing to the control point, which answers by
+// indication; samples then arrive as frames on the data characteristic:
+//
+//   frame := u8 measurement type, u64 sensor timestamp (ns, last sample),
+//            u8 frame type, samples
+//
+// Frame type bit 7 selects delta compression: one reference sample, then
+// blocks of u8 bit width, u8 sample count and count * channels signed deltas
+// of that width, packed LSB first. Otherwise samples are fixed-width signed
+// little-endian values (ECG: 3 bytes, uV; ACC: 1/2/3 bytes per axis, mG).
+inline constexpr std::string_view kPmdControlUUID = "fb005c81-02e7-f387-1cad-8acd2d8df0c8";
+inline constexpr std::string_view kPmdDataUUID = "fb005c82-02e7-f387-1cad-8acd2d8df0c8";
+
+enum class PmdType : uint8_t { Ecg = 0, Acc = 2 };
+
+struct PmdSettings {
+  uint16_t rate_hz = 0;
+  uint16_t resolution_bits = 0;
+  uint16_t range_g = 0;  // ACC only; 0 = not sent
+};
+
+// H10: ECG 130 Hz / 14 bit; ACC 25/50/100/200 Hz, 16 bit, 2/4/8 G.
+PmdSettings pmd_default_settings(PmdType t);
+const char* pmd_type_name(PmdType t);
+
+// Control point writes; return the command length.
+inline constexpr size_t kPmdCommandMax = 16;
+size_t pmd_start_command(PmdType t, const PmdSettings& s, uint8_t* out);
+size_t pmd_stop_command(PmdType t, uint8_t* out);
+
+// Control point response: F0 <op> <type> <status> [params].
+inline constexpr uint8_t kPmdOpStart = 0x02;
+inline constexpr uint8_t kPmdOpStop = 0x03;
+inline constexpr uint8_t kPmdStatusOk = 0x00;
+inline constexpr uint8_t kPmdStatusAlreadyInState = 0x06;
+struct PmdResponse {
+  uint8_t op = 0;
+  uint8_t type = 0;
+  uint8_t status = 0;
+};
+bool pmd_parse_response(const uint8_t* p, size_t n, PmdResponse* out);
+const char* pmd_status_name(uint8_t status);
+
+// One decoded data frame. Preallocated once by its owner: decoding writes
+// straight into v[] and never allocates.
+inline constexpr size_t kPmdMaxValues = 4096;  // channels * samples
+struct PmdFrame {
+  PmdType type = PmdType::Ecg;
+  uint8_t channels = 0;      // 1 (ECG) or 3 (ACC x, y, z)
+  uint16_t rate_hz = 0;
+  uint32_t samples = 0;
+  uint64_t sensor_ts_ns = 0; // sensor clock at the last sample
+  int32_t v[kPmdMaxValues];  // channel-interleaved
+};
+
+enum class PmdDecode : uint8_t { Ok, Short, UnknownType, UnknownFrame, Overflow };
+const char* pmd_decode_name(PmdDecode d);
+
+// Decodes data frames using the settings the streams were started with
+// (rate, and the reference sample width of compressed frames).
+class PmdDecoder {
+ public:
+  void set(PmdType t, const PmdSettings& s);
+  PmdDecode decode(const uint8_t* p, size_t n, PmdFrame* out) const;
+
+ private:
+  PmdSettings ecg_ = pmd_default_settings(PmdType::Ecg);
+  PmdSettings acc_ = pmd_default_settings(PmdType::Acc);
+};
@@ -0,0 +1,311 @@
+#include "pmd_capture.hpp"
+
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include "bluetooth.hpp"
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "output.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+enum class StreamState { Idle, Starting, Streaming, Failed };
+
+struct Stream {
+  PmdType type = PmdType::Ecg;
+  PmdSettings settings;
+  StreamState state = StreamState::Idle;
+  Clock::time_point deadline{};  // Starting: reply due; Failed: next retry
+};
+
+struct Capture {
+  std::string dev_path;
+  std::string cp_path;
+  std::string data_path;
+  sd_bus_slot* cp_slot{};
+  sd_bus_slot* data_slot{};
+  bool subscribed = false;
+  bool missing_logged = false;
+  Clock::time_point retry_at{};  // subscribe back-off
+  Stream streams[2];
+  unsigned nstreams = 0;
+  PmdDecoder decoder;
+  std::unique_ptr<PmdFrame> frame;
+  uint64_t frames = 0;
+  uint64_t decode_errors = 0;
+};
+
+Capture s_pmd;
+
+uint64_t epoch_ms() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void setup_streams(Capture* c) {
+  c->nstreams = 0;
+  if (g_pmd.ecg) {
+    Stream& s = c->streams[c->nstreams++];
+    s = Stream{};
+    s.type = PmdType::Ecg;
+    s.settings = pmd_default_settings(PmdType::Ecg);
+  }
+  if (g_pmd.acc) {
+    Stream& s = c->streams[c->nstreams++];
+    s = Stream{};
+    s.type = PmdType::Acc;
+    s.settings = pmd_default_settings(PmdType::Acc);
+    s.settings.rate_hz = g_pmd.acc_rate_hz;
+    s.settings.range_g = g_pmd.acc_range_g;
+  }
+  for (unsigned i = 0; i < c->nstreams; ++i)
+    c->decoder.set(c->streams[i].type, c->streams[i].settings);
+}
+
+void reset(Capture* c) {
+  c->cp_slot = sd_bus_slot_unref(c->cp_slot);
+  c->data_slot = sd_bus_slot_unref(c->data_slot);
+  c->cp_path.clear();
+  c->data_path.clear();
+  c->subscribed = false;
+  c->retry_at = {};
+  for (unsigned i = 0; i < c->nstreams; ++i) {
+    c->streams[i].state = StreamState::Idle;
+    c->streams[i].deadline = {};
+  }
+}
+
+int write_value(sd_bus* bus, const std::string& char_path, const uint8_t* p, size_t n) {
+  sd_bus_message* m = nullptr;
+  int r = sd_bus_message_new_method_call(bus, &m, std::string(kBluezService).c_str(),
+                                         char_path.c_str(), std::string(kGattChar1).c_str(),
+                                         "WriteValue");
+  if (r < 0) return r;
+  r = sd_bus_message_append_array(m, 'y', p, n);
+  if (r >= 0) r = sd_bus_message_append(m, "a{sv}", 0);
+  if (r < 0) { sd_bus_message_unref(m); return r; }
+
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+  uint64_t t0 = metrics_now_ns();
+  r = sd_bus_call(bus, m, 0, &error, nullptr);
+  metrics_since(Metric::CallOther, t0);
+  if (r < 0) {
+    ERR << "[err] D-Bus: " << (error.name ? error.name : "unknown")
+        << " - " << (error.message ? error.message : "") << "\n";
+  }
+  sd_bus_error_free(&error);
+  sd_bus_message_unref(m);
+  return r;
+}
+
+// Points *data into the message at the Value of a GattCharacteristic1
+// PropertiesChanged signal; false if the signal carries none.
+bool read_changed_value(sd_bus_message* m, const void** data, size_t* len) {
+  const char* interface = nullptr;
+  if (sd_bus_message_read(m, "s", &interface) < 0) return false;
+  if (!interface || std::string_view(interface) != kGattChar1) return false;
+  if (sd_bus_message_enter_container(m, 'a', "{sv}") < 0) return false;
+  int r;
+  while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+    const char* prop = nullptr;
+    if (sd_bus_message_read(m, "s", &prop) < 0) return false;
+    if (prop && std::strcmp(prop, "Value") == 0) {
+      if (sd_bus_message_enter_container(m, 'v', "ay") < 0) return false;
+      return sd_bus_message_read_array(m, 'y', data, len) >= 0;
+    }
+    if (sd_bus_message_skip(m, "v") < 0) return false;
+    sd_bus_message_exit_container(m);
+  }
+  return false;
+}
+
+int pmd_cp_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)ret_error;
+  auto* c = static_cast<Capture*>(userdata);
+  const void* data = nullptr;
+  size_t len = 0;
+  if (!read_changed_value(m, &data, &len)) return 0;
+  PmdResponse resp;
+  if (!pmd_parse_response(static_cast<const uint8_t*>(data), len, &resp)) {
+    DBG << "[dbg] PMD control point: raw=["
+        << LogHex{static_cast<const uint8_t*>(data), len} << "]\n";
+    return 0;
+  }
+  if (resp.op != kPmdOpStart) return 0;
+  for (unsigned i = 0; i < c->nstreams; ++i) {
+    Stream& s = c->streams[i];
+    if ((uint8_t)s.type != resp.type || s.state != StreamState::Starting) continue;
+    if (resp.status == kPmdStatusOk || resp.status == kPmdStatusAlreadyInState) {
+      s.state = StreamState::Streaming;
+      ERR << "[info] PMD " << pmd_type_name(s.type) << " streaming at "
+          << s.settings.rate_hz << " Hz\n";
+    } else {
+      s.state = StreamState::Failed;
+      s.deadline = Clock::now() + 10s;
+      ERR << "[err] PMD " << pmd_type_name(s.type) << " start refused: "
+          << pmd_status_name(resp.status) << "\n";
+    }
+  }
+  return 0;
+}
+
+int pmd_data_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)ret_error;
+  const uint64_t t0 = metrics_now_ns();
+  const uint64_t ts_ms = epoch_ms();
+  auto* c = static_cast<Capture*>(userdata);
+  const void* data = nullptr;
+  size_t len = 0;
+  if (!read_changed_value(m, &data, &len)) return 0;
+  PmdDecode d = c->decoder.decode(static_cast<const uint8_t*>(data), len, c->frame.get());
+  if (d != PmdDecode::Ok) {
+    // Once per connection on stderr; the rest only with -d.
+    if (c->decode_errors++ == 0) {
+      ERR << "[warn] PMD frame dropped: " << pmd_decode_name(d) << "\n";
+    } else {
+      DBG << "[dbg] PMD frame dropped: " << pmd_decode_name(d) << " (" << len << " bytes)\n";
+    }
+    return 0;
+  }
+  ++c->frames;
+  output_pmd({}, *c->frame, ts_ms);
+  metrics_since(Metric::Callback, t0);
+  return 0;
+}
+
+int add_value_match(sd_bus* bus, const std::string& path, sd_bus_slot** slot,
+                    sd_bus_message_handler_t cb, Capture* c) {
+  std::string match =
+    "type='signal',"
+    "sender='org.bluez',"
+    "interface='org.freedesktop.DBus.Properties',"
+    "member='PropertiesChanged',"
+    "path='" + path + "'";
+  DBG << "[dbg] Installing PMD D-Bus match: " << match << "\n";
+  int r = sd_bus_add_match(bus, slot, match.c_str(), cb, c);
+  if (r < 0) ERR << "[err] sd_bus_add_match failed: " << -r << "\n";
+  return r;
+}
+
+bool subscribe(sd_bus* bus, Capture* c) {
+  if (add_value_match(bus, c->cp_path, &c->cp_slot, pmd_cp_cb, c) < 0 ||
+      add_value_match(bus, c->data_path, &c->data_slot, pmd_data_cb, c) < 0) {
+    return false;
+  }
+  // Control point replies come by indication; subscribe before writing.
+  if (start_notify(bus, c->cp_path) < 0 || start_notify(bus, c->data_path) < 0) {
+    ERR << "[warn] PMD StartNotify failed\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+uint64_t pmd_maintain(sd_bus* bus, const std::string& dev_path) {
+  Capture* c = &s_pmd;
+  if (!g_pmd.enabled()) return UINT64_MAX;
+  if (!c->frame) {
+    c->frame = std::make_unique<PmdFrame>();
+    setup_streams(c);
+  }
+  if (dev_path != c->dev_path) {
+    reset(c);
+    c->dev_path = dev_path;
+    c->missing_logged = false;
+  }
+  if (!cached_device_connected(dev_path).value_or(false) ||
+      !cached_services_resolved(dev_path).value_or(true)) {
+    if (c->subscribed || c->cp_slot) {
+      DBG << "[dbg] PMD: link down, streams reset\n";
+      reset(c);
+    }
+    return UINT64_MAX;
+  }
+
+  const auto now = Clock::now();
+  if (!c->subscribed) {
+    if (now < c->retry_at) {
+      return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        c->retry_at - now).count();
+    }
+    auto cp = find_char_by_uuid(bus, dev_path, kPmdControlUUID);
+    auto data = find_char_by_uuid(bus, dev_path, kPmdDataUUID);
+    if (!cp || !data) {
+      if (!c->missing_logged) {
+        ERR << "[warn] PMD service not found on " << dev_path << "; no ECG/ACC streams\n";
+        c->missing_logged = true;
+      }
+      return UINT64_MAX;
+    }
+    c->cp_path = std::move(*cp);
+    c->data_path = std::move(*data);
+    if (!subscribe(bus, c)) {
+      reset(c);
+      c->retry_at = now + 10s;
+      return 10000000;
+    }
+    c->subscribed = true;
+    c->decode_errors = 0;
+  }
+
+  // The control point takes one command at a time: wait out a pending start,
+  // otherwise send the next stream that is idle or done backing off.
+  auto wake = Clock::time_point::max();
+  Stream* next = nullptr;
+  for (unsigned i = 0; i < c->nstreams; ++i) {
+    Stream& s = c->streams[i];
+    if (s.state == StreamState::Starting && now >= s.deadline) {
+      ERR << "[warn] PMD " << pmd_type_name(s.type) << " start: no response; retrying\n";
+      s.state = StreamState::Idle;
+    }
+    if (s.state == StreamState::Failed && now >= s.deadline) s.state = StreamState::Idle;
+    if (s.state == StreamState::Starting) {
+      next = nullptr;
+      wake = s.deadline;
+      break;
+    }
+    if (s.state == StreamState::Failed) wake = std::min(wake, s.deadline);
+    if (s.state == StreamState::Idle && !next) next = &s;
+  }
+  if (next) {
+    uint8_t cmd[kPmdCommandMax];
+    size_t n = pmd_start_command(next->type, next->settings, cmd);
+    DBG << "[dbg] PMD start " << pmd_type_name(next->type) << ": raw=[" << LogHex{cmd, n} << "]\n";
+    if (write_value(bus, c->cp_path, cmd, n) < 0) {
+      next->state = StreamState::Failed;
+      next->deadline = now + 10s;
+    } else {
+      next->state = StreamState::Starting;
+      next->deadline = now + 5s;
+    }
+    wake = std::min(wake, next->deadline);
+  }
+  if (wake == Clock::time_point::max()) return UINT64_MAX;
+  return (uint64_t)std::max<int64_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count(), 0);
+}
+
+void pmd_shutdown(sd_bus* bus) {
+  Capture* c = &s_pmd;
+  if (c->subscribed && cached_device_connected(c->dev_path).value_or(false)) {
+    for (unsigned i = 0; i < c->nstreams; ++i) {
+      if (c->streams[i].state != StreamState::Streaming) continue;
+      uint8_t cmd[kPmdCommandMax];
+      size_t n = pmd_stop_command(c->streams[i].type, cmd);
+      write_value(bus, c->cp_path, cmd, n);
+    }
+  }
+  if (c->frames || c->decode_errors) {
+    ERR << "[info] PMD: " << c->frames << " frames recorded, "
+        << c->decode_errors << " dropped\n";
+  }
+  reset(c);
+}
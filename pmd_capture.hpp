@@ -0,0 +1,27 @@
+#pragma once
+#include <systemd/sd-bus.h>
+#include <cstdint>
+#include <string>
+
+#include "pmd.hpp"
+
+// --pmd: H10 ECG/ACC streams captured next to HR in the default mode. Frames
+// are decoded straight from the PropertiesChanged message into one reused
+// PmdFrame and go to the binary sink as PMD blocks (--format bin only).
+struct PmdOptions {
+  bool ecg = false;
+  bool acc = false;
+  uint16_t acc_rate_hz = 200;  // 25, 50, 100 or 200
+  uint16_t acc_range_g = 8;    // 2, 4 or 8
+  bool enabled() const { return ecg || acc; }
+};
+
+extern PmdOptions g_pmd;
+
+// Keeps the requested streams running on dev_path: subscribes to the control
+// point and data characteristics, starts one stream at a time and retries
+// refused or unanswered starts; everything resets when the link drops.
+// Returns the sd_bus_wait() timeout in usec (UINT64_MAX: nothing pending).
+uint64_t pmd_maintain(sd_bus* bus, const std::string& dev_path);
+// Stops the running streams (best effort) and drops the matches.
+void pmd_shutdown(sd_bus* bus);
@@ -0,0 +1,559 @@
+#include "replay_bus.hpp"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <systemd/sd-event.h>
+#include <systemd/sd-id128.h>
+
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bluetooth.hpp"
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+namespace {
+
+constexpr uint16_t kMtu = 247;
+constexpr uint64_t kEndGraceUs = 1000000;  // let polarm drain the last values
+
+struct MockObject {
+  std::map<std::string, BluezProps, std::less<>> ifaces;
+  int notify_peer = -1;  // our end of an AcquireNotify socket
+};
+
+bool under(std::string_view scope, std::string_view path) {
+  return path.size() > scope.size() && path.starts_with(scope) && path[scope.size()] == '/';
+}
+
+int append_props(sd_bus_message* m, const BluezProps& p) {
+  int r = sd_bus_message_open_container(m, 'a', "{sv}");
+  auto str = [&](const char* key, const std::optional<std::string>& v) {
+    if (r >= 0 && v) r = sd_bus_message_append(m, "{sv}", key, "s", v->c_str());
+  };
+  auto flag = [&](const char* key, const std::optional<bool>& v) {
+    if (r >= 0 && v) r = sd_bus_message_append(m, "{sv}", key, "b", (int)*v);
+  };
+  str("Name", p.name);
+  str("UUID", p.uuid);
+  str("Address", p.address);
+  flag("Connected", p.connected);
+  flag("ServicesResolved", p.services_resolved);
+  flag("Notifying", p.notifying);
+  if (r >= 0) r = sd_bus_message_close_container(m);
+  return r;
+}
+
+// Fields of `to` that differ from `from`.
+BluezProps diff(const BluezProps& from, const BluezProps& to) {
+  BluezProps d;
+  if (to.name && to.name != from.name) d.name = to.name;
+  if (to.uuid && to.uuid != from.uuid) d.uuid = to.uuid;
+  if (to.address && to.address != from.address) d.address = to.address;
+  if (to.connected && to.connected != from.connected) d.connected = to.connected;
+  if (to.services_resolved && to.services_resolved != from.services_resolved)
+    d.services_resolved = to.services_resolved;
+  if (to.notifying && to.notifying != from.notifying) d.notifying = to.notifying;
+  return d;
+}
+
+void merge(BluezProps* into, const BluezProps& d) {
+  if (d.name) into->name = d.name;
+  if (d.uuid) into->uuid = d.uuid;
+  if (d.address) into->address = d.address;
+  if (d.connected) into->connected = d.connected;
+  if (d.services_resolved) into->services_resolved = d.services_resolved;
+  if (d.notifying) into->notifying = d.notifying;
+}
+
+bool empty(const BluezProps& p) {
+  return !p.name && !p.uuid && !p.address && !p.connected && !p.services_resolved && !p.notifying;
+}
+
+class ReplayBus {
+ public:
+  bool init(const std::string& path, std::string* err);
+  int open_client(sd_bus** out);
+
+ private:
+  using Action = std::function<void()>;
+
+  void run(int fd);
+  uint64_t after(uint64_t trace_ms) const {
+    return metrics_now_ns() / 1000 + trace_ms * 1000;
+  }
+  void at(uint64_t usec, Action a);
+  void arm();
+  static int timer_cb(sd_event_source* s, uint64_t usec, void* userdata);
+  static int method_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error);
+  int on_method(sd_bus_message* m);
+  void send(sd_bus_message* m);
+  void reply_error(sd_bus_message* call, const std::string& name);
+  void answer(sd_bus_message* call, const std::string& path, const std::string& iface,
+              const std::string& member, bool recorded);
+  BluezProps* find(std::string_view path, std::string_view iface);
+
+  void apply(const TraceEvent& ev);
+  void add_iface(const std::string& path, const std::string& iface, const BluezProps& p);
+  void remove_iface(const std::string& path, const std::string& iface);
+  void set_props(const std::string& path, const std::string& iface, const BluezProps& p);
+  void release_notify(MockObject* obj);
+  void deliver(const std::string& path, const std::vector<uint8_t>& value);
+  void finish();
+
+  std::vector<TraceEvent> events_;
+  std::map<std::string, std::deque<const TraceEvent*>> calls_;  // "<path> <Method>"
+  std::map<std::string, MockObject, std::less<>> objects_;
+  uint64_t end_ms_ = 0;
+  uint64_t t0_us_ = 0;
+  pthread_t main_thread_{};  // gets the SIGTERM at the end
+
+  sd_bus* bus_{};
+  sd_event* event_{};
+  sd_event_source* timer_{};
+  std::multimap<uint64_t, Action> queue_;  // CLOCK_MONOTONIC usec
+
+  uint64_t values_ = 0;
+  uint64_t delivered_ = 0;
+  uint64_t calls_replayed_ = 0;
+  uint64_t calls_modelled_ = 0;
+};
+
+std::unique_ptr<ReplayBus> s_replay;
+
+bool ReplayBus::init(const std::string& path, std::string* err) {
+  if (!trace_load(path, &events_, err)) return false;
+  for (const auto& ev : events_) {
+    end_ms_ = std::max(end_ms_, ev.t_ms);
+    if (ev.kind == TraceEvent::Kind::Call) calls_[ev.path + " " + ev.method].push_back(&ev);
+    // The snapshot is the state GetManagedObjects returns.
+    if (ev.kind == TraceEvent::Kind::Add && ev.t_ms == 0)
+      merge(&objects_[ev.path].ifaces[ev.iface], ev.props);
+  }
+  if (objects_.empty()) {
+    *err = path + ": no objects at time 0";
+    return false;
+  }
+  return true;
+}
+
+int ReplayBus::open_client(sd_bus** out) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, sv) < 0) return -errno;
+  main_thread_ = pthread_self();
+  std::thread([this, fd = sv[0]] { run(fd); }).detach();
+
+  sd_bus* bus = nullptr;
+  int r = sd_bus_new(&bus);
+  if (r >= 0) r = sd_bus_set_fd(bus, sv[1], sv[1]);
+  if (r >= 0) r = sd_bus_start(bus);
+  if (r < 0) {
+    if (bus) sd_bus_unref(bus);
+    return r;
+  }
+  *out = bus;
+  return 0;
+}
+
+void ReplayBus::run(int fd) {
+  // Signals are for the main loop (sigaction or its signalfd).
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+  sd_id128_t id;
+  int r = sd_event_new(&event_);
+  if (r >= 0) r = sd_bus_new(&bus_);
+  if (r >= 0) r = sd_bus_set_fd(bus_, fd, fd);
+  if (r >= 0) r = sd_id128_randomize(&id);
+  if (r >= 0) r = sd_bus_set_server(bus_, 1, id);
+  if (r >= 0) r = sd_bus_negotiate_fds(bus_, 1);
+  if (r >= 0) r = sd_bus_start(bus_);
+  if (r >= 0) r = sd_bus_attach_event(bus_, event_, SD_EVENT_PRIORITY_NORMAL);
+  if (r >= 0) r = sd_bus_add_fallback(bus_, nullptr, "/", method_cb, this);
+  if (r >= 0) r = sd_event_add_time(event_, &timer_, CLOCK_MONOTONIC, UINT64_MAX, 0, timer_cb, this);
+  if (r < 0) {
+    ERR << "[fatal] --replay-trace: mock bus setup: " << strerror(-r) << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  t0_us_ = metrics_now_ns() / 1000;
+  bool has_end = false;
+  for (const auto& ev : events_) {
+    if (ev.kind == TraceEvent::Kind::Call) continue;
+    if (ev.kind == TraceEvent::Kind::Add && ev.t_ms == 0) continue;
+    if (ev.kind == TraceEvent::Kind::End) has_end = true;
+    at(after(ev.t_ms), [this, &ev] { apply(ev); });
+  }
+  if (!has_end) at(after(end_ms_) + kEndGraceUs, [this] { finish(); });
+  ERR << "[info] Replaying " << events_.size() << " trace events\n";
+  sd_event_loop(event_);
+}
+
+void ReplayBus::at(uint64_t usec, Action a) {
+  queue_.emplace(usec, std::move(a));
+  arm();
+}
+
+void ReplayBus::arm() {
+  if (queue_.empty()) {
+    sd_event_source_set_enabled(timer_, SD_EVENT_OFF);
+    return;
+  }
+  sd_event_source_set_time(timer_, queue_.begin()->first);
+  sd_event_source_set_enabled(timer_, SD_EVENT_ONESHOT);
+}
+
+int ReplayBus::timer_cb(sd_event_source* s, uint64_t usec, void* userdata) {
+  (void)s;
+  (void)usec;
+  auto* self = static_cast<ReplayBus*>(userdata);
+  uint64_t now = metrics_now_ns() / 1000;
+  while (!self->queue_.empty() && self->queue_.begin()->first <= now) {
+    Action a = std::move(self->queue_.begin()->second);
+    self->queue_.erase(self->queue_.begin());
+    a();
+  }
+  self->arm();
+  return 0;
+}
+
+// ---- method calls ----
+int ReplayBus::method_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)ret_error;
+  return static_cast<ReplayBus*>(userdata)->on_method(m);
+}
+
+void ReplayBus::send(sd_bus_message* m) {
+  // The client's matches ask for sender='org.bluez'.
+  int r = sd_bus_message_set_sender(m, std::string(kBluezService).c_str());
+  if (r >= 0) r = sd_bus_send(bus_, m, nullptr);
+  if (r < 0) DBG << "[dbg] replay: send: " << strerror(-r) << "\n";
+  sd_bus_message_unref(m);
+}
+
+void ReplayBus::reply_error(sd_bus_message* call, const std::string& name) {
+  sd_bus_message* r = nullptr;
+  // "errno:<n>": a failure recorded without an error name.
+  int err = 0;
+  if (name.starts_with("errno:")) {
+    const char* end = name.data() + name.size();
+    auto res = std::from_chars(name.data() + 6, end, err);
+    if (res.ec == std::errc() && res.ptr == end && err > 0 && err < 4096) {
+      if (sd_bus_message_new_method_errno(call, &r, err, nullptr) >= 0) send(r);
+      return;
+    }
+  }
+  if (sd_bus_message_new_method_errorf(call, &r, name.c_str(), "replayed") >= 0) send(r);
+}
+
+BluezProps* ReplayBus::find(std::string_view path, std::string_view iface) {
+  auto obj = objects_.find(path);
+  if (obj == objects_.end()) return nullptr;
+  auto it = obj->second.ifaces.find(iface);
+  return it == obj->second.ifaces.end() ? nullptr : &it->second;
+}
+
+int ReplayBus::on_method(sd_bus_message* m) {
+  std::string path = sd_bus_message_get_path(m) ? sd_bus_message_get_path(m) : "";
+  std::string iface = sd_bus_message_get_interface(m) ? sd_bus_message_get_interface(m) : "";
+  std::string member = sd_bus_message_get_member(m) ? sd_bus_message_get_member(m) : "";
+
+  if (iface == kProps && (member == "Get" || member == "GetAll")) {
+    const char* i = nullptr;
+    const char* prop = nullptr;
+    int r = member == "Get" ? sd_bus_message_read(m, "ss", &i, &prop)
+                            : sd_bus_message_read(m, "s", &i);
+    BluezProps* p = r >= 0 && i ? find(path, i) : nullptr;
+    if (!p) {
+      reply_error(m, "org.freedesktop.DBus.Error.UnknownObject");
+      return 1;
+    }
+    sd_bus_message* reply = nullptr;
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) return 1;
+    if (member == "GetAll") {
+      r = append_props(reply, *p);
+    } else {
+      std::string_view name(prop);
+      auto flag = name == "Connected" ? p->connected
+                : name == "ServicesResolved" ? p->services_resolved
+                : name == "Notifying" ? p->notifying : std::nullopt;
+      if (!flag) {
+        sd_bus_message_unref(reply);
+        reply_error(m, "org.freedesktop.DBus.Error.InvalidArgs");
+        return 1;
+      }
+      r = sd_bus_message_append(reply, "v", "b", (int)*flag);
+    }
+    if (r >= 0) send(reply);
+    else sd_bus_message_unref(reply);
+    return 1;
+  }
+
+  // Everything else takes the next recorded outcome for this path and method.
+  const TraceEvent* rec = nullptr;
+  auto q = calls_.find(path + " " + member);
+  if (q != calls_.end() && !q->second.empty()) {
+    rec = q->second.front();
+    q->second.pop_front();
+  }
+  if (rec) {
+    ++calls_replayed_;
+    for (const auto& eff : rec->effects) at(after(eff.t_ms), [this, &eff] { apply(eff); });
+  } else {
+    ++calls_modelled_;
+  }
+  std::string error = rec && rec->result != "ok" ? rec->result : "";
+  sd_bus_message_ref(m);
+  at(after(rec ? rec->latency_ms : 0), [=, this] {
+    if (!error.empty()) reply_error(m, error);
+    else answer(m, path, iface, member, rec != nullptr);
+    sd_bus_message_unref(m);
+  });
+  return 1;
+}
+
+// A successful reply; `recorded` calls take their effects from the trace.
+void ReplayBus::answer(sd_bus_message* call, const std::string& path, const std::string& iface,
+                       const std::string& member, bool recorded) {
+  if (iface == kObjManager && member == "GetManagedObjects") {
+    sd_bus_message* reply = nullptr;
+    int r = sd_bus_message_new_method_return(call, &reply);
+    if (r >= 0) r = sd_bus_message_open_container(reply, 'a', "{oa{sa{sv}}}");
+    for (const auto& [opath, obj] : objects_) {
+      if (r >= 0) r = sd_bus_message_open_container(reply, 'e', "oa{sa{sv}}");
+      if (r >= 0) r = sd_bus_message_append(reply, "o", opath.c_str());
+      if (r >= 0) r = sd_bus_message_open_container(reply, 'a', "{sa{sv}}");
+      for (const auto& [name, props] : obj.ifaces) {
+        if (r >= 0) r = sd_bus_message_open_container(reply, 'e', "sa{sv}");
+        if (r >= 0) r = sd_bus_message_append(reply, "s", name.c_str());
+        if (r >= 0) r = append_props(reply, props);
+        if (r >= 0) r = sd_bus_message_close_container(reply);
+      }
+      if (r >= 0) r = sd_bus_message_close_container(reply);
+      if (r >= 0) r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) r = sd_bus_message_close_container(reply);
+    if (r >= 0) send(reply);
+    else if (reply) sd_bus_message_unref(reply);
+    return;
+  }
+
+  auto obj = objects_.find(path);
+  if (obj == objects_.end()) {
+    reply_error(call, "org.freedesktop.DBus.Error.UnknownObject");
+    return;
+  }
+  std::string scope(trace_scope(path));
+  BluezProps* dev = find(scope, kDevice1);
+  bool connected = dev && dev->connected.value_or(false);
+  if (!recorded && !connected && iface == kGattChar1 &&
+      (member == "StartNotify" || member == "AcquireNotify")) {
+    reply_error(call, "org.bluez.Error.NotConnected");
+    return;
+  }
+
+  sd_bus_message* reply = nullptr;
+  if (sd_bus_message_new_method_return(call, &reply) < 0) return;
+  if (member == "AcquireNotify") {
+    int p[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, p) < 0) {
+      sd_bus_message_unref(reply);
+      reply_error(call, "org.bluez.Error.Failed");
+      return;
+    }
+    release_notify(&obj->second);
+    obj->second.notify_peer = p[0];
+    // The message keeps its own copy of the fd.
+    sd_bus_message_append(reply, "hq", p[1], kMtu);
+    close(p[1]);
+  }
+  send(reply);
+  if (recorded) return;
+
+  BluezProps change;
+  if (member == "Connect") {
+    change.connected = true;
+    set_props(path, std::string(kDevice1), change);
+    change = {};
+    change.services_resolved = true;
+    set_props(path, std::string(kDevice1), change);
+  } else if (member == "Disconnect") {
+    change.connected = false;
+    set_props(path, std::string(kDevice1), change);
+  } else if (member == "StartNotify" || member == "StopNotify") {
+    change.notifying = member == "StartNotify";
+    set_props(path, std::string(kGattChar1), change);
+  }
+}
+
+// ---- model ----
+void ReplayBus::apply(const TraceEvent& ev) {
+  switch (ev.kind) {
+    case TraceEvent::Kind::Add: add_iface(ev.path, ev.iface, ev.props); break;
+    case TraceEvent::Kind::Remove: remove_iface(ev.path, ev.iface); break;
+    case TraceEvent::Kind::Set: set_props(ev.path, ev.iface, ev.props); break;
+    case TraceEvent::Kind::Value: deliver(ev.path, ev.value); break;
+    case TraceEvent::Kind::End: finish(); break;
+    case TraceEvent::Kind::Call: break;
+  }
+}
+
+void ReplayBus::add_iface(const std::string& path, const std::string& iface,
+                          const BluezProps& p) {
+  if (find(path, iface)) {
+    set_props(path, iface, p);
+    return;
+  }
+  objects_[path].ifaces[iface] = p;
+  sd_bus_message* sig = nullptr;
+  int r = sd_bus_message_new_signal(bus_, &sig, "/", std::string(kObjManager).c_str(),
+                                    "InterfacesAdded");
+  if (r >= 0) r = sd_bus_message_append(sig, "o", path.c_str());
+  if (r >= 0) r = sd_bus_message_open_container(sig, 'a', "{sa{sv}}");
+  if (r >= 0) r = sd_bus_message_open_container(sig, 'e', "sa{sv}");
+  if (r >= 0) r = sd_bus_message_append(sig, "s", iface.c_str());
+  if (r >= 0) r = append_props(sig, p);
+  if (r >= 0) r = sd_bus_message_close_container(sig);
+  if (r >= 0) r = sd_bus_message_close_container(sig);
+  if (r >= 0) send(sig);
+  else if (sig) sd_bus_message_unref(sig);
+}
+
+void ReplayBus::remove_iface(const std::string& path, const std::string& iface) {
+  auto obj = objects_.find(path);
+  if (obj == objects_.end() || !obj->second.ifaces.count(iface)) return;
+  // A device goes after its GATT objects.
+  if (iface == kDevice1) {
+    std::vector<std::pair<std::string, std::string>> children;
+    for (const auto& [p, o] : objects_) {
+      if (!under(path, p)) continue;
+      for (const auto& i : o.ifaces) children.emplace_back(p, i.first);
+    }
+    for (auto it = children.rbegin(); it != children.rend(); ++it)
+      remove_iface(it->first, it->second);
+    obj = objects_.find(path);
+  }
+  obj->second.ifaces.erase(iface);
+  if (obj->second.ifaces.empty()) {
+    release_notify(&obj->second);
+    objects_.erase(obj);
+  }
+  sd_bus_message* sig = nullptr;
+  int r = sd_bus_message_new_signal(bus_, &sig, "/", std::string(kObjManager).c_str(),
+                                    "InterfacesRemoved");
+  if (r >= 0) r = sd_bus_message_append(sig, "oas", path.c_str(), 1, iface.c_str());
+  if (r >= 0) send(sig);
+  else if (sig) sd_bus_message_unref(sig);
+}
+
+void ReplayBus::set_props(const std::string& path, const std::string& iface,
+                          const BluezProps& p) {
+  BluezProps* cur = find(path, iface);
+  if (!cur) return;
+  BluezProps d = diff(*cur, p);
+  bool dropped = iface == kDevice1 && d.connected && !*d.connected;
+  if (dropped && cur->services_resolved.value_or(false)) d.services_resolved = false;
+  if (empty(d)) return;
+  merge(cur, d);
+  sd_bus_message* sig = nullptr;
+  int r = sd_bus_message_new_signal(bus_, &sig, path.c_str(), std::string(kProps).c_str(),
+                                    "PropertiesChanged");
+  if (r >= 0) r = sd_bus_message_append(sig, "s", iface.c_str());
+  if (r >= 0) r = append_props(sig, d);
+  if (r >= 0) r = sd_bus_message_append(sig, "as", 0);
+  if (r >= 0) send(sig);
+  else if (sig) sd_bus_message_unref(sig);
+  if (!dropped) return;
+
+  // The link is gone: so are the subscriptions on it.
+  std::vector<std::string> chars;
+  for (auto& [p2, obj] : objects_) {
+    if (!under(path, p2)) continue;
+    release_notify(&obj);
+    if (obj.ifaces.count(std::string(kGattChar1))) chars.push_back(p2);
+  }
+  BluezProps off;
+  off.notifying = false;
+  for (const auto& c : chars) set_props(c, std::string(kGattChar1), off);
+}
+
+void ReplayBus::release_notify(MockObject* obj) {
+  if (obj->notify_peer < 0) return;
+  close(obj->notify_peer);
+  obj->notify_peer = -1;
+}
+
+void ReplayBus::deliver(const std::string& path, const std::vector<uint8_t>& value) {
+  ++values_;
+  auto obj = objects_.find(path);
+  BluezProps* ch = find(path, kGattChar1);
+  if (obj == objects_.end() || !ch) return;
+  if (obj->second.notify_peer >= 0) {
+    if (::send(obj->second.notify_peer, value.data(), value.size(), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+        (ssize_t)value.size()) {
+      ++delivered_;
+    } else if (errno != EAGAIN) {
+      release_notify(&obj->second);  // polarm closed its end
+    }
+    return;
+  }
+  if (!ch->notifying.value_or(false)) return;
+  sd_bus_message* sig = nullptr;
+  int r = sd_bus_message_new_signal(bus_, &sig, path.c_str(), std::string(kProps).c_str(),
+                                    "PropertiesChanged");
+  if (r >= 0) r = sd_bus_message_append(sig, "s", std::string(kGattChar1).c_str());
+  if (r >= 0) r = sd_bus_message_open_container(sig, 'a', "{sv}");
+  if (r >= 0) r = sd_bus_message_open_container(sig, 'e', "sv");
+  if (r >= 0) r = sd_bus_message_append(sig, "s", "Value");
+  if (r >= 0) r = sd_bus_message_open_container(sig, 'v', "ay");
+  if (r >= 0) r = sd_bus_message_append_array(sig, 'y', value.data(), value.size());
+  if (r >= 0) r = sd_bus_message_close_container(sig);
+  if (r >= 0) r = sd_bus_message_close_container(sig);
+  if (r >= 0) r = sd_bus_message_close_container(sig);
+  if (r >= 0) r = sd_bus_message_append(sig, "as", 0);
+  if (r >= 0) {
+    send(sig);
+    ++delivered_;
+  } else if (sig) {
+    sd_bus_message_unref(sig);
+  }
+}
+
+void ReplayBus::finish() {
+  double wall_s = (double)(metrics_now_ns() / 1000 - t0_us_) / 1e6;
+  ERR << "[info] Replay done after " << wall_s << " s: " << values_ << " values, "
+      << delivered_ << " delivered, " << values_ - delivered_
+      << " lost (link down or not subscribed); " << calls_replayed_
+      << " calls from the trace, " << calls_modelled_ << " modelled\n";
+  metrics_dump();
+  queue_.clear();
+  pthread_kill(main_thread_, SIGTERM);
+}
+
+}  // namespace
+
+bool replay_init(const std::string& trace_path, std::string* err) {
+  auto r = std::make_unique<ReplayBus>();
+  if (!r->init(trace_path, err)) return false;
+  s_replay = std::move(r);
+  return true;
+}
+
+bool replay_enabled() { return s_replay != nullptr; }
+
+int replay_open_bus(sd_bus** bus) {
+  return s_replay->open_client(bus);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <systemd/sd-bus.h>
+#include <string>
+
+// --replay-trace (main.cpp): polarm talks to a stand-in BlueZ on a private
+// socket instead of the system bus, so the unchanged startup, maintenance and
+// --async code runs against a recorded (--trace-record) or hand-written
+// scenario. The mock runs on its own thread and keeps a model of the objects:
+//
+// - Properties.Get/GetAll and GetManagedObjects are answered from the model.
+// - Other calls take the outcome and latency of the next recorded call with
+//   the same path and method, and its "+" effects are applied relative to
+//   when polarm made the call. Without one they succeed at once with BlueZ's
+//   usual effect (Connect sets Connected and ServicesResolved, StartNotify
+//   Notifying, ...). AcquireNotify hands out a real SEQPACKET socket.
+// - A disconnect clears ServicesResolved and Notifying and closes the
+//   notification sockets of the device, as BlueZ does.
+// - Timed events play at their trace time, in real time, since polarm's own
+//   timers do; values reach polarm only while it is subscribed, others are
+//   counted as lost.
+//
+// At the end of the trace the mock logs its counters and the latency
+// histograms and sends SIGTERM to the thread that opened the bus.
+bool replay_init(const std::string& trace_path, std::string* err);
+bool replay_enabled();
+// The client end of the mock, started; Bus uses it instead of the system bus.
+int replay_open_bus(sd_bus** bus);
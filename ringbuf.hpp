@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <span>
+
+// Fixed-capacity ring buffer over a mirrored array: slot i is stored at i and
+// i + N, so any run of up to N consecutive elements is one contiguous span
+// (last(k), view()) and never needs copying out. N must be a power of two.
+template <class T, size_t N>
+class MirroredRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == N; }
+
+  // Oldest element is [0].
+  const T& operator[](size_t i) const { return buf_[(head_ + i) & (N - 1)]; }
+  const T& front() const { return (*this)[0]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  // All elements, oldest first.
+  std::span<const T> view() const { return {buf_.data() + head_, size_}; }
+  // The newest k <= size() elements.
+  std::span<const T> last(size_t k) const {
+    return {buf_.data() + ((head_ + size_ - k) & (N - 1)), k};
+  }
+
+  // Drops the oldest element when full.
+  void push_back(const T& v) {
+    if (size_ == N) pop_front();
+    put((head_ + size_) & (N - 1), v);
+    ++size_;
+  }
+  // Caller ensures !full().
+  void push_front(const T& v) {
+    head_ = (head_ + N - 1) & (N - 1);
+    put(head_, v);
+    ++size_;
+  }
+  void pop_front() {
+    head_ = (head_ + 1) & (N - 1);
+    --size_;
+  }
+  void pop_back() { --size_; }
+  void clear() { head_ = size_ = 0; }
+
+  bool operator==(const MirroredRing& o) const {
+    return std::ranges::equal(view(), o.view());
+  }
+
+ private:
+  void put(size_t slot, const T& v) {
+    buf_[slot] = v;
+    buf_[slot + N] = v;
+  }
+
+  std::array<T, 2 * N> buf_{};
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
@@ -0,0 +1,355 @@
+#include "rollup.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+
+#include "debug.hpp"
+
+namespace {
+
+constexpr size_t kRecord = sizeof(RollupBucket);
+constexpr size_t kBatchBytes = 64u << 10;
+
+int64_t floor_to(int64_t v, int64_t step) {
+  int64_t r = v % step;
+  return (r < 0) ? v - r - step : v - r;
+}
+
+int64_t ceil_to(int64_t v, int64_t step) {
+  int64_t f = floor_to(v, step);
+  return (f == v) ? v : f + step;
+}
+
+template <class T>
+void widen(T* lo, T* hi, bool first, T v) {
+  if (first || v < *lo) *lo = v;
+  if (first || v > *hi) *hi = v;
+}
+
+bool write_all(int fd, const char* p, size_t n) {
+  while (n) {
+    ssize_t w = ::write(fd, p, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+std::string tier_path(const std::string& dir, std::string_view stem, int t) {
+  return dir + "/" + std::string(stem) + "." + kRollupTierName[t];
+}
+
+bool header_ok(const char* h, int t) {
+  uint32_t version = 0, tier_ms = 0;
+  std::memcpy(&version, h + 8, 4);
+  std::memcpy(&tier_ms, h + 12, 4);
+  return std::memcmp(h, kRollupMagic, 8) == 0 && version == kRollupVersion &&
+         tier_ms == (uint32_t)kRollupTierMs[t];
+}
+
+// Records of a tier file starting at or after `from`, newest first.
+template <class F>
+void for_each_from(int fd, int64_t from, F f) {
+  struct stat st {};
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < kRollupHeader) return;
+  size_t n = ((size_t)st.st_size - kRollupHeader) / kRecord;
+  RollupBucket buf[64];
+  while (n) {
+    size_t k = std::min<size_t>(n, 64);
+    if (pread(fd, buf, k * kRecord, (off_t)(kRollupHeader + (n - k) * kRecord)) !=
+        (ssize_t)(k * kRecord))
+      return;
+    for (size_t i = k; i-- > 0;) {
+      if (buf[i].start_ms < from) return;
+      f(buf[i]);
+    }
+    n -= k;
+  }
+}
+
+}  // namespace
+
+void RollupBucket::add(int bpm, std::span<const int> rr_ms) {
+  if (bpm > 0) {
+    uint16_t v = (uint16_t)std::min(bpm, 0xffff);
+    widen(&bpm_min, &bpm_max, samples == 0, v);
+    ++samples;
+    bpm_sum += v;
+  }
+  for (int rr : rr_ms) {
+    if (rr <= 0 || rr > 0xffff) continue;
+    widen(&rr_min, &rr_max, rr_count == 0, (uint16_t)rr);
+    ++rr_count;
+    rr_sum += (uint64_t)rr;
+    rr_sq_sum += (uint64_t)rr * (uint64_t)rr;
+  }
+}
+
+void RollupBucket::merge(const RollupBucket& o) {
+  if (o.samples) {
+    widen(&bpm_min, &bpm_max, samples == 0, o.bpm_min);
+    widen(&bpm_min, &bpm_max, false, o.bpm_max);
+    samples += o.samples;
+    bpm_sum += o.bpm_sum;
+  }
+  if (o.rr_count) {
+    widen(&rr_min, &rr_max, rr_count == 0, o.rr_min);
+    widen(&rr_min, &rr_max, false, o.rr_max);
+    rr_count += o.rr_count;
+    rr_sum += o.rr_sum;
+    rr_sq_sum += o.rr_sq_sum;
+  }
+}
+
+std::string rollup_file_stem(std::string_view tag) {
+  if (tag.empty()) return "default";
+  std::string s(tag);
+  std::replace(s.begin(), s.end(), '/', '_');
+  if (s.front() == '.') s.front() = '_';
+  return s;
+}
+
+// ---- writer ----
+RollupWriter::~RollupWriter() {
+  close();
+}
+
+bool RollupWriter::open(const std::string& dir, bool rebuild, bool batched, std::string* err) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec || !std::filesystem::is_directory(dir, ec)) {
+    *err = "cannot create rollup directory " + dir;
+    return false;
+  }
+  dir_ = dir;
+  rebuild_ = rebuild;
+  batched_ = batched;
+  return true;
+}
+
+bool RollupWriter::open_tier(const std::string& stem, int t, Tier* tier) {
+  std::string path = tier_path(dir_, stem, t);
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (rebuild_ ? O_TRUNC : 0), 0644);
+  if (fd < 0) {
+    ERR << "[err] rollup: cannot open " << path << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  struct stat st {};
+  fstat(fd, &st);
+  size_t size = (size_t)st.st_size;
+  if (size == 0) {
+    char h[kRollupHeader];
+    uint32_t version = kRollupVersion, tier_ms = (uint32_t)kRollupTierMs[t];
+    std::memcpy(h, kRollupMagic, 8);
+    std::memcpy(h + 8, &version, 4);
+    std::memcpy(h + 12, &tier_ms, 4);
+    if (!write_all(fd, h, sizeof h)) {
+      ERR << "[err] rollup: cannot write " << path << ": " << strerror(errno) << "\n";
+      ::close(fd);
+      return false;
+    }
+    size = kRollupHeader;
+  } else {
+    char h[kRollupHeader];
+    if (pread(fd, h, sizeof h, 0) != (ssize_t)sizeof h || !header_ok(h, t)) {
+      ERR << "[err] rollup: " << path << " is not a " << kRollupTierName[t] << " rollup tier\n";
+      ::close(fd);
+      return false;
+    }
+    size_t whole = kRollupHeader + (size - kRollupHeader) / kRecord * kRecord;
+    if (whole != size) {
+      // A record cut short by a crash.
+      ERR << "[warn] rollup: dropping a partial record at the end of " << path << "\n";
+      if (ftruncate(fd, (off_t)whole) < 0) {
+        ::close(fd);
+        return false;
+      }
+      size = whole;
+    }
+    if (size > kRollupHeader) {
+      RollupBucket last;
+      pread(fd, &last, kRecord, (off_t)(size - kRecord));
+      tier->written_end = last.start_ms + kRollupTierMs[t];
+    }
+  }
+  lseek(fd, 0, SEEK_END);
+  tier->fd = fd;
+  tier->step_ms = kRollupTierMs[t];
+  return true;
+}
+
+// The open minute and hour are the finer records (and open bucket) since the
+// start of the interval the newest finer bucket falls into.
+void RollupWriter::resume(Device* d) {
+  for (int t = 1; t < kRollupTiers; ++t) {
+    Tier& fine = d->tiers[t - 1];
+    Tier& tier = d->tiers[t];
+    int64_t latest = (fine.written_end == INT64_MIN) ? INT64_MIN
+                                                      : fine.written_end - kRollupTierMs[t - 1];
+    if (fine.has_open) latest = std::max(latest, fine.open.start_ms);
+    if (latest == INT64_MIN) continue;
+    int64_t start = floor_to(latest, kRollupTierMs[t]);
+    if (start < tier.written_end) continue;
+    RollupBucket b;
+    b.start_ms = start;
+    for_each_from(fine.fd, start, [&](const RollupBucket& r) { b.merge(r); });
+    if (fine.has_open && fine.open.start_ms >= start) b.merge(fine.open);
+    if (b.empty()) continue;
+    tier.open = b;
+    tier.has_open = true;
+  }
+}
+
+RollupWriter::Device* RollupWriter::device(std::string_view tag) {
+  auto it = devices_.find(tag);
+  if (it != devices_.end()) return it->second.get();
+  auto d = std::make_unique<Device>();
+  std::string stem = rollup_file_stem(tag);
+  bool ok = true;
+  for (int t = 0; t < kRollupTiers && ok; ++t) ok = open_tier(stem, t, &d->tiers[t]);
+  if (!ok) {
+    // Not retried per sample; the device is left out of the store.
+    for (auto& tier : d->tiers) {
+      if (tier.fd >= 0) ::close(tier.fd);
+    }
+    failed_ = true;
+    d.reset();
+  } else if (!rebuild_) {
+    resume(d.get());
+  }
+  return devices_.emplace(std::string(tag), std::move(d)).first->second.get();
+}
+
+void RollupWriter::add(std::string_view tag, int64_t ts_ms, int bpm, std::span<const int> rr_ms) {
+  Device* d = device(tag);
+  if (!d) return;
+  for (int t = 0; t < kRollupTiers; ++t) {
+    Tier& tier = d->tiers[t];
+    int64_t start = floor_to(ts_ms, kRollupTierMs[t]);
+    if (tier.has_open && start > tier.open.start_ms) emit(&tier);
+    if (!tier.has_open) {
+      if (start < tier.written_end) {
+        if (t == 0) ++late_;
+        start = tier.written_end;
+      }
+      tier.open = RollupBucket{};
+      tier.open.start_ms = start;
+      tier.has_open = true;
+    } else if (start < tier.open.start_ms && t == 0) {
+      ++late_;
+    }
+    tier.open.add(bpm, rr_ms);
+  }
+}
+
+void RollupWriter::emit(Tier* tier) {
+  tier->buf.append(reinterpret_cast<const char*>(&tier->open), kRecord);
+  tier->written_end = tier->open.start_ms + tier->step_ms;
+  tier->has_open = false;
+  if (!batched_ || tier->buf.size() >= kBatchBytes) flush(tier);
+}
+
+bool RollupWriter::flush(Tier* tier) {
+  if (tier->buf.empty()) return true;
+  bool ok = write_all(tier->fd, tier->buf.data(), tier->buf.size());
+  if (!ok && !failed_) ERR << "[err] rollup: write failed: " << strerror(errno) << "\n";
+  failed_ |= !ok;
+  tier->buf.clear();
+  return ok;
+}
+
+bool RollupWriter::close() {
+  for (auto& [tag, d] : devices_) {
+    if (!d) continue;
+    // Coarser open buckets are rebuilt from this on the next open.
+    if (d->tiers[0].has_open) emit(&d->tiers[0]);
+    for (auto& tier : d->tiers) {
+      flush(&tier);
+      if (tier.fd >= 0) ::close(tier.fd);
+      tier.fd = -1;
+    }
+  }
+  devices_.clear();
+  return !failed_;
+}
+
+// ---- reader ----
+bool RollupReader::open(const std::string& dir, std::string_view stem, std::string* err) {
+  for (int t = 0; t < kRollupTiers; ++t) {
+    std::string path = tier_path(dir, stem, t);
+    end_[t] = INT64_MIN;
+    std::error_code ec;
+    if (t > 0 && !std::filesystem::exists(path, ec)) continue;
+    if (!files_[t].open(path, err)) return false;
+    if (files_[t].size() < kRollupHeader || !header_ok(files_[t].data(), t)) {
+      *err = path + ": not a " + kRollupTierName[t] + " rollup tier";
+      return false;
+    }
+    auto recs = records(t);
+    if (!recs.empty()) end_[t] = recs.back().start_ms + kRollupTierMs[t];
+  }
+  return true;
+}
+
+std::span<const RollupBucket> RollupReader::records(int t) const {
+  const MappedFile& f = files_[t];
+  if (f.size() < kRollupHeader) return {};
+  return {reinterpret_cast<const RollupBucket*>(f.data() + kRollupHeader),
+          (f.size() - kRollupHeader) / kRecord};
+}
+
+void RollupReader::scan(int t, int64_t lo, int64_t hi, RollupBucket* out, uint64_t* reads) const {
+  auto recs = records(t);
+  auto it = std::lower_bound(recs.begin(), recs.end(), lo,
+                             [](const RollupBucket& b, int64_t v) { return b.start_ms < v; });
+  for (; it != recs.end() && it->start_ms < hi; ++it) {
+    out->merge(*it);
+    if (reads) ++reads[t];
+  }
+}
+
+// Whole tier-t intervals inside [lo, hi) that tier t already has records
+// for come from tier t; the rest from the finer tiers.
+void RollupReader::aggregate(int t, int64_t lo, int64_t hi, RollupBucket* out,
+                             uint64_t* reads) const {
+  if (lo >= hi) return;
+  if (t == 0) {
+    scan(0, lo, hi, out, reads);
+    return;
+  }
+  int64_t a = ceil_to(lo, kRollupTierMs[t]);
+  int64_t b = std::min(floor_to(hi, kRollupTierMs[t]), end_[t]);
+  if (a >= b) {
+    aggregate(t - 1, lo, hi, out, reads);
+    return;
+  }
+  aggregate(t - 1, lo, a, out, reads);
+  scan(t, a, b, out, reads);
+  aggregate(t - 1, b, hi, out, reads);
+}
+
+RollupBucket RollupReader::range(int64_t from_ms, int64_t to_ms, uint64_t* reads) const {
+  RollupBucket out;
+  out.start_ms = from_ms;
+  aggregate(kRollupTiers - 1, from_ms, to_ms, &out, reads);
+  return out;
+}
+
+std::vector<std::string> rollup_list_devices(const std::string& dir) {
+  std::vector<std::string> out;
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (name.size() > 3 && name.ends_with(".1s")) out.push_back(name.substr(0, name.size() - 3));
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
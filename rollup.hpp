@@ -0,0 +1,114 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "logscan.hpp"
+
+// Tiered rollup store (--rollup): per device, 1 s / 1 min / 1 h buckets of
+// BPM and RR statistics, each tier its own append-only file
+// "<dir>/<device>.<1s|1m|1h>" of fixed-size records in ascending bucket
+// order behind a 16-byte header. A bucket is written once its interval is
+// over (the next sample falls into a later one); on close only the open 1 s
+// buckets are written, and reopening rebuilds the open minute and hour from
+// the finer tiers, so coarse records always cover whole intervals.
+
+inline constexpr int kRollupTiers = 3;
+inline constexpr int64_t kRollupTierMs[kRollupTiers] = {1000, 60 * 1000, 60 * 60 * 1000};
+inline constexpr const char* kRollupTierName[kRollupTiers] = {"1s", "1m", "1h"};
+inline constexpr char kRollupMagic[8] = {'P', 'L', 'R', 'M', 'R', 'L', 'U', 'P'};
+inline constexpr uint32_t kRollupVersion = 1;
+inline constexpr size_t kRollupHeader = 16;  // magic, u32 version, u32 tier ms
+
+// Readings with BPM > 0 count as samples; each RR value counts once.
+struct RollupBucket {
+  int64_t start_ms = 0;
+  uint32_t samples = 0;
+  uint16_t bpm_min = 0;
+  uint16_t bpm_max = 0;
+  uint64_t bpm_sum = 0;
+  uint32_t rr_count = 0;
+  uint16_t rr_min = 0;
+  uint16_t rr_max = 0;
+  uint64_t rr_sum = 0;
+  uint64_t rr_sq_sum = 0;
+
+  bool empty() const { return samples == 0 && rr_count == 0; }
+  void add(int bpm, std::span<const int> rr_ms);
+  void merge(const RollupBucket& o);
+};
+static_assert(sizeof(RollupBucket) == 48, "on-disk record layout");
+
+// "default" for the untagged device; '/' and a leading '.' become '_'.
+std::string rollup_file_stem(std::string_view tag);
+
+// Appends samples to the store. Live capture appends to what is there;
+// --analyze-log rebuilds the files of the devices it sees.
+class RollupWriter {
+ public:
+  RollupWriter() = default;
+  ~RollupWriter();
+  RollupWriter(const RollupWriter&) = delete;
+  RollupWriter& operator=(const RollupWriter&) = delete;
+
+  // `batched` buffers records until 64 KiB (builder); otherwise each record
+  // is written when its bucket closes.
+  bool open(const std::string& dir, bool rebuild, bool batched, std::string* err);
+  // Samples older than a device's newest bucket count toward that bucket.
+  void add(std::string_view tag, int64_t ts_ms, int bpm, std::span<const int> rr_ms);
+  bool close();
+  uint64_t late() const { return late_; }
+
+ private:
+  struct Tier {
+    int fd = -1;
+    int64_t step_ms = 0;
+    RollupBucket open;
+    bool has_open = false;
+    int64_t written_end = INT64_MIN;  // end of the newest record on disk
+    std::string buf;
+  };
+  struct Device {
+    std::array<Tier, kRollupTiers> tiers;
+  };
+
+  Device* device(std::string_view tag);
+  bool open_tier(const std::string& stem, int t, Tier* tier);
+  void resume(Device* d);
+  void emit(Tier* tier);
+  bool flush(Tier* tier);
+
+  std::string dir_;
+  bool rebuild_ = false;
+  bool batched_ = false;
+  bool failed_ = false;
+  uint64_t late_ = 0;
+  std::map<std::string, std::unique_ptr<Device>, std::less<>> devices_;
+};
+
+// Range aggregates over one device's tiers.
+class RollupReader {
+ public:
+  bool open(const std::string& dir, std::string_view stem, std::string* err);
+  // Buckets starting in [from_ms, to_ms), from the coarsest tier that has
+  // whole intervals inside the range and finer tiers at the edges. The
+  // range should be in whole seconds. `reads` (optional) counts records
+  // visited per tier.
+  RollupBucket range(int64_t from_ms, int64_t to_ms, uint64_t* reads = nullptr) const;
+
+ private:
+  std::span<const RollupBucket> records(int t) const;
+  void scan(int t, int64_t lo, int64_t hi, RollupBucket* out, uint64_t* reads) const;
+  void aggregate(int t, int64_t lo, int64_t hi, RollupBucket* out, uint64_t* reads) const;
+
+  std::array<MappedFile, kRollupTiers> files_;
+  std::array<int64_t, kRollupTiers> end_{};  // end of each tier's newest record
+};
+
+// Device stems with a 1 s tier in `dir`, sorted.
+std::vector<std::string> rollup_list_devices(const std::string& dir);
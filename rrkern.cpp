@@ -0,0 +1,447 @@
+#include "rrkern.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RRKERN_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define RRKERN_NEON 1
+#endif
+
+namespace {
+
+// The ratio tests of the Dash cleaning in integers: for positive a, b below
+// 2^26, b / a <= 0.8 (double) iff 5b <= 4a, since a quotient other than 0.8
+// is at least 1 / (5a) away from it, far more than the rounding error.
+inline bool dash_at(int32_t a, int32_t b, int32_t c, int32_t d) {
+  return 5 * b <= 4 * a && 10 * c >= 13 * b && 10 * d <= 9 * c;
+}
+
+inline int hist_bin(int32_t x, int32_t lo, int32_t hi) {
+  double t = (double)(x - lo) / (double)(hi - lo);
+  int k = static_cast<int>(t * 16);
+  return (k > 15) ? 15 : k;
+}
+
+// ---- scalar ----
+int64_t sum_scalar(const int32_t* rr, size_t n) {
+  int64_t s = 0;
+  for (size_t i = 0; i < n; ++i) s += rr[i];
+  return s;
+}
+
+int64_t sum_sq_diff_tail(const int32_t* rr, size_t i, size_t n) {
+  int64_t s = 0;
+  for (; i + 1 < n; ++i) {
+    int64_t d = (int64_t)rr[i + 1] - rr[i];
+    s += d * d;
+  }
+  return s;
+}
+
+int64_t sum_sq_diff_scalar(const int32_t* rr, size_t n) { return sum_sq_diff_tail(rr, 0, n); }
+
+uint64_t turning_points_tail(const int32_t* rr, size_t i, size_t n) {
+  uint64_t tp = 0;
+  for (; i + 1 < n; ++i) {
+    int32_t a = rr[i - 1], b = rr[i], c = rr[i + 1];
+    tp += (b > a && b > c) || (b < a && b < c);
+  }
+  return tp;
+}
+
+uint64_t turning_points_scalar(const int32_t* rr, size_t n) {
+  return (n < 3) ? 0 : turning_points_tail(rr, 1, n);
+}
+
+void dash_patterns_tail(const int32_t* rr, size_t i, size_t n, uint8_t* out) {
+  for (; i + 2 < n; ++i) out[i] = dash_at(rr[i - 1], rr[i], rr[i + 1], rr[i + 2]);
+  for (; i < n; ++i) out[i] = 0;
+}
+
+void dash_patterns_scalar(const int32_t* rr, size_t n, uint8_t* out) {
+  if (n == 0) return;
+  out[0] = 0;
+  dash_patterns_tail(rr, 1, n, out);
+}
+
+void histogram16_tail(const int32_t* rr, size_t i, size_t n, int32_t lo, int32_t hi,
+                      RrHistogram16* out) {
+  for (; i < n; ++i) {
+    int32_t x = rr[i];
+    if (x < lo) ++out->below;
+    else if (x > hi) ++out->above;
+    else ++out->bins[hist_bin(x, lo, hi)];
+  }
+}
+
+void histogram16_scalar(const int32_t* rr, size_t n, int32_t lo, int32_t hi, RrHistogram16* out) {
+  histogram16_tail(rr, 0, n, lo, hi, out);
+}
+
+// Lane mask (bit k = lane k) to one 0/1 byte per lane.
+constexpr std::array<uint64_t, 256> make_mask_bytes() {
+  std::array<uint64_t, 256> t{};
+  for (unsigned m = 0; m < 256; ++m) {
+    for (unsigned k = 0; k < 8; ++k) {
+      if (m & (1u << k)) t[m] |= 1ULL << (8 * k);
+    }
+  }
+  return t;
+}
+constexpr std::array<uint64_t, 256> kMaskBytes = make_mask_bytes();
+
+// ---- AVX2 ----
+#if RRKERN_X86
+__attribute__((target("avx2"))) int64_t sum_avx2(const int32_t* rr, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(rr + i, n - i);
+}
+
+__attribute__((target("avx2"))) int64_t sum_sq_diff_avx2(const int32_t* rr, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 < n; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i + 1));
+    __m256i d = _mm256_sub_epi32(b, a);
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(d, d));
+    __m256i odd = _mm256_srli_epi64(d, 32);
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(odd, odd));
+  }
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_sq_diff_tail(rr, i, n);
+}
+
+__attribute__((target("avx2"))) uint64_t turning_points_avx2(const int32_t* rr, size_t n) {
+  if (n < 3) return 0;
+  uint64_t tp = 0;
+  size_t i = 1;
+  for (; i + 8 < n; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i - 1));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i));
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i + 1));
+    __m256i peak = _mm256_and_si256(_mm256_cmpgt_epi32(b, a), _mm256_cmpgt_epi32(b, c));
+    __m256i dip = _mm256_and_si256(_mm256_cmpgt_epi32(a, b), _mm256_cmpgt_epi32(c, b));
+    tp += (uint64_t)__builtin_popcount(
+        (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(peak, dip))));
+  }
+  return tp + turning_points_tail(rr, i, n);
+}
+
+__attribute__((target("avx2"))) void dash_patterns_avx2(const int32_t* rr, size_t n, uint8_t* out) {
+  if (n == 0) return;
+  out[0] = 0;
+  const __m256i k4 = _mm256_set1_epi32(4), k5 = _mm256_set1_epi32(5);
+  const __m256i k9 = _mm256_set1_epi32(9), k10 = _mm256_set1_epi32(10);
+  const __m256i k13 = _mm256_set1_epi32(13);
+  size_t i = 1;
+  for (; i + 10 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i - 1));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i));
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i + 1));
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i + 2));
+    __m256i fail = _mm256_cmpgt_epi32(_mm256_mullo_epi32(b, k5), _mm256_mullo_epi32(a, k4));
+    fail = _mm256_or_si256(fail, _mm256_cmpgt_epi32(_mm256_mullo_epi32(b, k13),
+                                                    _mm256_mullo_epi32(c, k10)));
+    fail = _mm256_or_si256(fail, _mm256_cmpgt_epi32(_mm256_mullo_epi32(d, k10),
+                                                    _mm256_mullo_epi32(c, k9)));
+    unsigned m = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(fail)) & 0xffu;
+    std::memcpy(out + i, &kMaskBytes[m], 8);
+  }
+  dash_patterns_tail(rr, i, n, out);
+}
+
+__attribute__((target("avx2"))) void histogram16_avx2(const int32_t* rr, size_t n, int32_t lo,
+                                                      int32_t hi, RrHistogram16* out) {
+  const __m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+  const __m256d span = _mm256_set1_pd((double)(hi - lo));
+  const __m256d sixteen = _mm256_set1_pd(16.0);
+  const __m128i fifteen = _mm_set1_epi32(15);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rr + i));
+    unsigned below = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(vlo, v)));
+    unsigned above = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, vhi)));
+    out->below += (uint32_t)__builtin_popcount(below);
+    out->above += (uint32_t)__builtin_popcount(above);
+    unsigned in = ~(below | above) & 0xffu;
+    if (!in) continue;
+    __m256i off = _mm256_sub_epi32(v, vlo);
+    alignas(16) int32_t bins[8];
+    for (int half = 0; half < 2; ++half) {
+      __m128i o = half ? _mm256_extracti128_si256(off, 1) : _mm256_castsi256_si128(off);
+      __m256d t = _mm256_div_pd(_mm256_cvtepi32_pd(o), span);
+      __m128i k = _mm_min_epi32(_mm256_cvttpd_epi32(_mm256_mul_pd(t, sixteen)), fifteen);
+      _mm_store_si128(reinterpret_cast<__m128i*>(bins + 4 * half), k);
+    }
+    for (; in; in &= in - 1) ++out->bins[bins[__builtin_ctz(in)]];
+  }
+  histogram16_tail(rr, i, n, lo, hi, out);
+}
+
+// ---- AVX-512 ----
+// GCC 12's AVX-512 headers trip -Wuninitialized on their own placeholders.
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f"))) int64_t sum_avx512(const int32_t* rr, size_t n) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i v = _mm512_loadu_si512(rr + i);
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+  }
+  return _mm512_reduce_add_epi64(acc) + sum_scalar(rr + i, n - i);
+}
+
+__attribute__((target("avx512f"))) int64_t sum_sq_diff_avx512(const int32_t* rr, size_t n) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 16 < n; i += 16) {
+    __m512i d = _mm512_sub_epi32(_mm512_loadu_si512(rr + i + 1), _mm512_loadu_si512(rr + i));
+    acc = _mm512_add_epi64(acc, _mm512_mul_epi32(d, d));
+    __m512i odd = _mm512_srli_epi64(d, 32);
+    acc = _mm512_add_epi64(acc, _mm512_mul_epi32(odd, odd));
+  }
+  return _mm512_reduce_add_epi64(acc) + sum_sq_diff_tail(rr, i, n);
+}
+
+__attribute__((target("avx512f"))) uint64_t turning_points_avx512(const int32_t* rr, size_t n) {
+  if (n < 3) return 0;
+  uint64_t tp = 0;
+  size_t i = 1;
+  for (; i + 16 < n; i += 16) {
+    __m512i a = _mm512_loadu_si512(rr + i - 1);
+    __m512i b = _mm512_loadu_si512(rr + i);
+    __m512i c = _mm512_loadu_si512(rr + i + 1);
+    __mmask16 peak = _mm512_cmpgt_epi32_mask(b, a) & _mm512_cmpgt_epi32_mask(b, c);
+    __mmask16 dip = _mm512_cmpgt_epi32_mask(a, b) & _mm512_cmpgt_epi32_mask(c, b);
+    tp += (uint64_t)__builtin_popcount((unsigned)(peak | dip));
+  }
+  return tp + turning_points_tail(rr, i, n);
+}
+
+__attribute__((target("avx512f"))) void dash_patterns_avx512(const int32_t* rr, size_t n,
+                                                             uint8_t* out) {
+  if (n == 0) return;
+  out[0] = 0;
+  const __m512i k4 = _mm512_set1_epi32(4), k5 = _mm512_set1_epi32(5);
+  const __m512i k9 = _mm512_set1_epi32(9), k10 = _mm512_set1_epi32(10);
+  const __m512i k13 = _mm512_set1_epi32(13);
+  size_t i = 1;
+  for (; i + 18 <= n; i += 16) {
+    __m512i a = _mm512_loadu_si512(rr + i - 1);
+    __m512i b = _mm512_loadu_si512(rr + i);
+    __m512i c = _mm512_loadu_si512(rr + i + 1);
+    __m512i d = _mm512_loadu_si512(rr + i + 2);
+    __mmask16 ok = _mm512_cmple_epi32_mask(_mm512_mullo_epi32(b, k5), _mm512_mullo_epi32(a, k4)) &
+                   _mm512_cmple_epi32_mask(_mm512_mullo_epi32(b, k13), _mm512_mullo_epi32(c, k10)) &
+                   _mm512_cmple_epi32_mask(_mm512_mullo_epi32(d, k10), _mm512_mullo_epi32(c, k9));
+    std::memcpy(out + i, &kMaskBytes[ok & 0xff], 8);
+    std::memcpy(out + i + 8, &kMaskBytes[ok >> 8], 8);
+  }
+  dash_patterns_tail(rr, i, n, out);
+}
+
+__attribute__((target("avx512f"))) void histogram16_avx512(const int32_t* rr, size_t n, int32_t lo,
+                                                           int32_t hi, RrHistogram16* out) {
+  const __m512i vlo = _mm512_set1_epi32(lo), vhi = _mm512_set1_epi32(hi);
+  const __m512d span = _mm512_set1_pd((double)(hi - lo));
+  const __m512d sixteen = _mm512_set1_pd(16.0);
+  const __m256i fifteen = _mm256_set1_epi32(15);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i v = _mm512_loadu_si512(rr + i);
+    __mmask16 below = _mm512_cmplt_epi32_mask(v, vlo);
+    __mmask16 above = _mm512_cmpgt_epi32_mask(v, vhi);
+    out->below += (uint32_t)__builtin_popcount((unsigned)below);
+    out->above += (uint32_t)__builtin_popcount((unsigned)above);
+    unsigned in = (unsigned)(~(below | above)) & 0xffffu;
+    if (!in) continue;
+    __m512i off = _mm512_sub_epi32(v, vlo);
+    alignas(32) int32_t bins[16];
+    for (int half = 0; half < 2; ++half) {
+      __m256i o = half ? _mm512_extracti64x4_epi64(off, 1) : _mm512_castsi512_si256(off);
+      __m512d t = _mm512_div_pd(_mm512_cvtepi32_pd(o), span);
+      __m256i k = _mm256_min_epi32(_mm512_cvttpd_epi32(_mm512_mul_pd(t, sixteen)), fifteen);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(bins + 8 * half), k);
+    }
+    for (; in; in &= in - 1) ++out->bins[bins[__builtin_ctz(in)]];
+  }
+  histogram16_tail(rr, i, n, lo, hi, out);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// ---- NEON ----
+#if RRKERN_NEON
+int64_t sum_neon(const int32_t* rr, size_t n) {
+  int64x2_t acc = vdupq_n_s64(0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) acc = vpadalq_s32(acc, vld1q_s32(rr + i));
+  return vaddvq_s64(acc) + sum_scalar(rr + i, n - i);
+}
+
+int64_t sum_sq_diff_neon(const int32_t* rr, size_t n) {
+  int64x2_t acc = vdupq_n_s64(0);
+  size_t i = 0;
+  for (; i + 4 < n; i += 4) {
+    int32x4_t d = vsubq_s32(vld1q_s32(rr + i + 1), vld1q_s32(rr + i));
+    acc = vmlal_s32(acc, vget_low_s32(d), vget_low_s32(d));
+    acc = vmlal_high_s32(acc, d, d);
+  }
+  return vaddvq_s64(acc) + sum_sq_diff_tail(rr, i, n);
+}
+
+uint64_t turning_points_neon(const int32_t* rr, size_t n) {
+  if (n < 3) return 0;
+  uint32x4_t count = vdupq_n_u32(0);
+  size_t i = 1;
+  for (; i + 4 < n; i += 4) {
+    int32x4_t a = vld1q_s32(rr + i - 1);
+    int32x4_t b = vld1q_s32(rr + i);
+    int32x4_t c = vld1q_s32(rr + i + 1);
+    uint32x4_t peak = vandq_u32(vcgtq_s32(b, a), vcgtq_s32(b, c));
+    uint32x4_t dip = vandq_u32(vcltq_s32(b, a), vcltq_s32(b, c));
+    count = vsubq_u32(count, vorrq_u32(peak, dip));  // lanes are 0 or ~0
+  }
+  return (uint64_t)vaddvq_u32(count) + turning_points_tail(rr, i, n);
+}
+
+void dash_patterns_neon(const int32_t* rr, size_t n, uint8_t* out) {
+  if (n == 0) return;
+  out[0] = 0;
+  size_t i = 1;
+  for (; i + 6 <= n; i += 4) {
+    int32x4_t a = vld1q_s32(rr + i - 1);
+    int32x4_t b = vld1q_s32(rr + i);
+    int32x4_t c = vld1q_s32(rr + i + 1);
+    int32x4_t d = vld1q_s32(rr + i + 2);
+    uint32x4_t ok = vcleq_s32(vmulq_n_s32(b, 5), vmulq_n_s32(a, 4));
+    ok = vandq_u32(ok, vcleq_s32(vmulq_n_s32(b, 13), vmulq_n_s32(c, 10)));
+    ok = vandq_u32(ok, vcleq_s32(vmulq_n_s32(d, 10), vmulq_n_s32(c, 9)));
+    uint16x4_t n16 = vmovn_u32(ok);
+    uint8_t bytes[8];
+    vst1_u8(bytes, vand_u8(vmovn_u16(vcombine_u16(n16, n16)), vdup_n_u8(1)));
+    std::memcpy(out + i, bytes, 4);
+  }
+  dash_patterns_tail(rr, i, n, out);
+}
+
+void histogram16_neon(const int32_t* rr, size_t n, int32_t lo, int32_t hi, RrHistogram16* out) {
+  const int32x4_t vlo = vdupq_n_s32(lo), vhi = vdupq_n_s32(hi);
+  const float64x2_t span = vdupq_n_f64((double)(hi - lo));
+  const float64x2_t sixteen = vdupq_n_f64(16.0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32x4_t v = vld1q_s32(rr + i);
+    uint32x4_t below = vcltq_s32(v, vlo);
+    uint32x4_t above = vcgtq_s32(v, vhi);
+    out->below += vaddvq_u32(vandq_u32(below, vdupq_n_u32(1)));
+    out->above += vaddvq_u32(vandq_u32(above, vdupq_n_u32(1)));
+    uint32x4_t in = vmvnq_u32(vorrq_u32(below, above));
+    if (vmaxvq_u32(in) == 0) continue;
+    int32x4_t off = vsubq_s32(v, vlo);
+    float64x2_t t0 = vdivq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(off))), span);
+    float64x2_t t1 = vdivq_f64(vcvtq_f64_s64(vmovl_high_s32(off)), span);
+    int64x2_t k0 = vcvtq_s64_f64(vmulq_f64(t0, sixteen));
+    int64x2_t k1 = vcvtq_s64_f64(vmulq_f64(t1, sixteen));
+    int32x4_t k = vminq_s32(vcombine_s32(vmovn_s64(k0), vmovn_s64(k1)), vdupq_n_s32(15));
+    int32_t bins[4];
+    uint32_t lanes[4];
+    vst1q_s32(bins, k);
+    vst1q_u32(lanes, in);
+    for (int l = 0; l < 4; ++l) {
+      if (lanes[l]) ++out->bins[bins[l]];
+    }
+  }
+  histogram16_tail(rr, i, n, lo, hi, out);
+}
+#endif
+
+const RrKernels kScalar = {"scalar", sum_scalar, sum_sq_diff_scalar, turning_points_scalar,
+                           dash_patterns_scalar, histogram16_scalar};
+
+RrKernels pick_kernels() {
+#if RRKERN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {"avx512", sum_avx512, sum_sq_diff_avx512, turning_points_avx512, dash_patterns_avx512,
+            histogram16_avx512};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2", sum_avx2, sum_sq_diff_avx2, turning_points_avx2, dash_patterns_avx2,
+            histogram16_avx2};
+  }
+#elif RRKERN_NEON
+  return {"neon", sum_neon, sum_sq_diff_neon, turning_points_neon, dash_patterns_neon,
+          histogram16_neon};
+#endif
+  return kScalar;
+}
+
+}  // namespace
+
+const RrKernels& rr_kernels() {
+  static const RrKernels k = pick_kernels();
+  return k;
+}
+
+const RrKernels& rr_kernels_scalar() { return kScalar; }
+
+int64_t rr_sum(std::span<const int32_t> rr) { return rr_kernels().sum(rr.data(), rr.size()); }
+
+int64_t rr_sum_sq_diff(std::span<const int32_t> rr) {
+  return rr_kernels().sum_sq_diff(rr.data(), rr.size());
+}
+
+uint64_t rr_turning_points(std::span<const int32_t> rr) {
+  return rr_kernels().turning_points(rr.data(), rr.size());
+}
+
+void rr_dash_patterns(std::span<const int32_t> rr, std::vector<uint8_t>* out) {
+  out->resize(rr.size());
+  rr_kernels().dash_patterns(rr.data(), rr.size(), out->data());
+}
+
+RrHistogram16 rr_histogram16(std::span<const int32_t> rr, int32_t lo, int32_t hi) {
+  RrHistogram16 h;
+  rr_kernels().histogram16(rr.data(), rr.size(), lo, hi, &h);
+  return h;
+}
+
+void rr_dash_clean(std::span<const int32_t> rr, std::vector<int32_t>* out) {
+  std::vector<uint8_t> pat;
+  rr_dash_patterns(rr, &pat);
+  out->clear();
+  out->reserve(rr.size());
+  // Patterns never start at adjacent beats, so each beat is dropped by at
+  // most one of them.
+  for (size_t i = 0; i < rr.size(); ++i) {
+    if (!pat[i] && !(i > 0 && pat[i - 1])) out->push_back(rr[i]);
+  }
+}
+
+void rr_from_float(std::span<const float> rr, std::vector<int32_t>* out) {
+  out->resize(rr.size());
+  for (size_t i = 0; i < rr.size(); ++i) (*out)[i] = (int32_t)std::lround(rr[i]);
+}
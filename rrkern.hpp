@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Vectorized kernels over RR arrays (ms), for bulk replay of whole
+// recordings. AVX-512, AVX2, NEON or scalar is picked at startup; all of them
+// return exactly what the scalar double-precision formulas in the health
+// checks compute. Values must be positive and below 2^26 (any plausible RR).
+//
+// float arrays are accepted as whole milliseconds (rounded to nearest), which
+// is what hrm_parse produces.
+
+// 16 bins of int((x - lo) / (hi - lo) * 16) over lo <= x <= hi (x == hi goes
+// to the last bin), plus the values outside.
+struct RrHistogram16 {
+  uint32_t bins[16] = {};
+  uint32_t below = 0;
+  uint32_t above = 0;
+};
+
+struct RrKernels {
+  const char* name;
+  int64_t (*sum)(const int32_t* rr, size_t n);
+  // sum of (rr[i + 1] - rr[i])^2
+  int64_t (*sum_sq_diff)(const int32_t* rr, size_t n);
+  // i in [1, n - 1) with rr[i] a strict local maximum or minimum
+  uint64_t (*turning_points)(const int32_t* rr, size_t n);
+  // out[i] = 1 when rr[i] / rr[i - 1] <= 0.8, rr[i + 1] / rr[i] >= 1.3 and
+  // rr[i + 2] / rr[i + 1] <= 0.9 (i in [1, n - 2)), else 0; out has n bytes.
+  void (*dash_patterns)(const int32_t* rr, size_t n, uint8_t* out);
+  void (*histogram16)(const int32_t* rr, size_t n, int32_t lo, int32_t hi, RrHistogram16* out);
+};
+
+// Kernels for this CPU, and the scalar reference set.
+const RrKernels& rr_kernels();
+const RrKernels& rr_kernels_scalar();
+
+// ---- batch API over whole recordings ----
+int64_t rr_sum(std::span<const int32_t> rr);
+int64_t rr_sum_sq_diff(std::span<const int32_t> rr);
+uint64_t rr_turning_points(std::span<const int32_t> rr);
+void rr_dash_patterns(std::span<const int32_t> rr, std::vector<uint8_t>* out);
+RrHistogram16 rr_histogram16(std::span<const int32_t> rr, int32_t lo, int32_t hi);
+
+// Drops both beats of every short-long-short pattern in the recording (the
+// Dash-style cleaning used by the AF screening, applied once to the whole
+// array).
+void rr_dash_clean(std::span<const int32_t> rr, std::vector<int32_t>* out);
+
+// float RR (ms) to the int32 arrays above.
+void rr_from_float(std::span<const float> rr, std::vector<int32_t>* out);
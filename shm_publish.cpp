@@ -0,0 +1,149 @@
+#include "shm_publish.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#include "debug.hpp"
+
+namespace {
+
+void put_str(char* dst, size_t cap, std::string_view s) {
+  size_t n = std::min(s.size(), cap - 1);
+  std::memcpy(dst, s.data(), n);
+  std::memset(dst + n, 0, cap - n);
+}
+
+}  // namespace
+
+ShmPublisher::~ShmPublisher() {
+  close();
+}
+
+bool ShmPublisher::open(const std::string& name, uint64_t capacity, std::string* err) {
+  close();
+  path_ = name.starts_with('/') ? name : "/" + name;
+  uint64_t cap = 1;
+  while (cap < capacity) cap <<= 1;
+
+  // A ring left by a crashed run may still be mapped by readers; they keep
+  // the old object and see `closed` stay 0 until they reopen the name.
+  shm_unlink(path_.c_str());
+  int fd = shm_open(path_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *err = "shm_open " + path_ + ": " + std::strerror(errno);
+    return false;
+  }
+  size_t bytes = shm_ring_bytes(cap);
+  if (ftruncate(fd, (off_t)bytes) < 0) {
+    *err = "ftruncate " + path_ + ": " + std::strerror(errno);
+    ::close(fd);
+    shm_unlink(path_.c_str());
+    return false;
+  }
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    *err = "mmap " + path_ + ": " + std::strerror(errno);
+    shm_unlink(path_.c_str());
+    return false;
+  }
+  map_ = p;
+  map_bytes_ = bytes;
+  // ftruncate zero-fills: every seq starts at 0, which no record matches.
+  hdr_ = new (p) ShmRingHeader;
+  records_ = reinterpret_cast<ShmRecord*>(static_cast<char*>(p) + sizeof(ShmRingHeader));
+  for (uint64_t i = 0; i < cap; ++i) new (&records_[i]) ShmRecord;
+  mask_ = cap - 1;
+  head_ = 0;
+  devices_ = 0;
+
+  hdr_->version = kShmVersion;
+  hdr_->record_size = sizeof(ShmRecord);
+  hdr_->capacity = cap;
+  hdr_->created_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  hdr_->publisher_pid = (int32_t)getpid();
+  hdr_->magic.store(kShmMagic, std::memory_order_release);
+  ERR << "[info] Publishing samples to shared memory " << path_ << " (" << cap
+      << " records, " << (bytes >> 10) << " KiB)\n";
+  return true;
+}
+
+void ShmPublisher::close() {
+  if (!map_) return;
+  hdr_->closed.store(1, std::memory_order_release);
+  munmap(map_, map_bytes_);
+  shm_unlink(path_.c_str());
+  map_ = nullptr;
+  hdr_ = nullptr;
+  records_ = nullptr;
+}
+
+uint16_t ShmPublisher::device_id(std::string_view tag) {
+  tag = tag.substr(0, sizeof(ShmDevice::tag) - 1);
+  for (uint32_t i = 0; i < devices_; ++i) {
+    const ShmDevice& d = hdr_->devices[i];
+    if (std::string_view(d.tag, strnlen(d.tag, sizeof d.tag)) == tag) return (uint16_t)i;
+  }
+  if (devices_ == kShmMaxDevices) {
+    if (!devices_full_logged_) {
+      ERR << "[warn] shared memory device table full; later devices are unnamed\n";
+      devices_full_logged_ = true;
+    }
+    return kShmNoDevice;
+  }
+  ShmDevice& d = hdr_->devices[devices_];
+  d.seq.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  put_str(d.tag, sizeof d.tag, tag);
+  put_str(d.name, sizeof d.name, "");
+  put_str(d.address, sizeof d.address, "");
+  d.seq.store(2, std::memory_order_release);
+  hdr_->device_count.store(++devices_, std::memory_order_release);
+  return (uint16_t)(devices_ - 1);
+}
+
+void ShmPublisher::describe_device(std::string_view tag, std::string_view name,
+                                   std::string_view address) {
+  if (!map_) return;
+  uint16_t id = device_id(tag);
+  if (id == kShmNoDevice) return;
+  ShmDevice& d = hdr_->devices[id];
+  uint32_t s = d.seq.load(std::memory_order_relaxed);
+  d.seq.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  put_str(d.name, sizeof d.name, name);
+  put_str(d.address, sizeof d.address, address);
+  d.seq.store(s + 2, std::memory_order_release);
+}
+
+void ShmPublisher::publish_sample(std::string_view tag, const HrmSample& s) {
+  if (!map_) return;
+  const uint16_t dev = device_id(tag);
+  // Usually one record; RR values beyond kShmMaxRR follow in kShmSampleRR
+  // records, and head covers them all at once.
+  size_t rr_done = 0;
+  for (uint16_t kind = kShmSample; kind == kShmSample || rr_done < s.rr_count;
+       kind = kShmSampleRR) {
+    const uint64_t n = head_;
+    ShmRecord& r = records_[n & mask_];
+    size_t rr_n = std::min<size_t>(s.rr_count - rr_done, kShmMaxRR);
+    r.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    r.ts_ms = s.ts_ms;
+    r.kind = kind;
+    r.device = dev;
+    r.flags = s.flags;
+    r.rr_count = (uint8_t)rr_n;
+    r.rr_truncated = (uint8_t)(s.rr_count - rr_done - rr_n);
+    r.reserved = 0;
+    r.bpm = kind == kShmSample ? s.bpm : -1;
+    std::memset(r.rr_ms, 0, sizeof r.rr_ms);
+    std::memcpy(r.rr_ms, s.rr_ms + rr_done, rr_n * sizeof(int32_t));
+    r.seq.store(2 * n + 2, std::memory_order_release);
+    rr_done += rr_n;
+    head_ = n + 1;
+  }
+  hdr_->head.store(head_, std::memory_order_release);
+}
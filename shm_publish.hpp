@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "hrm.hpp"
+#include "shm_ring.hpp"
+
+// --shm <name>: writer side of the shared-memory ring (layout and reader in
+// shm_ring.hpp). Single writer; output.cpp calls it under its stream lock.
+class ShmPublisher {
+ public:
+  ShmPublisher() = default;
+  ~ShmPublisher();
+  ShmPublisher(const ShmPublisher&) = delete;
+  ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+  // Replaces any ring left under `name` by a previous run; `capacity` is
+  // rounded up to a power of two.
+  bool open(const std::string& name, uint64_t capacity, std::string* err);
+  void publish_sample(std::string_view tag, const HrmSample& s);
+  void describe_device(std::string_view tag, std::string_view name, std::string_view address);
+  // Marks the ring closed for readers and removes the name; readers that
+  // have it mapped keep their view.
+  void close();
+
+ private:
+  uint16_t device_id(std::string_view tag);
+
+  std::string path_;
+  void* map_ = nullptr;
+  size_t map_bytes_ = 0;
+  ShmRingHeader* hdr_ = nullptr;
+  ShmRecord* records_ = nullptr;
+  uint64_t mask_ = 0;
+  uint64_t head_ = 0;
+  uint32_t devices_ = 0;
+  bool devices_full_logged_ = false;
+};
@@ -0,0 +1,230 @@
+#pragma once
+// Shared-memory sample ring (--shm <name>), and a header-only reader for
+// local consumers. Self-contained: include it without the rest of polarm.
+//
+// polarm creates /dev/shm/<name> (shm_open) holding a ShmRingHeader followed
+// by `capacity` 64-byte ShmRecords. It is the only writer; any number of
+// readers map it read-only and follow `head` at their own pace. Publishing
+// record n (n = 0, 1, ...) into slot n % capacity:
+//
+//   slot.seq = 2n + 1 (odd: being written), fields, slot.seq = 2n + 2,
+//   head = n + 1
+//
+// A reader that sees seq == 2n + 2 before and after looking at the fields
+// read a complete record n; anything else means the writer lapped it. Slow
+// readers lose the oldest records, never the writer's time: there is no
+// back-pressure and no syscall on either side per record. Readers poll
+// `head` (e.g. every few ms, or on their own tick).
+//
+// `kind` says what a record holds; readers skip kinds they do not know, so
+// new kinds (HRV reports, warnings) can be added without a version bump.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+inline constexpr uint64_t kShmMagic = 0x474e49524d524c50ULL;  // "PLRMRING"
+inline constexpr uint32_t kShmVersion = 1;
+inline constexpr uint32_t kShmMaxRR = 9;
+inline constexpr uint32_t kShmMaxDevices = 64;
+inline constexpr uint16_t kShmNoDevice = 0xffff;  // beyond the device table
+
+enum ShmRecordKind : uint16_t {
+  kShmSample = 1,    // one HR notification: ts_ms, bpm, rr_ms[rr_count]
+  // RR values of the kShmSample before it that did not fit: same ts_ms and
+  // device, bpm -1, rr_ms[rr_count], rr_truncated still to come after it.
+  // Published together with their sample (one head update).
+  kShmSampleRR = 2,
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+struct alignas(64) ShmRecord {
+  std::atomic<uint64_t> seq;
+  uint64_t ts_ms;        // epoch ms
+  uint16_t kind;         // ShmRecordKind
+  uint16_t device;       // ShmRingHeader::devices index
+  uint8_t flags;         // HRM flags byte
+  uint8_t rr_count;
+  uint8_t rr_truncated;  // RR values beyond kShmMaxRR, in kShmSampleRR records
+  uint8_t reserved;
+  int32_t bpm;           // -1 if the notification had none
+  int32_t rr_ms[kShmMaxRR];
+};
+static_assert(sizeof(ShmRecord) == 64);
+
+// Identity of a strap, as in the binary recording's device blocks. Written
+// under its own seq (odd while changing) when the device is first seen or
+// resolved.
+struct alignas(64) ShmDevice {
+  std::atomic<uint32_t> seq;
+  uint32_t reserved;
+  char tag[40];      // output tag ("" for the default strap)
+  char name[64];     // advertised name
+  char address[24];  // "AA:BB:CC:DD:EE:FF"
+};
+
+struct ShmRingHeader {
+  std::atomic<uint64_t> magic;  // stored last when the ring is created
+  uint32_t version;
+  uint32_t record_size;      // sizeof(ShmRecord)
+  uint64_t capacity;         // records, a power of two
+  uint64_t created_ms;       // epoch ms
+  int32_t publisher_pid;
+  std::atomic<uint32_t> closed;  // 1 once the publisher exited cleanly
+  std::atomic<uint32_t> device_count;
+  alignas(64) std::atomic<uint64_t> head;  // records published so far
+  alignas(64) ShmDevice devices[kShmMaxDevices];
+};
+static_assert(sizeof(ShmRingHeader) % 64 == 0);
+
+inline size_t shm_ring_bytes(uint64_t capacity) {
+  return sizeof(ShmRingHeader) + (size_t)capacity * sizeof(ShmRecord);
+}
+
+struct ShmDeviceInfo {
+  std::string tag;
+  std::string name;
+  std::string address;
+};
+
+// Follows a ring from the next record published on (seek_oldest() to start
+// from what is still in it). Records are read in place:
+//
+//   while (const ShmRecord* r = reader.peek()) {
+//     ... read *r ...
+//     if (!reader.done()) ... discard what was read: it was overwritten
+//   }
+class ShmRingReader {
+ public:
+  ShmRingReader() = default;
+  ~ShmRingReader() { close(); }
+  ShmRingReader(const ShmRingReader&) = delete;
+  ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+  bool open(const std::string& name, std::string* err = nullptr) {
+    close();
+    std::string path = name.starts_with('/') ? name : "/" + name;
+    int fd = shm_open(path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return fail(err, "shm_open " + path + ": " + std::strerror(errno));
+    struct stat st {};
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+      ::close(fd);
+      return fail(err, path + ": not a polarm ring");
+    }
+    void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return fail(err, "mmap " + path + ": " + std::strerror(errno));
+    map_ = p;
+    map_bytes_ = (size_t)st.st_size;
+    hdr_ = static_cast<const ShmRingHeader*>(p);
+    if (hdr_->magic.load(std::memory_order_acquire) != kShmMagic ||
+        hdr_->version != kShmVersion || hdr_->record_size != sizeof(ShmRecord) || hdr_->capacity == 0 ||
+        (hdr_->capacity & (hdr_->capacity - 1)) != 0 ||
+        shm_ring_bytes(hdr_->capacity) > map_bytes_) {
+      close();
+      return fail(err, path + ": not a polarm ring (or still being created)");
+    }
+    mask_ = hdr_->capacity - 1;
+    records_ = reinterpret_cast<const ShmRecord*>(static_cast<const char*>(p) +
+                                                  sizeof(ShmRingHeader));
+    next_ = hdr_->head.load(std::memory_order_acquire);
+    return true;
+  }
+
+  void close() {
+    if (map_) munmap(map_, map_bytes_);
+    map_ = nullptr;
+    hdr_ = nullptr;
+    records_ = nullptr;
+    cur_ = nullptr;
+  }
+
+  // Oldest record still in the ring.
+  void seek_oldest() {
+    uint64_t head = hdr_->head.load(std::memory_order_acquire);
+    next_ = head > hdr_->capacity ? head - hdr_->capacity : 0;
+  }
+
+  // The next record, or nullptr when caught up.
+  const ShmRecord* peek() {
+    if (!hdr_) return nullptr;
+    for (;;) {
+      uint64_t head = hdr_->head.load(std::memory_order_acquire);
+      if (next_ >= head) return nullptr;
+      if (head - next_ > hdr_->capacity) {
+        lost_ += head - hdr_->capacity - next_;
+        next_ = head - hdr_->capacity;
+      }
+      const ShmRecord* r = &records_[next_ & mask_];
+      uint64_t seq = r->seq.load(std::memory_order_acquire);
+      if (seq == 2 * next_ + 2) {
+        cur_ = r;
+        cur_seq_ = seq;
+        return r;
+      }
+      // Overwritten between the head load and here.
+      ++lost_;
+      ++next_;
+    }
+  }
+
+  // Finishes the record peek() returned; false if it changed while read.
+  bool done() {
+    if (!cur_) return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool ok = cur_->seq.load(std::memory_order_relaxed) == cur_seq_;
+    cur_ = nullptr;
+    ++next_;
+    if (!ok) ++lost_;
+    return ok;
+  }
+
+  // Copy of a device table entry; false if unset or changing (retry).
+  bool device(uint16_t id, ShmDeviceInfo* out) const {
+    if (!hdr_ || id >= hdr_->device_count.load(std::memory_order_acquire)) return false;
+    const ShmDevice& d = hdr_->devices[id];
+    uint32_t s = d.seq.load(std::memory_order_acquire);
+    if (s == 0 || (s & 1)) return false;
+    char tag[sizeof d.tag], name[sizeof d.name], address[sizeof d.address];
+    std::memcpy(tag, d.tag, sizeof tag);
+    std::memcpy(name, d.name, sizeof name);
+    std::memcpy(address, d.address, sizeof address);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (d.seq.load(std::memory_order_relaxed) != s) return false;
+    out->tag.assign(tag, strnlen(tag, sizeof tag));
+    out->name.assign(name, strnlen(name, sizeof name));
+    out->address.assign(address, strnlen(address, sizeof address));
+    return true;
+  }
+
+  const ShmRingHeader* header() const { return hdr_; }
+  bool publisher_closed() const {
+    return hdr_ && hdr_->closed.load(std::memory_order_acquire) != 0;
+  }
+  uint64_t position() const { return next_; }  // records consumed or lost
+  uint64_t lost() const { return lost_; }
+
+ private:
+  static bool fail(std::string* err, std::string msg) {
+    if (err) *err = std::move(msg);
+    return false;
+  }
+
+  void* map_ = nullptr;
+  size_t map_bytes_ = 0;
+  const ShmRingHeader* hdr_ = nullptr;
+  const ShmRecord* records_ = nullptr;
+  uint64_t mask_ = 0;
+  uint64_t next_ = 0;
+  uint64_t lost_ = 0;
+  const ShmRecord* cur_ = nullptr;
+  uint64_t cur_seq_ = 0;
+};
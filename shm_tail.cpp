@@ -0,0 +1,86 @@
+// polarm-shm-tail: follows a --shm ring and prints its samples as polarm's
+// text lines ("[<tag> ]<epoch_ms>,<bpm>[,<rr_ms>...]"). Also the reference
+// for attaching with shm_ring.hpp alone.
+//
+// Usage: polarm-shm-tail <name> [--from-oldest]
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "shm_ring.hpp"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <name> [--from-oldest]\n", argv[0]);
+    return 2;
+  }
+  ShmRingReader reader;
+  std::string err;
+  if (!reader.open(argv[1], &err)) {
+    std::fprintf(stderr, "%s\n", err.c_str());
+    return 1;
+  }
+  if (argc > 2 && std::strcmp(argv[2], "--from-oldest") == 0) reader.seek_oldest();
+
+  std::vector<std::string> tags;
+  uint64_t lost = 0;
+  std::string line;  // sample being assembled from its record(s)
+  uint16_t line_dev = kShmNoDevice;
+  char field[24];
+  auto print_line = [&] {
+    if (line.empty()) return;
+    if (line_dev != kShmNoDevice && line_dev >= tags.size()) {
+      ShmDeviceInfo info;
+      for (uint16_t id = (uint16_t)tags.size(); id <= line_dev && reader.device(id, &info); ++id)
+        tags.push_back(info.tag);
+    }
+    const char* tag = line_dev < tags.size() ? tags[line_dev].c_str() : "";
+    std::printf("%s%s%s\n", tag, *tag ? " " : "", line.c_str());
+    line.clear();
+  };
+  for (;;) {
+    // Checked first: what was published before closing is still drained.
+    bool closed = reader.publisher_closed();
+    bool any = false;
+    while (const ShmRecord* r = reader.peek()) {
+      any = true;
+      if (r->kind != kShmSample && r->kind != kShmSampleRR) {
+        reader.done();
+        continue;
+      }
+      // Continuation records are published with their sample, so a sample's
+      // line is complete once the next non-continuation record shows up.
+      bool more_rr = r->kind == kShmSampleRR;
+      if (!more_rr) print_line();
+      std::string part;
+      if (!more_rr) {
+        std::snprintf(field, sizeof field, "%llu", (unsigned long long)r->ts_ms);
+        part = field;
+        if (r->bpm >= 0) part += "," + std::to_string(r->bpm);
+      }
+      for (unsigned i = 0; i < r->rr_count && i < kShmMaxRR; ++i)
+        part += "," + std::to_string(r->rr_ms[i]);
+      uint16_t dev = r->device;
+      if (!reader.done()) {  // overwritten while formatting
+        line.clear();
+        continue;
+      }
+      if (more_rr && (line.empty() || dev != line_dev)) continue;  // its sample was lost
+      line += part;
+      line_dev = dev;
+    }
+    print_line();
+    if (reader.lost() != lost) {
+      std::fprintf(stderr, "[warn] %llu records overwritten before they were read\n",
+                   (unsigned long long)(reader.lost() - lost));
+      lost = reader.lost();
+    }
+    if (any) std::fflush(stdout);
+    if (closed) return 0;
+    timespec ts{0, 10 * 1000000L};
+    nanosleep(&ts, nullptr);
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock-free single-producer/single-consumer queue. Each side owns
+// one index on its own cache line and keeps a cached copy of the other's,
+// so a push or pop only reads the shared index when the cached one says the
+// ring looks full or empty. The capacity is rounded up to a power of two.
+template <class T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+    buf_ = std::make_unique<T[]>(cap);
+    mask_ = cap - 1;
+  }
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Producer side.
+  bool try_push(const T& v) {
+    size_t t = tail_.load(std::memory_order_relaxed);
+    if (t - head_cache_ > mask_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (t - head_cache_ > mask_) return false;
+    }
+    buf_[t & mask_] = v;
+    tail_.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  // Elements queued as seen by the producer (exact for it, a bound for others).
+  size_t producer_size() const {
+    return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire);
+  }
+
+  // Consumer side.
+  bool try_pop(T* out) {
+    size_t h = head_.load(std::memory_order_relaxed);
+    if (h == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (h == tail_cache_) return false;
+    }
+    *out = buf_[h & mask_];
+    head_.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t kLine = 64;
+
+  std::unique_ptr<T[]> buf_;
+  size_t mask_ = 0;
+  alignas(kLine) std::atomic<size_t> head_{0};  // written by the consumer
+  size_t tail_cache_ = 0;                       // consumer's view of tail_
+  alignas(kLine) std::atomic<size_t> tail_{0};  // written by the producer
+  size_t head_cache_ = 0;                       // producer's view of head_
+};
@@ -0,0 +1,89 @@
+#include "stall.hpp"
+
+#include <algorithm>
+
+#include "debug.hpp"
+#include "metrics.hpp"
+
+namespace {
+
+constexpr uint64_t kSecond = 1000000000ULL;
+
+// How long each step gets before the next one.
+uint64_t step_grace_ns(StallAction a, uint64_t threshold_ns) {
+  switch (a) {
+    case StallAction::Resubscribe: return std::max(threshold_ns, 5 * kSecond);
+    case StallAction::Reconnect: return std::max(threshold_ns, 30 * kSecond);
+    default: return std::max(threshold_ns, 60 * kSecond);
+  }
+}
+
+const char* action_name(StallAction a) {
+  switch (a) {
+    case StallAction::Resubscribe: return "resubscribing";
+    case StallAction::Reconnect: return "reconnecting";
+    case StallAction::Reacquire: return "reacquiring the device";
+    default: return "waiting";
+  }
+}
+
+std::string_view label(std::string_view tag) {
+  return tag.empty() ? std::string_view("HR") : tag;
+}
+
+}  // namespace
+
+void StallWatchdog::on_notify(std::string_view tag, uint64_t now_ns) {
+  if (stalled_since_ns_) {
+    uint64_t gap = now_ns - last_ns_;
+    uint64_t recover = now_ns - stalled_since_ns_;
+    metrics_record(Metric::StallGap, gap);
+    metrics_record(Metric::StallRecover, recover);
+    ERR << "[info] " << label(tag) << ": notifications resumed after a "
+        << (double)gap / kSecond << " s gap (" << (double)recover / kSecond
+        << " s after detection, " << steps_ << " recovery step(s))\n";
+    stalled_since_ns_ = 0;
+    steps_ = 0;
+  } else if (last_ns_ && now_ns > last_ns_) {
+    uint64_t d = now_ns - last_ns_;
+    interval_ns_ = interval_ns_ ? (interval_ns_ * 7 + d) / 8 : d;
+  }
+  last_ns_ = now_ns;
+}
+
+uint64_t StallWatchdog::threshold_ns() const {
+  return std::max((uint64_t)g_stall_timeout_s * kSecond, 4 * interval_ns_);
+}
+
+uint64_t StallWatchdog::deadline_ns() const {
+  if (!g_stall_timeout_s || !last_ns_) return UINT64_MAX;
+  if (stalled_since_ns_) return next_step_ns_;
+  return std::max(last_ns_ + threshold_ns(), hold_ns_);
+}
+
+void StallWatchdog::wait(uint64_t now_ns) {
+  if (stalled_since_ns_) next_step_ns_ = now_ns + threshold_ns();
+  else hold_ns_ = now_ns + threshold_ns();
+}
+
+StallAction StallWatchdog::check(std::string_view tag, uint64_t now_ns, bool link_up) {
+  if (now_ns < deadline_ns()) return StallAction::None;
+  // Maintenance is reconnecting, or has just finished: look again later.
+  if (!link_up || down_) {
+    down_ = !link_up;
+    wait(now_ns);
+    return StallAction::None;
+  }
+  if (!stalled_since_ns_) {
+    stalled_since_ns_ = now_ns;
+    ERR << "[warn] " << label(tag) << ": no notification for "
+        << (double)(now_ns - last_ns_) / kSecond << " s while connected and notifying\n";
+  }
+  static constexpr StallAction kSteps[] = {StallAction::Resubscribe, StallAction::Reconnect,
+                                           StallAction::Reacquire};
+  StallAction a = kSteps[steps_ % 3];
+  ++steps_;
+  next_step_ns_ = now_ns + step_grace_ns(a, threshold_ns());
+  ERR << "[warn] " << label(tag) << ": stalled; " << action_name(a) << "\n";
+  return a;
+}
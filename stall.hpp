@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+// --stall-timeout (main.cpp): seconds without a notification, while the
+// maintenance view says connected and notifying, before the watchdog acts;
+// 0 disables it.
+extern unsigned g_stall_timeout_s;
+
+// Recovery steps, tried in this order while the stall lasts.
+enum class StallAction {
+  None,
+  Resubscribe,  // StopNotify + StartNotify, or a fresh AcquireNotify socket
+  Reconnect,    // Disconnect; maintenance connects again
+  Reacquire,    // forget the device/characteristic paths and resolve them again
+};
+
+// Per-strap notification watchdog. Notifications only store their time
+// (on_notify); the deadline is derived from it, so the loop's timer is
+// re-armed once per check instead of once per packet. The threshold follows
+// the strap's cadence: the larger of --stall-timeout and four times the
+// average notification interval.
+class StallWatchdog {
+ public:
+  // Every notification (hrm_on_value); ends a stall and records the
+  // stall_gap / stall_recover metrics.
+  void on_notify(std::string_view tag, uint64_t now_ns);
+  // Monotonic ns of the next check; UINT64_MAX when disabled or before the
+  // first notification.
+  uint64_t deadline_ns() const;
+  // Maintenance saw the link down (hrm_source_down). Once it is back up the
+  // strap gets a full threshold to start sending again.
+  void on_down() { down_ = true; }
+  // Call at or after deadline_ns(). `link_up` is false while maintenance
+  // already knows the link is down; the watchdog then only waits.
+  StallAction check(std::string_view tag, uint64_t now_ns, bool link_up);
+  bool stalled() const { return stalled_since_ns_ != 0; }
+
+ private:
+  uint64_t threshold_ns() const;
+  void wait(uint64_t now_ns);
+
+  uint64_t last_ns_ = 0;           // last notification
+  uint64_t interval_ns_ = 0;       // moving average of the notification interval
+  uint64_t hold_ns_ = 0;           // no check before this (link known down)
+  uint64_t stalled_since_ns_ = 0;  // when the stall was detected; 0 = streaming
+  uint64_t next_step_ns_ = 0;      // next escalation while stalled
+  unsigned steps_ = 0;             // actions taken in this stall
+  bool down_ = false;
+};
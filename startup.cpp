@@ -0,0 +1,246 @@
+#include "startup.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct ConnectCall {
+  sd_bus_slot* slot{};  // in flight while set
+  std::string path;
+  uint64_t start_ns = 0;
+  bool replied = false;
+  std::string error;    // D-Bus error name of a failed reply
+};
+
+int connect_reply_cb(sd_bus_message* m, void* userdata, sd_bus_error* ret_error) {
+  (void)ret_error;
+  auto* c = static_cast<ConnectCall*>(userdata);
+  metrics_since(Metric::CallConnect, c->start_ns);
+  c->slot = sd_bus_slot_unref(c->slot);
+  c->replied = true;
+  const sd_bus_error* err = sd_bus_message_is_method_error(m, nullptr)
+    ? sd_bus_message_get_error(m) : nullptr;
+  if (g_trace_record)
+    trace_call_end(c->path, "Connect", c->start_ns, err ? (err->name ? err->name : "unknown") : "");
+  if (err) {
+    ERR << "[err] D-Bus: " << (err->name ? err->name : "unknown")
+        << " - " << (err->message ? err->message : "") << "\n";
+    c->error = err->name ? err->name : "unknown";
+  } else {
+    DBG << "[dbg] async Connect -> ok\n";
+  }
+  return 0;
+}
+
+int connect_async(sd_bus* bus, const std::string& dev_path, ConnectCall* c) {
+  c->replied = false;
+  c->error.clear();
+  c->start_ns = metrics_now_ns();
+  c->path = dev_path;
+  if (g_trace_record) trace_call_begin(dev_path, "Connect", c->start_ns);
+  int r = sd_bus_call_method_async(bus, &c->slot, std::string(kBluezService).c_str(),
+                                   dev_path.c_str(), std::string(kDevice1).c_str(),
+                                   "Connect", connect_reply_cb, c, "");
+  if (r < 0) ERR << "[err] sd_bus_call_method_async(Connect): " << strerror(-r) << "\n";
+  return r;
+}
+
+long long ms_between(uint64_t from_ns, uint64_t to_ns) {
+  return (long long)((to_ns - from_ns + 500000) / 1000000);
+}
+
+}  // namespace
+
+std::optional<StartupResult> startup_connect(sd_bus* bus,
+                                             const std::vector<std::string_view>& names) {
+  StartupResult res;
+  StartupTimes& t = res.times;
+  t.start_ns = metrics_now_ns();
+
+  const auto find_deadline = Clock::now() + 90s;
+  auto connect_deadline = Clock::time_point::max();
+  auto char_deadline = Clock::time_point::max();
+  auto retry_at = Clock::time_point();  // next Connect() after a failed reconnect
+  bool reconnecting = false;            // the link dropped before the characteristic
+  ConnectCall call;
+  bool discovering = false;
+
+  auto stop_discovery = [&] {
+    if (discovering) stop_adapter_discovery(bus);
+    discovering = false;
+  };
+  auto fail = [&](const char* msg) -> std::optional<StartupResult> {
+    stop_discovery();
+    // Drop the pending reply; its callback must not see `call` again.
+    if (call.slot) call.slot = sd_bus_slot_unref(call.slot);
+    ERR << msg;
+    return std::nullopt;
+  };
+
+  for (;;) {
+    // First pass loads the cache and its matches; later passes dispatch the
+    // signals and the Connect() reply that woke sd_bus_wait().
+    object_cache_sync(bus);
+    auto now = Clock::now();
+    auto wake = Clock::time_point::max();
+
+    if (!t.found_ns) {
+      if (auto dev = find_any_device_by_names(bus, names)) {
+        res.dev = std::move(*dev);
+        t.found_ns = metrics_now_ns();
+        ERR << "[info] Found device: " << res.dev.name << " path: " << res.dev.path << "\n";
+        stop_discovery();
+      } else {
+        if (!discovering) {
+          ERR << "[info] Starting discovery...\n";
+          if (start_adapter_discovery(bus) < 0) return fail("[err] StartDiscovery failed\n");
+          discovering = true;
+          t.scanned = true;
+        }
+        if (now >= find_deadline) return fail("[err] Device not found after scan.\n");
+        wake = find_deadline;
+      }
+    }
+
+    if (t.found_ns && !t.connected_ns) {
+      // Once connected, a failed or timed-out reconnect is routine (e.g.
+      // le-connection-abort): warn and retry until the characteristic
+      // deadline instead of giving up.
+      auto retry_later = [&](const char* msg) {
+        ERR << msg;
+        if (call.slot) call.slot = sd_bus_slot_unref(call.slot);
+        connect_deadline = Clock::time_point::max();
+        retry_at = now + 2s;
+      };
+      if (cached_device_connected(res.dev.path).value_or(false)) {
+        t.connected_ns = metrics_now_ns();
+        ERR << (reconnecting ? "[info] Connected (retry).\n" : "[info] Connected.\n");
+        connect_deadline = Clock::time_point::max();
+        if (char_deadline == Clock::time_point::max()) char_deadline = now + 60s;
+      } else if (reconnecting && now >= char_deadline) {
+        return fail("[err] Heart Rate Measurement characteristic not found (timeout).\n");
+      } else if (!call.slot) {
+        if (call.replied && !call.error.empty()) {
+          call.replied = false;
+          if (call.error != "org.bluez.Error.InProgress") {
+            if (!reconnecting) return fail("[err] Connect failed\n");
+            retry_later("[warn] Connect failed during HR characteristic retry.\n");
+          }
+          // On InProgress someone else is connecting it; Connected=true will
+          // tell us.
+        }
+        if (connect_deadline == Clock::time_point::max()) {
+          if (now >= retry_at) {
+            ERR << "[info] Connecting...\n";
+            if (connect_async(bus, res.dev.path, &call) < 0) {
+              if (!reconnecting) return fail("[err] Connect failed\n");
+              retry_later("[warn] Connect failed during HR characteristic retry.\n");
+            } else {
+              connect_deadline = now + 20s;
+            }
+          }
+        } else if (now >= connect_deadline) {
+          if (!reconnecting) return fail("[err] Failed to connect (timeout).\n");
+          retry_later("[warn] Connect timeout during HR characteristic retry.\n");
+        }
+      } else if (now >= connect_deadline) {
+        if (!reconnecting) return fail("[err] Failed to connect (timeout).\n");
+        retry_later("[warn] Connect timeout during HR characteristic retry.\n");
+      }
+      if (!t.connected_ns) {
+        wake = std::min(wake, connect_deadline != Clock::time_point::max() ? connect_deadline
+                                                                            : retry_at);
+        if (reconnecting) wake = std::min(wake, char_deadline);
+      }
+    }
+
+    if (t.connected_ns && !t.resolved_ns) {
+      if (!cached_device_connected(res.dev.path).value_or(false)) {
+        // Dropped before the GATT database came in; connect again.
+        ERR << "[info] Reconnecting while waiting for HR characteristic...\n";
+        t.connected_ns = 0;
+        reconnecting = true;
+        continue;
+      }
+      auto ch = find_char_by_uuid(bus, res.dev.path, kHRCharUUID);
+      // GATT objects are announced before ServicesResolved flips; older
+      // BlueZ without the property only has the objects to go by.
+      if (ch && cached_services_resolved(res.dev.path).value_or(true)) {
+        res.ch_path = std::move(*ch);
+        t.resolved_ns = metrics_now_ns();
+        ERR << "[info] Heart Rate characteristic: " << res.ch_path << "\n";
+      } else if (now >= char_deadline) {
+        return fail("[err] Heart Rate Measurement characteristic not found (timeout).\n");
+      } else {
+        DBG << "[dbg] waiting for HR characteristic (found=" << ch.has_value() << " resolved="
+            << cached_services_resolved(res.dev.path).value_or(false) << ")\n";
+        wake = std::min(wake, char_deadline);
+      }
+    }
+
+    if (t.resolved_ns) break;
+
+    uint64_t timeout_us = UINT64_MAX;
+    if (wake != Clock::time_point::max()) {
+      auto left = std::chrono::duration_cast<std::chrono::microseconds>(wake - Clock::now());
+      timeout_us = (uint64_t)std::max<int64_t>(left.count(), 0);
+    }
+    int r = sd_bus_wait(bus, timeout_us);
+    if (r < 0 && r != -EINTR) {
+      ERR << "[fatal] sd_bus_wait: " << -r << "\n";
+      return fail("[err] Startup aborted\n");
+    }
+  }
+  // Connected=true can arrive before the Connect() reply; drop the pending
+  // call while `call` is still alive.
+  if (call.slot) call.slot = sd_bus_slot_unref(call.slot);
+
+  if (!acquire_notify_default(bus, res.ch_path)) {
+    // Match first, so the first notification after StartNotify is not missed.
+    std::string match =
+      "type='signal',"
+      "sender='org.bluez',"
+      "interface='org.freedesktop.DBus.Properties',"
+      "member='PropertiesChanged',"
+      "path='" + res.ch_path + "'";
+    DBG << "[dbg] Installing HR D-Bus match: " << match << "\n";
+    int r = sd_bus_add_match(bus, &res.slot, match.c_str(), props_changed_cb, nullptr);
+    if (r < 0) {
+      ERR << "[err] sd_bus_add_match failed: " << -r << "\n";
+      return std::nullopt;
+    }
+    if (start_notify(bus, res.ch_path) < 0) {
+      ERR << "[err] StartNotify failed\n";
+      res.slot = sd_bus_slot_unref(res.slot);
+      return std::nullopt;
+    }
+  }
+  t.subscribed_ns = metrics_now_ns();
+  startup_log_times(t);
+  return res;
+}
+
+void startup_log_times(const StartupTimes& t) {
+  ERR << "[info] Startup: device " << ms_between(t.start_ns, t.found_ns) << " ms"
+      << (t.scanned ? " (scan)" : " (known)")
+      << ", connect " << ms_between(t.found_ns, t.connected_ns) << " ms"
+      << ", services " << ms_between(t.connected_ns, t.resolved_ns) << " ms"
+      << ", subscribe " << ms_between(t.resolved_ns, t.subscribed_ns) << " ms"
+      << "; " << ms_between(t.start_ns, t.subscribed_ns) << " ms total\n";
+}
+
+void startup_log_first_sample(const StartupTimes& t, uint64_t first_ns) {
+  ERR << "[info] First sample " << ms_between(t.subscribed_ns, first_ns)
+      << " ms after subscribing; " << ms_between(t.start_ns, first_ns) << " ms after start\n";
+}
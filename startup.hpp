@@ -0,0 +1,44 @@
+#pragma once
+#include <systemd/sd-bus.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bluetooth.hpp"
+
+// Default-mode startup: find the strap, connect and subscribe, driven by the
+// object cache's BlueZ signals instead of sleep/poll loops. Discovery starts
+// at once when the device is not known, Connect() goes out (async) the moment
+// InterfacesAdded announces it, and the Value match plus StartNotify go in as
+// soon as ServicesResolved is true and the HR characteristic is there
+// (with --transport fd, AcquireNotify first).
+
+// Phase timestamps (metrics_now_ns()); 0 = not reached.
+struct StartupTimes {
+  uint64_t start_ns = 0;
+  uint64_t found_ns = 0;       // Device1 object present
+  uint64_t connected_ns = 0;   // Connected=true
+  uint64_t resolved_ns = 0;    // ServicesResolved=true and the HR characteristic known
+  uint64_t subscribed_ns = 0;  // StartNotify or AcquireNotify replied
+  bool scanned = false;        // the device only showed up through discovery
+};
+
+struct StartupResult {
+  FoundDev dev;
+  std::string ch_path;
+  sd_bus_slot* slot{};  // PropertiesChanged match on ch_path; null on the fd transport
+  StartupTimes times;
+};
+
+// Same timeouts as before: 90s to find the device, 20s per Connect() and 60s
+// after connecting for the characteristic. nullopt (logged) on failure.
+std::optional<StartupResult> startup_connect(sd_bus* bus,
+                                             const std::vector<std::string_view>& names);
+
+// "[info] Startup: device N ms (scan|known), connect ..., services ...,
+// subscribe ...; N ms total" (also used by --backend att).
+void startup_log_times(const StartupTimes& t);
+// "[info] First sample ..." relative to subscribing and to startup.
+void startup_log_first_sample(const StartupTimes& t, uint64_t first_ns);
@@ -0,0 +1,159 @@
+#include "synth.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <string>
+#include <vector>
+
+SynthStrap::SynthStrap(const SynthOptions& opts, uint64_t start_ms)
+    : opts_(opts), state_(opts.seed * 0x9E3779B97F4A7C15ULL + 1), start_ms_(start_ms) {}
+
+// xorshift64*: cheap and plenty for traffic that only has to look plausible.
+uint32_t SynthStrap::rnd() {
+  state_ ^= state_ >> 12;
+  state_ ^= state_ << 25;
+  state_ ^= state_ >> 27;
+  return (uint32_t)((state_ * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+double SynthStrap::uniform() {
+  return (double)rnd() * (1.0 / 4294967296.0);
+}
+
+void SynthStrap::next_segment() {
+  double r = uniform();
+  segment_beat_ = 0;
+  if (r < opts_.af_share) {
+    rhythm_ = SynthRhythm::AfLike;
+    segment_left_ = 120 + rnd() % 360;
+  } else if (r < opts_.af_share + opts_.ectopic_share) {
+    rhythm_ = (rnd() & 1) ? SynthRhythm::Ectopic : SynthRhythm::Bigeminy;
+    segment_left_ = 60 + rnd() % 240;
+  } else {
+    rhythm_ = SynthRhythm::Sinus;
+    segment_left_ = 200 + rnd() % 1000;
+  }
+  // Resting, bradycardic or tachycardic rate to drift towards.
+  double band = uniform();
+  if (band < 0.2) target_rr_ = 1050.0 + 250.0 * uniform();
+  else if (band < 0.4) target_rr_ = 480.0 + 100.0 * uniform();
+  else target_rr_ = 650.0 + 350.0 * uniform();
+}
+
+int SynthStrap::next_rr_ms() {
+  if (segment_left_ == 0) next_segment();
+  --segment_left_;
+  ++segment_beat_;
+  rr_ += (target_rr_ - rr_) * 0.02;
+
+  constexpr double kTwoPi = 2.0 * std::numbers::pi;
+  double t = gen_t_ms_ / 1000.0;
+  double noise = (uniform() + uniform() + uniform() - 1.5) * 12.0;
+  double sinus = rr_ * (1.0 + 0.035 * std::sin(kTwoPi * 0.25 * t) +
+                        0.02 * std::sin(kTwoPi * 0.1 * t)) + noise;
+  double v = sinus;
+  switch (rhythm_) {
+    case SynthRhythm::Sinus:
+      break;
+    case SynthRhythm::AfLike:
+      v = rr_ * (0.45 + 0.9 * uniform());
+      break;
+    case SynthRhythm::Ectopic:
+      // A premature beat every ~12 beats, then the compensatory pause.
+      if (segment_beat_ % 12 == 0) v = sinus * 0.62;
+      else if (segment_beat_ % 12 == 1 && segment_beat_ > 1) v = sinus * 1.45;
+      break;
+    case SynthRhythm::Bigeminy:
+      v = (segment_beat_ & 1) ? sinus * 0.62 : sinus * 1.38;
+      break;
+  }
+  int rr = (int)std::lround(std::clamp(v, 300.0, 2000.0));
+  gen_t_ms_ += rr;
+  return rr;
+}
+
+size_t SynthStrap::next_payload(uint8_t* out, uint64_t* ts_ms) {
+  // About one notification a second, with scheduling jitter.
+  send_t_ms_ += 1000.0 + (uniform() - 0.5) * 40.0;
+  bool ee = opts_.ee_every && packets_ % opts_.ee_every == 0;
+  ++packets_;
+
+  size_t n = 0;
+  out[n++] = (uint8_t)(0x06 | (opts_.hr_16bit ? 0x01 : 0) | (ee ? 0x08 : 0));  // contact ok
+  size_t hr_at = n;
+  n += opts_.hr_16bit ? 2 : 1;
+  if (ee) {
+    uint16_t kj = (uint16_t)(packets_ / 16);
+    out[n++] = (uint8_t)(kj & 0xff);
+    out[n++] = (uint8_t)(kj >> 8);
+  }
+
+  // Beats that ended since the last notification, as many as fit.
+  size_t rr_cap = (kSynthPayloadMax - n) / 2;
+  size_t rr_n = 0;
+  int rr_sum = 0;
+  for (; rr_n < rr_cap; ++rr_n) {
+    if (next_beat_ < 0) next_beat_ = next_rr_ms();
+    if (beat_t_ms_ + next_beat_ > send_t_ms_) break;
+    beat_t_ms_ += next_beat_;
+    rr_sum += next_beat_;
+    uint16_t v = (uint16_t)((next_beat_ * 1024 + 500) / 1000);
+    out[n++] = (uint8_t)(v & 0xff);
+    out[n++] = (uint8_t)(v >> 8);
+    next_beat_ = -1;
+  }
+  if (rr_n) {
+    out[0] |= 0x10;
+    recent_rr_ = (recent_rr_ + rr_sum / (int)rr_n) / 2;  // straps smooth the HR value
+  }
+  int bpm = std::clamp((60000 + recent_rr_ / 2) / recent_rr_, 25, 240);
+  out[hr_at] = (uint8_t)(bpm & 0xff);
+  if (opts_.hr_16bit) out[hr_at + 1] = (uint8_t)(bpm >> 8);
+
+  *ts_ms = start_ms_ + (uint64_t)send_t_ms_;
+  return n;
+}
+
+uint64_t synth_write_log(std::FILE* out, uint64_t bytes, unsigned devices,
+                         const SynthOptions& opts) {
+  devices = std::max(devices, 1u);
+  struct Dev {
+    SynthStrap strap;
+    std::string tag;
+    uint8_t payload[kSynthPayloadMax]{};
+    size_t len = 0;
+    uint64_t ts = 0;
+  };
+  std::vector<Dev> devs;
+  devs.reserve(devices);
+  for (unsigned i = 0; i < devices; ++i) {
+    SynthOptions o = opts;
+    o.seed = opts.seed + i;
+    if (i & 1) o.hr_16bit = !opts.hr_16bit;
+    devs.push_back(Dev{SynthStrap(o), devices > 1 ? "dev" + std::to_string(i) + " " : ""});
+    devs.back().len = devs.back().strap.next_payload(devs.back().payload, &devs.back().ts);
+  }
+
+  std::string buf;
+  buf.reserve(1 << 20);
+  uint64_t written = 0, lines = 0;
+  char line[kHrmLineMax + 1];
+  while (written < bytes) {
+    buf.clear();
+    while (buf.size() < (1 << 20) - 512 && written + buf.size() < bytes) {
+      Dev& d = *std::min_element(devs.begin(), devs.end(),
+                                 [](const Dev& a, const Dev& b) { return a.ts < b.ts; });
+      HrmSample s;
+      hrm_parse(d.payload, d.len, d.ts, &s);
+      buf += d.tag;
+      buf.append(line, hrm_format_line(s, line, kHrmLineMax));
+      buf.push_back('\n');
+      ++lines;
+      d.len = d.strap.next_payload(d.payload, &d.ts);
+    }
+    if (std::fwrite(buf.data(), 1, buf.size(), out) != buf.size()) return 0;
+    written += buf.size();
+  }
+  return lines;
+}
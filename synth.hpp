@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "hrm.hpp"
+
+// Synthetic strap traffic for polarm-bench. Beats come from a rhythm model
+// (sinus rhythm with respiratory and 0.1 Hz modulation drifting between
+// bradycardic, normal and tachycardic rates, AF-like irregular runs, isolated
+// ectopic beats and bigeminy) and are packed into Heart Rate Measurement
+// (0x2a37) payloads about once a second, the way a strap sends them.
+
+enum class SynthRhythm : uint8_t { Sinus, AfLike, Ectopic, Bigeminy };
+
+struct SynthOptions {
+  uint32_t seed = 1;
+  bool hr_16bit = false;        // 16-bit HR field, as some firmware always sends
+  unsigned ee_every = 64;       // Energy Expended in every n-th payload; 0 never
+  double af_share = 0.15;       // share of rhythm segments that are AF-like
+  double ectopic_share = 0.15;  // share with ectopic beats or bigeminy
+};
+
+// flags + 16-bit HR + EE + 8 RR values fit the 20-byte default-MTU value.
+inline constexpr size_t kSynthPayloadMax = 20;
+
+class SynthStrap {
+ public:
+  explicit SynthStrap(const SynthOptions& opts, uint64_t start_ms = 1700000000000ULL);
+
+  // One beat of the rhythm model, in ms.
+  int next_rr_ms();
+  // Next notification into out[0..kSynthPayloadMax); returns its length and
+  // sets *ts_ms to its arrival time.
+  size_t next_payload(uint8_t* out, uint64_t* ts_ms);
+  SynthRhythm rhythm() const { return rhythm_; }
+
+ private:
+  uint32_t rnd();
+  double uniform();  // [0, 1)
+  void next_segment();
+
+  SynthOptions opts_;
+  uint64_t state_;
+  SynthRhythm rhythm_ = SynthRhythm::Sinus;
+  uint32_t segment_left_ = 0;  // beats left in the current rhythm
+  uint32_t segment_beat_ = 0;
+  double rr_ = 850.0;          // current sinus RR, drifting to target_rr_
+  double target_rr_ = 850.0;
+  double gen_t_ms_ = 0.0;      // end of the last generated beat
+  double beat_t_ms_ = 0.0;     // end of the last beat sent
+  double send_t_ms_ = 0.0;     // next notification
+  uint64_t start_ms_;
+  uint32_t packets_ = 0;
+  int next_beat_ = -1;         // generated but not yet due
+  int recent_rr_ = 850;
+};
+
+// Text capture lines ("[dev<i> ]<epoch_ms>,<bpm>[,<rr_ms>...]") from
+// `devices` straps, interleaved by time, until at least `bytes` are written.
+// Returns the number of lines, or 0 when a write fails.
+uint64_t synth_write_log(std::FILE* out, uint64_t bytes, unsigned devices,
+                         const SynthOptions& opts);
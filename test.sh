@@ -5,4 +5,30 @@ set -eo pipefail
 cd "$(dirname "${BASH_SOURCE[0]}")"
 
 set -x
-exit 0
+
+[[ -x ./build/polarm ]] || ./build.sh
+
+# traces/dropout.trace: 5 samples, a link loss with one failed reconnect,
+# then 6 more. Each maintenance mode must stream again after the gap.
+for mode in "" "--maintenance event" "--async"; do
+    out="$(./build/polarm $mode --replay-trace traces/dropout.trace 2>/dev/null)"
+    awk -F, '
+        NR > 1 && $1 - prev > 4000 { gap = NR }
+        { prev = $1 }
+        END {
+            if (NR < 8 || !gap || NR - gap < 2) {
+                printf "dropout: %d samples, gap at %d\n", NR, gap > "/dev/stderr"
+                exit 1
+            }
+        }' <<< "$out"
+done
+
+# traces/reconnect.trace: two failed Connect calls while waiting for the HR
+# characteristic; startup must retry through them and stream both samples.
+out="$(./build/polarm --replay-trace traces/reconnect.trace 2>/dev/null)"
+[[ "$(wc -l <<< "$out")" -eq 2 ]]
+
+# traces/burst.trace: an isolated artifact burst; its "repeated" summary must
+# come out once the 3 s alert window has passed, before the replay ends.
+./build/polarm -hw --alert-window 3 --replay-trace traces/burst.trace 2>&1 >/dev/null |
+    awk '/pause\/artifact repeated/ && !done { seen = 1 } /Replay done/ { done = 1 } END { exit !seen }'
@@ -0,0 +1,345 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "metrics.hpp"
+
+namespace {
+
+// Signals this soon after a call on the same device count as its effects.
+constexpr uint64_t kEffectWindowNs = 5000000000ULL;
+constexpr size_t kRecentCalls = 64;
+
+bool in_scope(std::string_view scope, std::string_view path) {
+  return path.starts_with(scope) && (path.size() == scope.size() || path[scope.size()] == '/');
+}
+
+void append_escaped(std::string* out, std::string_view s) {
+  static const char kHex[] = "0123456789ABCDEF";
+  for (unsigned char c : s) {
+    if (c > ' ' && c < 0x7f && c != '%') {
+      out->push_back((char)c);
+    } else {
+      out->push_back('%');
+      out->push_back(kHex[c >> 4]);
+      out->push_back(kHex[c & 15]);
+    }
+  }
+}
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool unescape(std::string_view s, std::string* out) {
+  out->clear();
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] != '%') {
+      out->push_back(s[i]);
+      continue;
+    }
+    int hi = i + 2 < s.size() ? hex_digit(s[i + 1]) : -1;
+    int lo = hi >= 0 ? hex_digit(s[i + 2]) : -1;
+    if (lo < 0) return false;
+    out->push_back((char)(hi << 4 | lo));
+    i += 2;
+  }
+  return true;
+}
+
+void append_props(std::string* out, const BluezProps& p) {
+  auto str = [&](const char* key, const std::optional<std::string>& v) {
+    if (!v) return;
+    *out += ' ';
+    *out += key;
+    *out += '=';
+    append_escaped(out, *v);
+  };
+  auto flag = [&](const char* key, const std::optional<bool>& v) {
+    if (!v) return;
+    *out += ' ';
+    *out += key;
+    *out += *v ? "=true" : "=false";
+  };
+  str("Name", p.name);
+  str("UUID", p.uuid);
+  str("Address", p.address);
+  flag("Connected", p.connected);
+  flag("ServicesResolved", p.services_resolved);
+  flag("Notifying", p.notifying);
+}
+
+bool parse_prop(std::string_view kv, BluezProps* p) {
+  size_t eq = kv.find('=');
+  if (eq == std::string_view::npos) return false;
+  std::string_view key = kv.substr(0, eq);
+  std::string_view val = kv.substr(eq + 1);
+  auto flag = [&](std::optional<bool>* f) {
+    if (val != "true" && val != "false") return false;
+    *f = (val == "true");
+    return true;
+  };
+  auto str = [&](std::optional<std::string>* f) {
+    std::string s;
+    if (!unescape(val, &s)) return false;
+    *f = std::move(s);
+    return true;
+  };
+  if (key == "Connected") return flag(&p->connected);
+  if (key == "ServicesResolved") return flag(&p->services_resolved);
+  if (key == "Notifying") return flag(&p->notifying);
+  if (key == "Name") return str(&p->name);
+  if (key == "Address") return str(&p->address);
+  if (key == "UUID") {
+    if (!str(&p->uuid)) return false;
+    std::transform(p->uuid->begin(), p->uuid->end(), p->uuid->begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return true;
+  }
+  return false;
+}
+
+bool parse_u64(std::string_view s, uint64_t* out) {
+  auto r = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return r.ec == std::errc() && r.ptr == s.data() + s.size() && !s.empty();
+}
+
+// ---- recorder ----
+struct OpenCall {
+  std::string path;
+  std::string method;
+  uint64_t start_ns = 0;
+  std::string effects;  // lines that arrived while in flight
+};
+
+struct Recorder {
+  std::FILE* f = nullptr;
+  uint64_t t0_ns = 0;
+  std::vector<OpenCall> open;
+  std::vector<std::pair<std::string, uint64_t>> recent;  // scope, start of call lines
+  std::map<int, std::string> fd_paths;
+};
+
+Recorder s_rec;
+
+std::string ms_since(uint64_t from_ns, uint64_t to_ns) {
+  return std::to_string(to_ns > from_ns ? (to_ns - from_ns + 500000) / 1000000 : 0);
+}
+
+void write_line(const std::string& line) {
+  std::fwrite(line.data(), 1, line.size(), s_rec.f);
+}
+
+// add/remove/set: an effect of a recent call on the same device, if any.
+void write_event(std::string_view path, const std::string& body) {
+  uint64_t now = metrics_now_ns();
+  for (auto it = s_rec.open.rbegin(); it != s_rec.open.rend(); ++it) {
+    if (!in_scope(trace_scope(it->path), path)) continue;
+    it->effects += "+" + ms_since(it->start_ns, now) + " " + body + "\n";
+    return;
+  }
+  for (auto it = s_rec.recent.rbegin(); it != s_rec.recent.rend(); ++it) {
+    if (!in_scope(it->first, path)) continue;
+    // Replay attaches "+" lines to the latest matching call line.
+    if (now - it->second <= kEffectWindowNs) {
+      write_line("+" + ms_since(it->second, now) + " " + body + "\n");
+      return;
+    }
+    break;
+  }
+  write_line(ms_since(s_rec.t0_ns, now) + " " + body + "\n");
+}
+
+void close_trace() {
+  if (!s_rec.f) return;
+  // Calls still in flight at exit never got a reply.
+  for (auto& c : s_rec.open) {
+    write_line(ms_since(s_rec.t0_ns, c.start_ns) + " call " + c.path + " " + c.method +
+               " org.freedesktop.DBus.Error.NoReply 0\n" + c.effects);
+  }
+  s_rec.open.clear();
+  std::fclose(s_rec.f);
+  s_rec.f = nullptr;
+}
+
+}  // namespace
+
+std::string_view trace_scope(std::string_view path) {
+  size_t dev = path.find("/dev_");
+  if (dev == std::string_view::npos) return path;
+  return path.substr(0, path.find('/', dev + 1));
+}
+
+bool trace_open(const std::string& path, std::string* err) {
+  s_rec.f = std::fopen(path.c_str(), "we");
+  if (!s_rec.f) {
+    *err = "cannot create " + path + ": " + strerror(errno);
+    return false;
+  }
+  s_rec.t0_ns = metrics_now_ns();
+  std::fputs("# polarm D-Bus trace: <ms> add|remove|set|value|call|end ...\n", s_rec.f);
+  std::atexit(close_trace);
+  return true;
+}
+
+void trace_object(std::string_view path, std::string_view iface, const BluezProps& p,
+                  bool snapshot) {
+  std::string body = "add " + std::string(path) + " " + std::string(iface);
+  append_props(&body, p);
+  if (snapshot) write_line("0 " + body + "\n");
+  else write_event(path, body);
+}
+
+void trace_removed(std::string_view path, std::string_view iface) {
+  write_event(path, "remove " + std::string(path) + " " + std::string(iface));
+}
+
+void trace_props(std::string_view path, std::string_view iface, const BluezProps& changed) {
+  std::string body = "set " + std::string(path) + " " + std::string(iface);
+  size_t bare = body.size();
+  append_props(&body, changed);
+  if (body.size() > bare) write_event(path, body);
+}
+
+void trace_value(std::string_view path, const uint8_t* data, size_t len) {
+  static const char kHex[] = "0123456789abcdef";
+  std::string line = ms_since(s_rec.t0_ns, metrics_now_ns()) + " value " + std::string(path) + " ";
+  for (size_t i = 0; i < len; ++i) {
+    line.push_back(kHex[data[i] >> 4]);
+    line.push_back(kHex[data[i] & 15]);
+  }
+  line.push_back('\n');
+  write_line(line);
+}
+
+void trace_call_begin(std::string_view path, std::string_view method, uint64_t start_ns) {
+  s_rec.open.push_back(OpenCall{std::string(path), std::string(method), start_ns, {}});
+}
+
+std::string trace_call_error(int r, const char* error_name) {
+  if (r >= 0) return {};
+  if (error_name && *error_name) return error_name;
+  return "errno:" + std::to_string(-r);
+}
+
+void trace_call_end(std::string_view path, std::string_view method, uint64_t start_ns,
+                    std::string_view error) {
+  std::string effects;
+  auto it = std::find_if(s_rec.open.begin(), s_rec.open.end(), [&](const OpenCall& c) {
+    return c.start_ns == start_ns && c.path == path && c.method == method;
+  });
+  if (it != s_rec.open.end()) {
+    effects = std::move(it->effects);
+    s_rec.open.erase(it);
+  }
+  uint64_t now = metrics_now_ns();
+  std::string result = error.empty() ? "ok" : "";
+  append_escaped(&result, error);  // one token, whatever the name holds
+  write_line(ms_since(s_rec.t0_ns, start_ns) + " call " + std::string(path) + " " +
+             std::string(method) + " " + result + " " + ms_since(start_ns, now) + "\n" +
+             effects);
+  s_rec.recent.emplace_back(std::string(trace_scope(path)), start_ns);
+  if (s_rec.recent.size() > kRecentCalls) s_rec.recent.erase(s_rec.recent.begin());
+}
+
+void trace_notify_fd(int fd, std::string_view char_path) {
+  s_rec.fd_paths[fd] = std::string(char_path);
+}
+
+void trace_fd_value(int fd, const uint8_t* data, size_t len) {
+  auto it = s_rec.fd_paths.find(fd);
+  if (it != s_rec.fd_paths.end()) trace_value(it->second, data, len);
+}
+
+// ---- loader ----
+bool trace_load(const std::string& path, std::vector<TraceEvent>* out, std::string* err) {
+  std::ifstream in(path);
+  if (!in) {
+    *err = "cannot open " + path;
+    return false;
+  }
+  out->clear();
+  std::vector<size_t> calls;  // indices of call lines, in file order
+  std::string line;
+  for (size_t lineno = 1; std::getline(in, line); ++lineno) {
+    auto fail = [&](const std::string& what) {
+      *err = path + ":" + std::to_string(lineno) + ": " + what;
+      return false;
+    };
+    std::istringstream words(line);
+    std::vector<std::string> w;
+    for (std::string s; words >> s;) {
+      if (s[0] == '#') break;
+      w.push_back(std::move(s));
+    }
+    if (w.empty()) continue;
+    if (w.size() < 2) return fail("missing event");
+
+    TraceEvent ev;
+    bool relative = w[0][0] == '+';
+    if (!parse_u64(std::string_view(w[0]).substr(relative ? 1 : 0), &ev.t_ms))
+      return fail("bad time '" + w[0] + "'");
+    const std::string& kind = w[1];
+    if (kind == "add" || kind == "remove" || kind == "set") {
+      ev.kind = kind == "add" ? TraceEvent::Kind::Add
+              : kind == "remove" ? TraceEvent::Kind::Remove : TraceEvent::Kind::Set;
+      if (w.size() < 4 || (kind == "remove" && w.size() != 4) || (kind == "set" && w.size() < 5))
+        return fail("usage: " + kind + " <path> <iface>" + (kind == "remove" ? "" : " <Prop>=<value>..."));
+      ev.path = w[2];
+      ev.iface = w[3];
+      for (size_t i = 4; i < w.size(); ++i) {
+        if (!parse_prop(w[i], &ev.props)) return fail("bad property '" + w[i] + "'");
+      }
+    } else if (kind == "value") {
+      ev.kind = TraceEvent::Kind::Value;
+      if (w.size() != 4 || w[3].size() % 2) return fail("usage: value <path> <hex>");
+      ev.path = w[2];
+      for (size_t i = 0; i < w[3].size(); i += 2) {
+        int hi = hex_digit(w[3][i]), lo = hex_digit(w[3][i + 1]);
+        if (hi < 0 || lo < 0) return fail("bad hex value");
+        ev.value.push_back((uint8_t)(hi << 4 | lo));
+      }
+    } else if (kind == "call") {
+      ev.kind = TraceEvent::Kind::Call;
+      if (w.size() != 6 || !parse_u64(w[5], &ev.latency_ms))
+        return fail("usage: call <path> <Method> <ok|error> <latency_ms>");
+      ev.path = w[2];
+      ev.method = w[3];
+      if (!unescape(w[4], &ev.result) || ev.result.empty()) return fail("bad call result");
+    } else if (kind == "end") {
+      ev.kind = TraceEvent::Kind::End;
+      if (w.size() != 2) return fail("usage: end");
+    } else {
+      return fail("unknown event '" + kind + "'");
+    }
+
+    if (relative) {
+      if (ev.kind != TraceEvent::Kind::Add && ev.kind != TraceEvent::Kind::Remove &&
+          ev.kind != TraceEvent::Kind::Set)
+        return fail("only add/remove/set can be relative to a call");
+      auto c = std::find_if(calls.rbegin(), calls.rend(), [&](size_t i) {
+        return in_scope(trace_scope((*out)[i].path), ev.path);
+      });
+      if (c == calls.rend()) return fail("no call on this device before a relative event");
+      (*out)[*c].effects.push_back(std::move(ev));
+      continue;
+    }
+    if (ev.kind == TraceEvent::Kind::Call) calls.push_back(out->size());
+    out->push_back(std::move(ev));
+  }
+  std::stable_sort(out->begin(), out->end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.t_ms < b.t_ms; });
+  return true;
+}
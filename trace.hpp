@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The BlueZ properties polarm keeps per object interface (the object cache in
+// bluetooth.cpp, --trace-record and the --replay-trace mock).
+struct BluezProps {
+  std::optional<std::string> name;
+  std::optional<std::string> uuid;
+  std::optional<std::string> address;     // Device1.Address
+  std::optional<bool> connected;          // Device1.Connected
+  std::optional<bool> services_resolved;  // Device1.ServicesResolved
+  std::optional<bool> notifying;          // GattCharacteristic1.Notifying
+};
+
+// ---- trace format ----
+// One event per line, '#' starts a comment:
+//
+//   <ms> add <path> <iface> [<Prop>=<value>...]   InterfacesAdded (0: snapshot)
+//   <ms> remove <path> <iface>                    InterfacesRemoved
+//   <ms> set <path> <iface> <Prop>=<value>...     PropertiesChanged
+//   <ms> value <path> <hex>                       HR notification
+//   <ms> call <path> <Method> <ok|error> <lat_ms> method call and its reply
+//   <ms> end                                      end of the scenario
+//
+// <ms> counts from the start of the recording. A "+<ms>" time makes an
+// add/remove/set an effect of the latest call line above it on the same
+// device (or adapter), relative to that call being made: replay applies it
+// when polarm makes the matching call, not at a fixed time. Values are
+// true/false or %-escaped strings. A call's error is the D-Bus error name, or
+// errno:<n> when the call failed without one (%-escaped as well).
+struct TraceEvent {
+  enum class Kind { Add, Remove, Set, Value, Call, End };
+  Kind kind = Kind::End;
+  uint64_t t_ms = 0;
+  std::string path;
+  std::string iface;             // Add/Remove/Set
+  BluezProps props;              // Add/Set
+  std::vector<uint8_t> value;    // Value
+  std::string method;            // Call
+  std::string result;            // Call: "ok", the D-Bus error name or "errno:<n>"
+  uint64_t latency_ms = 0;       // Call
+  std::vector<TraceEvent> effects;  // Call: relative t_ms
+};
+
+// Parses a trace. Top-level events come back sorted by time.
+bool trace_load(const std::string& path, std::vector<TraceEvent>* out, std::string* err);
+
+// The device (or adapter) an object belongs to: effects are matched on it.
+std::string_view trace_scope(std::string_view path);
+
+// ---- --trace-record ----
+// Set by main.cpp once trace_open() succeeded; every hook below is called
+// from the bus thread under `if (g_trace_record)`.
+extern bool g_trace_record;
+
+bool trace_open(const std::string& path, std::string* err);
+void trace_object(std::string_view path, std::string_view iface, const BluezProps& p,
+                  bool snapshot);
+void trace_removed(std::string_view path, std::string_view iface);
+void trace_props(std::string_view path, std::string_view iface, const BluezProps& changed);
+void trace_value(std::string_view path, const uint8_t* data, size_t len);
+// A BlueZ method call; `error` is empty on success.
+void trace_call_begin(std::string_view path, std::string_view method, uint64_t start_ns);
+// The `error` for trace_call_end() from a call's return value and error name
+// (may be null): empty when r >= 0, else the name or "errno:<-r>".
+std::string trace_call_error(int r, const char* error_name);
+void trace_call_end(std::string_view path, std::string_view method, uint64_t start_ns,
+                    std::string_view error);
+// --transport fd: values read from `fd` belong to `char_path`.
+void trace_notify_fd(int fd, std::string_view char_path);
+void trace_fd_value(int fd, const uint8_t* data, size_t len);
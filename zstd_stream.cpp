@@ -0,0 +1,106 @@
+#include "zstd_stream.hpp"
+
+#include <cstring>
+
+#if POLARM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+bool zstd_detect(const char* p, size_t n) {
+  static constexpr unsigned char kMagic[4] = {0x28, 0xb5, 0x2f, 0xfd};
+  return n >= 4 && std::memcmp(p, kMagic, 4) == 0;
+}
+
+#if POLARM_HAVE_ZSTD
+
+ZstdEncoder::~ZstdEncoder() {
+  ZSTD_freeCCtx(ctx_);
+}
+
+bool ZstdEncoder::init(int level, std::string* err) {
+  ctx_ = ZSTD_createCCtx();
+  if (!ctx_) {
+    *err = "zstd: out of memory";
+    return false;
+  }
+  ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, level);
+  ZSTD_CCtx_setParameter(ctx_, ZSTD_c_checksumFlag, 1);
+  return true;
+}
+
+bool ZstdEncoder::compress(std::string_view in, bool end_frame, std::string* out) {
+  ZSTD_inBuffer src{in.data(), in.size(), 0};
+  ZSTD_EndDirective mode = end_frame ? ZSTD_e_end : ZSTD_e_flush;
+  size_t chunk = ZSTD_CStreamOutSize();
+  for (;;) {
+    size_t have = out->size();
+    out->resize(have + chunk);
+    ZSTD_outBuffer dst{out->data() + have, chunk, 0};
+    size_t left = ZSTD_compressStream2(ctx_, &dst, &src, mode);
+    out->resize(have + dst.pos);
+    if (ZSTD_isError(left)) return false;
+    if (left == 0 && src.pos == src.size) break;
+  }
+  frame_bytes_ = end_frame ? 0 : frame_bytes_ + in.size();
+  return true;
+}
+
+ZstdDecoder::~ZstdDecoder() {
+  ZSTD_freeDCtx(ctx_);
+}
+
+bool ZstdDecoder::init(std::string* err) {
+  ctx_ = ZSTD_createDCtx();
+  if (!ctx_) {
+    *err = "zstd: out of memory";
+    return false;
+  }
+  return true;
+}
+
+bool ZstdDecoder::decompress(std::string_view in, std::string* out, std::string* err) {
+  if (in.empty()) return true;
+  ZSTD_inBuffer src{in.data(), in.size(), 0};
+  size_t chunk = ZSTD_DStreamOutSize();
+  for (;;) {
+    size_t have = out->size();
+    out->resize(have + chunk);
+    ZSTD_outBuffer dst{out->data() + have, chunk, 0};
+    size_t r = ZSTD_decompressStream(ctx_, &dst, &src);
+    out->resize(have + dst.pos);
+    if (ZSTD_isError(r)) {
+      *err = std::string("zstd: ") + ZSTD_getErrorName(r);
+      return false;
+    }
+    at_end_ = (r == 0);
+    // A full output buffer may leave decoded bytes pending.
+    if (src.pos == src.size && dst.pos < dst.size) return true;
+  }
+}
+
+#else
+
+ZstdEncoder::~ZstdEncoder() = default;
+
+bool ZstdEncoder::init(int, std::string* err) {
+  *err = "built without zstd";
+  return false;
+}
+
+bool ZstdEncoder::compress(std::string_view, bool, std::string*) {
+  return false;
+}
+
+ZstdDecoder::~ZstdDecoder() = default;
+
+bool ZstdDecoder::init(std::string* err) {
+  *err = "built without zstd";
+  return false;
+}
+
+bool ZstdDecoder::decompress(std::string_view, std::string*, std::string* err) {
+  *err = "built without zstd";
+  return false;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Streaming zstd for --compress and compressed --analyze-log inputs; built
+// with libzstd when meson finds it (POLARM_HAVE_ZSTD). Without it the
+// classes exist but every call fails.
+#ifndef POLARM_HAVE_ZSTD
+#define POLARM_HAVE_ZSTD 0
+#endif
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+inline constexpr bool kHaveZstd = POLARM_HAVE_ZSTD;
+
+// Frame magic 28 b5 2f fd.
+bool zstd_detect(const char* p, size_t n);
+
+class ZstdEncoder {
+ public:
+  ZstdEncoder() = default;
+  ~ZstdEncoder();
+  ZstdEncoder(const ZstdEncoder&) = delete;
+  ZstdEncoder& operator=(const ZstdEncoder&) = delete;
+
+  bool init(int level, std::string* err);
+  // Appends `in` to the current frame and makes everything so far
+  // decodable (a zstd flush); `end_frame` closes the frame instead, so a
+  // reader can start at the next one. Compressed bytes are appended to *out.
+  bool compress(std::string_view in, bool end_frame, std::string* out);
+  uint64_t frame_bytes() const { return frame_bytes_; }  // input in the open frame
+
+ private:
+  ZSTD_CCtx_s* ctx_ = nullptr;
+  uint64_t frame_bytes_ = 0;
+};
+
+class ZstdDecoder {
+ public:
+  ZstdDecoder() = default;
+  ~ZstdDecoder();
+  ZstdDecoder(const ZstdDecoder&) = delete;
+  ZstdDecoder& operator=(const ZstdDecoder&) = delete;
+
+  bool init(std::string* err);
+  // Decompresses `in` (any number of concatenated frames, split anywhere)
+  // and appends the output to *out.
+  bool decompress(std::string_view in, std::string* out, std::string* err);
+  // After the last input: false if it stopped inside a frame (a writer that
+  // died before ending it; everything up to its last flush was decoded).
+  bool at_frame_end() const { return at_end_; }
+
+ private:
+  ZSTD_DCtx_s* ctx_ = nullptr;
+  bool at_end_ = true;
+};